@@ -1,365 +1,2272 @@
-﻿#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
-
-#include "RedBlackTree.h"
-#include "RedBlackTreeNode.h"
-
-#define MAX(a,b) (a > b) ? a : b
-
-//#define ASSERTS
-
-#ifdef ASSERTS
-#include <assert.h>
-#else
-#define assert(X) {/* Asserts are unused unless defined */}
-#endif // ASSERTS
-
-void KL_forEach(RedBlackBST* self, KeyList* list, void(* func)(RedBlackBST*, Node*))
-{
-	Node* node;
-	while (list && list->node)
-	{
-		node = list->node;
-		func(self, node);
-		KeyList* to_release = list;
-		list = list->next;
-		free(to_release);
-	}
-	free(list);
-}
-
-void applyKeyVal(Node* node, Key key, Value val)
-{
-	// Integer can simply be applied
-	node->key = key;
-
-	// Must save room for string
-	char* nodeBuffer = (char*)calloc(1, strlen(val));
-	node->val = nodeBuffer;
-	sprintf(node->val, "%s", val);
-}
-
-Node* CreateNode(Key _key, Value _val, bool _color, int _size)
-{
-	Node* node = calloc(1, sizeof(Node));
-	memset(node, 0, sizeof(Node));
-	Node stackNode = { .key = _key, .val = _val, .color = _color, .size = _size, .left = NULL, .right = NULL };
-
-	applyKeyVal(&stackNode, _key, _val);
-
-	memcpy(node, &stackNode, sizeof(Node));
-	return (Node*)node;
-}
-
-/***************************************************************************
-*  Standard BST search.
-***************************************************************************/
-
-Value* RBT_get(const RedBlackBST* self, Key key)
-{
-	if (key == NULL) { printf("argument to get() is NULL"); exit(EXIT_FAILURE); }
-	return NODE_get(self->root, key);
-}
-
-/* Returns the number of key-value pairs in this symbol table. */
-int RBT_size(const RedBlackBST* self)
-{
-	return NODE_size(self->root);
-}
-
-/* Is this symbol table empty? */
-bool RBT_isEmpty(const RedBlackBST* self)
-{
-	return self->root == NULL;
-}
-
-bool RBT_contains(const RedBlackBST* self, Key key)
-{
-	return RBT_get(self, key) != NULL;
-}
-
-/* Returns the smallest key in the symbol table. */
-const Node* RBT_min_bykey(const RedBlackBST* self)
-{
-	if (RBT_isEmpty(self)) { printf("called min() with empty symbol table"); exit(EXIT_FAILURE); }
-	return NODE_min_bykey(self->root);
-}
-
-/* Returns the largest key in the symbol table. */
-const Node* RBT_max_bykey(const RedBlackBST* self)
-{
-	if (RBT_isEmpty(self)) { printf("called max() with empty symbol table"); exit(EXIT_FAILURE); }
-	return NODE_max_bykey(self->root);
-}
-
-/***************************************************************************
-*  Red-black tree deletion.
-***************************************************************************/
-
-/* Removes the largest key and associated value from the symbol table. */
-void RBT_deleteMax(RedBlackBST* self)
-{
-	if (RBT_isEmpty(self)) { printf("BST underflow"); exit(EXIT_FAILURE); }
-
-	// if both children of root are black, set root to red
-	if (!NODE_isRed(self->root->left) && !NODE_isRed(self->root->right))
-	{
-		self->root->color = RED;
-	}
-
-	self->root = NODE_deleteMax(self->root);
-	if (!RBT_isEmpty(self)) self->root->color = BLACK;
-	assert(RBT_self_check(self));
-}
-
-/* Removes the specified key and its associated value from this symbol table
-   (if the key is in this symbol table). */
-void RBT_remove(RedBlackBST* self, Key key)
-{
-	if (key == NULL) { printf("argument to remove() is NULL"); exit(EXIT_FAILURE); }
-	if (!RBT_contains(self, key)) return;
-
-	/* if both children of root are black, set root to red */
-	if (!NODE_isRed(self->root->left) && !NODE_isRed(self->root->right))
-	{
-		self->root->color = RED;
-	}
-
-	self->root = NODE_remove(self->root, key);
-	if (!RBT_isEmpty(self)) self->root->color = BLACK;
-	assert(RBT_self_check(self));
-}
-
-
-/***************************************************************************
-*  Red-black tree insertion.
-***************************************************************************/
-
-/* Inserts the specified key-value pair into the symbol table, overwriting the old
- value with the new value if the symbol table already contains the specified key.
- Deletes the specified key (and its associated value) from this symbol table
- if the specified value is {NULL}. */
-void RBT_put(RedBlackBST* self, Key key, Value val)
-{
-	if (key == NULL)
-	{
-		printf("first argument to put() is NULL"); exit(EXIT_FAILURE);
-	}
-	if (val == NULL)
-	{
-		RBT_remove(self, key);
-		return;
-	}
-
-	self->root = NODE_put(self->root, key, val);
-	self->root->color = BLACK;
-	assert(RBT_self_check(self));
-}
-
-
-/***************************************************************************
-*  Utility functions.
-***************************************************************************/
-
-/* Returns the height of the BST (for debugging). */
-int RBT_height(const RedBlackBST* self)
-{
-	return NODE_height(self->root);
-}
-
-
-/***************************************************************************
-*  Ordered symbol table functions.
-***************************************************************************/
-
-/* Returns the largest key in the symbol table less than or equal to {key}. */
-Node* RBT_floor(const RedBlackBST* self, Key key)
-{
-	if (key == NULL) { printf("argument to floor() is NULL"); exit(EXIT_FAILURE); }
-	if (RBT_isEmpty(self)) { printf("called floor() with empty symbol table"); exit(EXIT_FAILURE); }
-
-	Node* x = NODE_floor(self->root, key);
-	if (x == NULL) return NULL;
-	else return x;
-}
-
-/* Returns the smallest key in the symbol table greater than or equal to {key}. */
-Node* RBT_ceiling(const RedBlackBST* self, Key key)
-{
-	if (key == NULL) { printf("argument to ceiling() is NULL"); exit(EXIT_FAILURE); }
-	if (RBT_isEmpty(self)) { printf("called ceiling() with empty symbol table"); exit(EXIT_FAILURE); }
-
-	Node* x = NODE_ceiling(self->root, key);
-	if (x == NULL) return NULL;
-	else return x;
-}
-
-/* Return the kth smallest key in the symbol table */
-Key RBT_select(const RedBlackBST* self, int k)
-{
-	if (k < 0 || k >= RBT_size(self)) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
-	Node* x = NODE_select(self->root, k);
-	return x->key;
-}
-
-/* Return the number of keys in the symbol table strictly less than {key}. */
-int RBT_rank(const RedBlackBST* self, Key key)
-{
-	if (key == NULL) { printf("argument to rank() is NULL"); exit(EXIT_FAILURE); }
-	return NODE_rank(key, self->root);
-}
-
-
-/***************************************************************************
-*  Range count and range search.
-***************************************************************************/
-
-/* Returns all keys in the symbol table in the given range as a KeyList */
-KeyList* RBT_keys_range(const RedBlackBST* self, const Key lo, const Key hi)
-{
-	if (lo == NULL) { printf("first argument to keys() is NULL"); exit(EXIT_FAILURE); }
-	if (hi == NULL) { printf("second argument to keys() is NULL"); exit(EXIT_FAILURE); }
-
-	KeyList* list = (KeyList*)calloc(1, sizeof(KeyList));
-	KeyList* end = list;
-
-	NODE_keys(self->root, &end, lo, hi);
-	return list;
-}
-
-/* Returns all keys in the symbol table as a KeyList */
-KeyList* RBT_keys(const RedBlackBST* self)
-{
-	if (RBT_isEmpty(self)) return NULL;
-	return RBT_keys_range(self, RBT_min_bykey(self)->key, RBT_max_bykey(self)->key);
-}
-
-/* Returns the number of keys in the symbol table in the given range. */
-int RBT_range_size(const RedBlackBST* self, Key lo, Key hi)
-{
-	if (lo == NULL) { printf("first argument to size() is NULL"); exit(EXIT_FAILURE); }
-	if (hi == NULL) { printf("second argument to size() is NULL"); exit(EXIT_FAILURE); }
-
-	if (lo < hi) return 0;
-	if (RBT_contains(self, hi)) return RBT_rank(self, hi) - RBT_rank(self, lo) + 1;
-	return RBT_rank(self, hi) - RBT_rank(self, lo);
-}
-
-/* Free the specified RBT */
-bool RBT_free(RedBlackBST* self)
-{
-	// Free the BST
-	KeyList* list = RBT_keys(self);
-	while (list && list->node)
-	{
-		KeyList* release = list;
-		list = list->next;
-
-		free(release->node->val);
-		release->node->val = NULL;
-
-		free(release->node);
-		release->node->left = NULL;
-		release->node->right = NULL;
-		release->node = NULL;
-
-		free(release);
-		release = NULL;
-	}
-	self->root = NULL;
-	//free the null element in the keylist
-	free(list);
-
-	return true;
-}
-
-#pragma region RBT_Tests
-
-/***************************************************************************
-*  Check integrity of red-black tree data structure.
-***************************************************************************/
-
-/* does this binary tree satisfy symmetric order?
-   Note: this test also ensures that data structure is a binary tree since order is strict */
-bool RBT_test_isBST(const RedBlackBST* self)
-{
-	return NODE_test_isBST(self->root, NULL, NULL);
-}
-
-/* are the size fields correct? */
-bool RBT_test_isSizeConsistent(const RedBlackBST* self)
-{
-	return NODE_test_isSizeConsistent(self->root);
-}
-
-/* check that ranks are consistent */
-bool RBT_test_isRankConsistent(const RedBlackBST* self)
-{
-	int i = 0;
-	for (; i < RBT_size(self); i++)
-		if (i != RBT_rank(self, RBT_select(self, i))) return false;
-
-	KeyList* list = RBT_keys(self);
-	Node* n;
-
-	while (list && list->node)
-	{
-		n = list->node;
-		if (n->key != RBT_select(self, RBT_rank(self, n->key)))
-		{
-			/* Free the rest of the list then return false */
-			while (list->next)
-			{
-				KeyList* release = list;
-				list = list->next;
-				free(release);
-			}
-			free(list);
-			return false;
-		}
-
-		/* Move to the next item and free as we go */
-		KeyList* release = list;
-		list = list->next;
-		free(release);
-	}
-	free(list);
-
-	return true;
-}
-
-/* Does the tree have no red right links, and at most one (left)
-   red links in a row on any path? */
-bool RBT_test_is23(const RedBlackBST* self)
-{
-	return NODE_test_is23(self->root, self->root);
-}
-
-/* do all paths from root to leaf have same number of black edges? */
-bool RBT_test_isBalanced(const RedBlackBST* self)
-{
-	/* number of black links on path from root to min */
-	int black = 0;
-	Node* x = self->root;
-	while (x != NULL)
-	{
-		if (!NODE_isRed(x)) black++;
-		x = x->left;
-	}
-	return NODE_test_isBalanced(self->root, black);
-}
-
-bool RBT_self_check(const RedBlackBST* self)
-{
-	bool t1, t2, t3, t4, t5;
-	if (!(t1 = RBT_test_isBST(self)))            fprintf(stdout, "Not in symmetric order\n");
-	if (!(t2 = RBT_test_isSizeConsistent(self))) fprintf(stdout, "Subtree counts not consistent\n");
-	if (!(t3 = RBT_test_isRankConsistent(self))) fprintf(stdout, "Ranks not consistent\n");
-	if (!(t4 = RBT_test_is23(self)))             fprintf(stdout, "Not a 2-3 tree\n");
-	if (!(t5 = RBT_test_isBalanced(self)))       fprintf(stdout, "Not balanced\n");
-
-	return t1 && t2 && t3 && t4 && t5;
-}
-
-#pragma endregion
+﻿#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include "RedBlackTree.h"
+#include "RedBlackTreeNode.h"
+#include "RedBlackTreePool.h"
+
+#define MAX(a,b) (a > b) ? a : b
+
+//#define ASSERTS
+
+#ifdef ASSERTS
+#include <assert.h>
+#else
+#define assert(X) {/* Asserts are unused unless defined */}
+#endif // ASSERTS
+
+// use the original recursive NODE_put/NODE_remove/NODE_deleteMax for writes
+//#define RECURSIVE_WRITES
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(X) __builtin_prefetch(X)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define PREFETCH(X) _mm_prefetch((const char*)(X), _MM_HINT_T0)
+#else
+#define PREFETCH(X) {/* No prefetch available */}
+#endif
+
+// number of lookups RBT_get_many keeps in flight at once
+#define GET_MANY_LANES 8
+
+// RBT_put_batch rebuilds the whole tree when BATCH_REBUILD_RATIO times the batch is at least the tree's size
+#define BATCH_REBUILD_RATIO 1
+
+// loads and stores that may race with another thread, for the sequence number and optimistic readers
+#if defined(__GNUC__) || defined(__clang__)
+#define SEQ_LOAD(TYPE, X) __atomic_load_n(&(X), __ATOMIC_RELAXED)
+#define SEQ_STORE(X, V) __atomic_store_n(&(X), V, __ATOMIC_RELAXED)
+#define SEQ_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define SEQ_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define SEQ_ADD(X, V) __atomic_fetch_add(&(X), V, __ATOMIC_RELAXED)
+#include <sched.h>
+#define SEQ_YIELD() sched_yield()
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define SEQ_LOAD(TYPE, X) (*(volatile TYPE const*)&(X))
+#define SEQ_STORE(X, V) (*(volatile unsigned*)&(X) = (V))
+#define SEQ_ACQUIRE() _ReadWriteBarrier()
+#define SEQ_RELEASE() _ReadWriteBarrier()
+#define SEQ_ADD(X, V) _InterlockedExchangeAdd((volatile long*)&(X), V)
+#include <windows.h>
+#define SEQ_YIELD() SwitchToThread()
+#endif
+
+// spins a reader waits on a write in progress before giving up its time slice
+#define SEQ_SPINS 64
+
+// attempts an optimistic read makes before asking the writer to hold off
+#define SEQ_RETRIES 4
+
+// spins the writer holds off for readers that asked, at most, giving up its time slice every SEQ_SPINS
+#define SEQ_HOLD_SPINS 1024
+
+// set operations fork threads where POSIX threads are available
+#if !defined(_MSC_VER)
+#include <pthread.h>
+#include <unistd.h>
+#define SET_THREADS
+#endif
+
+// subtrees holding fewer nodes than this are combined on the calling thread
+#define SET_PARALLEL_GRAIN 16384
+
+// mark the start of a write: the sequence number turns odd before any node changes.
+// Optimistic readers that keep losing to writes first get a window to finish in, but
+// the writer only waits so long for them.
+static void seq_begin(RedBlackBST* self)
+{
+	int spins;
+	for (spins = 1; spins <= SEQ_HOLD_SPINS && SEQ_LOAD(unsigned, self->starved) != 0; spins++)
+	{
+		if (spins % SEQ_SPINS == 0) SEQ_YIELD();
+	}
+	SEQ_STORE(self->seq, self->seq + 1);
+	SEQ_RELEASE();
+}
+
+// mark the end of a write: every node change is visible before the sequence number turns even
+static void seq_end(RedBlackBST* self)
+{
+	SEQ_RELEASE();
+	SEQ_STORE(self->seq, self->seq + 1);
+}
+
+#ifdef RBT_LAZY_DELETE
+// start compacting once one node in LAZY_DEAD_RATIO is dead
+#define LAZY_DEAD_RATIO 2
+
+// nodes every removal compacts while a sweep is under way
+#define LAZY_SWEEP_NODES 64
+
+// the smallest and largest live nodes; dead nodes hold no rank, so select skips them
+#define tree_min(X) (((X)->root != NULL) ? NODE_select((X)->root, 0) : NULL)
+#define tree_max(X) (((X)->root != NULL) ? NODE_select((X)->root, NODE_size((X)->root) - 1) : NULL)
+#else
+#define tree_min(X) (((X)->root != NULL) ? NODE_min_bykey((X)->root) : NULL)
+#define tree_max(X) (((X)->root != NULL) ? NODE_max_bykey((X)->root) : NULL)
+#endif
+
+// the cached ends a write has to find again
+#define ENDS_FIRST 1
+#define ENDS_LAST 2
+#define ENDS_BOTH (ENDS_FIRST | ENDS_LAST)
+
+#ifdef RBT_PRIORITY_QUEUE
+// find the given ends again after a write that may have replaced them. Writes only
+// relink the nodes they keep, so an end the write could not have reached stays put.
+static void ends_refresh(RedBlackBST* self, int ends)
+{
+	if (self->root == NULL)
+	{
+		self->first = self->last = NULL;
+		return;
+	}
+	if (ends & ENDS_FIRST) self->first = tree_min(self);
+	if (ends & ENDS_LAST) self->last = tree_max(self);
+}
+
+// the ends that removing key unlinks, to be found again afterwards. NODE_remove moves
+// the successor's key into the removed node and frees the successor's node instead.
+static int ends_holding(const RedBlackBST* self, Key key)
+{
+	int ends = 0;
+	if (self->first == NULL || RBT_cmp(key, self->first->key) == 0) ends |= ENDS_FIRST;
+	if (self->last == NULL || RBT_cmp(key, self->last->key) == 0) ends |= ENDS_LAST;
+#ifdef RECURSIVE_WRITES
+	else if (NODE_rank(self->last->key, self->root) == NODE_rank(key, self->root) + 1) ends |= ENDS_LAST;
+#endif
+	return ends;
+}
+
+// key was just inserted, it is one of the ends if it lies beyond them. Rotations move
+// nodes around but never change which node holds a key, so the other end stays put.
+static void ends_insert(RedBlackBST* self, Key key)
+{
+	if (self->first == NULL || RBT_cmp(key, self->first->key) < 0) self->first = tree_min(self);
+	if (self->last == NULL || RBT_cmp(key, self->last->key) > 0) self->last = tree_max(self);
+}
+#else
+#define ends_refresh(X, ENDS) { (void)(ENDS); /* No cached ends */ }
+#define ends_holding(X, KEY) 0
+#define ends_insert(X, KEY) {/* No cached ends */}
+#endif
+
+#ifdef RBT_LAZY_DELETE
+static void lazy_compact(RedBlackBST* self);
+static void lazy_sweep(RedBlackBST* self);
+
+// once the dead nodes reach their share of the tree, start a sweep: from then on every
+// removal compacts the next LAZY_SWEEP_NODES nodes in key order, so no single one pays
+// for the whole tree. A tree of dead nodes only is compacted at once, so an empty tree
+// keeps a NULL root.
+static void lazy_tidy(RedBlackBST* self)
+{
+	if (self->dead == 0) return;
+	if (NODE_size(self->root) == 0)
+	{
+		lazy_compact(self);
+		return;
+	}
+
+	if (!self->sweeping && (long long)self->dead * LAZY_DEAD_RATIO >= (long long)NODE_size(self->root) + self->dead)
+	{
+		self->sweeping = true;
+		self->sweep = NODE_min_bykey(self->root)->key;
+	}
+	if (self->sweeping) lazy_sweep(self);
+}
+
+// before a write that moves whole subtrees around: drop the dead nodes first,
+// so every node it moves is live and the dead count stays with its tree
+static void lazy_settle(RedBlackBST* self)
+{
+	if (self->dead > 0) RBT_compact(self);
+}
+
+// x was unlinked from the tree: if it is dead, free it and return true
+static bool lazy_drop(RedBlackBST* self, Node** x)
+{
+	if (NODE_isLive(*x)) return false;
+	NODE_free(self->pool, x);
+	self->dead--;
+	return true;
+}
+
+// find the node holding key, storing the path above it in stack; NULL if there is none
+static Node* lazy_find(const RedBlackBST* self, Key key, Node** stack, int* depth)
+{
+	Node* x = self->root;
+	*depth = 0;
+	while (x != NULL && RBT_cmp(key, x->key) != 0)
+	{
+		stack[(*depth)++] = x;
+		x = x->child[RBT_cmp(key, x->key) > 0];
+	}
+	return x;
+}
+
+// take the root out for good, dead or live, by joining the subtrees on either side of it.
+// Removing the key at the root then always shrinks the tree, so a caller emptying it
+// through self->root->key is never handed the same dead key again.
+static void lazy_unlinkRoot(RedBlackBST* self)
+{
+	Node *l, *r;
+	int lBlack, rBlack, black;
+	Node* x = NODE_split(self->root, NODE_blackHeight(self->root), self->root->key, &l, &lBlack, &r, &rBlack);
+	self->root = NODE_join2(l, lBlack, r, &black);
+
+	if (x->dead) self->dead--;
+	NODE_free(self->pool, &x);
+}
+
+// mark key's node dead where it is: no rotations, only the counts on its path drop by one
+static void lazy_remove(RedBlackBST* self, Key key)
+{
+	Node* stack[RBT_MAX_DEPTH];
+	int depth;
+	Node* x = lazy_find(self, key, stack, &depth);
+	if (x == NULL || (x->dead && depth > 0)) return;
+
+	seq_begin(self);
+	int ends = ends_holding(self, key);
+	if (depth == 0)
+	{
+		lazy_unlinkRoot(self);
+		lazy_tidy(self);
+		ends_refresh(self, ends);
+		seq_end(self);
+		assert(RBT_self_check(self));
+		return;
+	}
+
+	x->dead = true;
+	NODE_releaseVal(self->pool, x);
+	self->dead++;
+
+	// every subtree on the path holds one live key less
+	stack[depth++] = x;
+	while (depth > 0)
+	{
+#ifdef RBT_AGGREGATE
+		NODE_pull(stack[--depth]);
+#else
+		stack[--depth]->size--;
+#endif
+	}
+	lazy_tidy(self);
+	ends_refresh(self, ends);
+	seq_end(self);
+	assert(RBT_self_check(self));
+}
+
+// store val in key's node if it is still linked, bringing it back to life if it was dead
+static bool lazy_revive(RedBlackBST* self, Key key, Value val)
+{
+	Node* stack[RBT_MAX_DEPTH];
+	int depth;
+	Node* x = lazy_find(self, key, stack, &depth);
+	if (x == NULL) return false;
+
+	seq_begin(self);
+	bool revived = x->dead;
+	NODE_releaseVal(self->pool, x);
+	applyKeyVal(self->pool, x, key, val);
+	x->dead = false;
+	self->dead -= revived;
+
+	// a revived key counts again in every subtree on the path
+	stack[depth++] = x;
+	while (depth > 0)
+	{
+#ifdef RBT_AGGREGATE
+		NODE_pull(stack[--depth]);
+#else
+		stack[--depth]->size += revived;
+#endif
+	}
+	ends_insert(self, key);
+	seq_end(self);
+	assert(RBT_self_check(self));
+	return true;
+}
+#else
+#define lazy_tidy(X) {/* Nodes are unlinked at once */}
+#define lazy_settle(X) {/* Nodes are unlinked at once */}
+#define lazy_drop(X, NODE) false
+#endif
+
+void KL_forEach(RedBlackBST* self, KeyList* list, void(* func)(RedBlackBST*, Node*))
+{
+	Node* node;
+	while (list && list->node)
+	{
+		node = list->node;
+		func(self, node);
+		KeyList* to_release = list;
+		list = list->next;
+		free(to_release);
+	}
+	free(list);
+}
+
+void applyKeyVal(NodePool* pool, Node* node, Key key, Value val)
+{
+	// Integer can simply be applied
+	node->key = key;
+
+	// Short strings live in the node itself, longer ones need room on the heap
+	size_t length = strlen(val) + 1;
+	if (length <= RBT_INLINE_VALUE)
+	{
+		node->val = node->inlineVal;
+	}
+	else
+	{
+		node->val = (pool != NULL) ? POOL_allocVal(pool, length) : (char*)malloc(length);
+	}
+	memcpy(node->val, val, length);
+}
+
+Node* CreateNode(NodePool* pool, Key _key, Value _val, bool _color, int _size)
+{
+	Node* node = (pool != NULL) ? POOL_alloc(pool) : calloc(1, sizeof(Node));
+	memset(node, 0, sizeof(Node));
+	node->color = _color;
+	node->size = _size;
+
+	// the value may point into the node, so it is applied in place
+	applyKeyVal(pool, node, _key, _val);
+#ifdef RBT_AGGREGATE
+	node->agg = AGG_lift(node->key, node->val);
+#endif
+	return node;
+}
+
+#ifdef RBT_AGGREGATE
+Aggregate AGG_identity(void)
+{
+	Aggregate a = { .count = 0, .sum = 0, .min = LLONG_MAX, .max = LLONG_MIN };
+	return a;
+}
+
+Aggregate AGG_lift(Key key, Value val)
+{
+	(void)key;						// the default aggregate only reads values
+	long long x = strtoll(val, NULL, 10);
+	Aggregate a = { .count = 1, .sum = x, .min = x, .max = x };
+	return a;
+}
+
+Aggregate AGG_combine(Aggregate a, Aggregate b)
+{
+	Aggregate c = { .count = a.count + b.count, .sum = a.sum + b.sum };
+	c.min = (a.min < b.min) ? a.min : b.min;
+	c.max = (a.max > b.max) ? a.max : b.max;
+	return c;
+}
+#endif // RBT_AGGREGATE
+
+/* Switches an empty tree over to slab allocation, {slabSize} nodes per slab.
+   Nodes are then reused through the pool's free list and released slab by slab by RBT_free. */
+void RBT_use_pool(RedBlackBST* self, int slabSize)
+{
+	if (!RBT_isEmpty(self)) { printf("use_pool() called on a non-empty tree"); exit(EXIT_FAILURE); }
+	if (self->pool != NULL) POOL_destroy(self->pool);
+	self->pool = POOL_create(slabSize > 0 ? slabSize : POOL_DEFAULT_SLAB);
+}
+
+/***************************************************************************
+*  Standard BST search.
+***************************************************************************/
+
+Value* RBT_get(const RedBlackBST* self, Key key)
+{
+	return NODE_get(self->root, key);
+}
+
+/* Looks up {n} keys at once, storing what RBT_get would return for keys[i] in out[i].
+   Up to GET_MANY_LANES descents advance in lockstep, one level at a time, and each
+   prefetches the node it will visit next, so their cache misses overlap instead of
+   being paid one after another. */
+void RBT_get_many(const RedBlackBST* self, const Key* keys, Value** out, size_t n)
+{
+	Node* lane[GET_MANY_LANES];
+	size_t slot[GET_MANY_LANES];
+	size_t next = 0;
+	int active = 0;
+	int i;
+
+	// start the first batch of descents
+	while (active < GET_MANY_LANES && next < n)
+	{
+		lane[active] = self->root;
+		slot[active] = next++;
+		active++;
+	}
+
+	while (active > 0)
+	{
+		for (i = 0; i < active; i++)
+		{
+			Node* x = lane[i];
+			Key key = keys[slot[i]];
+
+			if (x != NULL && RBT_cmp(key, x->key) != 0)
+			{
+				// step down one level and get the next node on its way
+				x = (RBT_cmp(key, x->key) < 0) ? x->left : x->right;
+				if (x != NULL) PREFETCH(x);
+				lane[i] = x;
+				continue;
+			}
+
+			// this lookup is finished, record it and reuse the lane
+			out[slot[i]] = (x != NULL && NODE_isLive(x)) ? &x->val : NULL;
+			if (next < n)
+			{
+				lane[i] = self->root;
+				slot[i] = next++;
+			}
+			else
+			{
+				active--;
+				lane[i] = lane[active];
+				slot[i] = slot[active];
+				i--;
+			}
+		}
+	}
+}
+
+/* Returns the number of key-value pairs in this symbol table. */
+int RBT_size(const RedBlackBST* self)
+{
+	return NODE_size(self->root);
+}
+
+/* Is this symbol table empty? */
+bool RBT_isEmpty(const RedBlackBST* self)
+{
+	return self->root == NULL;
+}
+
+bool RBT_contains(const RedBlackBST* self, Key key)
+{
+	return RBT_get(self, key) != NULL;
+}
+
+/* Returns the smallest key in the symbol table. */
+const Node* RBT_min_bykey(const RedBlackBST* self)
+{
+	if (RBT_isEmpty(self)) { printf("called min() with empty symbol table"); exit(EXIT_FAILURE); }
+#ifdef RBT_PRIORITY_QUEUE
+	if (self->first != NULL) return self->first;
+#endif
+	return tree_min(self);
+}
+
+/* Returns the largest key in the symbol table. */
+const Node* RBT_max_bykey(const RedBlackBST* self)
+{
+	if (RBT_isEmpty(self)) { printf("called max() with empty symbol table"); exit(EXIT_FAILURE); }
+#ifdef RBT_PRIORITY_QUEUE
+	if (self->last != NULL) return self->last;
+#endif
+	return tree_max(self);
+}
+
+/***************************************************************************
+*  Red-black tree deletion.
+***************************************************************************/
+
+/* Removes the largest key and associated value from the symbol table. */
+void RBT_deleteMax(RedBlackBST* self)
+{
+	if (RBT_isEmpty(self)) { printf("BST underflow"); exit(EXIT_FAILURE); }
+#ifdef RBT_LAZY_DELETE
+	RBT_remove(self, tree_max(self)->key);
+#else
+	seq_begin(self);
+
+	// if both children of root are black, set root to red
+	if (!NODE_isRed(self->root->left) && !NODE_isRed(self->root->right))
+	{
+		self->root->color = RED;
+	}
+
+#ifdef RECURSIVE_WRITES
+	self->root = NODE_deleteMax(self->pool, self->root);
+#else
+	self->root = NODE_deleteMax_iterative(self->pool, self->root);
+#endif
+	if (!RBT_isEmpty(self)) self->root->color = BLACK;
+	ends_refresh(self, ENDS_LAST);
+	seq_end(self);
+	assert(RBT_self_check(self));
+#endif
+}
+
+/* Removes the entry with the smallest key and hands it over to the caller, who can read
+   its key and val until giving it back with RBT_release; the value is neither copied nor
+   moved. Returns NULL if the symbol table is empty. */
+Node* RBT_pop_min(RedBlackBST* self)
+{
+	if (RBT_isEmpty(self)) return NULL;
+
+	seq_begin(self);
+
+	// dead nodes that come out first are freed on the way
+	Node *min, *next;
+	do
+	{
+		// if both children of root are black, set root to red
+		if (!NODE_isRed(self->root->left) && !NODE_isRed(self->root->right))
+		{
+			self->root->color = RED;
+		}
+
+		self->root = NODE_detachMin_iterative(self->root, &min, &next);
+		if (!RBT_isEmpty(self)) self->root->color = BLACK;
+	} while (lazy_drop(self, &min));
+#ifdef RBT_LAZY_DELETE
+	// the new end may be dead, and the tree may hold nothing else
+	lazy_tidy(self);
+	ends_refresh(self, ENDS_FIRST);
+#elif defined(RBT_PRIORITY_QUEUE)
+	self->first = next;
+	if (next == NULL) self->last = NULL;
+#endif
+	seq_end(self);
+	assert(RBT_self_check(self));
+	return min;
+}
+
+/* Removes the entry with the largest key and hands it over to the caller, like RBT_pop_min. */
+Node* RBT_pop_max(RedBlackBST* self)
+{
+	if (RBT_isEmpty(self)) return NULL;
+
+	seq_begin(self);
+
+	// dead nodes that come out first are freed on the way
+	Node *max, *next;
+	do
+	{
+		// if both children of root are black, set root to red
+		if (!NODE_isRed(self->root->left) && !NODE_isRed(self->root->right))
+		{
+			self->root->color = RED;
+		}
+
+		self->root = NODE_detachMax_iterative(self->root, &max, &next);
+		if (!RBT_isEmpty(self)) self->root->color = BLACK;
+	} while (lazy_drop(self, &max));
+#ifdef RBT_LAZY_DELETE
+	// the new end may be dead, and the tree may hold nothing else
+	lazy_tidy(self);
+	ends_refresh(self, ENDS_LAST);
+#elif defined(RBT_PRIORITY_QUEUE)
+	self->last = next;
+	if (next == NULL) self->first = NULL;
+#endif
+	seq_end(self);
+	assert(RBT_self_check(self));
+	return max;
+}
+
+/* Frees an entry returned by RBT_pop_min or RBT_pop_max, along with its value.
+   Entries of a pooled tree must be released before the tree is freed. */
+void RBT_release(RedBlackBST* self, Node* entry)
+{
+	if (entry != NULL) NODE_free(self->pool, &entry);
+}
+
+/* Removes the specified key and its associated value from this symbol table
+   (if the key is in this symbol table). */
+void RBT_remove(RedBlackBST* self, Key key)
+{
+#ifdef RBT_LAZY_DELETE
+	lazy_remove(self, key);
+#else
+	if (!RBT_contains(self, key)) return;
+
+	seq_begin(self);
+	int ends = ends_holding(self, key);
+
+	/* if both children of root are black, set root to red */
+	if (!NODE_isRed(self->root->left) && !NODE_isRed(self->root->right))
+	{
+		self->root->color = RED;
+	}
+
+#ifdef RECURSIVE_WRITES
+	self->root = NODE_remove(self->pool, self->root, key);
+#else
+	self->root = NODE_remove_iterative(self->pool, self->root, key);
+#endif
+	if (!RBT_isEmpty(self)) self->root->color = BLACK;
+	ends_refresh(self, ends);
+	seq_end(self);
+	assert(RBT_self_check(self));
+#endif
+}
+
+
+/***************************************************************************
+*  Red-black tree insertion.
+***************************************************************************/
+
+/* Inserts the specified key-value pair into the symbol table, overwriting the old
+ value with the new value if the symbol table already contains the specified key.
+ Deletes the specified key (and its associated value) from this symbol table
+ if the specified value is {NULL}. */
+void RBT_put(RedBlackBST* self, Key key, Value val)
+{
+	if (val == NULL)
+	{
+		RBT_remove(self, key);
+		return;
+	}
+#ifdef RBT_LAZY_DELETE
+	// a key still linked, dead or not, takes the value where it is
+	if (self->dead > 0 && lazy_revive(self, key, val)) return;
+#endif
+
+	seq_begin(self);
+#ifdef RECURSIVE_WRITES
+	self->root = NODE_put(self->pool, self->root, key, val);
+#elif !defined(RBT_APPEND)
+	self->root = NODE_put_iterative(self->pool, self->root, key, val);
+#else
+	// keys beyond the largest one go straight down the right spine; NODE_append
+	// checks the guess and corrects max when it was out of date
+	Node* root = NULL;
+	if (self->root != NULL && RBT_cmp(key, self->max) > 0) root = NODE_append(self->pool, self->root, key, val, &self->max);
+	if (root == NULL) root = NODE_put_iterative(self->pool, self->root, key, val);
+	if (self->root == NULL || RBT_cmp(key, self->max) > 0) self->max = key;
+	self->root = root;
+#endif
+	self->root->color = BLACK;
+	ends_insert(self, key);
+	seq_end(self);
+	assert(RBT_self_check(self));
+}
+
+/* Inserts {key} like RBT_put, but searches from {hint}'s position instead of the root
+   and leaves {hint} on {key}. Keys next to the hint's, as when inserting in or near
+   sorted order, are found in O(1) steps. A hint on another tree, or one that some other
+   write to this tree has made stale, is positioned with a full search first. The hint
+   loses any bounds it was created with. */
+void RBT_put_hint(RedBlackBST* self, RBT_Cursor* hint, Key key, Value val)
+{
+	if (val == NULL) { printf("value passed to put_hint() is NULL"); exit(EXIT_FAILURE); }
+
+#ifndef RECURSIVE_WRITES
+#ifdef RBT_LAZY_DELETE
+	// the finger search would take a dead node for a free spot
+	if (self->dead > 0) hint->depth = 0;
+#endif
+	if (hint->tree == self && hint->seq == self->seq && hint->depth > 0)
+	{
+		// the deepest node on the hint's path whose subtree the key belongs in. Walking up,
+		// the first ancestor we reached through its right link bounds the subtree below it
+		// from below, and the first reached through its left link bounds it from above;
+		// ancestors further up only give looser bounds, so the walk stops once both hold.
+		Node** stack = hint->stack;
+		int start = hint->depth - 1, i;
+		bool lowOk = false, highOk = false;
+		for (i = start - 1; i >= 0 && !(lowOk && highOk); i--)
+		{
+			bool right = stack[i + 1] == stack[i]->right;
+			if (right ? lowOk : highOk) continue;
+
+			if (right ? RBT_cmp(key, stack[i]->key) > 0 : RBT_cmp(key, stack[i]->key) < 0)
+			{
+				if (right) lowOk = true;
+				else highOk = true;
+			}
+			else
+			{
+				// key is outside everything below stack[i]
+				start = i;
+				lowOk = highOk = false;
+			}
+		}
+
+		hint->bounded = false;
+		seq_begin(self);
+		self->root = NODE_put_finger(self->pool, stack, &hint->depth, start, key, val);
+		self->root->color = BLACK;
+		ends_insert(self, key);
+		seq_end(self);
+
+		hint->seq = self->seq;
+		assert(RBT_self_check(self));
+		return;
+	}
+#endif
+
+	hint->tree = self;
+	hint->bounded = false;
+	RBT_put(self, key, val);
+	RBT_cursor_seek(hint, key);
+}
+
+
+/***************************************************************************
+*  Bulk loading.
+***************************************************************************/
+
+typedef struct _SortedSource
+{
+	NodePool* pool;
+	const Key* keys;
+	const Value* vals;
+	size_t next;
+} SortedSource;
+
+// hand out a fresh node for the next pair, in key order
+static Node* sorted_next(void* ctx)
+{
+	SortedSource* source = (SortedSource*)ctx;
+	size_t i = source->next++;
+	return CreateNode(source->pool, source->keys[i], source->vals[i], BLACK, 1);
+}
+
+/* Fills an empty tree with {n} pairs whose keys are strictly increasing, in linear time.
+   The tree is built directly in its final shape, no rotations are performed, and nodes
+   are allocated in key order so a pooled tree ends up laid out in key order too. */
+void RBT_build_sorted(RedBlackBST* self, const Key* keys, const Value* vals, size_t n)
+{
+	if (!RBT_isEmpty(self)) { printf("build_sorted() called on a non-empty tree"); exit(EXIT_FAILURE); }
+	if (n > INT_MAX) { printf("too many keys for build_sorted()"); exit(EXIT_FAILURE); }
+
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (vals[i] == NULL) { printf("value passed to build_sorted() is NULL"); exit(EXIT_FAILURE); }
+		if (i > 0 && RBT_cmp(keys[i - 1], keys[i]) >= 0) { printf("keys passed to build_sorted() are not strictly increasing"); exit(EXIT_FAILURE); }
+	}
+
+	SortedSource source = { .pool = self->pool, .keys = keys, .vals = vals, .next = 0 };
+	seq_begin(self);
+	self->root = NODE_build((int)n, NODE_buildHeight((int)n), sorted_next, &source);
+	ends_refresh(self, ENDS_BOTH);
+	seq_end(self);
+	assert(RBT_self_check(self));
+}
+
+
+/***************************************************************************
+*  Batch insertion.
+***************************************************************************/
+
+typedef struct _BatchItem
+{
+	Key key;
+	Value val;
+	size_t order;				// position in the caller's batch
+} BatchItem;
+
+// order by key, then by arrival so the last write of a key can be kept
+static int batch_compare(const void* a, const void* b)
+{
+	const BatchItem* x = (const BatchItem*)a;
+	const BatchItem* y = (const BatchItem*)b;
+	int c = RBT_cmp(x->key, y->key);
+	if (c != 0) return c;
+	return (x->order < y->order) ? -1 : (x->order > y->order);
+}
+
+typedef struct _MergeSource
+{
+	NodePool* pool;
+	Node* vine;					// existing nodes in key order, linked through ->right
+	const BatchItem* items;
+	size_t next, count;
+} MergeSource;
+
+// hand out the next node of the merged sequence, reusing existing nodes
+static Node* merge_next(void* ctx)
+{
+	MergeSource* source = (MergeSource*)ctx;
+	Node* x = source->vine;
+	const BatchItem* item = (source->next < source->count) ? &source->items[source->next] : NULL;
+
+	if (x != NULL && (item == NULL || RBT_cmp(x->key, item->key) <= 0))
+	{
+		source->vine = x->right;
+		if (item != NULL && RBT_cmp(x->key, item->key) == 0)
+		{
+			NODE_releaseVal(source->pool, x);
+			applyKeyVal(source->pool, x, item->key, item->val);
+			source->next++;
+		}
+		return x;
+	}
+
+	source->next++;
+	return CreateNode(source->pool, item->key, item->val, BLACK, 1);
+}
+
+// merge the sorted, distinct items into the tree by relinking every node into a fresh shape
+static void batch_rebuild(RedBlackBST* self, const BatchItem* items, size_t count)
+{
+	Node* vine = NODE_toVine(self->root);
+	Node* x = vine;
+	size_t i = 0;
+	size_t total = 0;
+
+	// count the merged keys first, the builder needs to know how many there are
+	while (x != NULL || i < count)
+	{
+		if (x == NULL) i++;
+		else if (i == count || RBT_cmp(x->key, items[i].key) < 0) x = x->right;
+		else if (RBT_cmp(x->key, items[i].key) > 0) i++;
+		else
+		{
+			x = x->right;
+			i++;
+		}
+		total++;
+	}
+	if (total > INT_MAX) { printf("too many keys for put_batch()"); exit(EXIT_FAILURE); }
+
+	MergeSource source = { .pool = self->pool, .vine = vine, .items = items, .next = 0, .count = count };
+	self->root = NODE_build((int)total, NODE_buildHeight((int)total), merge_next, &source);
+}
+
+// insert the sorted, distinct items[lo, hi) into the tree rooted at x (treated as black, black
+// height xBlack). Only the subtrees that receive keys are taken apart: the items are split around
+// x's key and each side is rejoined with x, and a run of items that lands in an empty subtree is
+// built directly.
+static Node* batch_union(NodePool* pool, Node* x, int xBlack, const BatchItem* items, size_t lo, size_t hi, int* black)
+{
+	if (lo == hi)
+	{
+		if (x != NULL) x->color = BLACK;
+		*black = xBlack;
+		return x;
+	}
+
+	if (x == NULL)
+	{
+		// the run becomes a subtree of its own
+		MergeSource source = { .pool = pool, .vine = NULL, .items = items, .next = lo, .count = hi };
+		*black = NODE_buildHeight((int)(hi - lo));
+		return NODE_build((int)(hi - lo), *black, merge_next, &source);
+	}
+
+	// a lone key goes down the ordinary insertion path
+	if (hi - lo == 1)
+	{
+		x->color = BLACK;
+#ifdef RECURSIVE_WRITES
+		x = NODE_put(pool, x, items[lo].key, items[lo].val);
+#else
+		x = NODE_put_iterative(pool, x, items[lo].key, items[lo].val);
+#endif
+		*black = xBlack;
+		if (NODE_isRed(x))
+		{
+			x->color = BLACK;
+			(*black)++;
+		}
+		return x;
+	}
+
+	// first item not smaller than x's key
+	size_t split = lo, end = hi;
+	while (split < end)
+	{
+		size_t mid = split + (end - split) / 2;
+		if (RBT_cmp(items[mid].key, x->key) < 0) split = mid + 1;
+		else end = mid;
+	}
+
+	size_t after = split;
+	if (after < hi && RBT_cmp(items[after].key, x->key) == 0)
+	{
+		NODE_releaseVal(pool, x);
+		applyKeyVal(pool, x, items[after].key, items[after].val);
+		after++;
+	}
+
+	// nothing new on either side: x keeps its shape, only its value may have changed
+	if (split == lo && after == hi)
+	{
+		x->color = BLACK;
+		NODE_pull(x);
+		*black = xBlack;
+		return x;
+	}
+
+	Node* left = x->left;
+	Node* right = x->right;
+	int leftBlack = NODE_isRed(left) ? xBlack : xBlack - 1;
+	int rightBlack = NODE_isRed(right) ? xBlack : xBlack - 1;
+
+	// both sides will be visited, start loading the second while working on the first
+	if (split > lo && after < hi && right != NULL) PREFETCH(right);
+
+	left = batch_union(pool, left, leftBlack, items, lo, split, &leftBlack);
+	right = batch_union(pool, right, rightBlack, items, after, hi, &rightBlack);
+	return NODE_join(left, leftBlack, x, right, rightBlack, black);
+}
+
+/* Inserts {n} key-value pairs at once, with the same result as calling RBT_put for each of
+   them in order (a later pair wins over an earlier one with the same key). The batch is sorted
+   first; a batch that is large next to the tree is merged in by rebuilding the tree around it
+   in linear time, a smaller one is inserted by splitting and rejoining only the subtrees its
+   keys fall into. Values must not be NULL. */
+void RBT_put_batch(RedBlackBST* self, const Key* keys, const Value* vals, size_t n)
+{
+	if (n == 0) return;
+	lazy_settle(self);
+
+	BatchItem* items = (BatchItem*)malloc(n * sizeof(BatchItem));
+	size_t i, count = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		if (vals[i] == NULL) { printf("value passed to put_batch() is NULL"); exit(EXIT_FAILURE); }
+		items[i].key = keys[i];
+		items[i].val = vals[i];
+		items[i].order = i;
+	}
+	qsort(items, n, sizeof(BatchItem), batch_compare);
+
+	// keep only the last write of every key
+	for (i = 0; i < n; i++)
+	{
+		if (i + 1 < n && RBT_cmp(items[i + 1].key, items[i].key) == 0) continue;
+		items[count++] = items[i];
+	}
+
+	int size = RBT_size(self);
+	seq_begin(self);
+	if (count * BATCH_REBUILD_RATIO >= (size_t)size)
+	{
+		batch_rebuild(self, items, count);
+	}
+	else
+	{
+		int black;
+		self->root = batch_union(self->pool, self->root, NODE_blackHeight(self->root), items, 0, count, &black);
+	}
+	// both paths keep every existing node, so only the batch's own ends can be new ones
+	ends_insert(self, items[0].key);
+	ends_insert(self, items[count - 1].key);
+	seq_end(self);
+
+	free(items);
+	assert(RBT_self_check(self));
+}
+
+
+#ifdef RBT_LAZY_DELETE
+/***************************************************************************
+*  Lazy deletion.
+*  RBT_remove only marks a node dead and lowers the counts above it, so
+*  a removal costs one descent and never restructures. Dead nodes still
+*  guide searches but hold no rank. Once they make up one node in
+*  LAZY_DEAD_RATIO a sweep starts, and each later removal rebuilds the
+*  next few nodes in key order from their live ones until it has been
+*  over the whole tree. Writes that move whole subtrees between trees
+*  compact the whole tree first.
+***************************************************************************/
+
+// hand out the next live node, in key order
+static Node* live_next(void* ctx)
+{
+	Node*** at = (Node***)ctx;
+	return *(*at)++;
+}
+
+// free every dead node and relink the live ones into a fresh shape. One in-order walk
+// collects them: rotating the tree into a vine first, as batch_rebuild does, writes
+// every node twice more and takes about three times as long on a large tree.
+static void lazy_compact(RedBlackBST* self)
+{
+	int n = NODE_size(self->root), count = 0, depth = 0;
+	Node** live = (Node**)malloc(((size_t)n + 1) * sizeof(Node*));
+	if (live == NULL) { printf("out of memory compacting tree"); exit(EXIT_FAILURE); }
+
+	Node* stack[RBT_MAX_DEPTH];
+	Node* x = self->root;
+	while (x != NULL || depth > 0)
+	{
+		while (x != NULL)
+		{
+			stack[depth++] = x;
+			x = x->left;
+		}
+		x = stack[--depth];
+
+		Node* right = x->right;
+		if (x->dead) NODE_free(self->pool, &x);
+		else live[count++] = x;
+		x = right;
+	}
+	assert(count == n);
+
+	Node** at = live;
+	self->root = NODE_build(n, NODE_buildHeight(n), live_next, &at);
+	free(live);
+	self->dead = 0;
+	self->sweeping = false;
+	// the live nodes are relinked, not copied, so the cached ends still hold
+}
+
+// compact the next LAZY_SWEEP_NODES nodes from the sweep key on: cut them out, free the
+// dead ones and join a tree built from the live ones back in, in O(log n) besides the
+// nodes swept. Nodes inserted or killed behind the sweep wait for the next one.
+static void lazy_sweep(RedBlackBST* self)
+{
+	Node* chunk[LAZY_SWEEP_NODES];
+	Node* stack[RBT_MAX_DEPTH];
+	int depth = 0, count = 0, live = 0, i;
+
+	// walk in key order from the first node at or after the sweep key, dead or live
+	Node* x = self->root;
+	while (x != NULL)
+	{
+		if (RBT_cmp(x->key, self->sweep) >= 0)
+		{
+			stack[depth++] = x;
+			x = x->left;
+		}
+		else x = x->right;
+	}
+	while (depth > 0 && count < LAZY_SWEEP_NODES)
+	{
+		x = stack[--depth];
+		chunk[count++] = x;
+		live += NODE_isLive(x);
+		for (x = x->right; x != NULL; x = x->left) stack[depth++] = x;
+	}
+
+	// the next sweep starts at the node after the chunk, if there is one
+	self->sweeping = depth > 0;
+	if (depth > 0) self->sweep = stack[depth - 1]->key;
+	if (live == count) return;
+
+	// keys below the chunk | the chunk's first node | the rest of it, and keys after it
+	Node *l, *r, *middle, *rest;
+	int lBlack, rBlack, middleBlack, restBlack, black;
+	NODE_split(self->root, NODE_blackHeight(self->root), chunk[0]->key, &l, &lBlack, &r, &rBlack);
+	if (count > 1) NODE_split(r, rBlack, chunk[count - 1]->key, &middle, &middleBlack, &rest, &restBlack);
+	else rest = r;
+
+	// every node of the chunk is now in hand, the shape it was linked in does not matter
+	live = 0;
+	for (i = 0; i < count; i++)
+	{
+		if (chunk[i]->dead) NODE_free(self->pool, &chunk[i]);
+		else chunk[live++] = chunk[i];
+	}
+	self->dead -= count - live;
+
+	Node** at = chunk;
+	middle = NODE_build(live, NODE_buildHeight(live), live_next, &at);
+	middle = NODE_join2(l, lBlack, middle, &middleBlack);
+	self->root = NODE_join2(middle, middleBlack, rest, &black);
+}
+
+/* Frees every node RBT_remove has marked dead, rebuilding the tree in O(n). Removals
+   compact a few nodes each once enough of them are dead; calling this at a quiet
+   moment does all of it at once and ends any sweep under way. */
+void RBT_compact(RedBlackBST* self)
+{
+	if (self->dead == 0) return;
+
+	seq_begin(self);
+	lazy_compact(self);
+	seq_end(self);
+	assert(RBT_self_check(self));
+}
+#endif // RBT_LAZY_DELETE
+
+
+/***************************************************************************
+*  Split, join and set operations.
+*  Union, intersection and difference divide and conquer over split and
+*  join: one tree is split around the root key of the other, the two pairs
+*  of halves are combined independently and the results joined again. The
+*  pairs share no nodes, so near the top of the recursion they are combined
+*  on separate threads. Nodes are relinked, never copied; the ones a set
+*  operation drops are collected and freed after every thread is done,
+*  since a pool is not thread safe.
+***************************************************************************/
+
+typedef enum _SetOp
+{
+	SET_UNION,
+	SET_INTERSECT,
+	SET_DIFFERENCE
+} SetOp;
+
+// subtrees dropped by a set operation, freed once it is over
+typedef struct _SetGarbage
+{
+	Node** trees;
+	size_t count, capacity;
+} SetGarbage;
+
+static void set_discard(SetGarbage* garbage, Node* x)
+{
+	if (x == NULL) return;
+	if (garbage->count == garbage->capacity)
+	{
+		size_t capacity = (garbage->capacity == 0) ? 64 : garbage->capacity * 2;
+		Node** trees = (Node**)realloc(garbage->trees, capacity * sizeof(Node*));
+		if (trees == NULL) { printf("out of memory in set operation"); exit(EXIT_FAILURE); }
+
+		garbage->trees = trees;
+		garbage->capacity = capacity;
+	}
+	garbage->trees[garbage->count++] = x;
+}
+
+// free every node of the subtree rooted at x without extra memory: rotate left
+// children up until the root has none, then release it and carry on down the right spine
+static void free_tree(NodePool* pool, Node* x)
+{
+	while (x != NULL)
+	{
+		if (x->left != NULL)
+		{
+			Node* left = x->left;
+			x->left = left->right;
+			left->right = x;
+			x = left;
+		}
+		else
+		{
+			Node* next = x->right;
+			NODE_free(pool, &x);
+			x = next;
+		}
+	}
+}
+
+// copy the subtree at x, shape and colours included, into nodes from pool, releasing
+// the originals to from
+static Node* tree_moveNodes(NodePool* pool, NodePool* from, Node* x)
+{
+	if (x == NULL) return NULL;
+
+	Node* copy = CreateNode(pool, x->key, x->val, x->color, x->size);
+#ifdef RBT_LAZY_DELETE
+	copy->dead = x->dead;
+#endif
+#ifdef RBT_PERSISTENT
+	copy->version = x->version;
+#endif
+#ifdef RBT_AGGREGATE
+	copy->agg = x->agg;
+#endif
+	copy->left = tree_moveNodes(pool, from, x->left);
+	copy->right = tree_moveNodes(pool, from, x->right);
+	NODE_free(from, &x);
+	return copy;
+}
+
+// before nodes of other move into self: make both trees allocate from the same place.
+// Two pools merge in O(1); a pooled and an unpooled tree, or a pool other trees still
+// use, cannot merge, and other's nodes are copied into self's allocator instead
+static void tree_adoptPool(RedBlackBST* self, RedBlackBST* other)
+{
+	if (self->pool == other->pool || RBT_isEmpty(other)) return;
+
+	if (RBT_isEmpty(self))
+	{
+		// self has no nodes yet, so it can simply take other's allocator
+		NodePool* pool = self->pool;
+		self->pool = other->pool;
+		other->pool = pool;
+	}
+	else if (self->pool != NULL && other->pool != NULL && POOL_adopt(self->pool, other->pool))
+	{
+		other->pool = POOL_share(self->pool);
+	}
+	else
+	{
+		seq_begin(other);
+		other->root = tree_moveNodes(self->pool, other->pool, other->root);
+		ends_refresh(other, ENDS_BOTH);
+		seq_end(other);
+	}
+}
+
+// levels of the recursion allowed to fork a thread, enough to give every core one
+static int set_depth(void)
+{
+	int depth = 0;
+#ifdef SET_THREADS
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((1L << depth) < cores) depth++;
+#endif
+	return depth;
+}
+
+typedef struct _SetTask
+{
+	SetOp op;
+	Node* a;					// from the tree being updated
+	int aBlack;
+	Node* b;					// from the tree being consumed
+	int bBlack;
+	int depth;					// levels below this task that may still fork
+	SetGarbage garbage;
+	Node* result;
+	int black;
+} SetTask;
+
+static Node* set_combine(SetOp op, Node* a, int aBlack, Node* b, int bBlack, int depth, SetGarbage* garbage, int* black);
+
+#ifdef SET_THREADS
+static void* set_thread(void* arg)
+{
+	SetTask* task = (SetTask*)arg;
+	task->result = set_combine(task->op, task->a, task->aBlack, task->b, task->bBlack, task->depth, &task->garbage, &task->black);
+	return NULL;
+}
+#endif
+
+// combine the trees a and b (black heights aBlack and bBlack, roots treated as black) by op;
+// a's values are kept, except that b's win in a union
+static Node* set_combine(SetOp op, Node* a, int aBlack, Node* b, int bBlack, int depth, SetGarbage* garbage, int* black)
+{
+	if (a == NULL || b == NULL)
+	{
+		Node* x = NULL;
+		*black = 0;
+		if (op == SET_UNION || (op == SET_DIFFERENCE && b == NULL))
+		{
+			x = (a != NULL) ? a : b;
+			*black = (a != NULL) ? aBlack : bBlack;
+			if (x != NULL) x->color = BLACK;
+		}
+		if (op != SET_UNION) set_discard(garbage, (op == SET_INTERSECT && a != NULL) ? a : b);
+		return x;
+	}
+
+	Node* bLeft = b->left;
+	Node* bRight = b->right;
+	int bLeftBlack = NODE_isRed(bLeft) ? bBlack : bBlack - 1;
+	int bRightBlack = NODE_isRed(bRight) ? bBlack : bBlack - 1;
+	b->left = b->right = NULL;
+	NODE_pull(b);
+
+	Node *l, *r;
+	int lBlack, rBlack;
+	Node* found = NODE_split(a, aBlack, b->key, &l, &lBlack, &r, &rBlack);
+
+	// the left pair on a new thread when the work is large enough, the right pair here
+	Node *left, *right;
+	int leftBlack, rightBlack;
+	bool forked = false;
+#ifdef SET_THREADS
+	SetTask task = { .op = op, .a = l, .aBlack = lBlack, .b = bLeft, .bBlack = bLeftBlack, .depth = depth - 1 };
+	pthread_t thread;
+	if (depth > 0 && NODE_size(l) + NODE_size(r) + NODE_size(bLeft) + NODE_size(bRight) >= SET_PARALLEL_GRAIN)
+	{
+		forked = pthread_create(&thread, NULL, set_thread, &task) == 0;
+	}
+#endif
+	if (!forked) left = set_combine(op, l, lBlack, bLeft, bLeftBlack, depth - 1, garbage, &leftBlack);
+	right = set_combine(op, r, rBlack, bRight, bRightBlack, depth - 1, garbage, &rightBlack);
+#ifdef SET_THREADS
+	if (forked)
+	{
+		pthread_join(thread, NULL);
+		left = task.result;
+		leftBlack = task.black;
+
+		size_t i;
+		for (i = 0; i < task.garbage.count; i++) set_discard(garbage, task.garbage.trees[i]);
+		free(task.garbage.trees);
+	}
+#endif
+
+	switch (op)
+	{
+	case SET_UNION:
+		set_discard(garbage, found);
+		return NODE_join(left, leftBlack, b, right, rightBlack, black);
+
+	case SET_INTERSECT:
+		set_discard(garbage, b);
+		if (found != NULL) return NODE_join(left, leftBlack, found, right, rightBlack, black);
+		return NODE_join2(left, leftBlack, right, black);
+
+	default:
+		set_discard(garbage, b);
+		set_discard(garbage, found);
+		return NODE_join2(left, leftBlack, right, black);
+	}
+}
+
+// run a set operation, leaving the result in self and other empty
+static void set_operation(RedBlackBST* self, RedBlackBST* other, SetOp op)
+{
+	if (self == other) { printf("set operation on a tree and itself"); exit(EXIT_FAILURE); }
+
+	lazy_settle(self);
+	lazy_settle(other);
+	tree_adoptPool(self, other);
+	seq_begin(self);
+	seq_begin(other);
+
+	SetGarbage garbage = { .trees = NULL, .count = 0, .capacity = 0 };
+	int black;
+	self->root = set_combine(op, self->root, NODE_blackHeight(self->root), other->root, NODE_blackHeight(other->root), set_depth(), &garbage, &black);
+	other->root = NULL;
+	ends_refresh(other, ENDS_BOTH);
+	ends_refresh(self, ENDS_BOTH);
+
+	seq_end(other);
+	seq_end(self);
+
+	size_t i;
+	for (i = 0; i < garbage.count; i++) free_tree(self->pool, garbage.trees[i]);
+	free(garbage.trees);
+	assert(RBT_self_check(self));
+}
+
+/* Moves every key of {self} not smaller than {key} into {right}, which must be empty.
+   Takes O(log n). Afterwards both trees allocate from {self}'s pool, if it has one. */
+void RBT_split(RedBlackBST* self, Key key, RedBlackBST* right)
+{
+	if (right == self || !RBT_isEmpty(right)) { printf("split() needs a separate, empty tree"); exit(EXIT_FAILURE); }
+	lazy_settle(self);
+
+	if (right->pool != self->pool)
+	{
+		POOL_destroy(right->pool);
+		right->pool = POOL_share(self->pool);
+	}
+
+	seq_begin(self);
+	seq_begin(right);
+
+	Node *l, *r;
+	int lBlack, rBlack, black;
+	Node* found = NODE_split(self->root, NODE_blackHeight(self->root), key, &l, &lBlack, &r, &rBlack);
+	if (found != NULL) r = NODE_join(NULL, 0, found, r, rBlack, &black);
+	self->root = l;
+	right->root = r;
+#ifdef RBT_PRIORITY_QUEUE
+	// right takes over self's largest key, and each side finds its new end
+	right->last = self->last;
+#endif
+	ends_refresh(right, ENDS_FIRST);
+	ends_refresh(self, ENDS_LAST);
+
+	seq_end(right);
+	seq_end(self);
+}
+
+/* Moves every key of {other} into {self}; they must all be larger than {self}'s keys.
+   Takes O(log n), plus O(m) for {other}'s m keys when its nodes have to be copied (see
+   RedBlackTree.h). Afterwards both trees allocate from the same pool. */
+void RBT_join(RedBlackBST* self, RedBlackBST* other)
+{
+	if (self == other) { printf("join() of a tree with itself"); exit(EXIT_FAILURE); }
+	if (RBT_isEmpty(other)) return;
+	lazy_settle(self);
+	lazy_settle(other);
+	if (!RBT_isEmpty(self) && RBT_cmp(RBT_max_bykey(self)->key, RBT_min_bykey(other)->key) >= 0) { printf("keys passed to join() overlap"); exit(EXIT_FAILURE); }
+
+	tree_adoptPool(self, other);
+	seq_begin(self);
+	seq_begin(other);
+
+	int black;
+	self->root = NODE_join2(self->root, NODE_blackHeight(self->root), other->root, &black);
+	other->root = NULL;
+#ifdef RBT_PRIORITY_QUEUE
+	// other's keys all come after self's, so its ends extend self's
+	if (self->first == NULL) self->first = other->first;
+	self->last = other->last;
+#endif
+	ends_refresh(other, ENDS_BOTH);
+
+	seq_end(other);
+	seq_end(self);
+}
+
+// unlink the keys in [lo, hi] from self, returning them as a tree of their own
+static Node* tree_cutRange(RedBlackBST* self, Key lo, Key hi)
+{
+	Node *l, *r, *middle, *rest;
+	int lBlack, rBlack, middleBlack, restBlack, black;
+
+	lazy_settle(self);
+	seq_begin(self);
+	int ends = 0;
+#ifdef RBT_PRIORITY_QUEUE
+	if (self->first == NULL || RBT_cmp(lo, self->first->key) <= 0) ends |= ENDS_FIRST;
+	if (self->last == NULL || RBT_cmp(hi, self->last->key) >= 0) ends |= ENDS_LAST;
+#endif
+
+	// keys below lo | lo | keys between lo and hi | hi | keys above hi
+	Node* first = NODE_split(self->root, NODE_blackHeight(self->root), lo, &l, &lBlack, &r, &rBlack);
+	Node* last = NODE_split(r, rBlack, hi, &middle, &middleBlack, &rest, &restBlack);
+
+	if (first != NULL) middle = NODE_join(NULL, 0, first, middle, middleBlack, &middleBlack);
+	if (last != NULL) middle = NODE_join(middle, middleBlack, last, NULL, 0, &middleBlack);
+	self->root = NODE_join2(l, lBlack, rest, &black);
+	ends_refresh(self, ends);
+
+	seq_end(self);
+	return middle;
+}
+
+/* Removes every key in [lo, hi] and returns how many there were. Cutting the range
+   out takes O(log n), freeing its nodes O(k). */
+int RBT_remove_range(RedBlackBST* self, Key lo, Key hi)
+{
+	if (RBT_cmp(lo, hi) > 0 || RBT_isEmpty(self)) return 0;
+
+	Node* range = tree_cutRange(self, lo, hi);
+	int removed = NODE_size(range);
+	free_tree(self->pool, range);
+
+	assert(RBT_self_check(self));
+	return removed;
+}
+
+/* Moves every key in [lo, hi] into a new tree, in O(log n). The new tree shares
+   {self}'s pool, if it has one, and must be released with RBT_free. */
+RedBlackBST RBT_extract_range(RedBlackBST* self, Key lo, Key hi)
+{
+	RedBlackBST range = { .root = NULL, .pool = POOL_share(self->pool), .seq = 0 };
+	if (RBT_cmp(lo, hi) <= 0 && !RBT_isEmpty(self)) range.root = tree_cutRange(self, lo, hi);
+	ends_refresh(&range, ENDS_BOTH);
+
+	assert(RBT_self_check(self));
+	return range;
+}
+
+/* Adds every key of {other} to {self}, taking {other}'s value where both have a key,
+   and leaves {other} empty. O(m log(n/m + 1)) work for trees of m <= n keys, done in
+   parallel on large trees. */
+void RBT_union(RedBlackBST* self, RedBlackBST* other)
+{
+	set_operation(self, other, SET_UNION);
+}
+
+/* Keeps only the keys of {self} that are also in {other}, and leaves {other} empty. */
+void RBT_intersect(RedBlackBST* self, RedBlackBST* other)
+{
+	set_operation(self, other, SET_INTERSECT);
+}
+
+/* Removes every key of {other} from {self}, and leaves {other} empty. */
+void RBT_difference(RedBlackBST* self, RedBlackBST* other)
+{
+	set_operation(self, other, SET_DIFFERENCE);
+}
+
+
+/***************************************************************************
+*  Utility functions.
+***************************************************************************/
+
+/* Returns the height of the BST (for debugging). */
+int RBT_height(const RedBlackBST* self)
+{
+	return NODE_height(self->root);
+}
+
+
+/***************************************************************************
+*  Ordered symbol table functions.
+***************************************************************************/
+
+/* Returns the largest key in the symbol table less than or equal to {key}. */
+Node* RBT_floor(const RedBlackBST* self, Key key)
+{
+	if (RBT_isEmpty(self)) { printf("called floor() with empty symbol table"); exit(EXIT_FAILURE); }
+
+#ifdef RBT_LAZY_DELETE
+	// the search could end on a dead node, ranks never do: key itself, or the live key ranked below it
+	int rank = NODE_rank(key, self->root);
+	Node* x = (rank < NODE_size(self->root)) ? NODE_select(self->root, rank) : NULL;
+	if (x == NULL || RBT_cmp(x->key, key) != 0) x = (rank > 0) ? NODE_select(self->root, rank - 1) : NULL;
+#else
+	Node* x = NODE_floor(self->root, key);
+#endif
+	if (x == NULL) return NULL;
+	else return x;
+}
+
+/* Returns the smallest key in the symbol table greater than or equal to {key}. */
+Node* RBT_ceiling(const RedBlackBST* self, Key key)
+{
+	if (RBT_isEmpty(self)) { printf("called ceiling() with empty symbol table"); exit(EXIT_FAILURE); }
+
+#ifdef RBT_LAZY_DELETE
+	// the live key of key's rank is the smallest one not below it
+	int rank = NODE_rank(key, self->root);
+	Node* x = (rank < NODE_size(self->root)) ? NODE_select(self->root, rank) : NULL;
+#else
+	Node* x = NODE_ceiling(self->root, key);
+#endif
+	if (x == NULL) return NULL;
+	else return x;
+}
+
+/* Return the kth smallest key in the symbol table */
+Key RBT_select(const RedBlackBST* self, int k)
+{
+	if (k < 0 || k >= RBT_size(self)) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+	Node* x = NODE_select(self->root, k);
+	return x->key;
+}
+
+/* Return the number of keys in the symbol table strictly less than {key}. */
+int RBT_rank(const RedBlackBST* self, Key key)
+{
+	return NODE_rank(key, self->root);
+}
+
+/* Stores the key of rank ranks[i] in out[i] for {n} ranks sorted in ascending order.
+   Nearby ranks share the top of their paths, which is walked only once, so this is far
+   cheaper than {n} calls to RBT_select. */
+void RBT_select_many(const RedBlackBST* self, const int* ranks, Key* out, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (ranks[i] < 0 || ranks[i] >= RBT_size(self)) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+		if (i > 0 && ranks[i] < ranks[i - 1]) { printf("ranks passed to select_many() are not sorted"); exit(EXIT_FAILURE); }
+	}
+	NODE_select_many(self->root, 0, ranks, out, n);
+}
+
+/* Stores RBT_rank(keys[i]) in out[i] for {n} keys sorted in ascending order, in one shared walk. */
+void RBT_rank_many(const RedBlackBST* self, const Key* keys, int* out, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (i > 0 && RBT_cmp(keys[i], keys[i - 1]) < 0) { printf("keys passed to rank_many() are not sorted"); exit(EXIT_FAILURE); }
+	}
+	NODE_rank_many(self->root, 0, keys, out, n);
+}
+
+/* Stores the {n} quantiles q[i] (sorted, each in [0, 1]) of the keys in out: the smallest key
+   with at least a fraction q[i] of the keys at or below it. */
+void RBT_quantiles(const RedBlackBST* self, const double* q, Key* out, size_t n)
+{
+	if (n == 0) return;
+	if (RBT_isEmpty(self)) { printf("quantiles() called with empty symbol table"); exit(EXIT_FAILURE); }
+
+	int size = RBT_size(self);
+	int* ranks = (int*)malloc(n * sizeof(int));
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (q[i] < 0 || q[i] > 1) { printf("quantile outside [0, 1]"); exit(EXIT_FAILURE); }
+
+		// nearest rank: the ceil(q * size)th key, the first one at q = 0
+		double exact = q[i] * size;
+		int count = (int)exact;
+		if (count < exact) count++;
+		ranks[i] = (count > 0) ? count - 1 : 0;
+	}
+
+	RBT_select_many(self, ranks, out, n);
+	free(ranks);
+}
+
+/* Counts the keys of each of {buckets} buckets [bounds[i], bounds[i + 1]) into counts[i].
+   {bounds} holds buckets + 1 sorted boundaries; takes one shared walk for all of them. */
+void RBT_histogram(const RedBlackBST* self, const Key* bounds, int* counts, size_t buckets)
+{
+	if (buckets == 0) return;
+
+	int* ranks = (int*)malloc((buckets + 1) * sizeof(int));
+	RBT_rank_many(self, bounds, ranks, buckets + 1);
+
+	size_t i;
+	for (i = 0; i < buckets; i++) counts[i] = ranks[i + 1] - ranks[i];
+	free(ranks);
+}
+
+
+/***************************************************************************
+*  Optimistic reads.
+*  One writer, any number of readers, no locks: a reader notes the write
+*  sequence number, searches, then checks the number did not move. Only a
+*  pooled tree can be read this way, because a pool never hands memory back,
+*  so a reader that races with a write can see stale links and values but
+*  never unmapped memory. Loops are bounded for the same reason. A reader
+*  that keeps losing to the writer asks it to hold off until the read is
+*  done, which the writer grants for a bounded time.
+***************************************************************************/
+
+// one optimistic read, over all of its attempts
+typedef struct _SeqReader
+{
+	unsigned seq;				// the write sequence number the current attempt started from
+	int attempts;
+	bool holding;				// counted in the tree's starved readers
+} SeqReader;
+
+// ask the writer to hold off. starved is the one field readers write, so the const is cast away
+static void seq_hold(const RedBlackBST* self, SeqReader* reader)
+{
+	if (reader->holding) return;
+	reader->holding = true;
+	SEQ_ADD(((RedBlackBST*)self)->starved, 1);
+}
+
+// wait out a write in progress and start an attempt from the sequence number after it
+static void seq_read_begin(const RedBlackBST* self, SeqReader* reader)
+{
+	if (self->pool == NULL) { printf("optimistic reads need a pooled tree"); exit(EXIT_FAILURE); }
+
+	if (++reader->attempts > SEQ_RETRIES) seq_hold(self, reader);
+	int spins = 0;
+	while ((reader->seq = SEQ_LOAD(unsigned, self->seq)) & 1)
+	{
+		// a write is under way; if it takes long its thread may be waiting for this core
+		if (++spins % SEQ_SPINS == 0)
+		{
+			seq_hold(self, reader);
+			SEQ_YIELD();
+		}
+	}
+	SEQ_ACQUIRE();
+}
+
+#ifdef RBT_LAZY_DELETE
+#define SEQ_LIVE(x) (!SEQ_LOAD(bool, (x)->dead))
+#else
+#define SEQ_LIVE(x) true
+#endif
+
+// did a write start since the attempt began? If not the read is done and lets the writer go on
+static bool seq_read_retry(const RedBlackBST* self, SeqReader* reader)
+{
+	SEQ_ACQUIRE();
+	if (SEQ_LOAD(unsigned, self->seq) != reader->seq) return true;
+	if (reader->holding) SEQ_ADD(((RedBlackBST*)self)->starved, -1);
+	return false;
+}
+
+// one search for key: the last node on the path whose key is smaller (floor side) and
+// larger (ceiling side), the node holding key, and, if asked for, the number of keys smaller
+typedef struct _SeqSearch
+{
+	Node* below;
+	Node* above;
+	Node* found;
+	int rank;
+	bool complete;				// false if the path ran longer than any real tree's
+} SeqSearch;
+
+static SeqSearch seq_search(const RedBlackBST* self, Key key, bool rank)
+{
+	SeqSearch search = { .below = NULL, .above = NULL, .found = NULL, .rank = 0, .complete = false };
+	Node* x = SEQ_LOAD(Node*, self->root);
+	int depth;
+
+	for (depth = 0; depth < RBT_MAX_DEPTH; depth++)
+	{
+		if (x == NULL)
+		{
+			search.complete = true;
+			break;
+		}
+
+		int c = RBT_cmp(key, SEQ_LOAD(Key, x->key));
+		int right = c > 0;
+
+		// the left child's count costs a cache miss, so it is only read for ranks
+		if (rank && (right || c == 0))
+		{
+			Node* left = SEQ_LOAD(Node*, x->left);
+			search.rank += ((left != NULL) ? SEQ_LOAD(int, left->size) : 0) + (right && SEQ_LIVE(x));
+		}
+
+		if (c == 0)
+		{
+			search.found = x;
+			search.complete = true;
+			break;
+		}
+		if (right) search.below = x;
+		else search.above = x;
+		x = SEQ_LOAD(Node*, x->child[right]);
+	}
+	return search;
+}
+
+#ifdef RBT_LAZY_DELETE
+// the live node of rank k, like NODE_select; complete is false if the path ran longer than any real tree's
+static Node* seq_select(const RedBlackBST* self, int k, bool* complete)
+{
+	Node* x = SEQ_LOAD(Node*, self->root);
+	int depth;
+
+	*complete = false;
+	for (depth = 0; depth < RBT_MAX_DEPTH; depth++)
+	{
+		if (x == NULL)
+		{
+			*complete = true;
+			break;
+		}
+
+		Node* left = SEQ_LOAD(Node*, x->left);
+		int t = (left != NULL) ? SEQ_LOAD(int, left->size) : 0;
+		bool live = SEQ_LIVE(x);
+		if (t == k && live)
+		{
+			*complete = true;
+			return x;
+		}
+
+		bool right = k >= t;
+		k -= right * (t + live);
+		x = SEQ_LOAD(Node*, x->child[right]);
+	}
+	return NULL;
+}
+#endif
+
+/* Copies the value stored for {key} into {out} (truncated to {outSize} bytes) without
+   taking a lock, while one other thread may be writing. The tree must be pooled. */
+bool RBT_optimistic_get(const RedBlackBST* self, Key key, char* out, size_t outSize)
+{
+	SeqReader reader = { .attempts = 0, .holding = false };
+	while (true)
+	{
+		seq_read_begin(self, &reader);
+		SeqSearch search = seq_search(self, key, false);
+		bool found = search.complete && search.found != NULL && SEQ_LIVE(search.found);
+
+		if (found && out != NULL && outSize > 0)
+		{
+			Node* x = search.found;
+			Value val = SEQ_LOAD(Value, x->val);
+			if (val == NULL) continue;
+
+			// copy no further than the buffer the value lives in, whatever its bytes say
+			size_t capacity = (val == x->inlineVal) ? RBT_INLINE_VALUE : POOL_valCapacity(val);
+			size_t i, limit = (outSize < capacity) ? outSize : capacity;
+			for (i = 0; i + 1 < limit; i++)
+			{
+				if ((out[i] = SEQ_LOAD(char, val[i])) == '\0') break;
+			}
+			out[i] = '\0';
+		}
+
+		if (search.complete && !seq_read_retry(self, &reader)) return found;
+	}
+}
+
+/* RBT_floor without taking a lock, see RBT_optimistic_get. Returns false if there is no such key. */
+bool RBT_optimistic_floor(const RedBlackBST* self, Key key, Key* out)
+{
+	SeqReader reader = { .attempts = 0, .holding = false };
+	while (true)
+	{
+		seq_read_begin(self, &reader);
+#ifdef RBT_LAZY_DELETE
+		// through ranks, as RBT_floor goes
+		SeqSearch search = seq_search(self, key, true);
+		bool complete = true;
+		Node* x = (search.found != NULL && SEQ_LIVE(search.found)) ? search.found : NULL;
+		if (x == NULL && search.rank > 0) x = seq_select(self, search.rank - 1, &complete);
+		complete = complete && search.complete;
+#else
+		SeqSearch search = seq_search(self, key, false);
+		bool complete = search.complete;
+		Node* x = (search.found != NULL) ? search.found : search.below;
+#endif
+		if (x != NULL) *out = SEQ_LOAD(Key, x->key);
+
+		if (complete && !seq_read_retry(self, &reader)) return x != NULL;
+	}
+}
+
+/* RBT_ceiling without taking a lock, see RBT_optimistic_get. Returns false if there is no such key. */
+bool RBT_optimistic_ceiling(const RedBlackBST* self, Key key, Key* out)
+{
+	SeqReader reader = { .attempts = 0, .holding = false };
+	while (true)
+	{
+		seq_read_begin(self, &reader);
+#ifdef RBT_LAZY_DELETE
+		SeqSearch search = seq_search(self, key, true);
+		bool complete = true;
+		Node* x = (search.found != NULL && SEQ_LIVE(search.found)) ? search.found : NULL;
+		if (x == NULL) x = seq_select(self, search.rank, &complete);
+		complete = complete && search.complete;
+#else
+		SeqSearch search = seq_search(self, key, false);
+		bool complete = search.complete;
+		Node* x = (search.found != NULL) ? search.found : search.above;
+#endif
+		if (x != NULL) *out = SEQ_LOAD(Key, x->key);
+
+		if (complete && !seq_read_retry(self, &reader)) return x != NULL;
+	}
+}
+
+/* RBT_rank without taking a lock, see RBT_optimistic_get. */
+int RBT_optimistic_rank(const RedBlackBST* self, Key key)
+{
+	SeqReader reader = { .attempts = 0, .holding = false };
+	while (true)
+	{
+		seq_read_begin(self, &reader);
+		SeqSearch search = seq_search(self, key, true);
+
+		if (search.complete && !seq_read_retry(self, &reader)) return search.rank;
+	}
+}
+
+
+/***************************************************************************
+*  Range count and range search.
+***************************************************************************/
+
+/* Returns all keys in the symbol table in the given range as a KeyList */
+KeyList* RBT_keys_range(const RedBlackBST* self, const Key lo, const Key hi)
+{
+	KeyList* list = (KeyList*)calloc(1, sizeof(KeyList));
+	KeyList* end = list;
+
+	NODE_keys(self->root, &end, lo, hi);
+	return list;
+}
+
+/* Returns all keys in the symbol table as a KeyList */
+KeyList* RBT_keys(const RedBlackBST* self)
+{
+	if (RBT_isEmpty(self)) return NULL;
+	return RBT_keys_range(self, RBT_min_bykey(self)->key, RBT_max_bykey(self)->key);
+}
+
+/* Returns the number of keys in the symbol table in the given range. */
+int RBT_range_size(const RedBlackBST* self, Key lo, Key hi)
+{
+	if (RBT_cmp(lo, hi) > 0) return 0;
+	if (RBT_contains(self, hi)) return RBT_rank(self, hi) - RBT_rank(self, lo) + 1;
+	return RBT_rank(self, hi) - RBT_rank(self, lo);
+}
+
+#ifdef RBT_AGGREGATE
+// what x itself adds to an aggregate: nothing once it is dead
+static Aggregate agg_own(const Node* x)
+{
+	return NODE_isLive(x) ? AGG_lift(x->key, x->val) : AGG_identity();
+}
+
+/* Returns AGG_combine of the values of every key in [lo, hi], in key order, or AGG_identity()
+   if there are none. Follows the two paths to lo and hi, so it takes O(log n). */
+Aggregate RBT_range_aggregate(const RedBlackBST* self, Key lo, Key hi)
+{
+	// the highest node inside the range, where the paths to lo and hi part
+	Node* x = self->root;
+	while (x != NULL && (RBT_cmp(x->key, lo) < 0 || RBT_cmp(x->key, hi) > 0)) x = (RBT_cmp(x->key, lo) < 0) ? x->right : x->left;
+	if (x == NULL) return AGG_identity();
+
+	// towards lo every node at or above lo brings itself and its right subtree, all of them
+	// larger than what is found further down
+	Aggregate left = AGG_identity();
+	Node* y;
+	for (y = x->left; y != NULL; y = (RBT_cmp(y->key, lo) < 0) ? y->right : y->left)
+	{
+		if (RBT_cmp(y->key, lo) >= 0) left = AGG_combine(AGG_combine(agg_own(y), NODE_agg(y->right)), left);
+	}
+
+	// and towards hi every node at or below hi brings its left subtree and itself
+	Aggregate right = AGG_identity();
+	for (y = x->right; y != NULL; y = (RBT_cmp(y->key, hi) > 0) ? y->left : y->right)
+	{
+		if (RBT_cmp(y->key, hi) <= 0) right = AGG_combine(right, AGG_combine(NODE_agg(y->left), agg_own(y)));
+	}
+
+	return AGG_combine(AGG_combine(left, agg_own(x)), right);
+}
+#endif // RBT_AGGREGATE
+
+
+/***************************************************************************
+*  In-order cursors.
+*  A cursor keeps the path from the root to its current node on a fixed
+*  size stack, so walking the tree never allocates.
+***************************************************************************/
+
+// push x onto the cursor path
+static void cursor_push(RBT_Cursor* cursor, Node* x)
+{
+	assert(cursor->depth < RBT_MAX_DEPTH);
+	cursor->stack[cursor->depth++] = x;
+}
+
+// stop the cursor if it has moved outside its bounds
+static bool cursor_check(RBT_Cursor* cursor)
+{
+	if (!RBT_cursor_valid(cursor)) cursor->depth = 0;
+	return cursor->depth > 0;
+}
+
+static bool cursor_stepNext(RBT_Cursor* cursor);
+static bool cursor_stepPrev(RBT_Cursor* cursor);
+
+#ifdef RBT_LAZY_DELETE
+// step over dead nodes the way step moves, so the cursor only ever rests on live ones
+static bool cursor_skipDead(RBT_Cursor* cursor, bool (*step)(RBT_Cursor*))
+{
+	while (cursor->depth > 0 && cursor->stack[cursor->depth - 1]->dead) step(cursor);
+	return cursor->depth > 0;
+}
+#else
+#define cursor_skipDead(CURSOR, STEP) ((CURSOR)->depth > 0)
+#endif
+
+/* Prepares a cursor over the whole tree, positioned at the smallest key. */
+void RBT_cursor_init(RBT_Cursor* cursor, const RedBlackBST* self)
+{
+	cursor->tree = self;
+	cursor->depth = 0;
+	cursor->bounded = false;
+	RBT_cursor_first(cursor);
+}
+
+/* Prepares a cursor over the keys in [lo, hi], positioned at the smallest of them. */
+void RBT_cursor_range(RBT_Cursor* cursor, const RedBlackBST* self, Key lo, Key hi)
+{
+	cursor->tree = self;
+	cursor->depth = 0;
+	cursor->bounded = true;
+	cursor->lo = lo;
+	cursor->hi = hi;
+	RBT_cursor_seek(cursor, lo);
+}
+
+/* Moves the cursor to the smallest key greater than or equal to {key}. */
+bool RBT_cursor_seek(RBT_Cursor* cursor, Key key)
+{
+	Node* x = cursor->tree->root;
+	int ceiling = 0;
+
+	cursor->depth = 0;
+	while (x != NULL)
+	{
+		cursor_push(cursor, x);
+		if (RBT_cmp(key, x->key) < 0)
+		{
+			// x is the best candidate so far, keep looking for a smaller one
+			ceiling = cursor->depth;
+			x = x->left;
+		}
+		else if (RBT_cmp(key, x->key) > 0) x = x->right;
+		else
+		{
+			ceiling = cursor->depth;
+			break;
+		}
+	}
+
+	// the path to the ceiling is a prefix of the search path
+	cursor->depth = ceiling;
+	cursor->seq = cursor->tree->seq;
+	cursor_check(cursor);
+	return cursor_skipDead(cursor, cursor_stepNext);
+}
+
+/* Moves the cursor to the smallest key. */
+bool RBT_cursor_first(RBT_Cursor* cursor)
+{
+	if (cursor->bounded) return RBT_cursor_seek(cursor, cursor->lo);
+
+	cursor->depth = 0;
+	cursor->seq = cursor->tree->seq;
+	Node* x = cursor->tree->root;
+	while (x != NULL)
+	{
+		cursor_push(cursor, x);
+		x = x->left;
+	}
+	return cursor_skipDead(cursor, cursor_stepNext);
+}
+
+/* Moves the cursor to the largest key. */
+bool RBT_cursor_last(RBT_Cursor* cursor)
+{
+	cursor->depth = 0;
+	cursor->seq = cursor->tree->seq;
+	Node* x = cursor->tree->root;
+
+	if (!cursor->bounded)
+	{
+		while (x != NULL)
+		{
+			cursor_push(cursor, x);
+			x = x->right;
+		}
+		return cursor_skipDead(cursor, cursor_stepPrev);
+	}
+
+	// find the floor of hi, mirroring seek
+	int floor = 0;
+	while (x != NULL)
+	{
+		cursor_push(cursor, x);
+		if (RBT_cmp(cursor->hi, x->key) > 0)
+		{
+			floor = cursor->depth;
+			x = x->right;
+		}
+		else if (RBT_cmp(cursor->hi, x->key) < 0) x = x->left;
+		else
+		{
+			floor = cursor->depth;
+			break;
+		}
+	}
+	cursor->depth = floor;
+	cursor_check(cursor);
+	return cursor_skipDead(cursor, cursor_stepPrev);
+}
+
+/* Advances the cursor to the next larger key. */
+bool RBT_cursor_next(RBT_Cursor* cursor)
+{
+	cursor_stepNext(cursor);
+	return cursor_skipDead(cursor, cursor_stepNext);
+}
+
+/* Moves the cursor back to the next smaller key. */
+bool RBT_cursor_prev(RBT_Cursor* cursor)
+{
+	cursor_stepPrev(cursor);
+	return cursor_skipDead(cursor, cursor_stepPrev);
+}
+
+// move to the in-order successor, dead or alive
+static bool cursor_stepNext(RBT_Cursor* cursor)
+{
+	if (cursor->depth == 0) return false;
+
+	Node* x = cursor->stack[cursor->depth - 1];
+	if (x->right != NULL)
+	{
+		// leftmost node of the right subtree
+		x = x->right;
+		cursor_push(cursor, x);
+		while (x->left != NULL)
+		{
+			x = x->left;
+			cursor_push(cursor, x);
+		}
+	}
+	else
+	{
+		// climb until we leave a left subtree
+		Node* child;
+		do
+		{
+			child = cursor->stack[--cursor->depth];
+		} while (cursor->depth > 0 && cursor->stack[cursor->depth - 1]->right == child);
+	}
+	return cursor_check(cursor);
+}
+
+// move to the in-order predecessor, dead or alive
+static bool cursor_stepPrev(RBT_Cursor* cursor)
+{
+	if (cursor->depth == 0) return false;
+
+	Node* x = cursor->stack[cursor->depth - 1];
+	if (x->left != NULL)
+	{
+		// rightmost node of the left subtree
+		x = x->left;
+		cursor_push(cursor, x);
+		while (x->right != NULL)
+		{
+			x = x->right;
+			cursor_push(cursor, x);
+		}
+	}
+	else
+	{
+		// climb until we leave a right subtree
+		Node* child;
+		do
+		{
+			child = cursor->stack[--cursor->depth];
+		} while (cursor->depth > 0 && cursor->stack[cursor->depth - 1]->left == child);
+	}
+	return cursor_check(cursor);
+}
+
+/* Is the cursor on a key (inside its bounds, if any)? */
+bool RBT_cursor_valid(const RBT_Cursor* cursor)
+{
+	if (cursor->depth == 0) return false;
+	if (!cursor->bounded) return true;
+
+	Key key = cursor->stack[cursor->depth - 1]->key;
+	return RBT_cmp(key, cursor->lo) >= 0 && RBT_cmp(key, cursor->hi) <= 0;
+}
+
+/* The node under the cursor, NULL once it has run off either end. */
+Node* RBT_cursor_node(const RBT_Cursor* cursor)
+{
+	if (!RBT_cursor_valid(cursor)) return NULL;
+	return cursor->stack[cursor->depth - 1];
+}
+
+/* Free the specified RBT */
+bool RBT_free(RedBlackBST* self)
+{
+	// a write like any other, so hints and optimistic readers see their nodes are gone
+	seq_begin(self);
+
+	// Pooled trees give their memory back a whole slab at a time, unless another tree still uses the pool
+	if (self->pool != NULL && !POOL_isShared(self->pool))
+	{
+		POOL_destroy(self->pool);
+		self->pool = NULL;
+		self->root = NULL;
+		ends_refresh(self, ENDS_BOTH);
+#ifdef RBT_LAZY_DELETE
+		self->dead = 0;
+		self->sweeping = false;
+#endif
+		seq_end(self);
+		return true;
+	}
+
+	free_tree(self->pool, self->root);
+	self->root = NULL;
+	ends_refresh(self, ENDS_BOTH);
+#ifdef RBT_LAZY_DELETE
+	self->dead = 0;
+	self->sweeping = false;
+#endif
+
+	POOL_destroy(self->pool);
+	self->pool = NULL;
+	seq_end(self);
+	return true;
+}
+
+#pragma region RBT_Tests
+
+/***************************************************************************
+*  Check integrity of red-black tree data structure.
+***************************************************************************/
+
+/* does this binary tree satisfy symmetric order?
+   Note: this test also ensures that data structure is a binary tree since order is strict */
+bool RBT_test_isBST(const RedBlackBST* self)
+{
+	return NODE_test_isBST(self->root, NULL, NULL);
+}
+
+/* are the size fields correct? */
+bool RBT_test_isSizeConsistent(const RedBlackBST* self)
+{
+	return NODE_test_isSizeConsistent(self->root);
+}
+
+/* check that ranks are consistent */
+bool RBT_test_isRankConsistent(const RedBlackBST* self)
+{
+	int i = 0;
+	for (; i < RBT_size(self); i++)
+		if (i != RBT_rank(self, RBT_select(self, i))) return false;
+
+	RBT_Cursor cursor;
+	Node* n;
+
+	for (RBT_cursor_init(&cursor, self); (n = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor))
+	{
+		if (RBT_cmp(n->key, RBT_select(self, RBT_rank(self, n->key))) != 0) return false;
+	}
+
+	return true;
+}
+
+/* Does the tree have no red right links, and at most one (left)
+   red links in a row on any path? */
+bool RBT_test_is23(const RedBlackBST* self)
+{
+	return NODE_test_is23(self->root, self->root);
+}
+
+/* do all paths from root to leaf have same number of black edges? */
+bool RBT_test_isBalanced(const RedBlackBST* self)
+{
+	/* number of black links on path from root to min */
+	int black = 0;
+	Node* x = self->root;
+	while (x != NULL)
+	{
+		if (!NODE_isRed(x)) black++;
+		x = x->left;
+	}
+	return NODE_test_isBalanced(self->root, black);
+}
+
+#ifdef RBT_PRIORITY_QUEUE
+/* do the cached ends, where known, hold the smallest and largest keys? */
+bool RBT_test_areEndsCurrent(const RedBlackBST* self)
+{
+	if (self->root == NULL) return self->first == NULL && self->last == NULL;
+	return (self->first == NULL || self->first == tree_min(self))
+		&& (self->last == NULL || self->last == tree_max(self));
+}
+#endif
+
+#ifdef RBT_LAZY_DELETE
+static int test_countDead(const Node* x)
+{
+	if (x == NULL) return 0;
+	return x->dead + test_countDead(x->left) + test_countDead(x->right);
+}
+
+/* does the dead count match the tree, and does a tree of dead nodes only never linger? */
+bool RBT_test_isDeadCountCurrent(const RedBlackBST* self)
+{
+	if (test_countDead(self->root) != self->dead) return false;
+	return self->root == NULL || NODE_size(self->root) > 0;
+}
+#endif
+
+bool RBT_self_check(const RedBlackBST* self)
+{
+	bool t1, t2, t3, t4, t5, t6 = true, t7 = true;
+	if (!(t1 = RBT_test_isBST(self)))            fprintf(stdout, "Not in symmetric order\n");
+	if (!(t2 = RBT_test_isSizeConsistent(self))) fprintf(stdout, "Subtree counts not consistent\n");
+	if (!(t3 = RBT_test_isRankConsistent(self))) fprintf(stdout, "Ranks not consistent\n");
+	if (!(t4 = RBT_test_is23(self)))             fprintf(stdout, "Not a 2-3 tree\n");
+	if (!(t5 = RBT_test_isBalanced(self)))       fprintf(stdout, "Not balanced\n");
+#ifdef RBT_PRIORITY_QUEUE
+	if (!(t6 = RBT_test_areEndsCurrent(self)))   fprintf(stdout, "Cached min or max out of date\n");
+#endif
+#ifdef RBT_LAZY_DELETE
+	if (!(t7 = RBT_test_isDeadCountCurrent(self))) fprintf(stdout, "Dead node count out of date\n");
+#endif
+
+	return t1 && t2 && t3 && t4 && t5 && t6 && t7;
+}
+
+#pragma endregion
@@ -1,62 +1,198 @@
-#pragma once
-
-#include "stdbool.h"
-
-typedef char* Value;
-typedef int Key;
-
-const static bool RED = 1;
-const static bool BLACK = 0;
-
-typedef struct _Node
-{
-	Value val;					// associated data
-	struct _Node* left, *right; // links to left and right subtrees
-	bool color;				    // color of parent link
-	Key key;					// key
-	int size;					// subtree count
-
-} Node;
-
-typedef struct _KeyList
-{
-	Node* node;
-	struct _KeyList* next;
-} KeyList;
-
-#define INIT_KeyList(X) KeyList X = { .node = NULL,	.next = NULL }
-
-typedef struct _RedBlackBST
-{
-	Node* root;
-} RedBlackBST;
-
-void applyKeyVal(Node* node, Key key, Value val);
-void KL_forEach(RedBlackBST* self, KeyList* list, void(* func)(RedBlackBST*, Node*));
-Node* CreateNode(Key _key, Value _val, bool _color, int _size);
-
-void RBT_deleteMax(RedBlackBST* self);
-void RBT_remove(RedBlackBST* self, Key key);
-void RBT_put(RedBlackBST* self, Key key, Value val);
-
-Value* RBT_get(const RedBlackBST* self, Key key);
-int RBT_size(const RedBlackBST* self);
-bool RBT_isEmpty(const RedBlackBST* self);
-bool RBT_contains(const RedBlackBST* self, Key key);
-
-const Node* RBT_min_bykey(const RedBlackBST* self);
-const Node* RBT_max_bykey(const RedBlackBST* self);
-
-int RBT_height(const RedBlackBST* self);
-Node* RBT_floor(const RedBlackBST* self, Key key);
-Node* RBT_ceiling(const RedBlackBST* self, Key key);
-Key RBT_select(const RedBlackBST* self, int k);
-
-int RBT_rank(const RedBlackBST* self, Key key);
-
-KeyList* RBT_keys_range(const RedBlackBST* self, const Key lo, const Key hi);
-KeyList* RBT_keys(const RedBlackBST* self);
-int RBT_range_size(const RedBlackBST* self, Key lo, Key hi);
-
-bool RBT_self_check(const RedBlackBST* self);
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+
+typedef char* Value;
+typedef int Key;
+
+// the order of Key, written like a DEFINE_RBT comparison (RedBlackTreeGeneric.h): negative,
+// zero or positive like strcmp. RBT_cmp, the one comparison of the RBT_* tree, is made from it
+#define RBT_KEY_CMP(a, b) RBT_CMP_NUMBER(a, b)
+
+const static bool RED = 1;
+const static bool BLACK = 0;
+
+// values shorter than this (including the terminator) are stored inside the node
+#define RBT_INLINE_VALUE 16
+
+// keep an aggregate of the values below every node, see RBT_range_aggregate
+//#define RBT_AGGREGATE
+
+// keep the smallest and largest nodes at hand, so RBT_min_bykey and RBT_max_bykey are O(1)
+//#define RBT_PRIORITY_QUEUE
+
+// RBT_remove marks nodes dead instead of unlinking them, see RBT_compact
+//#define RBT_LAZY_DELETE
+
+// stamp every node with the write that created it, needed by PersistentBST
+//#define RBT_PERSISTENT
+
+// RBT_put remembers the largest key and appends beyond it without comparing keys
+//#define RBT_APPEND
+
+#ifdef RBT_AGGREGATE
+// Like Key and Value, the aggregate can be changed: AGG_lift turns one key-value pair
+// into an aggregate and AGG_combine must be associative, with AGG_identity() as its
+// identity. The default keeps the count, sum, min and max of the values read as integers.
+typedef struct _Aggregate
+{
+	int count;
+	long long sum, min, max;
+} Aggregate;
+#endif
+
+typedef struct _Node
+{
+	Value val;					// associated data, points at inlineVal for short values
+	union
+	{
+		struct
+		{
+			struct _Node* left, *right; // links to left and right subtrees
+		};
+		struct _Node* child[2];	// the same links, indexed by (key > node's key)
+	};
+	bool color;				    // color of parent link
+#ifdef RBT_LAZY_DELETE
+	bool dead;					// removed, but linked until the tree is compacted
+#endif
+	Key key;					// key
+	int size;					// subtree count, of live nodes only
+#ifdef RBT_PERSISTENT
+	unsigned version;			// write that created the node, used by persistent trees
+#endif
+	char inlineVal[RBT_INLINE_VALUE]; // storage for short values
+#ifdef RBT_AGGREGATE
+	Aggregate agg;				// AGG_combine of every value in the subtree, in key order
+#endif
+
+} Node;
+
+typedef struct _KeyList
+{
+	Node* node;
+	struct _KeyList* next;
+} KeyList;
+
+#define INIT_KeyList(X) KeyList X = { .node = NULL,	.next = NULL }
+
+typedef struct _NodePool NodePool;
+
+typedef struct _RedBlackBST
+{
+	Node* root;
+	NodePool* pool;				// optional node allocator, NULL uses the heap
+	unsigned seq;				// write sequence number, odd while a write is under way
+	unsigned starved;			// optimistic readers asking the writer to hold off
+#ifdef RBT_APPEND
+	Key max;					// largest key as RBT_put last saw it, appends beyond it skip the search
+#endif
+#ifdef RBT_PRIORITY_QUEUE
+	Node* first;				// node with the smallest key, NULL if not known
+	Node* last;					// node with the largest key, NULL if not known
+#endif
+#ifdef RBT_LAZY_DELETE
+	int dead;					// nodes marked dead and still linked
+	bool sweeping;				// removals are compacting the tree a few nodes at a time
+	Key sweep;					// smallest key the sweep has yet to reach
+#endif
+} RedBlackBST;
+
+// a red-black tree of n nodes is at most 2*log2(n+1) deep, so this covers any int-sized tree
+#define RBT_MAX_DEPTH 64
+
+typedef struct _RBT_Cursor
+{
+	const RedBlackBST* tree;
+	Node* stack[RBT_MAX_DEPTH];	// path from the root down to the current node
+	int depth;					// nodes on the path, 0 once the cursor runs off the end
+	bool bounded;				// restrict the cursor to [lo, hi]
+	Key lo, hi;
+	unsigned seq;				// the tree's write sequence number when the path was taken
+} RBT_Cursor;
+
+void applyKeyVal(NodePool* pool, Node* node, Key key, Value val);
+void KL_forEach(RedBlackBST* self, KeyList* list, void(* func)(RedBlackBST*, Node*));
+Node* CreateNode(NodePool* pool, Key _key, Value _val, bool _color, int _size);
+
+#ifdef RBT_AGGREGATE
+Aggregate AGG_identity(void);
+Aggregate AGG_lift(Key key, Value val);
+Aggregate AGG_combine(Aggregate a, Aggregate b);
+#endif
+
+void RBT_use_pool(RedBlackBST* self, int slabSize);
+
+void RBT_deleteMax(RedBlackBST* self);
+Node* RBT_pop_min(RedBlackBST* self);
+Node* RBT_pop_max(RedBlackBST* self);
+void RBT_release(RedBlackBST* self, Node* entry);
+void RBT_remove(RedBlackBST* self, Key key);
+#ifdef RBT_LAZY_DELETE
+void RBT_compact(RedBlackBST* self);
+#endif
+void RBT_put(RedBlackBST* self, Key key, Value val);
+void RBT_put_hint(RedBlackBST* self, RBT_Cursor* hint, Key key, Value val);
+void RBT_build_sorted(RedBlackBST* self, const Key* keys, const Value* vals, size_t n);
+void RBT_put_batch(RedBlackBST* self, const Key* keys, const Value* vals, size_t n);
+
+// RBT_join and the set operations move {other}'s nodes into {self}. When both trees have
+// a node pool, {other}'s pool is merged into {self}'s in O(1) and {other} shares it from
+// then on. A pool only merges while no third tree uses it, and a pooled tree's nodes never
+// mix with heap nodes: in those cases {other}'s nodes are copied into {self}'s allocator
+// first, which costs O(1) per node of {other}
+void RBT_split(RedBlackBST* self, Key key, RedBlackBST* right);
+void RBT_join(RedBlackBST* self, RedBlackBST* other);
+int RBT_remove_range(RedBlackBST* self, Key lo, Key hi);
+RedBlackBST RBT_extract_range(RedBlackBST* self, Key lo, Key hi);
+void RBT_union(RedBlackBST* self, RedBlackBST* other);
+void RBT_intersect(RedBlackBST* self, RedBlackBST* other);
+void RBT_difference(RedBlackBST* self, RedBlackBST* other);
+
+Value* RBT_get(const RedBlackBST* self, Key key);
+void RBT_get_many(const RedBlackBST* self, const Key* keys, Value** out, size_t n);
+int RBT_size(const RedBlackBST* self);
+bool RBT_isEmpty(const RedBlackBST* self);
+bool RBT_contains(const RedBlackBST* self, Key key);
+
+const Node* RBT_min_bykey(const RedBlackBST* self);
+const Node* RBT_max_bykey(const RedBlackBST* self);
+
+int RBT_height(const RedBlackBST* self);
+Node* RBT_floor(const RedBlackBST* self, Key key);
+Node* RBT_ceiling(const RedBlackBST* self, Key key);
+Key RBT_select(const RedBlackBST* self, int k);
+
+int RBT_rank(const RedBlackBST* self, Key key);
+void RBT_select_many(const RedBlackBST* self, const int* ranks, Key* out, size_t n);
+void RBT_rank_many(const RedBlackBST* self, const Key* keys, int* out, size_t n);
+void RBT_quantiles(const RedBlackBST* self, const double* q, Key* out, size_t n);
+void RBT_histogram(const RedBlackBST* self, const Key* bounds, int* counts, size_t buckets);
+
+// lock-free reads while one other thread writes. Only for trees with a node pool
+// (RBT_use_pool): on any other tree they print an error and exit
+bool RBT_optimistic_get(const RedBlackBST* self, Key key, char* out, size_t outSize);
+bool RBT_optimistic_floor(const RedBlackBST* self, Key key, Key* out);
+bool RBT_optimistic_ceiling(const RedBlackBST* self, Key key, Key* out);
+int RBT_optimistic_rank(const RedBlackBST* self, Key key);
+
+KeyList* RBT_keys_range(const RedBlackBST* self, const Key lo, const Key hi);
+KeyList* RBT_keys(const RedBlackBST* self);
+int RBT_range_size(const RedBlackBST* self, Key lo, Key hi);
+#ifdef RBT_AGGREGATE
+Aggregate RBT_range_aggregate(const RedBlackBST* self, Key lo, Key hi);
+#endif
+
+void RBT_cursor_init(RBT_Cursor* cursor, const RedBlackBST* self);
+void RBT_cursor_range(RBT_Cursor* cursor, const RedBlackBST* self, Key lo, Key hi);
+bool RBT_cursor_seek(RBT_Cursor* cursor, Key key);
+bool RBT_cursor_first(RBT_Cursor* cursor);
+bool RBT_cursor_last(RBT_Cursor* cursor);
+bool RBT_cursor_next(RBT_Cursor* cursor);
+bool RBT_cursor_prev(RBT_Cursor* cursor);
+bool RBT_cursor_valid(const RBT_Cursor* cursor);
+Node* RBT_cursor_node(const RBT_Cursor* cursor);
+
+bool RBT_self_check(const RedBlackBST* self);
 bool RBT_free(RedBlackBST* self);
\ No newline at end of file
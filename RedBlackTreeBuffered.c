@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "RedBlackTreeBuffered.h"
+#include "RedBlackTreePool.h"
+
+#pragma region Private BBST_* functions
+
+static int BBST_hash(const BufferedBST* self, Key key)
+{
+	return (int)((uint32_t)key * 2654435761u & (uint32_t)(self->slots - 1));
+}
+
+// the buffered entry for key, NULL if key has not been written since the last merge
+static BufferEntry* BBST_find(const BufferedBST* self, Key key)
+{
+	int slot = BBST_hash(self, key);
+	while (self->index[slot] >= 0)
+	{
+		BufferEntry* entry = &self->entries[self->index[slot]];
+		if (entry->key == key) return entry;
+		slot = (slot + 1) & (self->slots - 1);
+	}
+	return NULL;
+}
+
+// the entry for key, appended if key has no entry yet; the buffer is never full on entry
+static BufferEntry* BBST_entry(BufferedBST* self, Key key)
+{
+	int slot = BBST_hash(self, key);
+	while (self->index[slot] >= 0)
+	{
+		BufferEntry* entry = &self->entries[self->index[slot]];
+		if (entry->key == key) return entry;
+		slot = (slot + 1) & (self->slots - 1);
+	}
+
+	BufferEntry* entry = &self->entries[self->count];
+	self->index[slot] = self->count++;
+	entry->key = key;
+	entry->val = NULL;
+	return entry;
+}
+
+static void BBST_releaseVal(BufferEntry* entry)
+{
+	if (entry->val != entry->inlineVal) free(entry->val);
+	entry->val = NULL;
+}
+
+// store a copy of val in the entry, NULL makes it a tombstone
+static void BBST_applyVal(BufferEntry* entry, Value val)
+{
+	BBST_releaseVal(entry);
+	if (val == NULL) return;
+
+	// short strings live in the entry itself, as they do in a node
+	size_t length = strlen(val) + 1;
+	entry->val = (length <= RBT_INLINE_VALUE) ? entry->inlineVal : (char*)malloc(length);
+	if (entry->val == NULL) { printf("out of memory buffering a write"); exit(EXIT_FAILURE); }
+	memcpy(entry->val, val, length);
+}
+
+static int BBST_compare(const void* a, const void* b)
+{
+	Key x = (*(const BufferEntry* const*)a)->key;
+	Key y = (*(const BufferEntry* const*)b)->key;
+	return (x > y) - (x < y);
+}
+
+// bring the entries appended since the last tidy into key order
+static void BBST_tidy(BufferedBST* self)
+{
+	int tail = self->count - self->sorted, i;
+	if (tail == 0) return;
+
+	for (i = 0; i < tail; i++) self->scratch[i] = &self->entries[self->sorted + i];
+	qsort(self->scratch, (size_t)tail, sizeof(BufferEntry*), BBST_compare);
+
+	// merge from the back, so the entries already in order move at most once; keys are distinct
+	int a = self->sorted - 1, b = tail - 1, at = self->count - 1;
+	while (b >= 0)
+	{
+		if (a >= 0 && self->order[a]->key > self->scratch[b]->key) self->order[at--] = self->order[a--];
+		else self->order[at--] = self->scratch[b--];
+	}
+	self->sorted = self->count;
+}
+
+// ordered reads tidy once the unsorted tail outgrows the square root of the buffer, which
+// bounds both their scan of the tail and the share of a tidy each write pays for
+static void BBST_tidyIfLong(BufferedBST* self)
+{
+	long tail = self->count - self->sorted;
+	if (tail * tail > self->count) BBST_tidy(self);
+}
+
+// position in order of the first sorted entry with a key not less than key
+static int BBST_lowerBound(const BufferedBST* self, Key key)
+{
+	int lo = 0, hi = self->sorted;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (self->order[mid]->key < key) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// the largest buffered key less than or equal to key that is not a tombstone
+static bool BBST_bufferFloor(const BufferedBST* self, Key key, Key* out)
+{
+	bool found = false;
+	int i = BBST_lowerBound(self, key);
+	if (i < self->sorted && self->order[i]->key == key) i++;
+	for (i--; i >= 0; i--)
+	{
+		if (self->order[i]->val == NULL) continue;
+		*out = self->order[i]->key;
+		found = true;
+		break;
+	}
+
+	for (i = self->sorted; i < self->count; i++)
+	{
+		const BufferEntry* entry = &self->entries[i];
+		if (entry->val != NULL && entry->key <= key && (!found || entry->key > *out))
+		{
+			*out = entry->key;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// the smallest buffered key greater than or equal to key that is not a tombstone
+static bool BBST_bufferCeiling(const BufferedBST* self, Key key, Key* out)
+{
+	bool found = false;
+	int i;
+	for (i = BBST_lowerBound(self, key); i < self->sorted; i++)
+	{
+		if (self->order[i]->val == NULL) continue;
+		*out = self->order[i]->key;
+		found = true;
+		break;
+	}
+
+	for (i = self->sorted; i < self->count; i++)
+	{
+		const BufferEntry* entry = &self->entries[i];
+		if (entry->val != NULL && entry->key >= key && (!found || entry->key < *out))
+		{
+			*out = entry->key;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// the buffered entries with keys in [lo, hi], tombstones included, in key order
+static BufferEntry** BBST_range(const BufferedBST* self, Key lo, Key hi, int* count)
+{
+	BufferEntry** range = (BufferEntry**)malloc(((size_t)self->count + 1) * sizeof(BufferEntry*));
+	if (range == NULL) { printf("out of memory sorting buffered writes"); exit(EXIT_FAILURE); }
+
+	// the tail's share, sorted at the back of the array
+	int i, tail = self->count;
+	for (i = self->sorted; i < self->count; i++)
+	{
+		BufferEntry* entry = &self->entries[i];
+		if (entry->key >= lo && entry->key <= hi) range[--tail] = entry;
+	}
+	qsort(range + tail, (size_t)(self->count - tail), sizeof(BufferEntry*), BBST_compare);
+
+	// merged with the sorted entries into the front
+	int a = BBST_lowerBound(self, lo), b = tail;
+	*count = 0;
+	while (true)
+	{
+		bool sortedLeft = a < self->sorted && self->order[a]->key <= hi;
+		if (!sortedLeft && b == self->count) break;
+		if (sortedLeft && (b == self->count || self->order[a]->key < range[b]->key)) range[(*count)++] = self->order[a++];
+		else range[(*count)++] = range[b++];
+	}
+	return range;
+}
+
+#pragma endregion
+
+/* Prepares an empty tree that buffers up to {capacity} writes, BBST_DEFAULT_CAPACITY if it is 0. */
+void BBST_init(BufferedBST* self, int capacity)
+{
+	if (capacity < 0 || capacity > (1 << 28)) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+	if (capacity == 0) capacity = BBST_DEFAULT_CAPACITY;
+
+	RedBlackBST empty = { .root = NULL };
+	self->tree = empty;
+	self->count = self->sorted = 0;
+	self->capacity = capacity;
+	for (self->slots = 1; self->slots < 2 * capacity; self->slots *= 2);
+
+	self->entries = (BufferEntry*)malloc((size_t)capacity * sizeof(BufferEntry));
+	self->order = (BufferEntry**)malloc((size_t)capacity * sizeof(BufferEntry*));
+	self->scratch = (BufferEntry**)malloc((size_t)capacity * sizeof(BufferEntry*));
+	self->index = (int*)malloc((size_t)self->slots * sizeof(int));
+	if (self->entries == NULL || self->order == NULL || self->scratch == NULL || self->index == NULL) { printf("out of memory creating write buffer"); exit(EXIT_FAILURE); }
+	memset(self->index, 0xFF, (size_t)self->slots * sizeof(int));
+}
+
+/* Releases the buffer and the tree. */
+void BBST_free(BufferedBST* self)
+{
+	int i;
+	for (i = 0; i < self->count; i++) BBST_releaseVal(&self->entries[i]);
+	free(self->entries);
+	free(self->order);
+	free(self->scratch);
+	free(self->index);
+	self->entries = NULL;
+	self->order = self->scratch = NULL;
+	self->index = NULL;
+	self->count = self->sorted = 0;
+	RBT_free(&self->tree);
+}
+
+/***************************************************************************
+*  Buffered writes.
+***************************************************************************/
+
+/* Buffers the pair, replacing any buffered write of the same key, and merges the buffer
+   into the tree once it is full. Removes the key if {val} is NULL. */
+void BBST_put(BufferedBST* self, Key key, Value val)
+{
+	BBST_applyVal(BBST_entry(self, key), val);
+	if (self->count == self->capacity) BBST_flush(self);
+}
+
+/* Buffers a tombstone for {key}; the key is taken out of the tree at the next merge. */
+void BBST_remove(BufferedBST* self, Key key)
+{
+	BBST_applyVal(BBST_entry(self, key), NULL);
+	if (self->count == self->capacity) BBST_flush(self);
+}
+
+/* Merges every buffered write into the tree and empties the buffer. Afterwards the tree
+   can be used with any RBT_* function until the next buffered write. */
+void BBST_flush(BufferedBST* self)
+{
+	if (self->count == 0) return;
+
+	// keys in the buffer are distinct, so the order between a removal and a put no longer matters
+	BBST_tidy(self);
+	int count = self->count, i, puts = 0, dead = 0;
+	BufferEntry** sorted = self->order;
+	Key* keys = (Key*)malloc((size_t)count * sizeof(Key));
+	Value* vals = (Value*)malloc((size_t)count * sizeof(Value));
+	Key* doomed = (Key*)malloc((size_t)count * sizeof(Key));
+	if (keys == NULL || vals == NULL || doomed == NULL) { printf("out of memory merging buffered writes"); exit(EXIT_FAILURE); }
+
+	for (i = 0; i < count; i++)
+	{
+		if (sorted[i]->val == NULL) doomed[dead++] = sorted[i]->key;
+		else
+		{
+			keys[puts] = sorted[i]->key;
+			vals[puts++] = sorted[i]->val;
+		}
+	}
+
+	// the tombstones become a tree of their own, which is subtracted in one pass
+	if (dead > 0 && !RBT_isEmpty(&self->tree))
+	{
+		RedBlackBST removed = { .root = NULL, .pool = POOL_share(self->tree.pool), .seq = 0 };
+		for (i = 0; i < dead; i++) vals[puts + i] = "";
+		RBT_build_sorted(&removed, doomed, vals + puts, (size_t)dead);
+		RBT_difference(&self->tree, &removed);
+		RBT_free(&removed);
+	}
+	RBT_put_batch(&self->tree, keys, vals, (size_t)puts);
+
+	for (i = 0; i < self->count; i++) BBST_releaseVal(&self->entries[i]);
+	self->count = self->sorted = 0;
+	memset(self->index, 0xFF, (size_t)self->slots * sizeof(int));
+
+	free(keys);
+	free(vals);
+	free(doomed);
+}
+
+/***************************************************************************
+*  Reads through the buffer.
+***************************************************************************/
+
+/* Returns the value associated with the given key, NULL if there is none. It stays valid
+   until the next write. */
+Value* BBST_get(const BufferedBST* self, Key key)
+{
+	BufferEntry* entry = BBST_find(self, key);
+	if (entry != NULL) return (entry->val != NULL) ? &entry->val : NULL;
+	return RBT_get(&self->tree, key);
+}
+
+bool BBST_contains(const BufferedBST* self, Key key)
+{
+	return BBST_get(self, key) != NULL;
+}
+
+/* Finds the largest key less than or equal to {key}. Returns false if there is none. Besides
+   the tree search it costs a binary search of the buffer and a scan of at most the square
+   root of its size. */
+bool BBST_floor(BufferedBST* self, Key key, Key* out)
+{
+	BBST_tidyIfLong(self);
+	bool found = BBST_bufferFloor(self, key, out);
+
+	// walk down from the tree's floor past keys the buffer removed, but never below the buffer's answer
+	RBT_Cursor cursor;
+	RBT_cursor_init(&cursor, &self->tree);
+	bool valid = RBT_cursor_seek(&cursor, key);
+	if (!valid) valid = RBT_cursor_last(&cursor);
+	else if (RBT_cursor_node(&cursor)->key > key) valid = RBT_cursor_prev(&cursor);
+	while (valid)
+	{
+		Key candidate = RBT_cursor_node(&cursor)->key;
+		if (found && candidate <= *out) break;
+
+		const BufferEntry* entry = BBST_find(self, candidate);
+		if (entry == NULL || entry->val != NULL)
+		{
+			*out = candidate;
+			return true;
+		}
+		valid = RBT_cursor_prev(&cursor);
+	}
+	return found;
+}
+
+/* Finds the smallest key greater than or equal to {key}. Returns false if there is none. Costs
+   the same as BBST_floor. */
+bool BBST_ceiling(BufferedBST* self, Key key, Key* out)
+{
+	BBST_tidyIfLong(self);
+	bool found = BBST_bufferCeiling(self, key, out);
+
+	RBT_Cursor cursor;
+	RBT_cursor_init(&cursor, &self->tree);
+	bool valid = RBT_cursor_seek(&cursor, key);
+	while (valid)
+	{
+		Key candidate = RBT_cursor_node(&cursor)->key;
+		if (found && candidate >= *out) break;
+
+		const BufferEntry* entry = BBST_find(self, candidate);
+		if (entry == NULL || entry->val != NULL)
+		{
+			*out = candidate;
+			return true;
+		}
+		valid = RBT_cursor_next(&cursor);
+	}
+	return found;
+}
+
+/* Calls {func} on every key in [lo, hi] and its value, in ascending order, buffered writes
+   taking the place of what the tree holds. Returns the number of keys visited. */
+int BBST_keys_range(BufferedBST* self, Key lo, Key hi, void(*func)(Key, Value, void*), void* ctx)
+{
+	int count, i = 0, visited = 0;
+	BBST_tidyIfLong(self);
+	BufferEntry** sorted = BBST_range(self, lo, hi, &count);
+
+	// merge the sorted buffer with the tree's range, the buffer winning on equal keys
+	RBT_Cursor cursor;
+	RBT_cursor_range(&cursor, &self->tree, lo, hi);
+	bool valid = RBT_cursor_valid(&cursor);
+	while (valid || i < count)
+	{
+		Node* x = valid ? RBT_cursor_node(&cursor) : NULL;
+		if (x == NULL || (i < count && sorted[i]->key <= x->key))
+		{
+			if (x != NULL && sorted[i]->key == x->key) valid = RBT_cursor_next(&cursor);
+			if (sorted[i]->val != NULL)
+			{
+				func(sorted[i]->key, sorted[i]->val, ctx);
+				visited++;
+			}
+			i++;
+		}
+		else
+		{
+			func(x->key, x->val, ctx);
+			visited++;
+			valid = RBT_cursor_next(&cursor);
+		}
+	}
+
+	free(sorted);
+	return visited;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Buffered red-black tree.
+*  Writes land in an unsorted buffer in front of the tree, one entry per
+*  key, a removal leaving a tombstone. When the buffer fills it is sorted
+*  and merged into the tree in one go: tombstones through RBT_difference,
+*  puts through RBT_put_batch, so a burst of writes shares the descents and
+*  rebalancing instead of paying for them one write at a time. Reads look
+*  in the buffer first, so they always see the latest write: gets through a
+*  hash index, ordered reads through a sorted index of the buffer that
+*  leaves at most a square root's worth of recent entries to scan.
+***************************************************************************/
+
+#define BBST_DEFAULT_CAPACITY 65536		// writes buffered before a merge
+
+typedef struct _BufferEntry
+{
+	Key key;
+	Value val;							// NULL for a tombstone
+	char inlineVal[RBT_INLINE_VALUE];	// storage for short values
+} BufferEntry;
+
+typedef struct _BufferedBST
+{
+	RedBlackBST tree;				// every write merged so far, current after BBST_flush
+	BufferEntry* entries;			// writes not merged yet, one per key, in arrival order
+	BufferEntry** order;			// the first sorted entries, in key order
+	BufferEntry** scratch;			// room to sort the entries appended since
+	int* index;						// open addressing table of entry positions by key, -1 when free
+	int count;						// entries in use
+	int sorted;						// entries covered by order
+	int capacity;					// entries merged at once
+	int slots;						// length of index, a power of two at least twice the capacity
+} BufferedBST;
+
+void BBST_init(BufferedBST* self, int capacity);
+void BBST_free(BufferedBST* self);
+
+void BBST_put(BufferedBST* self, Key key, Value val);
+void BBST_remove(BufferedBST* self, Key key);
+void BBST_flush(BufferedBST* self);
+
+Value* BBST_get(const BufferedBST* self, Key key);
+bool BBST_contains(const BufferedBST* self, Key key);
+bool BBST_floor(BufferedBST* self, Key key, Key* out);
+bool BBST_ceiling(BufferedBST* self, Key key, Key* out);
+int BBST_keys_range(BufferedBST* self, Key lo, Key hi, void(*func)(Key, Value, void*), void* ctx);
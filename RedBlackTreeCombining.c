@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+
+#include "RedBlackTreeCombining.h"
+
+// slot states: a slot is claimed by one thread, posted, applied by the combiner and handed back
+#define FC_FREE 0
+#define FC_POSTING 1
+#define FC_PENDING 2
+#define FC_DONE 3
+
+// spins a waiting thread makes before giving up its time slice
+#define FC_SPINS 64
+
+// the slot a thread tries first, so threads do not all fight over slot 0
+static _Thread_local int FC_slotHint = -1;
+static atomic_int FC_nextHint;
+
+#pragma region Private FC_* functions
+
+// take a free publication slot, waiting for one if every slot is in use
+static FC_Slot* FC_claim(FCBST* self)
+{
+	if (FC_slotHint < 0) FC_slotHint = atomic_fetch_add(&FC_nextHint, 1) % FCBST_MAX_SLOTS;
+
+	while (true)
+	{
+		int i;
+		for (i = 0; i < FCBST_MAX_SLOTS; i++)
+		{
+			int s = (FC_slotHint + i) % FCBST_MAX_SLOTS;
+			int expected = FC_FREE;
+			if (atomic_compare_exchange_strong(&self->slots[s].state, &expected, FC_POSTING))
+			{
+				// make sure the combiner scans far enough to see this slot
+				int used = atomic_load(&self->used);
+				while (used <= s && !atomic_compare_exchange_weak(&self->used, &used, s + 1));
+
+				FC_slotHint = s;
+				return &self->slots[s];
+			}
+		}
+		sched_yield();
+	}
+}
+
+// order by key so consecutive descents share the upper levels of the tree; deleteMax goes last
+static int FC_compare(const void* a, const void* b)
+{
+	const FC_Slot* x = *(const FC_Slot* const*)a;
+	const FC_Slot* y = *(const FC_Slot* const*)b;
+	bool xMax = (x->op == FC_DELETE_MAX), yMax = (y->op == FC_DELETE_MAX);
+	if (xMax != yMax) return xMax ? 1 : -1;
+	if (!xMax && x->key != y->key) return (x->key < y->key) ? -1 : 1;
+	return (x < y) ? -1 : (x > y);
+}
+
+// apply one posted operation and fill in its result
+static void FC_apply(FCBST* self, FC_Slot* slot)
+{
+	RedBlackBST* tree = &self->tree;
+	switch (slot->op)
+	{
+	case FC_PUT:
+		RBT_put(tree, slot->key, slot->val);
+		slot->found = true;
+		break;
+
+	case FC_REMOVE:
+		slot->found = RBT_contains(tree, slot->key);
+		if (slot->found) RBT_remove(tree, slot->key);
+		break;
+
+	case FC_GET:
+	{
+		Value* val = RBT_get(tree, slot->key);
+		slot->found = (val != NULL);
+		if (val != NULL && slot->out != NULL && slot->outSize > 0) snprintf(slot->out, slot->outSize, "%s", *val);
+		break;
+	}
+
+	case FC_DELETE_MAX:
+		slot->found = !RBT_isEmpty(tree);
+		if (slot->found)
+		{
+			slot->removed = RBT_max_bykey(tree)->key;
+			RBT_deleteMax(tree);
+		}
+		break;
+	}
+}
+
+// collect every posted operation, apply them in key order and hand back the results
+static void FC_combine(FCBST* self)
+{
+	int pass;
+	for (pass = 0; pass < FCBST_PASSES; pass++)
+	{
+		int used = atomic_load(&self->used), n = 0, i;
+		for (i = 0; i < used; i++)
+		{
+			if (atomic_load_explicit(&self->slots[i].state, memory_order_acquire) == FC_PENDING) self->batch[n++] = &self->slots[i];
+		}
+		if (n == 0) break;
+
+		// every operation in the batch was posted and is still waiting, so any order between them is linearizable
+		if (n > 1) qsort(self->batch, n, sizeof(FC_Slot*), FC_compare);
+
+		for (i = 0; i < n; i++)
+		{
+			FC_apply(self, self->batch[i]);
+			atomic_store_explicit(&self->batch[i]->state, FC_DONE, memory_order_release);
+		}
+	}
+}
+
+// post the operation in slot and wait until some combiner, possibly this thread, applied it
+static void FC_run(FCBST* self, FC_Slot* slot)
+{
+	atomic_store_explicit(&slot->state, FC_PENDING, memory_order_release);
+
+	int spins = 0;
+	while (atomic_load_explicit(&slot->state, memory_order_acquire) != FC_DONE)
+	{
+		if (!atomic_flag_test_and_set_explicit(&self->combining, memory_order_acquire))
+		{
+			FC_combine(self);
+			atomic_flag_clear_explicit(&self->combining, memory_order_release);
+		}
+		else if (++spins % FC_SPINS == 0) sched_yield();
+	}
+}
+
+// give the slot back once its results have been read
+static void FC_release(FC_Slot* slot)
+{
+	atomic_store_explicit(&slot->state, FC_FREE, memory_order_release);
+}
+
+#pragma endregion
+
+/* Prepares an empty tree. RBT_use_pool may be called on {tree} before the first operation. */
+void FCBST_init(FCBST* self)
+{
+	self->tree.root = NULL;
+	self->tree.pool = NULL;
+	self->tree.seq = 0;
+	self->tree.starved = 0;
+#ifdef RBT_APPEND
+	self->tree.max = 0;
+#endif
+#ifdef RBT_PRIORITY_QUEUE
+	self->tree.first = self->tree.last = NULL;
+#endif
+#ifdef RBT_LAZY_DELETE
+	self->tree.dead = 0;
+	self->tree.sweeping = false;
+#endif
+
+	int i;
+	for (i = 0; i < FCBST_MAX_SLOTS; i++) atomic_init(&self->slots[i].state, FC_FREE);
+	atomic_init(&self->used, 0);
+	atomic_flag_clear(&self->combining);
+}
+
+/* Frees the tree. No other thread may be using it. */
+void FCBST_free(FCBST* self)
+{
+	RBT_free(&self->tree);
+}
+
+/* Inserts or overwrites {key}. Returns once the write is part of the tree. */
+void FCBST_put(FCBST* self, Key key, Value val)
+{
+	FC_Slot* slot = FC_claim(self);
+	slot->op = FC_PUT;
+	slot->key = key;
+	slot->val = val;
+	FC_run(self, slot);
+	FC_release(slot);
+}
+
+/* Removes {key}. Returns whether it was present. */
+bool FCBST_remove(FCBST* self, Key key)
+{
+	FC_Slot* slot = FC_claim(self);
+	slot->op = FC_REMOVE;
+	slot->key = key;
+	FC_run(self, slot);
+
+	bool found = slot->found;
+	FC_release(slot);
+	return found;
+}
+
+/* Copies the value stored for {key} into {out} (truncated to {outSize} bytes).
+   Returns whether the key was present. */
+bool FCBST_get(FCBST* self, Key key, char* out, size_t outSize)
+{
+	FC_Slot* slot = FC_claim(self);
+	slot->op = FC_GET;
+	slot->key = key;
+	slot->out = out;
+	slot->outSize = outSize;
+	FC_run(self, slot);
+
+	bool found = slot->found;
+	FC_release(slot);
+	return found;
+}
+
+/* Removes the largest key and stores it in {out}. Returns false if the tree was empty. */
+bool FCBST_deleteMax(FCBST* self, Key* out)
+{
+	FC_Slot* slot = FC_claim(self);
+	slot->op = FC_DELETE_MAX;
+	FC_run(self, slot);
+
+	bool found = slot->found;
+	if (found && out != NULL) *out = slot->removed;
+	FC_release(slot);
+	return found;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Flat-combining red-black tree.
+*  A thread posts its operation into a publication slot and waits. Whichever
+*  waiting thread takes the combiner role collects every posted operation,
+*  sorts them by key and applies them to the tree in one pass, then hands
+*  each result back through its slot. The tree is only ever touched by the
+*  combiner, so it needs no lock, and contended threads do not hand a lock
+*  to each other once per operation.
+***************************************************************************/
+
+#define FCBST_MAX_SLOTS 128			// threads that can have an operation posted at the same time
+#define FCBST_PASSES 4				// rounds a combiner makes while new operations keep arriving
+
+typedef enum _FC_Op
+{
+	FC_PUT,
+	FC_REMOVE,
+	FC_GET,
+	FC_DELETE_MAX
+} FC_Op;
+
+typedef struct _FC_Slot
+{
+	_Alignas(64) atomic_int state;	// FC_FREE, FC_POSTING, FC_PENDING or FC_DONE
+	FC_Op op;
+	Key key;
+	Value val;						// value to put, owned by the waiting caller
+	char* out;						// get: buffer the value is copied into
+	size_t outSize;
+	bool found;						// result: the key was present (get, remove) or the tree was not empty (deleteMax)
+	Key removed;					// result of deleteMax
+} FC_Slot;
+
+typedef struct _FCBST
+{
+	RedBlackBST tree;				// only the combiner reads or writes it
+	FC_Slot slots[FCBST_MAX_SLOTS];
+	atomic_int used;				// slots below this index have been handed out at least once
+	_Alignas(64) atomic_flag combining;	// set while a thread holds the combiner role
+	FC_Slot* batch[FCBST_MAX_SLOTS];	// the combiner's scratch list of posted operations
+} FCBST;
+
+void FCBST_init(FCBST* self);
+void FCBST_free(FCBST* self);
+
+void FCBST_put(FCBST* self, Key key, Value val);
+bool FCBST_remove(FCBST* self, Key key);
+bool FCBST_get(FCBST* self, Key key, char* out, size_t outSize);
+bool FCBST_deleteMax(FCBST* self, Key* out);
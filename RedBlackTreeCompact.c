@@ -0,0 +1,741 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "RedBlackTreeCompact.h"
+
+//#define ASSERTS
+
+#ifdef ASSERTS
+#include <assert.h>
+#else
+#define assert(X) {/* Asserts are unused unless defined */}
+#endif // ASSERTS
+
+// the node at index x of this tree
+#define N(x) (self->nodes[x])
+
+#pragma region Private CNODE_* functions
+
+static bool CNODE_isRed(const CompactBST* self, NodeRef x)
+{
+	if (x == CRBT_NIL) return false;
+	return (N(x).sizeColor & CRBT_RED_BIT) != 0;
+}
+
+static void CNODE_setColor(CompactBST* self, NodeRef x, bool color)
+{
+	if (color == RED) N(x).sizeColor |= CRBT_RED_BIT;
+	else N(x).sizeColor &= ~CRBT_RED_BIT;
+}
+
+static int CNODE_size(const CompactBST* self, NodeRef x)
+{
+	if (x == CRBT_NIL) return 0;
+	return (int)(N(x).sizeColor & CRBT_SIZE_MASK);
+}
+
+static void CNODE_setSize(CompactBST* self, NodeRef x, int size)
+{
+	N(x).sizeColor = (N(x).sizeColor & ~CRBT_SIZE_MASK) | (uint32_t)size;
+}
+
+// recompute the subtree count of x from its children
+static void CNODE_resize(CompactBST* self, NodeRef x)
+{
+	CNODE_setSize(self, x, CNODE_size(self, N(x).left) + CNODE_size(self, N(x).right) + 1);
+}
+
+static Value CNODE_val(const CompactBST* self, NodeRef x)
+{
+	if (N(x).sizeColor & CRBT_INLINE_BIT) return (Value)N(x).val.inlineVal;
+	return N(x).val.heap;
+}
+
+static void CNODE_releaseVal(CompactBST* self, NodeRef x)
+{
+	if (!(N(x).sizeColor & CRBT_INLINE_BIT)) free(N(x).val.heap);
+	N(x).val.heap = NULL;
+	N(x).sizeColor &= ~CRBT_INLINE_BIT;
+}
+
+// copy a value into x, inline if it fits
+static void CNODE_applyVal(CompactBST* self, NodeRef x, Value val)
+{
+	size_t length = strlen(val) + 1;
+	if (length <= CRBT_INLINE_VALUE)
+	{
+		memcpy(N(x).val.inlineVal, val, length);
+		N(x).sizeColor |= CRBT_INLINE_BIT;
+	}
+	else
+	{
+		N(x).val.heap = (char*)malloc(length);
+		memcpy(N(x).val.heap, val, length);
+		N(x).sizeColor &= ~CRBT_INLINE_BIT;
+	}
+}
+
+// make room for at least one more node; indices stay valid, pointers into nodes do not
+static void CNODE_reserve(CompactBST* self)
+{
+	if (self->free != CRBT_NIL || self->used < self->capacity) return;
+
+	uint32_t capacity = (self->capacity == 0) ? 64 : self->capacity * 2;
+	if (capacity > CRBT_SIZE_MASK) { printf("compact tree is full"); exit(EXIT_FAILURE); }
+
+	CompactNode* nodes = (CompactNode*)realloc(self->nodes, capacity * sizeof(CompactNode));
+	if (nodes == NULL) { printf("out of memory growing compact tree"); exit(EXIT_FAILURE); }
+
+	self->nodes = nodes;
+	self->capacity = capacity;
+	if (self->used == 0) self->used = 1;	// slot 0 is CRBT_NIL
+}
+
+// take a slot for a new red leaf; CNODE_reserve must have been called
+static NodeRef CNODE_create(CompactBST* self, Key key, Value val)
+{
+	NodeRef x;
+	if (self->free != CRBT_NIL)
+	{
+		x = self->free;
+		self->free = N(x).left;
+	}
+	else x = self->used++;
+
+	N(x).left = CRBT_NIL;
+	N(x).right = CRBT_NIL;
+	N(x).sizeColor = CRBT_RED_BIT | 1;
+	N(x).key = key;
+	CNODE_applyVal(self, x, val);
+	return x;
+}
+
+static void CNODE_free(CompactBST* self, NodeRef x)
+{
+	CNODE_releaseVal(self, x);
+	N(x).left = self->free;
+	self->free = x;
+}
+
+static NodeRef CNODE_rotateRight(CompactBST* self, NodeRef h)
+{
+	assert((h != CRBT_NIL) && CNODE_isRed(self, N(h).left));
+	NodeRef x = N(h).left;
+	N(h).left = N(x).right;
+	N(x).right = h;
+	CNODE_setColor(self, x, CNODE_isRed(self, h));
+	CNODE_setColor(self, h, RED);
+	CNODE_setSize(self, x, CNODE_size(self, h));
+	CNODE_resize(self, h);
+	return x;
+}
+
+static NodeRef CNODE_rotateLeft(CompactBST* self, NodeRef h)
+{
+	assert((h != CRBT_NIL) && CNODE_isRed(self, N(h).right));
+	NodeRef x = N(h).right;
+	N(h).right = N(x).left;
+	N(x).left = h;
+	CNODE_setColor(self, x, CNODE_isRed(self, h));
+	CNODE_setColor(self, h, RED);
+	CNODE_setSize(self, x, CNODE_size(self, h));
+	CNODE_resize(self, h);
+	return x;
+}
+
+static void CNODE_flipColors(CompactBST* self, NodeRef h)
+{
+	N(h).sizeColor ^= CRBT_RED_BIT;
+	N(N(h).left).sizeColor ^= CRBT_RED_BIT;
+	N(N(h).right).sizeColor ^= CRBT_RED_BIT;
+}
+
+static NodeRef CNODE_moveRedLeft(CompactBST* self, NodeRef h)
+{
+	CNODE_flipColors(self, h);
+	if (CNODE_isRed(self, N(N(h).right).left))
+	{
+		N(h).right = CNODE_rotateRight(self, N(h).right);
+		h = CNODE_rotateLeft(self, h);
+		CNODE_flipColors(self, h);
+	}
+	return h;
+}
+
+static NodeRef CNODE_moveRedRight(CompactBST* self, NodeRef h)
+{
+	CNODE_flipColors(self, h);
+	if (CNODE_isRed(self, N(N(h).left).left))
+	{
+		h = CNODE_rotateRight(self, h);
+		CNODE_flipColors(self, h);
+	}
+	return h;
+}
+
+static NodeRef CNODE_balance(CompactBST* self, NodeRef h)
+{
+	if (CNODE_isRed(self, N(h).right)) h = CNODE_rotateLeft(self, h);
+	if (CNODE_isRed(self, N(h).left) && CNODE_isRed(self, N(N(h).left).left)) h = CNODE_rotateRight(self, h);
+	if (CNODE_isRed(self, N(h).left) && CNODE_isRed(self, N(h).right)) CNODE_flipColors(self, h);
+
+	CNODE_resize(self, h);
+	return h;
+}
+
+static NodeRef CNODE_fixUp(CompactBST* self, NodeRef h)
+{
+	// fix-up any right-leaning links
+	if (CNODE_isRed(self, N(h).right) && !CNODE_isRed(self, N(h).left)) h = CNODE_rotateLeft(self, h);
+	if (CNODE_isRed(self, N(h).left) && CNODE_isRed(self, N(N(h).left).left)) h = CNODE_rotateRight(self, h);
+	if (CNODE_isRed(self, N(h).left) && CNODE_isRed(self, N(h).right)) CNODE_flipColors(self, h);
+
+	CNODE_resize(self, h);
+	return h;
+}
+
+static NodeRef CNODE_min(const CompactBST* self, NodeRef x)
+{
+	while (N(x).left != CRBT_NIL) x = N(x).left;
+	return x;
+}
+
+static NodeRef CNODE_max(const CompactBST* self, NodeRef x)
+{
+	while (N(x).right != CRBT_NIL) x = N(x).right;
+	return x;
+}
+
+// Writes keep their path on an explicit stack like the iterative NODE_* writes: on the
+// way back up a level is only rebalanced if it was restructured on the way down or the
+// colors below it changed, and above that only the subtree counts change.
+typedef struct _CompactPath
+{
+	NodeRef node[RBT_MAX_DEPTH];	// subtree roots from the top down, after any restructuring
+	bool right[RBT_MAX_DEPTH];		// which child the path continues into
+	bool red[RBT_MAX_DEPTH];		// color of the subtree root as its parent last saw it
+	bool leftRed[RBT_MAX_DEPTH];	// color of that root's left child
+	bool touched[RBT_MAX_DEPTH];	// must be rebalanced on the way up
+	int shadow;						// levels still affected by the last restructuring
+	int depth;
+} CompactPath;
+
+// remember what the parent of h sees before h is changed
+static void CPATH_enter(const CompactBST* self, CompactPath* path, NodeRef h)
+{
+	assert(path->depth < RBT_MAX_DEPTH);
+	path->red[path->depth] = CNODE_isRed(self, h);
+	path->leftRed[path->depth] = CNODE_isRed(self, N(h).left);
+	path->touched[path->depth] = path->shadow > 0;
+}
+
+// the current level was restructured, which reaches two levels further down
+static void CPATH_touch(CompactPath* path)
+{
+	path->touched[path->depth] = true;
+	path->shadow = 3;
+}
+
+// record h as the subtree root at this level and continue into one of its children
+static void CPATH_push(CompactPath* path, NodeRef h, bool right)
+{
+	path->node[path->depth] = h;
+	path->right[path->depth] = right;
+	path->depth++;
+	if (path->shadow > 0) path->shadow--;
+}
+
+// relink the path bottom up, hanging child below the deepest level.
+// sizeDelta is the change in subtree counts along the path.
+static NodeRef CPATH_unwind(CompactBST* self, CompactPath* path, NodeRef child, int sizeDelta, bool insert)
+{
+	bool settled = false;
+	int i;
+
+	for (i = path->depth - 1; i >= 0; i--)
+	{
+		NodeRef h = path->node[i];
+		if (path->right[i]) N(h).right = child;
+		else N(h).left = child;
+
+		if (settled && !path->touched[i]) CNODE_setSize(self, h, CNODE_size(self, h) + sizeDelta);
+		else h = insert ? CNODE_fixUp(self, h) : CNODE_balance(self, h);
+
+		settled = CNODE_isRed(self, h) == path->red[i] && CNODE_isRed(self, N(h).left) == path->leftRed[i];
+		child = h;
+	}
+	return child;
+}
+
+// insert the key-value pair in the tree rooted at h; CNODE_reserve must have been called
+static NodeRef CNODE_put(CompactBST* self, NodeRef h, Key key, Value val)
+{
+	CompactPath path;
+	path.depth = 0;
+	path.shadow = 0;
+
+	while (h != CRBT_NIL)
+	{
+		if (key == N(h).key)
+		{
+			// Replace the key with a new value, the shape does not change
+			CNODE_releaseVal(self, h);
+			CNODE_applyVal(self, h, val);
+			return path.depth > 0 ? path.node[0] : h;
+		}
+
+		CPATH_enter(self, &path, h);
+		CPATH_push(&path, h, key > N(h).key);
+		h = (key < N(h).key) ? N(h).left : N(h).right;
+	}
+
+	return CPATH_unwind(self, &path, CNODE_create(self, key, val), 1, true);
+}
+
+// delete the maximum of the tree rooted at h
+static NodeRef CNODE_deleteMax(CompactBST* self, NodeRef h)
+{
+	CompactPath path;
+	path.depth = 0;
+	path.shadow = 0;
+
+	while (true)
+	{
+		CPATH_enter(self, &path, h);
+		if (CNODE_isRed(self, N(h).left))
+		{
+			h = CNODE_rotateRight(self, h);
+			CPATH_touch(&path);
+		}
+
+		if (N(h).right == CRBT_NIL)
+		{
+			CNODE_free(self, h);
+			return CPATH_unwind(self, &path, CRBT_NIL, -1, false);
+		}
+
+		if (!CNODE_isRed(self, N(h).right) && !CNODE_isRed(self, N(N(h).right).left))
+		{
+			h = CNODE_moveRedRight(self, h);
+			CPATH_touch(&path);
+		}
+		CPATH_push(&path, h, true);
+		h = N(h).right;
+	}
+}
+
+// delete the key from the tree rooted at h; the key must be present. The successor
+// node takes the removed node's place in the tree.
+static NodeRef CNODE_remove(CompactBST* self, NodeRef h, Key key)
+{
+	CompactPath path;
+	NodeRef target = CRBT_NIL;
+	int targetDepth = 0;
+	path.depth = 0;
+	path.shadow = 0;
+
+	// find the key, pushing a red link down in front of us
+	while (true)
+	{
+		CPATH_enter(self, &path, h);
+		if (key < N(h).key)
+		{
+			if (!CNODE_isRed(self, N(h).left) && !CNODE_isRed(self, N(N(h).left).left))
+			{
+				h = CNODE_moveRedLeft(self, h);
+				CPATH_touch(&path);
+			}
+			CPATH_push(&path, h, false);
+			h = N(h).left;
+			continue;
+		}
+
+		if (CNODE_isRed(self, N(h).left))
+		{
+			h = CNODE_rotateRight(self, h);
+			CPATH_touch(&path);
+		}
+		if (key == N(h).key && (N(h).right == CRBT_NIL))
+		{
+			CNODE_free(self, h);
+			return CPATH_unwind(self, &path, CRBT_NIL, -1, false);
+		}
+		if (!CNODE_isRed(self, N(h).right) && !CNODE_isRed(self, N(N(h).right).left))
+		{
+			h = CNODE_moveRedRight(self, h);
+			CPATH_touch(&path);
+		}
+
+		CPATH_push(&path, h, true);
+		if (key == N(h).key)
+		{
+			target = h;
+			targetDepth = path.depth - 1;
+			h = N(h).right;
+			break;
+		}
+		h = N(h).right;
+	}
+
+	// delete the minimum of the right subtree, it takes the target's place
+	while (N(h).left != CRBT_NIL)
+	{
+		CPATH_enter(self, &path, h);
+		if (!CNODE_isRed(self, N(h).left) && !CNODE_isRed(self, N(N(h).left).left))
+		{
+			h = CNODE_moveRedLeft(self, h);
+			CPATH_touch(&path);
+		}
+		CPATH_push(&path, h, false);
+		h = N(h).left;
+	}
+
+	NodeRef successor = h;
+	N(successor).left = N(target).left;
+	N(successor).right = N(target).right;
+	N(successor).sizeColor = (N(target).sizeColor & ~CRBT_INLINE_BIT) | (N(successor).sizeColor & CRBT_INLINE_BIT);
+	path.node[targetDepth] = successor;
+	if (path.depth == targetDepth + 1)
+	{
+		// the successor was the target's right child
+		N(successor).right = CRBT_NIL;
+	}
+
+	CNODE_free(self, target);
+	return CPATH_unwind(self, &path, CRBT_NIL, -1, false);
+}
+
+static int CNODE_height(const CompactBST* self, NodeRef x)
+{
+	// depth-first walk; the stack never holds more than one pending node per level
+	NodeRef stack[RBT_MAX_DEPTH + 1];
+	int depth[RBT_MAX_DEPTH + 1];
+	int top = 0, height = -1;
+
+	if (x != CRBT_NIL)
+	{
+		stack[top] = x;
+		depth[top++] = 0;
+	}
+	while (top > 0)
+	{
+		x = stack[--top];
+		int d = depth[top];
+		if (d > height) height = d;
+		if (N(x).right != CRBT_NIL)
+		{
+			stack[top] = N(x).right;
+			depth[top++] = d + 1;
+		}
+		if (N(x).left != CRBT_NIL)
+		{
+			stack[top] = N(x).left;
+			depth[top++] = d + 1;
+		}
+	}
+	return height;
+}
+
+static void CNODE_keys(const CompactBST* self, NodeRef x, Key lo, Key hi, void(*func)(Key, Value, void*), void* ctx)
+{
+	if (x == CRBT_NIL) return;
+	if (lo < N(x).key) CNODE_keys(self, N(x).left, lo, hi, func, ctx);
+	if (lo <= N(x).key && hi >= N(x).key) func(N(x).key, CNODE_val(self, x), ctx);
+	if (hi > N(x).key) CNODE_keys(self, N(x).right, lo, hi, func, ctx);
+}
+
+#pragma region Compact Node Tests
+
+static bool CNODE_test_isBST(const CompactBST* self, NodeRef x, const Key* min, const Key* max)
+{
+	if (x == CRBT_NIL) return true;
+	if (min != NULL && N(x).key <= *min) return false;
+	if (max != NULL && N(x).key >= *max) return false;
+	return CNODE_test_isBST(self, N(x).left, min, &N(x).key) && CNODE_test_isBST(self, N(x).right, &N(x).key, max);
+}
+
+static bool CNODE_test_isSizeConsistent(const CompactBST* self, NodeRef x)
+{
+	if (x == CRBT_NIL) return true;
+	if (CNODE_size(self, x) != CNODE_size(self, N(x).left) + CNODE_size(self, N(x).right) + 1) return false;
+	return CNODE_test_isSizeConsistent(self, N(x).left) && CNODE_test_isSizeConsistent(self, N(x).right);
+}
+
+static bool CNODE_test_is23(const CompactBST* self, NodeRef x)
+{
+	if (x == CRBT_NIL) return true;
+	if (CNODE_isRed(self, N(x).right)) return false;
+	if (x != self->root && CNODE_isRed(self, x) && CNODE_isRed(self, N(x).left)) return false;
+	return CNODE_test_is23(self, N(x).left) && CNODE_test_is23(self, N(x).right);
+}
+
+static bool CNODE_test_isBalanced(const CompactBST* self, NodeRef x, int black)
+{
+	if (x == CRBT_NIL) return black == 0;
+	if (!CNODE_isRed(self, x)) black--;
+	return CNODE_test_isBalanced(self, N(x).left, black) && CNODE_test_isBalanced(self, N(x).right, black);
+}
+
+#pragma endregion
+
+#pragma endregion
+
+/***************************************************************************
+*  Standard BST search.
+***************************************************************************/
+
+/* Returns the value stored for {key}, NULL if there is none. The pointer is
+   valid until the tree is next modified. */
+Value CRBT_get(const CompactBST* self, Key key)
+{
+	NodeRef x = self->root;
+	while (x != CRBT_NIL)
+	{
+		if (key == N(x).key) return CNODE_val(self, x);
+		x = (key < N(x).key) ? N(x).left : N(x).right;
+	}
+	return NULL;
+}
+
+/* Returns the number of key-value pairs in this symbol table. */
+int CRBT_size(const CompactBST* self)
+{
+	return CNODE_size(self, self->root);
+}
+
+/* Is this symbol table empty? */
+bool CRBT_isEmpty(const CompactBST* self)
+{
+	return self->root == CRBT_NIL;
+}
+
+bool CRBT_contains(const CompactBST* self, Key key)
+{
+	return CRBT_get(self, key) != NULL;
+}
+
+/* Returns the smallest key in the symbol table. */
+Key CRBT_min_bykey(const CompactBST* self)
+{
+	if (CRBT_isEmpty(self)) { printf("called min() with empty symbol table"); exit(EXIT_FAILURE); }
+	return N(CNODE_min(self, self->root)).key;
+}
+
+/* Returns the largest key in the symbol table. */
+Key CRBT_max_bykey(const CompactBST* self)
+{
+	if (CRBT_isEmpty(self)) { printf("called max() with empty symbol table"); exit(EXIT_FAILURE); }
+	return N(CNODE_max(self, self->root)).key;
+}
+
+/***************************************************************************
+*  Red-black tree deletion.
+***************************************************************************/
+
+/* Removes the largest key and associated value from the symbol table. */
+void CRBT_deleteMax(CompactBST* self)
+{
+	if (CRBT_isEmpty(self)) { printf("BST underflow"); exit(EXIT_FAILURE); }
+
+	// if both children of root are black, set root to red
+	if (!CNODE_isRed(self, N(self->root).left) && !CNODE_isRed(self, N(self->root).right))
+	{
+		CNODE_setColor(self, self->root, RED);
+	}
+
+	self->root = CNODE_deleteMax(self, self->root);
+	if (!CRBT_isEmpty(self)) CNODE_setColor(self, self->root, BLACK);
+	assert(CRBT_self_check(self));
+}
+
+/* Removes the specified key and its associated value from this symbol table
+   (if the key is in this symbol table). */
+void CRBT_remove(CompactBST* self, Key key)
+{
+	if (!CRBT_contains(self, key)) return;
+
+	/* if both children of root are black, set root to red */
+	if (!CNODE_isRed(self, N(self->root).left) && !CNODE_isRed(self, N(self->root).right))
+	{
+		CNODE_setColor(self, self->root, RED);
+	}
+
+	self->root = CNODE_remove(self, self->root, key);
+	if (!CRBT_isEmpty(self)) CNODE_setColor(self, self->root, BLACK);
+	assert(CRBT_self_check(self));
+}
+
+/***************************************************************************
+*  Red-black tree insertion.
+***************************************************************************/
+
+/* Inserts the specified key-value pair into the symbol table, overwriting the old
+ value with the new value if the symbol table already contains the specified key.
+ Deletes the specified key (and its associated value) from this symbol table
+ if the specified value is {NULL}. */
+void CRBT_put(CompactBST* self, Key key, Value val)
+{
+	if (val == NULL)
+	{
+		CRBT_remove(self, key);
+		return;
+	}
+
+	// grow before descending so the node array cannot move under the recursion
+	CNODE_reserve(self);
+	self->root = CNODE_put(self, self->root, key, val);
+	CNODE_setColor(self, self->root, BLACK);
+	assert(CRBT_self_check(self));
+}
+
+/***************************************************************************
+*  Utility functions.
+***************************************************************************/
+
+/* Returns the height of the BST (for debugging). */
+int CRBT_height(const CompactBST* self)
+{
+	return CNODE_height(self, self->root);
+}
+
+/***************************************************************************
+*  Ordered symbol table functions.
+***************************************************************************/
+
+/* Returns the largest key in the symbol table less than or equal to {key}, NULL if there is none. */
+const Key* CRBT_floor(const CompactBST* self, Key key)
+{
+	if (CRBT_isEmpty(self)) { printf("called floor() with empty symbol table"); exit(EXIT_FAILURE); }
+
+	NodeRef x = self->root, best = CRBT_NIL;
+	while (x != CRBT_NIL)
+	{
+		if (key == N(x).key) return &N(x).key;
+		if (key > N(x).key)
+		{
+			best = x;
+			x = N(x).right;
+		}
+		else x = N(x).left;
+	}
+	return (best != CRBT_NIL) ? &N(best).key : NULL;
+}
+
+/* Returns the smallest key in the symbol table greater than or equal to {key}, NULL if there is none. */
+const Key* CRBT_ceiling(const CompactBST* self, Key key)
+{
+	if (CRBT_isEmpty(self)) { printf("called ceiling() with empty symbol table"); exit(EXIT_FAILURE); }
+
+	NodeRef x = self->root, best = CRBT_NIL;
+	while (x != CRBT_NIL)
+	{
+		if (key == N(x).key) return &N(x).key;
+		if (key < N(x).key)
+		{
+			best = x;
+			x = N(x).left;
+		}
+		else x = N(x).right;
+	}
+	return (best != CRBT_NIL) ? &N(best).key : NULL;
+}
+
+/* Return the kth smallest key in the symbol table */
+Key CRBT_select(const CompactBST* self, int k)
+{
+	if (k < 0 || k >= CRBT_size(self)) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+
+	NodeRef x = self->root;
+	while (true)
+	{
+		int t = CNODE_size(self, N(x).left);
+		if (t == k) return N(x).key;
+		if (t > k) x = N(x).left;
+		else
+		{
+			k -= t + 1;
+			x = N(x).right;
+		}
+	}
+}
+
+/* Return the number of keys in the symbol table strictly less than {key}. */
+int CRBT_rank(const CompactBST* self, Key key)
+{
+	NodeRef x = self->root;
+	int rank = 0;
+	while (x != CRBT_NIL)
+	{
+		int t = CNODE_size(self, N(x).left);
+		if (key == N(x).key) return rank + t;
+		if (key < N(x).key) x = N(x).left;
+		else
+		{
+			rank += t + 1;
+			x = N(x).right;
+		}
+	}
+	return rank;
+}
+
+/***************************************************************************
+*  Range count and range search.
+***************************************************************************/
+
+/* Calls {func} for every key in [lo, hi] in order, with its value and {ctx}. */
+void CRBT_keys_range(const CompactBST* self, Key lo, Key hi, void(*func)(Key, Value, void*), void* ctx)
+{
+	CNODE_keys(self, self->root, lo, hi, func, ctx);
+}
+
+/* Returns the number of keys in the symbol table in the given range. */
+int CRBT_range_size(const CompactBST* self, Key lo, Key hi)
+{
+	if (lo > hi) return 0;
+	if (CRBT_contains(self, hi)) return CRBT_rank(self, hi) - CRBT_rank(self, lo) + 1;
+	return CRBT_rank(self, hi) - CRBT_rank(self, lo);
+}
+
+/* Free the specified compact tree */
+bool CRBT_free(CompactBST* self)
+{
+	// only the values need a walk, and that is a linear scan of the array
+	uint32_t x;
+	for (x = 1; x < self->used; x++)
+	{
+		CNODE_releaseVal(self, x);
+	}
+
+	free(self->nodes);
+	self->nodes = NULL;
+	self->capacity = self->used = 0;
+	self->free = self->root = CRBT_NIL;
+	return true;
+}
+
+/***************************************************************************
+*  Check integrity of red-black tree data structure.
+***************************************************************************/
+
+bool CRBT_self_check(const CompactBST* self)
+{
+	bool t1, t2, t3, t4 = true, t5;
+	int black = 0;
+	NodeRef x;
+
+	for (x = self->root; x != CRBT_NIL; x = N(x).left)
+		if (!CNODE_isRed(self, x)) black++;
+
+	int i;
+	for (i = 0; i < CRBT_size(self) && t4; i++)
+		if (i != CRBT_rank(self, CRBT_select(self, i))) t4 = false;
+
+	if (!(t1 = CNODE_test_isBST(self, self->root, NULL, NULL)))     fprintf(stdout, "Not in symmetric order\n");
+	if (!(t2 = CNODE_test_isSizeConsistent(self, self->root)))      fprintf(stdout, "Subtree counts not consistent\n");
+	if (!t4)                                                        fprintf(stdout, "Ranks not consistent\n");
+	if (!(t3 = CNODE_test_is23(self, self->root)))                  fprintf(stdout, "Not a 2-3 tree\n");
+	if (!(t5 = CNODE_test_isBalanced(self, self->root, black)))     fprintf(stdout, "Not balanced\n");
+
+	return t1 && t2 && t3 && t4 && t5;
+}
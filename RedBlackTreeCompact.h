@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Compact red-black tree.
+*  Nodes live in one array and refer to each other by 32-bit index, the
+*  color shares a word with the subtree count and short values are kept
+*  in the node, so a node takes 24 bytes instead of the 56 of a Node.
+*
+*  CompactBST is a standalone container, not another layout behind the
+*  RBT_* functions. Those hand out Node pointers (floor, ceiling, pop_min,
+*  cursors, key lists) that must stay valid across writes, while compact
+*  nodes move whenever the array grows; and pools, optimistic readers,
+*  persistent versions and the other tree types all work on Node. So the
+*  CRBT_* functions carry their own copy of the LLRB put and remove, and
+*  cover the ordered symbol table only: put, get, remove, min, max, floor,
+*  ceiling, rank, select and range walks, with keys handed out by value or
+*  by a pointer valid until the next write. Anything beyond that, such as
+*  split, join, set operations or the other tree types, needs RedBlackBST.
+***************************************************************************/
+
+typedef uint32_t NodeRef;			// index into CompactBST.nodes
+
+#define CRBT_NIL 0					// index 0 is never used, it stands for "no node"
+#define CRBT_RED_BIT 0x80000000u	// set in sizeColor for red nodes
+#define CRBT_INLINE_BIT 0x40000000u	// set in sizeColor when the value is stored inline
+#define CRBT_SIZE_MASK 0x3FFFFFFFu	// the subtree count
+#define CRBT_INLINE_VALUE 8			// values shorter than this (with terminator) are stored inline
+
+typedef struct _CompactNode
+{
+	NodeRef left, right;			// links to left and right subtrees
+	uint32_t sizeColor;				// subtree count, color and value storage bits
+	Key key;						// key
+	union
+	{
+		char* heap;					// values of CRBT_INLINE_VALUE bytes or more
+		char inlineVal[CRBT_INLINE_VALUE];
+	} val;						// associated data
+
+} CompactNode;
+
+typedef struct _CompactBST
+{
+	CompactNode* nodes;				// node storage, grows by doubling
+	uint32_t capacity;				// slots allocated
+	uint32_t used;					// slots handed out, including the unused slot 0
+	NodeRef free;					// released slots, linked through left
+	NodeRef root;
+} CompactBST;
+
+#define INIT_CompactBST(X) CompactBST X = { .nodes = NULL, .capacity = 0, .used = 0, .free = CRBT_NIL, .root = CRBT_NIL }
+
+void CRBT_deleteMax(CompactBST* self);
+void CRBT_remove(CompactBST* self, Key key);
+void CRBT_put(CompactBST* self, Key key, Value val);
+
+Value CRBT_get(const CompactBST* self, Key key);
+int CRBT_size(const CompactBST* self);
+bool CRBT_isEmpty(const CompactBST* self);
+bool CRBT_contains(const CompactBST* self, Key key);
+
+Key CRBT_min_bykey(const CompactBST* self);
+Key CRBT_max_bykey(const CompactBST* self);
+
+int CRBT_height(const CompactBST* self);
+const Key* CRBT_floor(const CompactBST* self, Key key);
+const Key* CRBT_ceiling(const CompactBST* self, Key key);
+Key CRBT_select(const CompactBST* self, int k);
+
+int CRBT_rank(const CompactBST* self, Key key);
+
+void CRBT_keys_range(const CompactBST* self, Key lo, Key hi, void(*func)(Key, Value, void*), void* ctx);
+int CRBT_range_size(const CompactBST* self, Key lo, Key hi);
+
+bool CRBT_self_check(const CompactBST* self);
+bool CRBT_free(CompactBST* self);
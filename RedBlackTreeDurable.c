@@ -0,0 +1,349 @@
+// fileno, fsync and the rest of the file handling are POSIX, not C11
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#if defined(_MSC_VER)
+#include <io.h>
+#define DBST_SYNC_FILE(f) _commit(_fileno(f))
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define DBST_SYNC_FILE(f) fsync(fileno(f))
+#endif
+
+#include "RedBlackTreeDurable.h"
+#include "RedBlackTreeMapped.h"
+
+#define DBST_HASH_SEED 2166136261u
+
+#pragma region Private DBST_* functions
+
+// FNV-1a over length bytes, continuing from hash
+static uint32_t DBST_hash(uint32_t hash, const void* data, size_t length)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// the check a record and its value must carry, field by field so padding never counts
+static uint32_t DBST_checksum(const LogRecord* record, const char* val)
+{
+	uint32_t hash = DBST_hash(DBST_HASH_SEED, &record->op, sizeof(record->op));
+	hash = DBST_hash(hash, &record->length, sizeof(record->length));
+	hash = DBST_hash(hash, &record->key, sizeof(record->key));
+	return DBST_hash(hash, val, record->length);
+}
+
+static char* DBST_path(const char* path, const char* suffix)
+{
+	size_t length = strlen(path) + strlen(suffix) + 1;
+	char* joined = (char*)malloc(length);
+	if (joined == NULL) { printf("out of memory opening durable tree"); exit(EXIT_FAILURE); }
+	snprintf(joined, length, "%s%s", path, suffix);
+	return joined;
+}
+
+// sync the directory holding path, so a file just created or renamed there is still there after a crash
+static void DBST_syncDirectory(const char* path)
+{
+#if !defined(_MSC_VER)
+	char* dir = DBST_path(path, "");
+	char* slash = strrchr(dir, '/');
+	if (slash == NULL) strcpy(dir, ".");
+	else slash[(slash == dir) ? 1 : 0] = '\0';
+
+	int file = open(dir, O_RDONLY);
+	if (file >= 0)
+	{
+		fsync(file);
+		close(file);
+	}
+	free(dir);
+#else
+	(void)path;						// NTFS journals renames itself
+#endif
+}
+
+// replace the log with an empty one
+static bool DBST_resetLog(DurableBST* self)
+{
+	if (self->log != NULL) fclose(self->log);
+	self->log = fopen(self->logPath, "wb");
+	if (self->log == NULL) return false;
+
+	LogHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DBST_LOG_MAGIC, sizeof(header.magic));
+	header.version = DBST_LOG_VERSION;
+	header.keySize = sizeof(Key);
+	bool ok = fwrite(&header, sizeof(header), 1, self->log) == 1 && fflush(self->log) == 0 && DBST_SYNC_FILE(self->log) == 0;
+	DBST_syncDirectory(self->logPath);
+
+	self->unsynced = self->logged = 0;
+	return ok;
+}
+
+// add one write to the log; it sits in the stream's buffer until the next sync
+static void DBST_append(DurableBST* self, uint32_t op, Key key, const char* val, size_t length)
+{
+	LogRecord record;
+	memset(&record, 0, sizeof(record));
+	record.op = op;
+	record.length = (uint32_t)length;
+	record.key = key;
+	record.check = DBST_checksum(&record, val);
+
+	if (fwrite(&record, sizeof(record), 1, self->log) != 1 || (length > 0 && fwrite(val, length, 1, self->log) != 1))
+	{
+		printf("could not append to the log"); exit(EXIT_FAILURE);
+	}
+}
+
+// count a write that has been logged and applied, then sync and snapshot as configured
+static void DBST_written(DurableBST* self)
+{
+	self->unsynced++;
+	self->logged++;
+	if (self->syncEvery > 0 && self->unsynced >= self->syncEvery) DBST_sync(self);
+
+	// if the snapshot can't be written the log still holds everything, so try again a group later
+	if (self->snapshotEvery > 0 && self->logged >= self->snapshotEvery && !DBST_checkpoint(self)) self->logged = 0;
+}
+
+// fill the empty tree from the snapshot, false if there is one but it can't be read
+static bool DBST_loadSnapshot(DurableBST* self)
+{
+	MappedBST* image = RBT_open_mapped(self->snapshotPath);
+	if (image == NULL)
+	{
+		FILE* file = fopen(self->snapshotPath, "rb");
+		if (file == NULL) return true;	// no snapshot taken yet
+		fclose(file);
+		return false;
+	}
+	if (!MAP_self_check(image))
+	{
+		MAP_close(image);
+		return false;
+	}
+
+	// an in-order walk of the image yields the pairs sorted, ready for a linear-time build
+	int n = MAP_size(image);
+	Key* keys = (Key*)malloc(((size_t)n + 1) * sizeof(Key));
+	Value* vals = (Value*)malloc(((size_t)n + 1) * sizeof(Value));
+	if (keys == NULL || vals == NULL) { printf("out of memory loading snapshot"); exit(EXIT_FAILURE); }
+
+	uint32_t stack[RBT_MAX_DEPTH];
+	uint32_t x = image->header->root;
+	int depth = 0, i = 0;
+	while (x != MAP_NIL || depth > 0)
+	{
+		while (x != MAP_NIL)
+		{
+			stack[depth++] = x;
+			x = image->nodes[x].left;
+		}
+		x = stack[--depth];
+		keys[i] = image->nodes[x].key;
+		vals[i++] = (Value)(image->heap + image->nodes[x].val);
+		x = image->nodes[x].right;
+	}
+	RBT_build_sorted(&self->tree, keys, vals, (size_t)n);
+
+	free(keys);
+	free(vals);
+	MAP_close(image);
+	return true;
+}
+
+// apply the log's records to the tree, setting *torn if it doesn't end on a complete record
+static bool DBST_replay(DurableBST* self, bool* torn)
+{
+	*torn = false;
+	FILE* file = fopen(self->logPath, "rb");
+	if (file == NULL) return true;		// nothing logged yet
+
+	LogHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1)
+	{
+		// the crash came while a new log was being started
+		fclose(file);
+		*torn = true;
+		return true;
+	}
+	if (memcmp(header.magic, DBST_LOG_MAGIC, sizeof(header.magic)) != 0 || header.version != DBST_LOG_VERSION || header.keySize != sizeof(Key))
+	{
+		fclose(file);
+		return false;
+	}
+
+	// stop at the first record that was not completely written, the crash came while appending it
+	size_t capacity = 256;
+	char* val = (char*)malloc(capacity);
+	if (val == NULL) { printf("out of memory replaying log"); exit(EXIT_FAILURE); }
+	long good = ftell(file);
+	LogRecord record;
+	while (fread(&record, sizeof(record), 1, file) == 1)
+	{
+		bool put = record.op == DBST_OP_PUT;
+		if (!put && record.op != DBST_OP_REMOVE) break;
+		if (put != (record.length > 0) || record.length > DBST_MAX_VALUE) break;
+		if (record.length > capacity)
+		{
+			while (record.length > capacity) capacity *= 2;
+			free(val);
+			val = (char*)malloc(capacity);
+			if (val == NULL) { printf("out of memory replaying log"); exit(EXIT_FAILURE); }
+		}
+		if (put && (fread(val, record.length, 1, file) != 1 || val[record.length - 1] != '\0')) break;
+		if (record.check != DBST_checksum(&record, val)) break;
+
+		if (put) RBT_put(&self->tree, record.key, val);
+		else RBT_remove(&self->tree, record.key);
+		self->recovered++;
+		good = ftell(file);
+	}
+	*torn = fseek(file, 0, SEEK_END) != 0 || ftell(file) != good;
+
+	free(val);
+	fclose(file);
+	return true;
+}
+
+#pragma endregion
+
+/* Opens the tree kept in the files {path}.snap and {path}.wal, creating them if they don't
+   exist, and recovers it: the last snapshot is loaded, then the writes logged since are
+   replayed. Writes are synced in groups of {syncEvery}, 1 syncs every write and 0 only
+   syncs on DBST_sync; a crash loses at most the writes not synced yet. Every {snapshotEvery}
+   writes, or never if it is 0, a snapshot is taken and the log emptied. Returns false if the
+   files exist but can't be read; {self} is then left closed. */
+bool DBST_open(DurableBST* self, const char* path, int syncEvery, int snapshotEvery)
+{
+	if (path == NULL) { printf("argument to open() is NULL"); exit(EXIT_FAILURE); }
+	if (syncEvery < 0 || snapshotEvery < 0) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+
+	RedBlackBST empty = { .root = NULL };
+	self->tree = empty;
+	self->logPath = DBST_path(path, ".wal");
+	self->snapshotPath = DBST_path(path, ".snap");
+	self->log = NULL;
+	self->syncEvery = syncEvery;
+	self->snapshotEvery = snapshotEvery;
+	self->unsynced = self->logged = self->recovered = 0;
+
+	bool torn = false;
+	bool ok = DBST_loadSnapshot(self) && DBST_replay(self, &torn);
+	if (ok && torn)
+	{
+		// start over from a snapshot rather than append behind a broken record
+		ok = DBST_checkpoint(self);
+	}
+	else if (ok)
+	{
+		self->log = fopen(self->logPath, "r+b");
+		if (self->log != NULL) ok = fseek(self->log, 0, SEEK_END) == 0;
+		else ok = DBST_resetLog(self);
+		self->logged = self->recovered;
+	}
+
+	if (!ok)
+	{
+		if (self->log != NULL) fclose(self->log);
+		RBT_free(&self->tree);
+		free(self->logPath);
+		free(self->snapshotPath);
+		return false;
+	}
+	return true;
+}
+
+/* Syncs the writes not synced yet and releases the tree. The files stay for the next DBST_open. */
+void DBST_close(DurableBST* self)
+{
+	DBST_sync(self);
+	fclose(self->log);
+	self->log = NULL;
+	RBT_free(&self->tree);
+	free(self->logPath);
+	free(self->snapshotPath);
+}
+
+/***************************************************************************
+*  Logged writes.
+***************************************************************************/
+
+/* Logs the pair, then inserts it, overwriting the old value with the new value if
+   the key is already present. Removes the key if {val} is NULL. */
+void DBST_put(DurableBST* self, Key key, Value val)
+{
+	if (val == NULL)
+	{
+		DBST_remove(self, key);
+		return;
+	}
+
+	size_t length = strlen(val) + 1;
+	if (length > DBST_MAX_VALUE) { printf("value passed to put() is too long to log"); exit(EXIT_FAILURE); }
+	DBST_append(self, DBST_OP_PUT, key, val, length);
+	RBT_put(&self->tree, key, val);
+	DBST_written(self);
+}
+
+/* Logs the removal of {key}, then removes it. Nothing is logged if the key is absent. */
+void DBST_remove(DurableBST* self, Key key)
+{
+	if (!RBT_contains(&self->tree, key)) return;
+
+	DBST_append(self, DBST_OP_REMOVE, key, NULL, 0);
+	RBT_remove(&self->tree, key);
+	DBST_written(self);
+}
+
+/* Logs and removes the largest key. It is logged as the removal of that key, so the
+   record does the same thing however often it is replayed. */
+void DBST_deleteMax(DurableBST* self)
+{
+	if (RBT_isEmpty(&self->tree)) { printf("BST underflow"); exit(EXIT_FAILURE); }
+
+	DBST_append(self, DBST_OP_REMOVE, RBT_max_bykey(&self->tree)->key, NULL, 0);
+	RBT_deleteMax(&self->tree);
+	DBST_written(self);
+}
+
+/***************************************************************************
+*  Group commit and snapshots.
+***************************************************************************/
+
+/* Makes every write so far durable: flushes the log and waits for the disk to have it. */
+void DBST_sync(DurableBST* self)
+{
+	if (self->unsynced == 0) return;
+	if (fflush(self->log) != 0 || DBST_SYNC_FILE(self->log) != 0) { printf("could not sync the log"); exit(EXIT_FAILURE); }
+	self->unsynced = 0;
+}
+
+/* Saves the tree as the new snapshot and empties the log, so the next recovery has nothing
+   to replay. Returns false, keeping the log as it is, if the snapshot could not be written. */
+bool DBST_checkpoint(DurableBST* self)
+{
+	if (self->log != NULL) DBST_sync(self);
+	if (!RBT_save(&self->tree, self->snapshotPath)) return false;
+	DBST_syncDirectory(self->snapshotPath);
+
+	// a crash before the log is emptied replays it over a snapshot that already holds its writes;
+	// every record is a plain put or remove of one key, so that leaves the same tree
+	if (!DBST_resetLog(self)) { printf("could not start a new log"); exit(EXIT_FAILURE); }
+	return true;
+}
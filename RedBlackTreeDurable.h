@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Durable red-black tree.
+*  Every write is appended to a write-ahead log before it is applied to the
+*  in-memory tree. The log is synced to disk once per group of writes, not
+*  once per write, and every so many writes the whole tree is saved as a
+*  snapshot and the log started afresh, so recovery loads the last snapshot
+*  in linear time and replays no more than one group of snapshotEvery
+*  writes on top of it.
+***************************************************************************/
+
+#define DBST_LOG_MAGIC "RBTWALOG"		// first 8 bytes of a log, without terminator
+#define DBST_LOG_VERSION 1
+#define DBST_MAX_VALUE (1u << 24)		// longest value a log record may carry, terminator included
+
+#define DBST_OP_PUT 1
+#define DBST_OP_REMOVE 2
+
+typedef struct _LogHeader
+{
+	char magic[8];					// DBST_LOG_MAGIC
+	uint32_t version;				// DBST_LOG_VERSION
+	uint32_t keySize;				// sizeof(Key)
+} LogHeader;
+
+typedef struct _LogRecord
+{
+	uint32_t op;					// DBST_OP_PUT or DBST_OP_REMOVE
+	uint32_t length;				// bytes of value following the record, terminator included, 0 for removes
+	Key key;
+	uint32_t check;					// checksum of the record, with check 0, and its value
+} LogRecord;
+
+typedef struct _DurableBST
+{
+	RedBlackBST tree;				// read it with the RBT_* queries, write it only through DBST_*
+	char* logPath;					// path + ".wal"
+	char* snapshotPath;				// path + ".snap", an RBT_save image
+	FILE* log;
+	int syncEvery;					// writes per group commit, 0 leaves syncing to DBST_sync
+	int snapshotEvery;				// writes logged before the next snapshot, 0 leaves it to DBST_checkpoint
+	int unsynced;					// writes logged since the last sync
+	int logged;						// writes in the log since the last snapshot
+	int recovered;					// writes DBST_open replayed from the log
+} DurableBST;
+
+bool DBST_open(DurableBST* self, const char* path, int syncEvery, int snapshotEvery);
+void DBST_close(DurableBST* self);
+
+void DBST_put(DurableBST* self, Key key, Value val);
+void DBST_remove(DurableBST* self, Key key);
+void DBST_deleteMax(DurableBST* self);
+
+void DBST_sync(DurableBST* self);
+bool DBST_checkpoint(DurableBST* self);
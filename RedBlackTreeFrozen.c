@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "RedBlackTreeFrozen.h"
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#define FRZ_ALIGNED_ALLOC(size) _aligned_malloc(size, 32)
+#define FRZ_ALIGNED_FREE(ptr) _aligned_free(ptr)
+#define FRZ_POPCOUNT(x) __popcnt(x)
+#else
+#define FRZ_ALIGNED_ALLOC(size) aligned_alloc(32, size)
+#define FRZ_ALIGNED_FREE(ptr) free(ptr)
+#define FRZ_POPCOUNT(x) __builtin_popcount(x)
+#endif
+
+#pragma region Private FRZ_* functions
+
+// block index of the i-th child (0..FRZ_BLOCK) of block k
+#define FRZ_CHILD(k, i) ((k) * (FRZ_BLOCK + 1) + (i) + 1)
+
+// number of keys in block k strictly less than key, without branching
+static int FRZ_countLess(const Key* block, Key key)
+{
+#if defined(__AVX2__)
+	__m256i needle = _mm256_set1_epi32(key);
+	__m256i keys = _mm256_load_si256((const __m256i*)block);
+	int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, keys)));
+	return FRZ_POPCOUNT(mask);
+#else
+	int count = 0;
+	int i;
+	for (i = 0; i < FRZ_BLOCK; i++) count += (block[i] < key);
+	return count;
+#endif
+}
+
+// tree slot of the first key >= {key}, -1 if there is none
+static ptrdiff_t FRZ_lowerSlot(const FrozenBST* self, Key key)
+{
+	ptrdiff_t result = -1;
+	int k = 0;
+	while (k < self->blocks)
+	{
+		const Key* block = self->tree + (size_t)k * FRZ_BLOCK;
+		int i = FRZ_countLess(block, key);
+
+		// deeper blocks only hold keys between their parent's neighbours, so the last hit is the tightest
+		result = (i < FRZ_BLOCK) ? (ptrdiff_t)k * FRZ_BLOCK + i : result;
+		k = FRZ_CHILD(k, i);
+	}
+	return result;
+}
+
+// rank of the first key >= {key}, n if there is none
+static int FRZ_lowerBound(const FrozenBST* self, Key key)
+{
+	ptrdiff_t slot = FRZ_lowerSlot(self, key);
+	return (slot < 0) ? self->n : self->rankOf[slot];
+}
+
+// lay the sorted keys out in block Eytzinger order by an in-order walk of the implicit tree
+static void FRZ_layout(FrozenBST* self, int k, int* next)
+{
+	if (k >= self->blocks) return;
+
+	int i;
+	for (i = 0; i <= FRZ_BLOCK; i++)
+	{
+		FRZ_layout(self, FRZ_CHILD(k, i), next);
+		if (i == FRZ_BLOCK) break;
+
+		size_t slot = (size_t)k * FRZ_BLOCK + i;
+		if (*next < self->n)
+		{
+			self->tree[slot] = self->keys[*next];
+			self->rankOf[slot] = (*next)++;
+		}
+		else
+		{
+			self->tree[slot] = INT_MAX;
+			self->rankOf[slot] = self->n;
+		}
+	}
+}
+
+#pragma endregion
+
+/* Copies {self} into a new frozen tree. Later changes to {self} are not seen by the copy. */
+FrozenBST* RBT_freeze(const RedBlackBST* self)
+{
+	FrozenBST* frozen = (FrozenBST*)calloc(1, sizeof(FrozenBST));
+	if (frozen == NULL) { printf("out of memory freezing tree"); exit(EXIT_FAILURE); }
+
+	int n = RBT_size(self);
+	frozen->n = n;
+	frozen->blocks = (n + FRZ_BLOCK - 1) / FRZ_BLOCK;
+	frozen->keys = (Key*)malloc(((size_t)n + 1) * sizeof(Key));
+	frozen->vals = (Value*)malloc(((size_t)n + 1) * sizeof(Value));
+
+	size_t slots = (size_t)frozen->blocks * FRZ_BLOCK;
+	frozen->tree = (Key*)FRZ_ALIGNED_ALLOC((slots + FRZ_BLOCK) * sizeof(Key));
+	frozen->rankOf = (int*)malloc((slots + 1) * sizeof(int));
+
+	if (frozen->keys == NULL || frozen->vals == NULL || frozen->tree == NULL || frozen->rankOf == NULL)
+	{
+		printf("out of memory freezing tree"); exit(EXIT_FAILURE);
+	}
+
+	// first pass: keys by rank and the size of the value blob
+	RBT_Cursor cursor;
+	Node* x;
+	size_t blobSize = 0;
+	int r = 0;
+	for (RBT_cursor_init(&cursor, self); (x = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor))
+	{
+		frozen->keys[r++] = x->key;
+		blobSize += strlen(x->val) + 1;
+	}
+
+	// second pass: copy the values next to each other
+	frozen->blob = (char*)malloc(blobSize + 1);
+	if (frozen->blob == NULL) { printf("out of memory freezing tree"); exit(EXIT_FAILURE); }
+
+	char* at = frozen->blob;
+	r = 0;
+	for (RBT_cursor_init(&cursor, self); (x = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor))
+	{
+		size_t length = strlen(x->val) + 1;
+		memcpy(at, x->val, length);
+		frozen->vals[r++] = at;
+		at += length;
+	}
+
+	int next = 0;
+	FRZ_layout(frozen, 0, &next);
+	return frozen;
+}
+
+/* Returns a pointer to the value stored for {key}, NULL if there is none. */
+Value* FRZ_get(const FrozenBST* self, Key key)
+{
+	// the slot's block was read on the way down, so the key check is a cache hit.
+	// Padding holds INT_MAX too, and stands for no key at all: its rank is n
+	ptrdiff_t slot = FRZ_lowerSlot(self, key);
+	if (slot < 0 || self->tree[slot] != key) return NULL;
+	int r = self->rankOf[slot];
+	return (r < self->n) ? &self->vals[r] : NULL;
+}
+
+/* Returns the number of key-value pairs in the frozen tree. */
+int FRZ_size(const FrozenBST* self)
+{
+	return self->n;
+}
+
+bool FRZ_contains(const FrozenBST* self, Key key)
+{
+	return FRZ_get(self, key) != NULL;
+}
+
+/* Returns the largest key less than or equal to {key}, NULL if there is none. */
+const Key* FRZ_floor(const FrozenBST* self, Key key)
+{
+	if (self->n == 0) { printf("called floor() with empty symbol table"); exit(EXIT_FAILURE); }
+
+	int r = FRZ_lowerBound(self, key);
+	if (r < self->n && self->keys[r] == key) return &self->keys[r];
+	if (r == 0) return NULL;
+	return &self->keys[r - 1];
+}
+
+/* Returns the smallest key greater than or equal to {key}, NULL if there is none. */
+const Key* FRZ_ceiling(const FrozenBST* self, Key key)
+{
+	if (self->n == 0) { printf("called ceiling() with empty symbol table"); exit(EXIT_FAILURE); }
+
+	int r = FRZ_lowerBound(self, key);
+	if (r == self->n) return NULL;
+	return &self->keys[r];
+}
+
+/* Return the kth smallest key. */
+Key FRZ_select(const FrozenBST* self, int k)
+{
+	if (k < 0 || k >= self->n) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+	return self->keys[k];
+}
+
+/* Return the number of keys strictly less than {key}. */
+int FRZ_rank(const FrozenBST* self, Key key)
+{
+	return FRZ_lowerBound(self, key);
+}
+
+/* Free the specified frozen tree */
+void FRZ_free(FrozenBST* self)
+{
+	if (self == NULL) return;
+	FRZ_ALIGNED_FREE(self->tree);
+	free(self->rankOf);
+	free(self->keys);
+	free(self->vals);
+	free(self->blob);
+	free(self);
+}
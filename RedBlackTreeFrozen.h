@@ -0,0 +1,38 @@
+#pragma once
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Frozen red-black tree.
+*  An immutable copy of a tree for read-mostly workloads. The keys are laid
+*  out as an implicit 9-ary search tree (Eytzinger order over blocks of
+*  FRZ_BLOCK keys), so a lookup touches one cache line per level and
+*  compares a whole block at once, with AVX2 when the compiler targets it.
+*  Values live in a parallel array ordered by rank.
+***************************************************************************/
+
+#define FRZ_BLOCK 8					// keys per block: one 32 byte AVX2 register of int keys
+
+typedef struct _FrozenBST
+{
+	int n;							// number of keys
+	int blocks;						// number of FRZ_BLOCK key blocks
+	Key* tree;						// keys in block Eytzinger order, padded with INT_MAX
+	int* rankOf;					// rank of the key in each tree slot, n for padding
+	Key* keys;						// keys by rank
+	Value* vals;					// values by rank, pointing into blob
+	char* blob;						// all value strings, back to back
+} FrozenBST;
+
+FrozenBST* RBT_freeze(const RedBlackBST* self);
+
+Value* FRZ_get(const FrozenBST* self, Key key);
+int FRZ_size(const FrozenBST* self);
+bool FRZ_contains(const FrozenBST* self, Key key);
+
+const Key* FRZ_floor(const FrozenBST* self, Key key);
+const Key* FRZ_ceiling(const FrozenBST* self, Key key);
+Key FRZ_select(const FrozenBST* self, int k);
+int FRZ_rank(const FrozenBST* self, Key key);
+
+void FRZ_free(FrozenBST* self);
@@ -0,0 +1,515 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Type-generic red-black trees.
+*  DEFINE_RBT(name, K, V, cmp, ...) writes out a left-leaning red-black
+*  tree type {name} with keys of type K and values of type V, both stored
+*  in the node itself, and name##_* functions that mirror the RBT_* ones.
+*  cmp(a, b, ...) returns a negative number, zero or a positive number
+*  like strcmp. Any arguments after cmp, such as a collation table, are
+*  passed to it after the two keys. It is pasted into name##_cmp as a
+*  macro or an inline function, so no comparison goes through a function
+*  pointer. Any key is valid, 0 included. Keys and values are copied as
+*  plain values, so a tree of pointers leaves what they point at to the
+*  caller. All the functions are static inline: use DEFINE_RBT once per
+*  tree type in each source file that needs it, at file scope.
+*  RedBlackBST orders its keys the same way: RedBlackTreeNode.h generates
+*  its RBT_cmp from RBT_KEY_CMP with RBT_GENERIC_CMP, and the NODE_* and
+*  RBT_* functions compare keys only through it. Its Node stays its own,
+*  carrying the pool, inline value, aggregate and lazy deletion state that
+*  the other modules rely on.
+***************************************************************************/
+
+// orderings for DEFINE_RBT; RBT_CMP_NUMBER tests equality first so that GCC folds
+// a test of its result, such as cmp(a, b) > 0, back into a single compare
+#define RBT_CMP_NUMBER(a, b) (((a) == (b)) ? 0 : ((a) < (b)) ? -1 : 1)		// integer and floating point keys
+#define RBT_CMP_STRING(a, b) strcmp((a), (b))				// strings, byte by byte
+#define RBT_CMP_BYTES(a, b) memcmp(&(a), &(b), sizeof(a))		// fixed-width keys without padding, such as a struct around a byte array
+
+// the comma before an empty ##__VA_ARGS__ is dropped by GCC, Clang and MSVC alike
+#define DEFINE_RBT(name, K, V, cmp, ...) \
+	RBT_GENERIC_TYPES(name, K, V) \
+	RBT_GENERIC_CMP(name, cmp, ##__VA_ARGS__) \
+	RBT_GENERIC_NODES(name) \
+	RBT_GENERIC_API(name)
+
+// the node and tree types of DEFINE_RBT
+#define RBT_GENERIC_TYPES(name, K, V) \
+typedef K name##_Key; \
+typedef V name##_Value; \
+\
+typedef struct name##_Node \
+{ \
+	name##_Key key; \
+	name##_Value val; \
+	struct name##_Node* left;		/* links to left and right subtrees */ \
+	struct name##_Node* right; \
+	int size;						/* subtree count */ \
+	bool color;						/* color of parent link */ \
+} name##_Node; \
+\
+typedef struct name \
+{ \
+	name##_Node* root; \
+} name;
+
+// the comparison of DEFINE_RBT, with the extra arguments bound after the two keys
+#define RBT_GENERIC_CMP(name, cmp, ...) \
+static inline int name##_cmp(name##_Key a, name##_Key b) \
+{ \
+	return cmp(a, b, ##__VA_ARGS__); \
+}
+
+// the private name##_node_* functions of DEFINE_RBT, mirroring the NODE_* and CNODE_* ones
+#define RBT_GENERIC_NODES(name) \
+static inline bool name##_node_isRed(const name##_Node* x) \
+{ \
+	return x != NULL && x->color == RED; \
+} \
+\
+static inline int name##_node_size(const name##_Node* x) \
+{ \
+	return (x != NULL) ? x->size : 0; \
+} \
+\
+static inline name##_Node* name##_node_create(name##_Key key, name##_Value val) \
+{ \
+	name##_Node* x = (name##_Node*)malloc(sizeof(name##_Node)); \
+	if (x == NULL) { printf("out of memory in " #name "_put()"); exit(EXIT_FAILURE); } \
+	x->key = key; \
+	x->val = val; \
+	x->left = x->right = NULL; \
+	x->size = 1; \
+	x->color = RED; \
+	return x; \
+} \
+\
+static inline name##_Node* name##_node_rotateRight(name##_Node* h) \
+{ \
+	name##_Node* x = h->left; \
+	h->left = x->right; \
+	x->right = h; \
+	x->color = h->color; \
+	h->color = RED; \
+	x->size = h->size; \
+	h->size = name##_node_size(h->left) + name##_node_size(h->right) + 1; \
+	return x; \
+} \
+\
+static inline name##_Node* name##_node_rotateLeft(name##_Node* h) \
+{ \
+	name##_Node* x = h->right; \
+	h->right = x->left; \
+	x->left = h; \
+	x->color = h->color; \
+	h->color = RED; \
+	x->size = h->size; \
+	h->size = name##_node_size(h->left) + name##_node_size(h->right) + 1; \
+	return x; \
+} \
+\
+static inline void name##_node_flipColors(name##_Node* h) \
+{ \
+	h->color = !h->color; \
+	h->left->color = !h->left->color; \
+	h->right->color = !h->right->color; \
+} \
+\
+static inline name##_Node* name##_node_moveRedLeft(name##_Node* h) \
+{ \
+	name##_node_flipColors(h); \
+	if (name##_node_isRed(h->right->left)) \
+	{ \
+		h->right = name##_node_rotateRight(h->right); \
+		h = name##_node_rotateLeft(h); \
+		name##_node_flipColors(h); \
+	} \
+	return h; \
+} \
+\
+static inline name##_Node* name##_node_moveRedRight(name##_Node* h) \
+{ \
+	name##_node_flipColors(h); \
+	if (name##_node_isRed(h->left->left)) \
+	{ \
+		h = name##_node_rotateRight(h); \
+		name##_node_flipColors(h); \
+	} \
+	return h; \
+} \
+\
+static inline name##_Node* name##_node_balance(name##_Node* h) \
+{ \
+	if (name##_node_isRed(h->right)) h = name##_node_rotateLeft(h); \
+	if (name##_node_isRed(h->left) && name##_node_isRed(h->left->left)) h = name##_node_rotateRight(h); \
+	if (name##_node_isRed(h->left) && name##_node_isRed(h->right)) name##_node_flipColors(h); \
+\
+	h->size = name##_node_size(h->left) + name##_node_size(h->right) + 1; \
+	return h; \
+} \
+\
+static inline name##_Node* name##_node_put(name##_Node* h, name##_Key key, name##_Value val) \
+{ \
+	if (h == NULL) return name##_node_create(key, val); \
+\
+	int c = name##_cmp(key, h->key); \
+	if (c < 0) h->left = name##_node_put(h->left, key, val); \
+	else if (c > 0) h->right = name##_node_put(h->right, key, val); \
+	else h->val = val; \
+\
+	/* fix-up any right-leaning links */ \
+	if (name##_node_isRed(h->right) && !name##_node_isRed(h->left)) h = name##_node_rotateLeft(h); \
+	if (name##_node_isRed(h->left) && name##_node_isRed(h->left->left)) h = name##_node_rotateRight(h); \
+	if (name##_node_isRed(h->left) && name##_node_isRed(h->right)) name##_node_flipColors(h); \
+\
+	h->size = name##_node_size(h->left) + name##_node_size(h->right) + 1; \
+	return h; \
+} \
+\
+/* detach the minimum of the subtree rooted at h, without freeing it */ \
+static inline name##_Node* name##_node_deleteMin(name##_Node* h, name##_Node** min) \
+{ \
+	if (h->left == NULL) \
+	{ \
+		*min = h; \
+		return NULL; \
+	} \
+\
+	if (!name##_node_isRed(h->left) && !name##_node_isRed(h->left->left)) h = name##_node_moveRedLeft(h); \
+\
+	h->left = name##_node_deleteMin(h->left, min); \
+	return name##_node_balance(h); \
+} \
+\
+static inline name##_Node* name##_node_deleteMax(name##_Node* h) \
+{ \
+	if (name##_node_isRed(h->left)) h = name##_node_rotateRight(h); \
+\
+	if (h->right == NULL) \
+	{ \
+		free(h); \
+		return NULL; \
+	} \
+\
+	if (!name##_node_isRed(h->right) && !name##_node_isRed(h->right->left)) h = name##_node_moveRedRight(h); \
+\
+	h->right = name##_node_deleteMax(h->right); \
+	return name##_node_balance(h); \
+} \
+\
+/* delete key from the subtree rooted at h; the key must be present */ \
+static inline name##_Node* name##_node_remove(name##_Node* h, name##_Key key) \
+{ \
+	if (name##_cmp(key, h->key) < 0) \
+	{ \
+		if (!name##_node_isRed(h->left) && !name##_node_isRed(h->left->left)) h = name##_node_moveRedLeft(h); \
+		h->left = name##_node_remove(h->left, key); \
+	} \
+	else \
+	{ \
+		if (name##_node_isRed(h->left)) h = name##_node_rotateRight(h); \
+		if (name##_cmp(key, h->key) == 0 && h->right == NULL) \
+		{ \
+			free(h); \
+			return NULL; \
+		} \
+		if (!name##_node_isRed(h->right) && !name##_node_isRed(h->right->left)) h = name##_node_moveRedRight(h); \
+		if (name##_cmp(key, h->key) == 0) \
+		{ \
+			/* the successor node takes h's place, so values of other keys never move */ \
+			name##_Node* min; \
+			name##_Node* right = name##_node_deleteMin(h->right, &min); \
+			min->left = h->left; \
+			min->right = right; \
+			min->color = h->color; \
+			free(h); \
+			h = min; \
+		} \
+		else h->right = name##_node_remove(h->right, key); \
+	} \
+	return name##_node_balance(h); \
+} \
+\
+/* free the subtree rooted at x without recursion: rotate left children up until x has none */ \
+static inline void name##_node_freeAll(name##_Node* x) \
+{ \
+	while (x != NULL) \
+	{ \
+		if (x->left != NULL) \
+		{ \
+			name##_Node* left = x->left; \
+			x->left = left->right; \
+			left->right = x; \
+			x = left; \
+		} \
+		else \
+		{ \
+			name##_Node* next = x->right; \
+			free(x); \
+			x = next; \
+		} \
+	} \
+} \
+\
+static inline int name##_node_height(const name##_Node* x) \
+{ \
+	if (x == NULL) return -1; \
+	int left = name##_node_height(x->left); \
+	int right = name##_node_height(x->right); \
+	return 1 + ((left > right) ? left : right); \
+} \
+\
+static inline void name##_node_keys(name##_Node* x, name##_Key lo, name##_Key hi, void(*func)(const name##_Key*, name##_Value*, void*), void* ctx) \
+{ \
+	if (x == NULL) return; \
+	int low = name##_cmp(lo, x->key), high = name##_cmp(hi, x->key); \
+	if (low < 0) name##_node_keys(x->left, lo, hi, func, ctx); \
+	if (low <= 0 && high >= 0) func(&x->key, &x->val, ctx); \
+	if (high > 0) name##_node_keys(x->right, lo, hi, func, ctx); \
+} \
+\
+static inline bool name##_node_test_isBST(const name##_Node* x, const name##_Key* min, const name##_Key* max) \
+{ \
+	if (x == NULL) return true; \
+	if (min != NULL && name##_cmp(x->key, *min) <= 0) return false; \
+	if (max != NULL && name##_cmp(x->key, *max) >= 0) return false; \
+	return name##_node_test_isBST(x->left, min, &x->key) && name##_node_test_isBST(x->right, &x->key, max); \
+} \
+\
+static inline bool name##_node_test_isSizeConsistent(const name##_Node* x) \
+{ \
+	if (x == NULL) return true; \
+	if (x->size != name##_node_size(x->left) + name##_node_size(x->right) + 1) return false; \
+	return name##_node_test_isSizeConsistent(x->left) && name##_node_test_isSizeConsistent(x->right); \
+} \
+\
+static inline bool name##_node_test_is23(const name##_Node* x, const name##_Node* root) \
+{ \
+	if (x == NULL) return true; \
+	if (name##_node_isRed(x->right)) return false; \
+	if (x != root && name##_node_isRed(x) && name##_node_isRed(x->left)) return false; \
+	return name##_node_test_is23(x->left, root) && name##_node_test_is23(x->right, root); \
+} \
+\
+static inline bool name##_node_test_isBalanced(const name##_Node* x, int black) \
+{ \
+	if (x == NULL) return black == 0; \
+	if (!name##_node_isRed(x)) black--; \
+	return name##_node_test_isBalanced(x->left, black) && name##_node_test_isBalanced(x->right, black); \
+}
+
+// the public name##_* functions of DEFINE_RBT
+#define RBT_GENERIC_API(name) \
+/* Prepares an empty tree. */ \
+static inline void name##_init(name* self) \
+{ \
+	self->root = NULL; \
+} \
+\
+/* Frees every node of the tree, leaving it empty. */ \
+static inline void name##_free(name* self) \
+{ \
+	name##_node_freeAll(self->root); \
+	self->root = NULL; \
+} \
+\
+/* Returns a pointer to the value stored for {key}, NULL if there is none. The value lives \
+   in the node, so the pointer stays valid until {key} is removed. */ \
+static inline name##_Value* name##_get(const name* self, name##_Key key) \
+{ \
+	name##_Node* x = self->root; \
+	while (x != NULL) \
+	{ \
+		int c = name##_cmp(key, x->key); \
+		if (c == 0) return &x->val; \
+		x = (c < 0) ? x->left : x->right; \
+	} \
+	return NULL; \
+} \
+\
+static inline bool name##_contains(const name* self, name##_Key key) \
+{ \
+	return name##_get(self, key) != NULL; \
+} \
+\
+/* Returns the number of key-value pairs in this symbol table. */ \
+static inline int name##_size(const name* self) \
+{ \
+	return name##_node_size(self->root); \
+} \
+\
+/* Is this symbol table empty? */ \
+static inline bool name##_isEmpty(const name* self) \
+{ \
+	return self->root == NULL; \
+} \
+\
+/* Inserts the specified key-value pair, overwriting the old value if the key is already \
+   there. The key already in the tree is kept. */ \
+static inline void name##_put(name* self, name##_Key key, name##_Value val) \
+{ \
+	self->root = name##_node_put(self->root, key, val); \
+	self->root->color = BLACK; \
+} \
+\
+/* Removes the largest key and associated value from the symbol table. */ \
+static inline void name##_deleteMax(name* self) \
+{ \
+	if (name##_isEmpty(self)) { printf("BST underflow"); exit(EXIT_FAILURE); } \
+\
+	/* if both children of root are black, set root to red */ \
+	if (!name##_node_isRed(self->root->left) && !name##_node_isRed(self->root->right)) self->root->color = RED; \
+\
+	self->root = name##_node_deleteMax(self->root); \
+	if (!name##_isEmpty(self)) self->root->color = BLACK; \
+} \
+\
+/* Removes the specified key and its associated value, if it is in this symbol table. */ \
+static inline void name##_remove(name* self, name##_Key key) \
+{ \
+	if (!name##_contains(self, key)) return; \
+\
+	/* if both children of root are black, set root to red */ \
+	if (!name##_node_isRed(self->root->left) && !name##_node_isRed(self->root->right)) self->root->color = RED; \
+\
+	self->root = name##_node_remove(self->root, key); \
+	if (!name##_isEmpty(self)) self->root->color = BLACK; \
+} \
+\
+/* Returns the smallest key in the symbol table. */ \
+static inline name##_Key name##_min_bykey(const name* self) \
+{ \
+	if (name##_isEmpty(self)) { printf("called min() with empty symbol table"); exit(EXIT_FAILURE); } \
+	name##_Node* x = self->root; \
+	while (x->left != NULL) x = x->left; \
+	return x->key; \
+} \
+\
+/* Returns the largest key in the symbol table. */ \
+static inline name##_Key name##_max_bykey(const name* self) \
+{ \
+	if (name##_isEmpty(self)) { printf("called max() with empty symbol table"); exit(EXIT_FAILURE); } \
+	name##_Node* x = self->root; \
+	while (x->right != NULL) x = x->right; \
+	return x->key; \
+} \
+\
+/* Returns the height of the BST (for debugging). */ \
+static inline int name##_height(const name* self) \
+{ \
+	return name##_node_height(self->root); \
+} \
+\
+/* Returns the largest key less than or equal to {key}, NULL if there is none. */ \
+static inline const name##_Key* name##_floor(const name* self, name##_Key key) \
+{ \
+	name##_Node *x = self->root, *best = NULL; \
+	while (x != NULL) \
+	{ \
+		int c = name##_cmp(key, x->key); \
+		if (c == 0) return &x->key; \
+		if (c < 0) x = x->left; \
+		else \
+		{ \
+			best = x; \
+			x = x->right; \
+		} \
+	} \
+	return (best != NULL) ? &best->key : NULL; \
+} \
+\
+/* Returns the smallest key greater than or equal to {key}, NULL if there is none. */ \
+static inline const name##_Key* name##_ceiling(const name* self, name##_Key key) \
+{ \
+	name##_Node *x = self->root, *best = NULL; \
+	while (x != NULL) \
+	{ \
+		int c = name##_cmp(key, x->key); \
+		if (c == 0) return &x->key; \
+		if (c > 0) x = x->right; \
+		else \
+		{ \
+			best = x; \
+			x = x->left; \
+		} \
+	} \
+	return (best != NULL) ? &best->key : NULL; \
+} \
+\
+/* Return the kth smallest key in the symbol table. */ \
+static inline name##_Key name##_select(const name* self, int k) \
+{ \
+	if (k < 0 || k >= name##_size(self)) { printf("Illegal arguement"); exit(EXIT_FAILURE); } \
+	name##_Node* x = self->root; \
+	while (true) \
+	{ \
+		int t = name##_node_size(x->left); \
+		if (t == k) return x->key; \
+		if (t > k) x = x->left; \
+		else \
+		{ \
+			k -= t + 1; \
+			x = x->right; \
+		} \
+	} \
+} \
+\
+/* Return the number of keys in the symbol table strictly less than {key}. */ \
+static inline int name##_rank(const name* self, name##_Key key) \
+{ \
+	name##_Node* x = self->root; \
+	int rank = 0; \
+	while (x != NULL) \
+	{ \
+		int c = name##_cmp(key, x->key); \
+		if (c <= 0) \
+		{ \
+			if (c == 0) return rank + name##_node_size(x->left); \
+			x = x->left; \
+		} \
+		else \
+		{ \
+			rank += name##_node_size(x->left) + 1; \
+			x = x->right; \
+		} \
+	} \
+	return rank; \
+} \
+\
+/* Calls {func} on every key in [lo, hi] and its value, in key order. */ \
+static inline void name##_keys_range(const name* self, name##_Key lo, name##_Key hi, void(*func)(const name##_Key*, name##_Value*, void*), void* ctx) \
+{ \
+	if (name##_cmp(lo, hi) > 0) return; \
+	name##_node_keys(self->root, lo, hi, func, ctx); \
+} \
+\
+/* Returns the number of keys in the symbol table in the given range. */ \
+static inline int name##_range_size(const name* self, name##_Key lo, name##_Key hi) \
+{ \
+	if (name##_cmp(lo, hi) > 0) return 0; \
+	if (name##_contains(self, hi)) return name##_rank(self, hi) - name##_rank(self, lo) + 1; \
+	return name##_rank(self, hi) - name##_rank(self, lo); \
+} \
+\
+static inline bool name##_self_check(const name* self) \
+{ \
+	int black = 0; \
+	const name##_Node* x; \
+	for (x = self->root; x != NULL; x = x->left) \
+	{ \
+		if (!name##_node_isRed(x)) black++; \
+	} \
+\
+	bool t1, t2, t3, t4; \
+	if (!(t1 = name##_node_test_isBST(self->root, NULL, NULL)))        fprintf(stdout, "Not in symmetric order\n"); \
+	if (!(t2 = name##_node_test_isSizeConsistent(self->root)))         fprintf(stdout, "Subtree counts not consistent\n"); \
+	if (!(t3 = name##_node_test_is23(self->root, self->root)))         fprintf(stdout, "Not a 2-3 tree\n"); \
+	if (!(t4 = name##_node_test_isBalanced(self->root, black)))        fprintf(stdout, "Not balanced\n"); \
+	return t1 && t2 && t3 && t4; \
+}
@@ -0,0 +1,449 @@
+// fileno, fsync and the rest of the file handling are POSIX, not C11
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#include <io.h>
+#define MAP_SYNC_FILE(f) _commit(_fileno(f))
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAP_SYNC_FILE(f) fsync(fileno(f))
+#endif
+
+#include "RedBlackTreeMapped.h"
+#include "RedBlackTreeNode.h"
+
+// the node at index x of this image
+#define N(x) (self->nodes[x])
+
+#pragma region Private MAP_* functions
+
+static bool MAP_isRed(const MappedBST* self, uint32_t x)
+{
+	if (x == MAP_NIL) return false;
+	return (N(x).sizeColor & MAP_RED_BIT) != 0;
+}
+
+static int MAP_nodeSize(const MappedBST* self, uint32_t x)
+{
+	if (x == MAP_NIL) return 0;
+	return (int)(N(x).sizeColor & MAP_SIZE_MASK);
+}
+
+// map the whole file at path read-only and store its length, NULL if that fails
+static const char* MAP_mapFile(const char* path, size_t* length)
+{
+	const char* base = NULL;
+#if defined(_MSC_VER)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+	{
+		// the view keeps the mapping alive, both handles can go
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		*length = (size_t)size.QuadPart;
+	}
+	CloseHandle(file);
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0) return NULL;
+
+	struct stat info;
+	if (fstat(file, &info) == 0 && info.st_size > 0)
+	{
+		// the mapping outlives the descriptor
+		void* at = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+		if (at != MAP_FAILED) base = (const char*)at;
+		*length = (size_t)info.st_size;
+	}
+	close(file);
+#endif
+	return base;
+}
+
+static void MAP_unmapFile(const char* base, size_t length)
+{
+#if defined(_MSC_VER)
+	UnmapViewOfFile(base);
+#else
+	munmap((void*)base, length);
+#endif
+}
+
+// move the file at from over the one at to in one step
+static bool MAP_replaceFile(const char* from, const char* to)
+{
+#if defined(_MSC_VER)
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+// does the header describe an image this build can read, exactly length bytes long?
+static bool MAP_validHeader(const MappedHeader* header, size_t length)
+{
+	if (length < sizeof(MappedHeader)) return false;
+	if (memcmp(header->magic, MAP_MAGIC, sizeof(header->magic)) != 0) return false;
+	if (header->version != MAP_VERSION || header->byteOrder != MAP_BYTE_ORDER || header->keySize != sizeof(Key)) return false;
+	if (header->count > MAP_SIZE_MASK || header->root > header->count) return false;
+	if ((header->count == 0) != (header->root == MAP_NIL)) return false;
+	if (header->nodesOffset < sizeof(MappedHeader) || header->nodesOffset % sizeof(uint64_t) != 0) return false;
+	if (header->heapOffset != header->nodesOffset + ((uint64_t)header->count + 1) * sizeof(MappedNode)) return false;
+	return header->heapOffset + header->heapSize == length;
+}
+
+// are the indices below x in range, each node reached once and no deeper than a red-black tree can be?
+static bool MAP_test_isWellFormed(const MappedBST* self, uint32_t x, int depth, uint32_t* seen)
+{
+	if (x == MAP_NIL) return true;
+	if (x > self->header->count || depth >= RBT_MAX_DEPTH || ++(*seen) > self->header->count) return false;
+	if (N(x).val >= self->header->heapSize) return false;
+	return MAP_test_isWellFormed(self, N(x).left, depth + 1, seen) && MAP_test_isWellFormed(self, N(x).right, depth + 1, seen);
+}
+
+static bool MAP_test_isBST(const MappedBST* self, uint32_t x, const Key* min, const Key* max)
+{
+	if (x == MAP_NIL) return true;
+	if (min != NULL && N(x).key <= *min) return false;
+	if (max != NULL && N(x).key >= *max) return false;
+	return MAP_test_isBST(self, N(x).left, min, &N(x).key) && MAP_test_isBST(self, N(x).right, &N(x).key, max);
+}
+
+static bool MAP_test_isSizeConsistent(const MappedBST* self, uint32_t x)
+{
+	if (x == MAP_NIL) return true;
+	if (MAP_nodeSize(self, x) != MAP_nodeSize(self, N(x).left) + MAP_nodeSize(self, N(x).right) + 1) return false;
+	return MAP_test_isSizeConsistent(self, N(x).left) && MAP_test_isSizeConsistent(self, N(x).right);
+}
+
+static bool MAP_test_is23(const MappedBST* self, uint32_t x)
+{
+	if (x == MAP_NIL) return true;
+	if (MAP_isRed(self, N(x).right)) return false;
+	if (x != self->header->root && MAP_isRed(self, x) && MAP_isRed(self, N(x).left)) return false;
+	return MAP_test_is23(self, N(x).left) && MAP_test_is23(self, N(x).right);
+}
+
+static bool MAP_test_isBalanced(const MappedBST* self, uint32_t x, int black)
+{
+	if (x == MAP_NIL) return black == 0;
+	if (!MAP_isRed(self, x)) black--;
+	return MAP_test_isBalanced(self, N(x).left, black) && MAP_test_isBalanced(self, N(x).right, black);
+}
+
+#ifdef RBT_LAZY_DELETE
+// hand out the next copy, in key order
+static Node* MAP_nextCopy(void* ctx)
+{
+	Node** at = (Node**)ctx;
+	return (*at)++;
+}
+
+// copies of the live nodes below root, linked into a fresh balanced shape. The tree
+// itself is left alone; the copies' values still point into it. NULL if there are none.
+static Node* MAP_liveCopy(const Node* root, int n, Node** copies)
+{
+	*copies = (Node*)malloc(((size_t)n + 1) * sizeof(Node));
+	if (*copies == NULL) { printf("out of memory saving tree"); exit(EXIT_FAILURE); }
+
+	const Node* stack[RBT_MAX_DEPTH];
+	const Node* x = root;
+	int depth = 0, count = 0;
+	while (x != NULL || depth > 0)
+	{
+		while (x != NULL)
+		{
+			stack[depth++] = x;
+			x = x->left;
+		}
+		x = stack[--depth];
+		if (NODE_isLive(x)) (*copies)[count++] = *x;
+		x = x->right;
+	}
+
+	Node* at = *copies;
+	return NODE_build(n, NODE_buildHeight(n), MAP_nextCopy, &at);
+}
+#endif
+
+#pragma endregion
+
+/* Writes {self} to the file at {path} as an image for RBT_open_mapped. The image is
+   written beside {path} first and renamed over it once complete, so the file at {path}
+   is always either the old image or the new one. Returns false if it could not be written. */
+bool RBT_save(const RedBlackBST* self, const char* path)
+{
+	int n = RBT_size(self);
+	Node* root = self->root;
+#ifdef RBT_LAZY_DELETE
+	// the image keeps the tree's shape, so dead nodes are left out of a balanced copy instead
+	Node* copies = NULL;
+	if (self->dead > 0) root = MAP_liveCopy(self->root, n, &copies);
+#endif
+	Node** order = (Node**)malloc(((size_t)n + 1) * sizeof(Node*));
+	size_t tmpLength = strlen(path) + sizeof(".tmp");
+	char* tmp = (char*)malloc(tmpLength);
+	if (order == NULL || tmp == NULL) { printf("out of memory saving tree"); exit(EXIT_FAILURE); }
+	snprintf(tmp, tmpLength, "%s.tmp", path);
+
+	FILE* file = fopen(tmp, "wb");
+	if (file == NULL)
+	{
+#ifdef RBT_LAZY_DELETE
+		free(copies);
+#endif
+		free(order);
+		free(tmp);
+		return false;
+	}
+
+	MappedHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAP_MAGIC, sizeof(header.magic));
+	header.version = MAP_VERSION;
+	header.byteOrder = MAP_BYTE_ORDER;
+	header.keySize = sizeof(Key);
+	header.count = (uint32_t)n;
+	header.blackHeight = (uint32_t)NODE_blackHeight(root);
+	header.root = (n > 0) ? 1 : MAP_NIL;
+	header.nodesOffset = sizeof(MappedHeader);
+	header.heapOffset = header.nodesOffset + ((uint64_t)n + 1) * sizeof(MappedNode);
+
+	// the heap size is filled in once the values have been counted
+	MappedNode record;
+	memset(&record, 0, sizeof(record));
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&record, sizeof(record), 1, file) == 1;
+
+	// number the nodes breadth first, order[i] becoming node i + 1, and write them out as they are reached
+	uint64_t heapAt = 0;
+	int head, tail = 0;
+	if (n > 0) order[tail++] = root;
+	for (head = 0; head < tail && ok; head++)
+	{
+		Node* x = order[head];
+		record.left = record.right = MAP_NIL;
+		if (x->left != NULL)
+		{
+			order[tail] = x->left;
+			record.left = (uint32_t)++tail;
+		}
+		if (x->right != NULL)
+		{
+			order[tail] = x->right;
+			record.right = (uint32_t)++tail;
+		}
+		record.sizeColor = (uint32_t)x->size | (NODE_isRed(x) ? MAP_RED_BIT : 0);
+		record.key = x->key;
+		record.val = heapAt;
+		heapAt += strlen(x->val) + 1;
+		ok = fwrite(&record, sizeof(record), 1, file) == 1;
+	}
+
+	// the values in the same order
+	for (head = 0; head < tail && ok; head++)
+	{
+		ok = fwrite(order[head]->val, strlen(order[head]->val) + 1, 1, file) == 1;
+	}
+
+	header.heapSize = heapAt;
+	ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fflush(file) == 0 && MAP_SYNC_FILE(file) == 0;
+	ok = (fclose(file) == 0) && ok;
+	ok = ok && MAP_replaceFile(tmp, path);
+	if (!ok) remove(tmp);
+
+#ifdef RBT_LAZY_DELETE
+	free(copies);
+#endif
+	free(order);
+	free(tmp);
+	return ok;
+}
+
+/* Maps the image at {path}, written by RBT_save, read-only. It can be queried at once;
+   pages are read from disk as queries first touch them. Returns NULL if the file is
+   missing or is not an image this build can read. Release it with MAP_close. */
+MappedBST* RBT_open_mapped(const char* path)
+{
+	size_t length = 0;
+	const char* base = MAP_mapFile(path, &length);
+	if (base == NULL) return NULL;
+
+	const MappedHeader* header = (const MappedHeader*)base;
+	if (!MAP_validHeader(header, length))
+	{
+		MAP_unmapFile(base, length);
+		return NULL;
+	}
+
+	MappedBST* mapped = (MappedBST*)malloc(sizeof(MappedBST));
+	if (mapped == NULL) { printf("out of memory opening tree image"); exit(EXIT_FAILURE); }
+	mapped->header = header;
+	mapped->nodes = (const MappedNode*)(base + header->nodesOffset);
+	mapped->heap = base + header->heapOffset;
+	mapped->length = length;
+	return mapped;
+}
+
+/* Unmaps the image. Keys and values returned from it are no longer valid. */
+void MAP_close(MappedBST* self)
+{
+	MAP_unmapFile((const char*)self->header, self->length);
+	free(self);
+}
+
+/***************************************************************************
+*  Standard BST search.
+***************************************************************************/
+
+/* Returns the value stored for {key}, NULL if there is none. The value is valid until MAP_close. */
+const char* MAP_get(const MappedBST* self, Key key)
+{
+	uint32_t x = self->header->root;
+	while (x != MAP_NIL)
+	{
+		if (key == N(x).key) return self->heap + N(x).val;
+		x = (key < N(x).key) ? N(x).left : N(x).right;
+	}
+	return NULL;
+}
+
+/* Returns the number of key-value pairs in this symbol table. */
+int MAP_size(const MappedBST* self)
+{
+	return (int)self->header->count;
+}
+
+/* Is this symbol table empty? */
+bool MAP_isEmpty(const MappedBST* self)
+{
+	return self->header->root == MAP_NIL;
+}
+
+bool MAP_contains(const MappedBST* self, Key key)
+{
+	return MAP_get(self, key) != NULL;
+}
+
+/***************************************************************************
+*  Ordered symbol table functions.
+***************************************************************************/
+
+/* Returns the largest key in the symbol table less than or equal to {key}, NULL if there is none. */
+const Key* MAP_floor(const MappedBST* self, Key key)
+{
+	if (MAP_isEmpty(self)) { printf("called floor() with empty symbol table"); exit(EXIT_FAILURE); }
+
+	uint32_t x = self->header->root, best = MAP_NIL;
+	while (x != MAP_NIL)
+	{
+		if (key == N(x).key) return &N(x).key;
+		if (key > N(x).key)
+		{
+			best = x;
+			x = N(x).right;
+		}
+		else x = N(x).left;
+	}
+	return (best != MAP_NIL) ? &N(best).key : NULL;
+}
+
+/* Returns the smallest key in the symbol table greater than or equal to {key}, NULL if there is none. */
+const Key* MAP_ceiling(const MappedBST* self, Key key)
+{
+	if (MAP_isEmpty(self)) { printf("called ceiling() with empty symbol table"); exit(EXIT_FAILURE); }
+
+	uint32_t x = self->header->root, best = MAP_NIL;
+	while (x != MAP_NIL)
+	{
+		if (key == N(x).key) return &N(x).key;
+		if (key < N(x).key)
+		{
+			best = x;
+			x = N(x).left;
+		}
+		else x = N(x).right;
+	}
+	return (best != MAP_NIL) ? &N(best).key : NULL;
+}
+
+/* Return the kth smallest key in the symbol table */
+Key MAP_select(const MappedBST* self, int k)
+{
+	if (k < 0 || k >= MAP_size(self)) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+
+	uint32_t x = self->header->root;
+	while (true)
+	{
+		int t = MAP_nodeSize(self, N(x).left);
+		if (t == k) return N(x).key;
+		if (t > k) x = N(x).left;
+		else
+		{
+			k -= t + 1;
+			x = N(x).right;
+		}
+	}
+}
+
+/* Return the number of keys in the symbol table strictly less than {key}. */
+int MAP_rank(const MappedBST* self, Key key)
+{
+	uint32_t x = self->header->root;
+	int rank = 0;
+	while (x != MAP_NIL)
+	{
+		int t = MAP_nodeSize(self, N(x).left);
+		if (key == N(x).key) return rank + t;
+		if (key < N(x).key) x = N(x).left;
+		else
+		{
+			rank += t + 1;
+			x = N(x).right;
+		}
+	}
+	return rank;
+}
+
+/***************************************************************************
+*  Check integrity of the image.
+***************************************************************************/
+
+/* Walks the whole image and checks it is a valid red-black tree. Queries trust the
+   image, so run this first on files that may have been damaged. */
+bool MAP_self_check(const MappedBST* self)
+{
+	uint32_t seen = 0;
+	bool t0 = MAP_test_isWellFormed(self, self->header->root, 0, &seen) && seen == self->header->count
+		&& (self->header->heapSize == 0 || self->heap[self->header->heapSize - 1] == '\0');
+	if (!t0)
+	{
+		fprintf(stdout, "Not a well formed image\n");
+		return false;
+	}
+
+	bool t1, t2, t3, t4;
+	if (!(t1 = MAP_test_isBST(self, self->header->root, NULL, NULL)))                   fprintf(stdout, "Not in symmetric order\n");
+	if (!(t2 = MAP_test_isSizeConsistent(self, self->header->root)))                    fprintf(stdout, "Subtree counts not consistent\n");
+	if (!(t3 = MAP_test_is23(self, self->header->root)))                                fprintf(stdout, "Not a 2-3 tree\n");
+	if (!(t4 = MAP_test_isBalanced(self, self->header->root, (int)self->header->blackHeight))) fprintf(stdout, "Not balanced\n");
+
+	return t1 && t2 && t3 && t4;
+}
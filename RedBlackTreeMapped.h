@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Mapped red-black tree image.
+*  RBT_save writes a tree to a file that RBT_open_mapped maps read-only and
+*  queries where it lies: nodes refer to each other by index and to their
+*  values by offset into a packed string heap, so nothing is allocated,
+*  rebuilt or relocated on startup, and every process mapping the same
+*  file shares its pages through the page cache. The MAP_* functions
+*  mirror the RBT_* ones.
+***************************************************************************/
+
+#define MAP_MAGIC "RBTIMAGE"		// first 8 bytes of an image, without terminator
+#define MAP_VERSION 1
+#define MAP_BYTE_ORDER 0x01020304u	// byteOrder as written by the saving machine
+#define MAP_NIL 0					// index 0 is never used, it stands for "no node"
+#define MAP_RED_BIT 0x80000000u		// set in sizeColor for red nodes
+#define MAP_SIZE_MASK 0x7FFFFFFFu	// the subtree count
+
+typedef struct _MappedHeader
+{
+	char magic[8];					// MAP_MAGIC
+	uint32_t version;				// MAP_VERSION
+	uint32_t byteOrder;				// MAP_BYTE_ORDER, images are only read on machines of the same byte order
+	uint32_t keySize;				// sizeof(Key)
+	uint32_t count;					// number of keys
+	uint32_t blackHeight;			// black nodes on every path from the root down to a leaf
+	uint32_t root;					// index of the root, MAP_NIL if the tree is empty
+	uint64_t nodesOffset;			// file offset of the node array, which has count + 1 entries
+	uint64_t heapOffset;			// file offset of the value heap
+	uint64_t heapSize;				// bytes in the value heap
+} MappedHeader;
+
+typedef struct _MappedNode
+{
+	uint32_t left, right;			// indices of the left and right subtrees
+	uint32_t sizeColor;				// subtree count and color
+	Key key;						// key
+	uint64_t val;					// offset of the value in the heap, '\0' terminated
+} MappedNode;
+
+typedef struct _MappedBST
+{
+	const MappedHeader* header;
+	const MappedNode* nodes;		// nodes in breadth-first order, so the top levels share pages
+	const char* heap;
+	size_t length;					// bytes mapped
+} MappedBST;
+
+bool RBT_save(const RedBlackBST* self, const char* path);
+MappedBST* RBT_open_mapped(const char* path);
+void MAP_close(MappedBST* self);
+
+const char* MAP_get(const MappedBST* self, Key key);
+int MAP_size(const MappedBST* self);
+bool MAP_isEmpty(const MappedBST* self);
+bool MAP_contains(const MappedBST* self, Key key);
+
+const Key* MAP_floor(const MappedBST* self, Key key);
+const Key* MAP_ceiling(const MappedBST* self, Key key);
+Key MAP_select(const MappedBST* self, int k);
+int MAP_rank(const MappedBST* self, Key key);
+
+bool MAP_self_check(const MappedBST* self);
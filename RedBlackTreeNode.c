@@ -1,387 +1,1276 @@
-#include "RedBlackTreeNode.h"
-#include <stdlib.h>
-#include <string.h>
-
-#define MAX(a,b) (a > b) ? a : b
-
-//#define ASSERTS
-
-#ifdef ASSERTS
-#include <assert.h>
-#else
-#define assert(X) {/* Asserts are unused unless defined */}
-#endif // ASSERTS
-
-#pragma region Private NODE_* functions
-
-// Release any memory associated with this node
-void NODE_free(Node** x)
-{
-	free((*x)->val);
-	(*x)->val = NULL;
-
-	free((*x));
-	(*x) = NULL;
-}
-
-bool NODE_isRed(const Node* x)
-{
-	if (x == NULL) return false;
-	return x->color == RED;
-}
-
-/* the smallest key in subtree rooted at x; NULL if no such key */
-Node* NODE_min_bykey(Node* x)
-{
-	assert(x != NULL);
-	if (x->left == NULL) return x;
-	return NODE_min_bykey(x->left);
-}
-
-/* value associated with the given key in subtree rooted at x; NULL if no such key */
-Value* NODE_get(Node* x, Key key)
-{
-	while (x != NULL)
-	{
-		if (key < x->key) x = x->left;
-		else if (key > x->key) x = x->right;
-		else return &x->val;
-	}
-	return NULL;
-}
-
-/* number of node in subtree rooted at x; 0 if x is NULL */
-int NODE_size(const Node* x)
-{
-	if (x == NULL) return 0;
-	return x->size;
-}
-
-/* the largest key in the subtree rooted at x; NULL if no such key */
-Node* NODE_max_bykey(Node* x)
-{
-	assert(x != NULL);
-	if (x->right == NULL) return x;
-	else return NODE_max_bykey(x->right);
-}
-
-/* make a left-leaning link lean to the right */
-Node* NODE_rotateRight(Node* h)
-{
-	assert( (h != NULL) && NODE_isRed(h->left));
-	Node* x = h->left;
-	h->left = x->right;
-	x->right = h;
-	x->color = x->right->color;
-	x->right->color = RED;
-	x->size = h->size;
-	h->size = NODE_size(h->left) + NODE_size(h->right) + 1;
-	return x;
-}
-
-// make a right-leaning link lean to the left
-Node* NODE_rotateLeft(Node* h)
-{
-	assert( (h != NULL) && NODE_isRed(h->right));
-	Node* x = h->right;
-	h->right = x->left;
-	x->left = h;
-	x->color = x->left->color;
-	x->left->color = RED;
-	x->size = h->size;
-	h->size = NODE_size(h->left) + NODE_size(h->right) + 1;
-	return x;
-}
-
-// flip the colors of a node and its two children
-void NODE_flipColors(Node* h)
-{
-	// h must have opposite color of its two children
-	assert((h != NULL) && (h->left != NULL) && (h->right != NULL));
-	assert((!NODE_isRed(h) &&  NODE_isRed(h->left) &&  NODE_isRed(h->right)) || (NODE_isRed(h)  && !NODE_isRed(h->left) && !NODE_isRed(h->right)));
-
-	h->color = !h->color;
-	h->left->color = !h->left->color;
-	h->right->color = !h->right->color;
-}
-
-// Assuming that h is red and both h.left and h.left.left
-// are black, make h.left or one of its children red.
-Node* NODE_moveRedLeft(Node* h)
-{
-	assert(h != NULL);
-	assert(NODE_isRed(h) && !NODE_isRed(h->left) && !NODE_isRed(h->left->left));
-
-	NODE_flipColors(h);
-	if (NODE_isRed(h->right->left))
-	{
-		h->right = NODE_rotateRight(h->right);
-		h = NODE_rotateLeft(h);
-		NODE_flipColors(h);
-	}
-	return h;
-}
-
-// Assuming that h is red and both h.right and h.right.left
-// are black, make h.right or one of its children red.
-Node* NODE_moveRedRight(Node* h)
-{
-	assert(h != NULL);
-	assert(NODE_isRed(h) && !NODE_isRed(h->right) && !NODE_isRed(h->right->left));
-
-	NODE_flipColors(h);
-	if (NODE_isRed(h->left->left))
-	{
-		h = NODE_rotateRight(h);
-		NODE_flipColors(h);
-	}
-	return h;
-}
-
-// restore red-black tree invariant
-Node* NODE_balance(Node* h)
-{
-	assert(h != NULL);
-
-	if (NODE_isRed(h->right))
-	{
-		h = NODE_rotateLeft(h);
-	}
-	if (NODE_isRed(h->left) && NODE_isRed(h->left->left))
-	{
-		h = NODE_rotateRight(h);
-	}
-
-	if (NODE_isRed(h->left) && NODE_isRed(h->right))
-	{
-		NODE_flipColors(h);
-	}
-
-	h->size = NODE_size(h->left) + NODE_size(h->right) + 1;
-	return h;
-}
-
-// delete the key-value pair with the minimum key rooted at h
-Node* NODE_deleteMin(Node* h)
-{
-	if (h->left == NULL)
-	{
-		NODE_free(&h);
-		return h;
-	}
-
-	if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
-	{
-		h = NODE_moveRedLeft(h);
-	}
-
-	h->left = NODE_deleteMin(h->left);
-	return NODE_balance(h);
-}
-
-// delete the key-value pair with the maximum key rooted at h
-Node* NODE_deleteMax(Node* h)
-{
-	if (NODE_isRed(h->left))
-		h = NODE_rotateRight(h);
-
-	if (h->right == NULL)
-	{
-		NODE_free(&h);
-		return NULL;
-	}
-
-	if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left))
-		h = NODE_moveRedRight(h);
-
-	h->right = NODE_deleteMax(h->right);
-
-	return NODE_balance(h);
-}
-
-// delete the key-value pair with the given key rooted at h
-Node* NODE_remove(Node* h, Key key)
-{
-	 assert(NODE_get(h, key) != NULL);
-
-	if (key < h->key)
-	{
-		if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
-			h = NODE_moveRedLeft(h);
-		h->left = NODE_remove(h->left, key);
-	}
-	else
-	{
-		if (NODE_isRed(h->left))
-		{
-			h = NODE_rotateRight(h);
-		}
-		if (key == h->key && (h->right == NULL))
-		{
-			NODE_free(&h);
-			return NULL;
-		}
-		if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left))
-		{
-			h = NODE_moveRedRight(h);
-		}
-		if (key == h->key)
-		{
-			Node* x = NODE_min_bykey(h->right);
-			h->key = x->key;
-
-			// x will be freed in a moment: make sure it's data is freed
-			Value temp = h->val;
-			h->val = x->val;
-			x->val = temp;
-
-			h->right = NODE_deleteMin(h->right);
-		}
-		else h->right = NODE_remove(h->right, key);
-	}
-	return NODE_balance(h);
-}
-
-// insert the key-value pair in the subtree rooted at h
-Node* NODE_put(Node* h, Key key, Value val)
-{
-	if (h == NULL) return CreateNode(key, val, RED, 1);
-
-	if (key < h->key)
-	{
-		h->left = NODE_put(h->left, key, val);
-	}
-	else if (key > h->key)
-	{
-		h->right = NODE_put(h->right, key, val);
-	}
-	else
-	{
-		// Replace the key with a new value
-		memcpy(h->val, val, sizeof(Value));
-	}
-
-	// fix-up any right-leaning links
-	if (NODE_isRed(h->right) && !NODE_isRed(h->left))
-	{
-		h = NODE_rotateLeft(h);
-	}
-	if (NODE_isRed(h->left) && NODE_isRed(h->left->left))
-	{
-		h = NODE_rotateRight(h);
-	}
-	if (NODE_isRed(h->left) && NODE_isRed(h->right))
-	{
-		NODE_flipColors(h);
-	}
-
-	h->size = NODE_size(h->left) + NODE_size(h->right) + 1;
-
-	return h;
-}
-
-int NODE_height(Node* x)
-{
-	if (x == NULL) return -1;
-	return 1 + (MAX(NODE_height(x->left), NODE_height(x->right)));
-}
-
-// the largest key in the subtree rooted at x less than or equal to the given key
-Node* NODE_floor(Node* x, Key key)
-{
-	if (x == NULL) return NULL;
-	if (key == x->key) return x;
-	if (key < x->key)  return NODE_floor(x->left, key);
-
-	Node* t = NODE_floor(x->right, key);
-	if (t != NULL) return t;
-	else return x;
-}
-
-
-// the smallest key in the subtree rooted at x greater than or equal to the given key
-Node* NODE_ceiling(Node* x, Key key)
-{
-	if (x == NULL) return NULL;
-	if (key == x->key) return x;
-	if (key > x->key)  return NODE_ceiling(x->right, key);
-	Node* t = NODE_ceiling(x->left, key);
-	if (t != NULL) return t;
-	else           return x;
-}
-
-// the key of rank k in the subtree rooted at x
-Node* NODE_select(Node* x, int k)
-{
-	assert(x != NULL);
-	assert(k >= 0 && k < NODE_size(x));
-	int t = NODE_size(x->left);
-	if (t > k) return NODE_select(x->left, k);
-	if (t < k) return NODE_select(x->right, k - t - 1);
-	return x;
-}
-
-// number of keys less than key in the subtree rooted at x
-int NODE_rank(Key key, Node* x)
-{
-	if (x == NULL) return 0;
-	if (key < x->key) return NODE_rank(key, x->left);
-	else if (key > x->key) return 1 + NODE_size(x->left) + NODE_rank(key, x->right);
-	else return NODE_size(x->left);
-}
-
-// add the keys between lo and hi in the subtree rooted at x to the queue
-void NODE_keys(Node* x, KeyList** queue, const Key lo, const Key hi)
-{
-	if (x == NULL || queue == NULL) return;
-	if (lo < x->key) NODE_keys(x->left, queue, lo, hi);
-	if (lo <= x->key && hi >= x->key)
-	{
-		KeyList* next = (KeyList*)calloc(1, sizeof(KeyList));
-		(*queue)->node = x;
-		(*queue)->next = next;
-		(*queue) = next;
-	}
-	if (hi > x->key) NODE_keys(x->right, queue, lo, hi);
-}
-
-#pragma region Node Tests
-
-// is the tree rooted at x a BST with all keys strictly between min and max
-// (if min or max is NULL, treat as empty constraint)
-// Credit: Bob Dondero's elegant solution
-bool NODE_test_isBST(const Node* x, const Key* min, const Key* max)
-{
-	if (x == NULL) return true;
-	if (min != NULL && x->key <= *min) return false;
-	if (max != NULL && x->key >= *max) return false;
-	return NODE_test_isBST(x->left, min, &x->key) && NODE_test_isBST(x->right, &x->key, max);
-}
-
-bool NODE_test_isSizeConsistent(const Node* x)
-{
-	if (x == NULL) return true;
-	if (x->size != NODE_size(x->left) + NODE_size(x->right) + 1) return false;
-	return NODE_test_isSizeConsistent(x->left) && NODE_test_isSizeConsistent(x->right);
-}
-
-bool NODE_test_is23(const Node* x, const Node* root)
-{
-	if (x == NULL) return true;
-	if (NODE_isRed(x->right)) return false;
-	if (x != root && NODE_isRed(x) && NODE_isRed(x->left))
-		return false;
-	return NODE_test_is23(x->left, root) && NODE_test_is23(x->right, root);
-}
-
-// does every path from the root to a leaf have the given number of black links?
-bool NODE_test_isBalanced(const Node* x, int black)
-{
-	if (x == NULL) return black == 0;
-	if (!NODE_isRed(x)) black--;
-	return NODE_test_isBalanced(x->left, black) && NODE_test_isBalanced(x->right, black);
-}
-
-#pragma endregion
-
-#pragma endregion
+#include "RedBlackTreeNode.h"
+#include "RedBlackTreePool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define MAX(a,b) (a > b) ? a : b
+
+//#define ASSERTS
+
+#ifdef ASSERTS
+#include <assert.h>
+#else
+#define assert(X) {/* Asserts are unused unless defined */}
+#endif // ASSERTS
+
+#pragma region Private NODE_* functions
+
+// Release the value held by this node; inline values have nothing to free.
+// Heap values of a pooled tree go back to the pool they came from.
+void NODE_releaseVal(NodePool* pool, Node* x)
+{
+	if (x->val != x->inlineVal && x->val != NULL)
+	{
+		if (pool != NULL) POOL_releaseVal(pool, x->val);
+		else free(x->val);
+	}
+	x->val = NULL;
+}
+
+// Hand the value of src over to dst without copying heap data.
+// dst must not hold a value, src is left without one.
+void NODE_moveVal(Node* dst, Node* src)
+{
+	if (src->val == src->inlineVal)
+	{
+		memcpy(dst->inlineVal, src->inlineVal, RBT_INLINE_VALUE);
+		dst->val = dst->inlineVal;
+	}
+	else dst->val = src->val;
+	src->val = NULL;
+}
+
+// Release any memory associated with this node, returning it to the pool if there is one
+void NODE_free(NodePool* pool, Node** x)
+{
+	NODE_releaseVal(pool, *x);
+
+	if (pool != NULL) POOL_release(pool, (*x));
+	else free((*x));
+	(*x) = NULL;
+}
+
+bool NODE_isRed(const Node* x)
+{
+	if (x == NULL) return false;
+	return x->color == RED;
+}
+
+/* the smallest key in subtree rooted at x; NULL if no such key */
+Node* NODE_min_bykey(Node* x)
+{
+	assert(x != NULL);
+	while (x->left != NULL) x = x->left;
+	return x;
+}
+
+/* value associated with the given key in subtree rooted at x; NULL if no such key */
+Value* NODE_get(Node* x, Key key)
+{
+	while (x != NULL)
+	{
+		if (RBT_cmp(key, x->key) == 0) return NODE_isLive(x) ? &x->val : NULL;
+		x = x->child[RBT_cmp(key, x->key) > 0];
+	}
+	return NULL;
+}
+
+/* number of node in subtree rooted at x; 0 if x is NULL */
+int NODE_size(const Node* x)
+{
+	if (x == NULL) return 0;
+	return x->size;
+}
+
+#ifdef RBT_AGGREGATE
+/* aggregate of the subtree rooted at x; AGG_identity() if x is NULL */
+Aggregate NODE_agg(const Node* x)
+{
+	if (x == NULL) return AGG_identity();
+	return x->agg;
+}
+#endif
+
+/* recompute the augmentation of x (its subtree count, and its aggregate when
+   RBT_AGGREGATE is defined) from its children; a dead x adds nothing to either */
+void NODE_pull(Node* x)
+{
+	x->size = NODE_size(x->left) + NODE_size(x->right) + NODE_isLive(x);
+#ifdef RBT_AGGREGATE
+	Aggregate own = NODE_isLive(x) ? AGG_lift(x->key, x->val) : AGG_identity();
+	x->agg = AGG_combine(AGG_combine(NODE_agg(x->left), own), NODE_agg(x->right));
+#endif
+}
+
+/* the largest key in the subtree rooted at x; NULL if no such key */
+Node* NODE_max_bykey(Node* x)
+{
+	assert(x != NULL);
+	while (x->right != NULL) x = x->right;
+	return x;
+}
+
+/* make a left-leaning link lean to the right */
+Node* NODE_rotateRight(Node* h)
+{
+	assert( (h != NULL) && NODE_isRed(h->left));
+	Node* x = h->left;
+	h->left = x->right;
+	x->right = h;
+	x->color = x->right->color;
+	x->right->color = RED;
+	NODE_pull(h);
+	NODE_pull(x);
+	return x;
+}
+
+// make a right-leaning link lean to the left
+Node* NODE_rotateLeft(Node* h)
+{
+	assert( (h != NULL) && NODE_isRed(h->right));
+	Node* x = h->right;
+	h->right = x->left;
+	x->left = h;
+	x->color = x->left->color;
+	x->left->color = RED;
+	NODE_pull(h);
+	NODE_pull(x);
+	return x;
+}
+
+// flip the colors of a node and its two children
+void NODE_flipColors(Node* h)
+{
+	// h must have opposite color of its two children
+	assert((h != NULL) && (h->left != NULL) && (h->right != NULL));
+	assert((!NODE_isRed(h) &&  NODE_isRed(h->left) &&  NODE_isRed(h->right)) || (NODE_isRed(h)  && !NODE_isRed(h->left) && !NODE_isRed(h->right)));
+
+	h->color = !h->color;
+	h->left->color = !h->left->color;
+	h->right->color = !h->right->color;
+}
+
+// Assuming that h is red and both h.left and h.left.left
+// are black, make h.left or one of its children red.
+Node* NODE_moveRedLeft(Node* h)
+{
+	assert(h != NULL);
+	assert(NODE_isRed(h) && !NODE_isRed(h->left) && !NODE_isRed(h->left->left));
+
+	NODE_flipColors(h);
+	if (NODE_isRed(h->right->left))
+	{
+		h->right = NODE_rotateRight(h->right);
+		h = NODE_rotateLeft(h);
+		NODE_flipColors(h);
+	}
+	return h;
+}
+
+// Assuming that h is red and both h.right and h.right.left
+// are black, make h.right or one of its children red.
+Node* NODE_moveRedRight(Node* h)
+{
+	assert(h != NULL);
+	assert(NODE_isRed(h) && !NODE_isRed(h->right) && !NODE_isRed(h->right->left));
+
+	NODE_flipColors(h);
+	if (NODE_isRed(h->left->left))
+	{
+		h = NODE_rotateRight(h);
+		NODE_flipColors(h);
+	}
+	return h;
+}
+
+// restore red-black tree invariant
+Node* NODE_balance(Node* h)
+{
+	assert(h != NULL);
+
+	if (NODE_isRed(h->right))
+	{
+		h = NODE_rotateLeft(h);
+	}
+	if (NODE_isRed(h->left) && NODE_isRed(h->left->left))
+	{
+		h = NODE_rotateRight(h);
+	}
+
+	if (NODE_isRed(h->left) && NODE_isRed(h->right))
+	{
+		NODE_flipColors(h);
+	}
+
+	NODE_pull(h);
+	return h;
+}
+
+// delete the key-value pair with the minimum key rooted at h
+Node* NODE_deleteMin(NodePool* pool, Node* h)
+{
+	if (h->left == NULL)
+	{
+		NODE_free(pool, &h);
+		return h;
+	}
+
+	if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
+	{
+		h = NODE_moveRedLeft(h);
+	}
+
+	h->left = NODE_deleteMin(pool, h->left);
+	return NODE_balance(h);
+}
+
+// delete the key-value pair with the maximum key rooted at h
+Node* NODE_deleteMax(NodePool* pool, Node* h)
+{
+	if (NODE_isRed(h->left))
+		h = NODE_rotateRight(h);
+
+	if (h->right == NULL)
+	{
+		NODE_free(pool, &h);
+		return NULL;
+	}
+
+	if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left))
+		h = NODE_moveRedRight(h);
+
+	h->right = NODE_deleteMax(pool, h->right);
+
+	return NODE_balance(h);
+}
+
+// delete the key-value pair with the given key rooted at h
+Node* NODE_remove(NodePool* pool, Node* h, Key key)
+{
+	 assert(NODE_get(h, key) != NULL);
+
+	if (RBT_cmp(key, h->key) < 0)
+	{
+		if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
+			h = NODE_moveRedLeft(h);
+		h->left = NODE_remove(pool, h->left, key);
+	}
+	else
+	{
+		if (NODE_isRed(h->left))
+		{
+			h = NODE_rotateRight(h);
+		}
+		if (RBT_cmp(key, h->key) == 0 && (h->right == NULL))
+		{
+			NODE_free(pool, &h);
+			return NULL;
+		}
+		if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left))
+		{
+			h = NODE_moveRedRight(h);
+		}
+		if (RBT_cmp(key, h->key) == 0)
+		{
+			Node* x = NODE_min_bykey(h->right);
+			h->key = x->key;
+
+			// x will be freed in a moment: take its value and drop our own
+			NODE_releaseVal(pool, h);
+			NODE_moveVal(h, x);
+
+			h->right = NODE_deleteMin(pool, h->right);
+		}
+		else h->right = NODE_remove(pool, h->right, key);
+	}
+	return NODE_balance(h);
+}
+
+// insert the key-value pair in the subtree rooted at h
+Node* NODE_put(NodePool* pool, Node* h, Key key, Value val)
+{
+	if (h == NULL) return CreateNode(pool, key, val, RED, 1);
+
+	if (RBT_cmp(key, h->key) < 0)
+	{
+		h->left = NODE_put(pool, h->left, key, val);
+	}
+	else if (RBT_cmp(key, h->key) > 0)
+	{
+		h->right = NODE_put(pool, h->right, key, val);
+	}
+	else
+	{
+		// Replace the key with a new value
+		NODE_releaseVal(pool, h);
+		applyKeyVal(pool, h, key, val);
+	}
+
+	return NODE_fixUp(h);
+}
+
+// restore the invariants at h after a red link was added below it
+Node* NODE_fixUp(Node* h)
+{
+	// fix-up any right-leaning links
+	if (NODE_isRed(h->right) && !NODE_isRed(h->left))
+	{
+		h = NODE_rotateLeft(h);
+	}
+	if (NODE_isRed(h->left) && NODE_isRed(h->left->left))
+	{
+		h = NODE_rotateRight(h);
+	}
+	if (NODE_isRed(h->left) && NODE_isRed(h->right))
+	{
+		NODE_flipColors(h);
+	}
+
+	NODE_pull(h);
+
+	return h;
+}
+
+/***************************************************************************
+*  Iterative writes.
+*  The same transformations as the recursive NODE_put, NODE_remove and
+*  NODE_deleteMax, with the path kept on an explicit stack. On the way back
+*  up a level is only rebalanced if it was restructured on the way down or
+*  the colors below it changed; above the point where neither holds, only
+*  the subtree counts need updating.
+***************************************************************************/
+
+typedef struct _WritePath
+{
+	Node* node[RBT_MAX_DEPTH];		// subtree roots from the top down, after any restructuring
+	bool right[RBT_MAX_DEPTH];		// which child the path continues into
+	bool red[RBT_MAX_DEPTH];		// color of the subtree root as its parent last saw it
+	bool leftRed[RBT_MAX_DEPTH];	// color of that root's left child
+	bool touched[RBT_MAX_DEPTH];	// must be rebalanced on the way up
+	int shadow;						// levels still affected by the last restructuring
+	int depth;
+	int moved;						// after unwinding: highest level whose subtree root was replaced
+} WritePath;
+
+// levels NODE_put_finger rebalances at a time above its starting point
+#define FINGER_WINDOW 4
+
+// remember what the parent of h sees before h is changed
+static void PATH_enter(WritePath* path, const Node* h)
+{
+	assert(path->depth < RBT_MAX_DEPTH);
+	path->red[path->depth] = NODE_isRed(h);
+	path->leftRed[path->depth] = NODE_isRed(h->left);
+	path->touched[path->depth] = path->shadow > 0;
+}
+
+// the current level was restructured. Rotations and color flips reach two levels
+// down, so the nodes that end up there may be left unbalanced as well.
+static void PATH_touch(WritePath* path)
+{
+	path->touched[path->depth] = true;
+	path->shadow = 3;
+}
+
+// record h as the subtree root at this level and continue into one of its children
+static void PATH_push(WritePath* path, Node* h, bool right)
+{
+	path->node[path->depth] = h;
+	path->right[path->depth] = right;
+	path->depth++;
+	if (path->shadow > 0) path->shadow--;
+}
+
+// relink the path bottom up, hanging child below the deepest level.
+// sizeDelta is the change in subtree counts along the path.
+static Node* PATH_unwind(WritePath* path, Node* child, int sizeDelta, bool insert)
+{
+	bool settled = false;
+	int i;
+#if defined(RBT_AGGREGATE) || defined(RBT_LAZY_DELETE)
+	(void)sizeDelta;				// these trees recount from the children instead
+#endif
+
+	path->moved = path->depth;
+	for (i = path->depth - 1; i >= 0; i--)
+	{
+		Node* h = path->node[i];
+		if (path->right[i]) h->right = child;
+		else h->left = child;
+
+		if (settled && !path->touched[i])
+		{
+			// nothing below changed as far as h can tell: h is still balanced. The
+			// node that left may have been dead, so lazy trees count again
+#if defined(RBT_AGGREGATE) || defined(RBT_LAZY_DELETE)
+			NODE_pull(h);
+#else
+			h->size += sizeDelta;
+#endif
+		}
+		else
+		{
+			h = insert ? NODE_fixUp(h) : NODE_balance(h);
+		}
+
+		settled = NODE_isRed(h) == path->red[i] && NODE_isRed(h->left) == path->leftRed[i];
+		if (h != path->node[i])
+		{
+			path->node[i] = h;
+			path->moved = i;
+		}
+		child = h;
+	}
+	return child;
+}
+
+// insert the key-value pair in the tree rooted at h
+Node* NODE_put_iterative(NodePool* pool, Node* h, Key key, Value val)
+{
+	WritePath path;
+	path.depth = 0;
+	path.shadow = 0;
+
+	while (h != NULL)
+	{
+		if (RBT_cmp(key, h->key) == 0)
+		{
+			// Replace the key with a new value, the shape does not change
+			NODE_releaseVal(pool, h);
+			applyKeyVal(pool, h, key, val);
+#ifdef RBT_AGGREGATE
+			// but every aggregate on the path includes the old value
+			NODE_pull(h);
+			int i;
+			for (i = path.depth - 1; i >= 0; i--) NODE_pull(path.node[i]);
+#endif
+			return path.depth > 0 ? path.node[0] : h;
+		}
+
+		PATH_enter(&path, h);
+		PATH_push(&path, h, RBT_cmp(key, h->key) > 0);
+		h = (RBT_cmp(key, h->key) < 0) ? h->left : h->right;
+	}
+
+	return PATH_unwind(&path, CreateNode(pool, key, val, RED, 1), 1, true);
+}
+
+// insert key, larger than every key in the tree rooted at h, at the bottom of the right
+// spine: the same place NODE_put_iterative puts it, without comparing keys on the way down.
+// If key is not the largest after all, returns NULL with the tree untouched and the
+// largest key stored in max.
+Node* NODE_append(NodePool* pool, Node* h, Key key, Value val, Key* max)
+{
+	Node* spine[RBT_MAX_DEPTH];
+	int depth = 0;
+	for (; h != NULL; h = h->right) spine[depth++] = h;
+
+	if (RBT_cmp(key, spine[depth - 1]->key) <= 0)
+	{
+		*max = spine[depth - 1]->key;
+		return NULL;
+	}
+	return NODE_put_finger(pool, spine, &depth, depth - 1, key, val);
+}
+
+// insert the key-value pair, starting the search at stack[start] instead of the root.
+// stack[0..start] must be a path from the root down to a node whose subtree is where
+// key belongs. Only that subtree is unwound like NODE_put_iterative; the levels above
+// it are rebalanced too if the change reaches them, and otherwise only count the new
+// node. On return stack holds the path from the new root to key's node, found again
+// only below the highest level the insertion restructured, and depth its length.
+Node* NODE_put_finger(NodePool* pool, Node** stack, int* depth, int start, Key key, Value val)
+{
+	WritePath path;
+	path.depth = 0;
+	path.shadow = 0;
+
+	int i;
+	Node* h = stack[start];
+	while (h != NULL)
+	{
+		if (RBT_cmp(key, h->key) == 0)
+		{
+			// Replace the key with a new value, the shape does not change
+			NODE_releaseVal(pool, h);
+			applyKeyVal(pool, h, key, val);
+#ifdef RBT_AGGREGATE
+			NODE_pull(h);
+			for (i = path.depth - 1; i >= 0; i--) NODE_pull(path.node[i]);
+			for (i = start - 1; i >= 0; i--) NODE_pull(stack[i]);
+#endif
+			for (i = 0; i < path.depth; i++) stack[start + i] = path.node[i];
+			stack[start + path.depth] = h;
+			*depth = start + path.depth + 1;
+			return stack[0];
+		}
+
+		PATH_enter(&path, h);
+		PATH_push(&path, h, RBT_cmp(key, h->key) > 0);
+		h = (RBT_cmp(key, h->key) < 0) ? h->left : h->right;
+	}
+
+	bool red = path.red[0], leftRed = path.leftRed[0];
+	Node* x = CreateNode(pool, key, val, RED, 1);
+	Node* sub = PATH_unwind(&path, x, 1, true);
+
+	// levels above the highest restructured one still lead the same way
+	for (i = 0; i < path.moved; i++) stack[start + i] = path.node[i];
+	int level = start + path.moved;
+	h = (path.moved < path.depth) ? path.node[path.moved] : x;
+
+	// while the root of the unwound part changed color, rebalance the levels above it a
+	// few at a time, recording its parent's left child as it was before the insertion
+	int top = start;
+	while (top > 0 && (NODE_isRed(sub) != red || NODE_isRed(sub->left) != leftRed))
+	{
+		int low = (top > FINGER_WINDOW) ? top - FINGER_WINDOW : 0;
+		bool wasLeft = stack[top - 1]->left == stack[top];
+
+		WritePath above;
+		above.depth = 0;
+		above.shadow = 0;
+		for (i = low; i < top; i++)
+		{
+			PATH_enter(&above, stack[i]);
+			PATH_push(&above, stack[i], (i + 1 < top) ? stack[i]->right == stack[i + 1] : !wasLeft);
+		}
+		if (wasLeft) above.leftRed[top - low - 1] = red;
+
+		red = above.red[0];
+		leftRed = above.leftRed[0];
+		sub = PATH_unwind(&above, sub, 1, true);
+		if (above.moved < above.depth)
+		{
+			level = low + above.moved;
+			h = above.node[above.moved];
+		}
+		top = low;
+	}
+
+	// the levels above that are still balanced, they only gain a node
+	if (top > 0)
+	{
+		if (stack[top - 1]->left == stack[top]) stack[top - 1]->left = sub;
+		else stack[top - 1]->right = sub;
+	}
+	for (i = top - 1; i >= 0; i--)
+	{
+#ifdef RBT_AGGREGATE
+		NODE_pull(stack[i]);
+#else
+		stack[i]->size++;
+#endif
+	}
+	Node* root = (top == 0) ? sub : stack[0];
+
+	// below the highest restructured level, find the key again
+	while (h != x)
+	{
+		stack[level++] = h;
+		h = h->child[RBT_cmp(key, h->key) > 0];
+	}
+	stack[level++] = x;
+	*depth = level;
+	return root;
+}
+
+// delete the key-value pair with the given key rooted at h; the key must be present.
+// Unlike NODE_remove the successor node is moved into place rather than its key and
+// value, so every remaining key stays in the node it was inserted into.
+Node* NODE_remove_iterative(NodePool* pool, Node* h, Key key)
+{
+	assert(NODE_get(h, key) != NULL);
+	WritePath path;
+	Node* target = NULL;
+	int targetDepth = 0;
+	path.depth = 0;
+	path.shadow = 0;
+
+	// find the key, pushing a red link down in front of us
+	while (true)
+	{
+		PATH_enter(&path, h);
+		if (RBT_cmp(key, h->key) < 0)
+		{
+			if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
+			{
+				h = NODE_moveRedLeft(h);
+				PATH_touch(&path);
+			}
+			PATH_push(&path, h, false);
+			h = h->left;
+			continue;
+		}
+
+		if (NODE_isRed(h->left))
+		{
+			h = NODE_rotateRight(h);
+			PATH_touch(&path);
+		}
+		if (RBT_cmp(key, h->key) == 0 && (h->right == NULL))
+		{
+			NODE_free(pool, &h);
+			return PATH_unwind(&path, NULL, -1, false);
+		}
+		if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left))
+		{
+			h = NODE_moveRedRight(h);
+			PATH_touch(&path);
+		}
+
+		PATH_push(&path, h, true);
+		if (RBT_cmp(key, h->key) == 0)
+		{
+			target = h;
+			targetDepth = path.depth - 1;
+			h = h->right;
+			break;
+		}
+		h = h->right;
+	}
+
+	// delete the minimum of the right subtree, it takes the target's place
+	while (h->left != NULL)
+	{
+		PATH_enter(&path, h);
+		if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
+		{
+			h = NODE_moveRedLeft(h);
+			PATH_touch(&path);
+		}
+		PATH_push(&path, h, false);
+		h = h->left;
+	}
+
+	Node* successor = h;
+	successor->left = target->left;
+	successor->right = target->right;
+	successor->color = target->color;
+	successor->size = target->size;
+	path.node[targetDepth] = successor;
+	if (path.depth == targetDepth + 1)
+	{
+		// the successor was the target's right child
+		successor->right = NULL;
+	}
+
+	NODE_free(pool, &target);
+	return PATH_unwind(&path, NULL, -1, false);
+}
+
+// delete the key-value pair with the maximum key rooted at h
+Node* NODE_deleteMax_iterative(NodePool* pool, Node* h)
+{
+	Node *max, *next;
+	h = NODE_detachMax_iterative(h, &max, &next);
+	NODE_free(pool, &max);
+	return h;
+}
+
+// unlink the node with the minimum key from the tree rooted at h and store it in min,
+// its key and value untouched. The node unlinked is always a leaf, so its parent, stored
+// in next, holds the new minimum (NULL once the tree is empty).
+Node* NODE_detachMin_iterative(Node* h, Node** min, Node** next)
+{
+	WritePath path;
+	path.depth = 0;
+	path.shadow = 0;
+
+	while (true)
+	{
+		PATH_enter(&path, h);
+		if (h->left == NULL)
+		{
+			*min = h;
+			*next = (path.depth > 0) ? path.node[path.depth - 1] : NULL;
+			return PATH_unwind(&path, NULL, -1, false);
+		}
+
+		if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
+		{
+			h = NODE_moveRedLeft(h);
+			PATH_touch(&path);
+		}
+		PATH_push(&path, h, false);
+		h = h->left;
+	}
+}
+
+// unlink the node with the maximum key from the tree rooted at h and store it in max,
+// with next the new maximum, like NODE_detachMin_iterative
+Node* NODE_detachMax_iterative(Node* h, Node** max, Node** next)
+{
+	WritePath path;
+	path.depth = 0;
+	path.shadow = 0;
+
+	while (true)
+	{
+		PATH_enter(&path, h);
+		if (NODE_isRed(h->left))
+		{
+			h = NODE_rotateRight(h);
+			PATH_touch(&path);
+		}
+
+		if (h->right == NULL)
+		{
+			*max = h;
+			*next = (path.depth > 0) ? path.node[path.depth - 1] : NULL;
+			return PATH_unwind(&path, NULL, -1, false);
+		}
+
+		if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left))
+		{
+			h = NODE_moveRedRight(h);
+			PATH_touch(&path);
+		}
+		PATH_push(&path, h, true);
+		h = h->right;
+	}
+}
+
+int NODE_height(Node* x)
+{
+	// depth-first walk; the stack never holds more than one pending node per level
+	Node* stack[RBT_MAX_DEPTH + 1];
+	int depth[RBT_MAX_DEPTH + 1];
+	int top = 0, height = -1;
+
+	if (x != NULL)
+	{
+		stack[top] = x;
+		depth[top++] = 0;
+	}
+	while (top > 0)
+	{
+		x = stack[--top];
+		int d = depth[top];
+		if (d > height) height = d;
+		if (x->right != NULL)
+		{
+			stack[top] = x->right;
+			depth[top++] = d + 1;
+		}
+		if (x->left != NULL)
+		{
+			stack[top] = x->left;
+			depth[top++] = d + 1;
+		}
+	}
+	return height;
+}
+
+// the largest key in the subtree rooted at x less than or equal to the given key
+Node* NODE_floor(Node* x, Key key)
+{
+	Node* best = NULL;
+	while (x != NULL)
+	{
+		if (RBT_cmp(key, x->key) == 0) return x;
+
+		// going right means x is smaller than the key: the best candidate so far
+		bool right = RBT_cmp(key, x->key) > 0;
+		best = right ? x : best;
+		x = x->child[right];
+	}
+	return best;
+}
+
+
+// the smallest key in the subtree rooted at x greater than or equal to the given key
+Node* NODE_ceiling(Node* x, Key key)
+{
+	Node* best = NULL;
+	while (x != NULL)
+	{
+		if (RBT_cmp(key, x->key) == 0) return x;
+
+		// going left means x is larger than the key: the best candidate so far
+		bool right = RBT_cmp(key, x->key) > 0;
+		best = right ? best : x;
+		x = x->child[right];
+	}
+	return best;
+}
+
+// the key of rank k in the subtree rooted at x
+Node* NODE_select(Node* x, int k)
+{
+	assert(x != NULL);
+	assert(k >= 0 && k < NODE_size(x));
+	while (x != NULL)
+	{
+		int t = NODE_size(x->left);
+		if (t == k && NODE_isLive(x)) return x;
+
+		// a dead x holds no rank, rank t is then the right subtree's first
+		bool right = k >= t;
+		k -= right * (t + NODE_isLive(x));
+		x = x->child[right];
+	}
+	return NULL;
+}
+
+// number of keys less than key in the subtree rooted at x
+int NODE_rank(Key key, Node* x)
+{
+	int rank = 0;
+	while (x != NULL)
+	{
+		int t = NODE_size(x->left);
+		if (RBT_cmp(key, x->key) == 0) return rank + t;
+
+		bool right = RBT_cmp(key, x->key) > 0;
+		rank += right * (t + NODE_isLive(x));
+		x = x->child[right];
+	}
+	return rank;
+}
+
+// first of the n sorted ranks that is not below rank
+static size_t NODE_firstRank(const int* ranks, size_t n, int rank)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (ranks[mid] < rank) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// first of the n sorted keys that is not below key
+static size_t NODE_firstKey(const Key* keys, size_t n, Key key)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (RBT_cmp(keys[mid], key) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// store the keys of the n sorted ranks in out, where the subtree rooted at x starts at rank
+// base. Ranks are split between the two subtrees at every node, so the paths they share
+// are walked once; the right part is followed in the loop, the left part recursively.
+void NODE_select_many(Node* x, int base, const int* ranks, Key* out, size_t n)
+{
+	while (n > 0)
+	{
+		assert(x != NULL);
+		int t = base + NODE_size(x->left);
+		size_t below = NODE_firstRank(ranks, n, t);
+		if (below > 0) NODE_select_many(x->left, base, ranks, out, below);
+
+		size_t after = below;
+		if (NODE_isLive(x))
+		{
+			while (after < n && ranks[after] == t) out[after++] = x->key;
+		}
+
+		ranks += after;
+		out += after;
+		n -= after;
+		base = t + NODE_isLive(x);
+		x = x->right;
+	}
+}
+
+// store the ranks of the n sorted keys in out, where the subtree rooted at x starts at rank base
+void NODE_rank_many(Node* x, int base, const Key* keys, int* out, size_t n)
+{
+	while (n > 0)
+	{
+		if (x == NULL)
+		{
+			while (n-- > 0) *out++ = base;
+			return;
+		}
+
+		int t = base + NODE_size(x->left);
+		size_t below = NODE_firstKey(keys, n, x->key);
+		if (below > 0) NODE_rank_many(x->left, base, keys, out, below);
+
+		size_t after = below;
+		while (after < n && RBT_cmp(keys[after], x->key) == 0) out[after++] = t;
+
+		keys += after;
+		out += after;
+		n -= after;
+		base = t + NODE_isLive(x);
+		x = x->right;
+	}
+}
+
+// add the keys between lo and hi in the subtree rooted at x to the queue
+void NODE_keys(Node* x, KeyList** queue, const Key lo, const Key hi)
+{
+	if (x == NULL || queue == NULL) return;
+	if (RBT_cmp(lo, x->key) < 0) NODE_keys(x->left, queue, lo, hi);
+	if (RBT_cmp(lo, x->key) <= 0 && RBT_cmp(hi, x->key) >= 0 && NODE_isLive(x))
+	{
+		KeyList* next = (KeyList*)calloc(1, sizeof(KeyList));
+		(*queue)->node = x;
+		(*queue)->next = next;
+		(*queue) = next;
+	}
+	if (RBT_cmp(hi, x->key) > 0) NODE_keys(x->right, queue, lo, hi);
+}
+
+// most nodes a tree of the given black height can hold: every node a 3-node
+static long long NODE_maxNodes(int black)
+{
+	long long n = 1;
+	while (black-- > 0 && n <= INT_MAX) n *= 3;
+	return n - 1;
+}
+
+// black height to build n nodes with: the tallest whose all 2-node tree still fits
+int NODE_buildHeight(int n)
+{
+	int black = 0;
+	while ((2LL << black) - 1 <= n) black++;
+	return black;
+}
+
+// build a left-leaning red-black tree of n nodes and the given black height,
+// taking the nodes in key order from next(). Each level is made of 2-nodes
+// while the children can still hold the rest, otherwise of 3-nodes (a black
+// node with a red left child), so the shape is valid for any n in
+// [2^black - 1, 3^black - 1].
+Node* NODE_build(int n, int black, Node* (*next)(void*), void* ctx)
+{
+	assert(n >= (1LL << black) - 1 && n <= NODE_maxNodes(black));
+	if (n == 0) return NULL;
+
+	long long most = NODE_maxNodes(black - 1);
+	if (n - 1 <= 2 * most)
+	{
+		int left = (n - 1) / 2;
+
+		Node* l = NODE_build(left, black - 1, next, ctx);
+		Node* h = next(ctx);
+		h->left = l;
+		h->right = NODE_build(n - 1 - left, black - 1, next, ctx);
+		h->color = BLACK;
+		NODE_pull(h);
+		return h;
+	}
+
+	int third = (n - 2) / 3;
+	int middle = (n - 2 - third) / 2;
+
+	Node* a = NODE_build(third, black - 1, next, ctx);
+	Node* r = next(ctx);
+	r->left = a;
+	r->right = NODE_build(middle, black - 1, next, ctx);
+	r->color = RED;
+	NODE_pull(r);
+
+	Node* h = next(ctx);
+	h->left = r;
+	h->right = NODE_build(n - 2 - third - middle, black - 1, next, ctx);
+	h->color = BLACK;
+	NODE_pull(h);
+	return h;
+}
+
+// unlink the node with the minimum key rooted at h without freeing it
+Node* NODE_detachMin(Node* h, Node** min)
+{
+	if (h->left == NULL)
+	{
+		*min = h;
+		return NULL;
+	}
+
+	if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left))
+	{
+		h = NODE_moveRedLeft(h);
+	}
+
+	h->left = NODE_detachMin(h->left, min);
+	return NODE_balance(h);
+}
+
+// number of black nodes on the path from x down to a leaf, counting x as black
+int NODE_blackHeight(const Node* x)
+{
+	int black = 0;
+	const Node* y;
+	for (y = x; y != NULL; y = y->left)
+	{
+		if (y == x || !NODE_isRed(y)) black++;
+	}
+	return black;
+}
+
+// black height of a child of a node with the given black height, once the child is made black
+static int NODE_childHeight(const Node* child, int black)
+{
+	return NODE_isRed(child) ? black : black - 1;
+}
+
+// hang k off the right spine of t, where t is the taller tree
+static Node* NODE_joinRight(Node* t, int tBlack, Node* k, Node* r, int rBlack)
+{
+	// links on the right spine are black, so every step loses one black level
+	if (tBlack == rBlack)
+	{
+		k->left = t;
+		k->right = r;
+		k->color = RED;
+		NODE_pull(k);
+		return k;
+	}
+
+	t->right = NODE_joinRight(t->right, tBlack - 1, k, r, rBlack);
+	return NODE_fixUp(t);
+}
+
+// hang k off the left spine of t, where t is the taller tree
+static Node* NODE_joinLeft(Node* l, int lBlack, Node* k, Node* t, int tBlack)
+{
+	if (tBlack == lBlack && !NODE_isRed(t))
+	{
+		k->left = l;
+		k->right = t;
+		k->color = RED;
+		NODE_pull(k);
+		return k;
+	}
+
+	t->left = NODE_joinLeft(l, lBlack, k, t->left, NODE_isRed(t) ? tBlack : tBlack - 1);
+	return NODE_fixUp(t);
+}
+
+// join l, the single node k and r into one tree, where every key in l is smaller
+// than k's and every key in r is larger. l and r have the given black heights and
+// their roots are made black; the black height of the result is stored in black.
+// Runs in time proportional to the difference in black heights.
+Node* NODE_join(Node* l, int lBlack, Node* k, Node* r, int rBlack, int* black)
+{
+	Node* h;
+	if (l != NULL) l->color = BLACK;
+	if (r != NULL) r->color = BLACK;
+
+	if (lBlack > rBlack) h = NODE_joinRight(l, lBlack, k, r, rBlack);
+	else if (lBlack < rBlack) h = NODE_joinLeft(l, lBlack, k, r, rBlack);
+	else
+	{
+		k->left = l;
+		k->right = r;
+		k->color = RED;
+		NODE_pull(k);
+		h = k;
+	}
+
+	*black = MAX(lBlack, rBlack);
+	if (NODE_isRed(h))
+	{
+		h->color = BLACK;
+		(*black)++;
+	}
+	return h;
+}
+
+// join l and r, where every key in l is smaller than every key in r. Taking r's smallest
+// node out may lower its black height, so r's is measured afterwards rather than passed in
+Node* NODE_join2(Node* l, int lBlack, Node* r, int* black)
+{
+	if (r == NULL)
+	{
+		if (l != NULL) l->color = BLACK;
+		*black = lBlack;
+		return l;
+	}
+
+	// borrow the smallest node of r to join on
+	Node* min;
+	r->color = BLACK;
+	if (!NODE_isRed(r->left) && !NODE_isRed(r->right)) r->color = RED;
+	r = NODE_detachMin(r, &min);
+	if (r != NULL) r->color = BLACK;
+
+	return NODE_join(l, lBlack, min, r, NODE_blackHeight(r), black);
+}
+
+// split the tree rooted at x (black height xBlack, root treated as black) into the keys
+// smaller than key, put in l, and the keys larger than key, put in r. Returns the node
+// holding key, unlinked, or NULL if there is none.
+Node* NODE_split(Node* x, int xBlack, Key key, Node** l, int* lBlack, Node** r, int* rBlack)
+{
+	if (x == NULL)
+	{
+		*l = *r = NULL;
+		*lBlack = *rBlack = 0;
+		return NULL;
+	}
+
+	Node* left = x->left;
+	Node* right = x->right;
+	int leftBlack = NODE_childHeight(left, xBlack);
+	int rightBlack = NODE_childHeight(right, xBlack);
+	Node* found;
+	Node* middle;
+	int middleBlack;
+
+	if (RBT_cmp(key, x->key) < 0)
+	{
+		found = NODE_split(left, leftBlack, key, l, lBlack, &middle, &middleBlack);
+		*r = NODE_join(middle, middleBlack, x, right, rightBlack, rBlack);
+	}
+	else if (RBT_cmp(key, x->key) > 0)
+	{
+		found = NODE_split(right, rightBlack, key, &middle, &middleBlack, r, rBlack);
+		*l = NODE_join(left, leftBlack, x, middle, middleBlack, lBlack);
+	}
+	else
+	{
+		if (left != NULL) left->color = BLACK;
+		if (right != NULL) right->color = BLACK;
+		*l = left;
+		*lBlack = leftBlack;
+		*r = right;
+		*rBlack = rightBlack;
+
+		x->left = x->right = NULL;
+		NODE_pull(x);
+		found = x;
+	}
+	return found;
+}
+
+// turn the tree rooted at x into a list linked through ->right, in key order, without extra memory
+Node* NODE_toVine(Node* x)
+{
+	Node head = { .right = x };
+	Node* tail = &head;
+
+	while (tail->right != NULL)
+	{
+		Node* y = tail->right;
+		if (y->left != NULL)
+		{
+			// rotate the left child up
+			Node* left = y->left;
+			y->left = left->right;
+			left->right = y;
+			tail->right = left;
+		}
+		else tail = y;
+	}
+	return head.right;
+}
+
+#pragma region Recursive NODE_* reads
+
+// The original recursive forms of the ordered queries, kept to measure the iterative ones against
+
+Node* NODE_min_bykey_recursive(Node* x)
+{
+	assert(x != NULL);
+	if (x->left == NULL) return x;
+	return NODE_min_bykey_recursive(x->left);
+}
+
+Node* NODE_max_bykey_recursive(Node* x)
+{
+	assert(x != NULL);
+	if (x->right == NULL) return x;
+	else return NODE_max_bykey_recursive(x->right);
+}
+
+int NODE_height_recursive(Node* x)
+{
+	if (x == NULL) return -1;
+	return 1 + (MAX(NODE_height_recursive(x->left), NODE_height_recursive(x->right)));
+}
+
+Node* NODE_floor_recursive(Node* x, Key key)
+{
+	if (x == NULL) return NULL;
+	if (RBT_cmp(key, x->key) == 0) return x;
+	if (RBT_cmp(key, x->key) < 0)  return NODE_floor_recursive(x->left, key);
+
+	Node* t = NODE_floor_recursive(x->right, key);
+	if (t != NULL) return t;
+	else return x;
+}
+
+Node* NODE_ceiling_recursive(Node* x, Key key)
+{
+	if (x == NULL) return NULL;
+	if (RBT_cmp(key, x->key) == 0) return x;
+	if (RBT_cmp(key, x->key) > 0)  return NODE_ceiling_recursive(x->right, key);
+	Node* t = NODE_ceiling_recursive(x->left, key);
+	if (t != NULL) return t;
+	else           return x;
+}
+
+Node* NODE_select_recursive(Node* x, int k)
+{
+	assert(x != NULL);
+	assert(k >= 0 && k < NODE_size(x));
+	int t = NODE_size(x->left);
+	if (t > k) return NODE_select_recursive(x->left, k);
+	if (t < k || !NODE_isLive(x)) return NODE_select_recursive(x->right, k - t - NODE_isLive(x));
+	return x;
+}
+
+int NODE_rank_recursive(Key key, Node* x)
+{
+	if (x == NULL) return 0;
+	if (RBT_cmp(key, x->key) < 0) return NODE_rank_recursive(key, x->left);
+	else if (RBT_cmp(key, x->key) > 0) return NODE_isLive(x) + NODE_size(x->left) + NODE_rank_recursive(key, x->right);
+	else return NODE_size(x->left);
+}
+
+#pragma endregion
+
+#pragma region Node Tests
+
+// is the tree rooted at x a BST with all keys strictly between min and max
+// (if min or max is NULL, treat as empty constraint)
+// Credit: Bob Dondero's elegant solution
+bool NODE_test_isBST(const Node* x, const Key* min, const Key* max)
+{
+	if (x == NULL) return true;
+	if (min != NULL && RBT_cmp(x->key, *min) <= 0) return false;
+	if (max != NULL && RBT_cmp(x->key, *max) >= 0) return false;
+	return NODE_test_isBST(x->left, min, &x->key) && NODE_test_isBST(x->right, &x->key, max);
+}
+
+bool NODE_test_isSizeConsistent(const Node* x)
+{
+	if (x == NULL) return true;
+	if (x->size != NODE_size(x->left) + NODE_size(x->right) + NODE_isLive(x)) return false;
+	return NODE_test_isSizeConsistent(x->left) && NODE_test_isSizeConsistent(x->right);
+}
+
+bool NODE_test_is23(const Node* x, const Node* root)
+{
+	if (x == NULL) return true;
+	if (NODE_isRed(x->right)) return false;
+	if (x != root && NODE_isRed(x) && NODE_isRed(x->left))
+		return false;
+	return NODE_test_is23(x->left, root) && NODE_test_is23(x->right, root);
+}
+
+// does every path from the root to a leaf have the given number of black links?
+bool NODE_test_isBalanced(const Node* x, int black)
+{
+	if (x == NULL) return black == 0;
+	if (!NODE_isRed(x)) black--;
+	return NODE_test_isBalanced(x->left, black) && NODE_test_isBalanced(x->right, black);
+}
+
+#pragma endregion
+
+#pragma endregion
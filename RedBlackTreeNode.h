@@ -1,30 +1,76 @@
-#pragma once
-
-#include "RedBlackTree.h"
-
-bool	NODE_isRed(const Node* x);
-Node*	NODE_min_bykey(Node* x);
-Value*	NODE_get(Node* x, Key key);
-int		NODE_size(const Node* x);
-Node*	NODE_max_bykey(Node* x);
-Node*	NODE_rotateRight(Node* h);
-Node*	NODE_rotateLeft(Node* h);
-void	NODE_flipColors(Node* h);
-Node*	NODE_moveRedLeft(Node* h);
-Node*	NODE_moveRedRight(Node* h);
-Node*	NODE_balance(Node* h);
-Node*	NODE_deleteMin(Node* h);
-Node*	NODE_deleteMax(Node* h);
-Node*	NODE_remove(Node* h, Key key);
-Node*	NODE_put(Node* h, Key key, Value val);
-int		NODE_height(Node* x);
-Node*	NODE_floor(Node* x, Key key);
-Node*	NODE_ceiling(Node* x, Key key);
-Node*	NODE_select(Node* x, int k);
-int		NODE_rank(Key key, Node* x);
-void	NODE_keys(Node* x, KeyList** queue, const Key lo, const Key hi);
-
-bool	NODE_test_isBST(const Node* x, const Key* min, const Key* max);
-bool	NODE_test_isSizeConsistent(const Node* x);
-bool	NODE_test_is23(const Node* x, const Node* root);
-bool	NODE_test_isBalanced(const Node* x, int black);
+#pragma once
+
+#include "RedBlackTree.h"
+#include "RedBlackTreeGeneric.h"
+
+// the key order of RedBlackBST, generated from RBT_KEY_CMP the way DEFINE_RBT generates
+// name##_cmp, so the RBT_* tree and the generic trees share one form of comparison
+typedef Key RBT_Key;
+RBT_GENERIC_CMP(RBT, RBT_KEY_CMP)
+
+// does x count as a key? Only RBT_LAZY_DELETE leaves dead nodes in a tree
+#ifdef RBT_LAZY_DELETE
+#define NODE_isLive(x) (!(x)->dead)
+#else
+#define NODE_isLive(x) true
+#endif
+
+void	NODE_releaseVal(NodePool* pool, Node* x);
+void	NODE_moveVal(Node* dst, Node* src);
+void	NODE_free(NodePool* pool, Node** x);
+bool	NODE_isRed(const Node* x);
+Node*	NODE_min_bykey(Node* x);
+Value*	NODE_get(Node* x, Key key);
+int		NODE_size(const Node* x);
+#ifdef RBT_AGGREGATE
+Aggregate	NODE_agg(const Node* x);
+#endif
+void	NODE_pull(Node* x);
+Node*	NODE_max_bykey(Node* x);
+Node*	NODE_rotateRight(Node* h);
+Node*	NODE_rotateLeft(Node* h);
+void	NODE_flipColors(Node* h);
+Node*	NODE_moveRedLeft(Node* h);
+Node*	NODE_moveRedRight(Node* h);
+Node*	NODE_balance(Node* h);
+Node*	NODE_deleteMin(NodePool* pool, Node* h);
+Node*	NODE_deleteMax(NodePool* pool, Node* h);
+Node*	NODE_remove(NodePool* pool, Node* h, Key key);
+Node*	NODE_put(NodePool* pool, Node* h, Key key, Value val);
+Node*	NODE_fixUp(Node* h);
+Node*	NODE_put_iterative(NodePool* pool, Node* h, Key key, Value val);
+Node*	NODE_append(NodePool* pool, Node* h, Key key, Value val, Key* max);
+Node*	NODE_put_finger(NodePool* pool, Node** stack, int* depth, int start, Key key, Value val);
+Node*	NODE_remove_iterative(NodePool* pool, Node* h, Key key);
+Node*	NODE_deleteMax_iterative(NodePool* pool, Node* h);
+Node*	NODE_detachMin_iterative(Node* h, Node** min, Node** next);
+Node*	NODE_detachMax_iterative(Node* h, Node** max, Node** next);
+int		NODE_height(Node* x);
+Node*	NODE_floor(Node* x, Key key);
+Node*	NODE_ceiling(Node* x, Key key);
+Node*	NODE_select(Node* x, int k);
+int		NODE_rank(Key key, Node* x);
+void	NODE_select_many(Node* x, int base, const int* ranks, Key* out, size_t n);
+void	NODE_rank_many(Node* x, int base, const Key* keys, int* out, size_t n);
+void	NODE_keys(Node* x, KeyList** queue, const Key lo, const Key hi);
+int		NODE_buildHeight(int n);
+Node*	NODE_build(int n, int black, Node* (*next)(void*), void* ctx);
+Node*	NODE_detachMin(Node* h, Node** min);
+int		NODE_blackHeight(const Node* x);
+Node*	NODE_join(Node* l, int lBlack, Node* k, Node* r, int rBlack, int* black);
+Node*	NODE_join2(Node* l, int lBlack, Node* r, int* black);
+Node*	NODE_split(Node* x, int xBlack, Key key, Node** l, int* lBlack, Node** r, int* rBlack);
+Node*	NODE_toVine(Node* x);
+
+Node*	NODE_min_bykey_recursive(Node* x);
+Node*	NODE_max_bykey_recursive(Node* x);
+int		NODE_height_recursive(Node* x);
+Node*	NODE_floor_recursive(Node* x, Key key);
+Node*	NODE_ceiling_recursive(Node* x, Key key);
+Node*	NODE_select_recursive(Node* x, int k);
+int		NODE_rank_recursive(Key key, Node* x);
+
+bool	NODE_test_isBST(const Node* x, const Key* min, const Key* max);
+bool	NODE_test_isSizeConsistent(const Node* x);
+bool	NODE_test_is23(const Node* x, const Node* root);
+bool	NODE_test_isBalanced(const Node* x, int black);
@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "RedBlackTreePersistent.h"
+#include "RedBlackTreeNode.h"
+
+#ifdef RBT_PERSISTENT
+
+//#define ASSERTS
+
+#ifdef ASSERTS
+#include <assert.h>
+#else
+#define assert(X) {/* Asserts are unused unless defined */}
+#endif // ASSERTS
+
+// the reader slot a thread tries first, so threads do not all fight over slot 0
+static _Thread_local int PBST_slotHint = -1;
+
+#pragma region Private PNODE_* functions
+
+// hand a node of an older version to the reclaimer
+static void PNODE_retire(PersistentBST* self, Node* x)
+{
+	if (self->retiredCount == self->retiredCapacity)
+	{
+		size_t capacity = (self->retiredCapacity == 0) ? 64 : self->retiredCapacity * 2;
+		PBST_Retired* retired = (PBST_Retired*)realloc(self->retired, capacity * sizeof(PBST_Retired));
+		if (retired == NULL) { printf("out of memory retiring nodes"); exit(EXIT_FAILURE); }
+
+		self->retired = retired;
+		self->retiredCapacity = capacity;
+	}
+
+	// the epoch is stamped when the write is published, see PBST_publish
+	self->retired[self->retiredCount].node = x;
+	self->retired[self->retiredCount].epoch = 0;
+	self->retiredCount++;
+}
+
+// a writable version of x: x itself if this write created it, otherwise a copy
+static Node* PNODE_own(PersistentBST* self, Node* x)
+{
+	if (x == NULL || x->version == self->version) return x;
+
+	Node* copy = CreateNode(NULL, x->key, x->val, x->color, x->size);
+	copy->left = x->left;
+	copy->right = x->right;
+	NODE_pull(copy);
+	copy->version = self->version;
+
+	PNODE_retire(self, x);
+	return copy;
+}
+
+// drop a node that is leaving the tree
+static void PNODE_drop(PersistentBST* self, Node* x)
+{
+	if (x->version == self->version) NODE_free(NULL, &x);
+	else PNODE_retire(self, x);
+}
+
+// The helpers below mirror their NODE_* counterparts. h must already be owned;
+// any child they modify is owned first.
+
+static Node* PNODE_rotateRight(PersistentBST* self, Node* h)
+{
+	h->left = PNODE_own(self, h->left);
+	return NODE_rotateRight(h);
+}
+
+static Node* PNODE_rotateLeft(PersistentBST* self, Node* h)
+{
+	h->right = PNODE_own(self, h->right);
+	return NODE_rotateLeft(h);
+}
+
+static void PNODE_flipColors(PersistentBST* self, Node* h)
+{
+	h->left = PNODE_own(self, h->left);
+	h->right = PNODE_own(self, h->right);
+	NODE_flipColors(h);
+}
+
+static Node* PNODE_moveRedLeft(PersistentBST* self, Node* h)
+{
+	PNODE_flipColors(self, h);
+	if (NODE_isRed(h->right->left))
+	{
+		h->right = PNODE_rotateRight(self, h->right);
+		h = PNODE_rotateLeft(self, h);
+		PNODE_flipColors(self, h);
+	}
+	return h;
+}
+
+static Node* PNODE_moveRedRight(PersistentBST* self, Node* h)
+{
+	PNODE_flipColors(self, h);
+	if (NODE_isRed(h->left->left))
+	{
+		h = PNODE_rotateRight(self, h);
+		PNODE_flipColors(self, h);
+	}
+	return h;
+}
+
+static Node* PNODE_balance(PersistentBST* self, Node* h)
+{
+	if (NODE_isRed(h->right)) h = PNODE_rotateLeft(self, h);
+	if (NODE_isRed(h->left) && NODE_isRed(h->left->left)) h = PNODE_rotateRight(self, h);
+	if (NODE_isRed(h->left) && NODE_isRed(h->right)) PNODE_flipColors(self, h);
+
+	NODE_pull(h);
+	return h;
+}
+
+static Node* PNODE_put(PersistentBST* self, Node* h, Key key, Value val)
+{
+	if (h == NULL)
+	{
+		Node* x = CreateNode(NULL, key, val, RED, 1);
+		x->version = self->version;
+		return x;
+	}
+
+	h = PNODE_own(self, h);
+	if (RBT_cmp(key, h->key) < 0) h->left = PNODE_put(self, h->left, key, val);
+	else if (RBT_cmp(key, h->key) > 0) h->right = PNODE_put(self, h->right, key, val);
+	else
+	{
+		// Replace the key with a new value
+		NODE_releaseVal(NULL, h);
+		applyKeyVal(NULL, h, key, val);
+	}
+
+	// fix-up any right-leaning links
+	if (NODE_isRed(h->right) && !NODE_isRed(h->left)) h = PNODE_rotateLeft(self, h);
+	if (NODE_isRed(h->left) && NODE_isRed(h->left->left)) h = PNODE_rotateRight(self, h);
+	if (NODE_isRed(h->left) && NODE_isRed(h->right)) PNODE_flipColors(self, h);
+
+	NODE_pull(h);
+	return h;
+}
+
+static Node* PNODE_deleteMin(PersistentBST* self, Node* h)
+{
+	if (h->left == NULL)
+	{
+		PNODE_drop(self, h);
+		return NULL;
+	}
+
+	h = PNODE_own(self, h);
+	if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left)) h = PNODE_moveRedLeft(self, h);
+
+	h->left = PNODE_deleteMin(self, h->left);
+	return PNODE_balance(self, h);
+}
+
+static Node* PNODE_deleteMax(PersistentBST* self, Node* h)
+{
+	if (NODE_isRed(h->left))
+	{
+		h = PNODE_own(self, h);
+		h = PNODE_rotateRight(self, h);
+	}
+
+	if (h->right == NULL)
+	{
+		PNODE_drop(self, h);
+		return NULL;
+	}
+
+	h = PNODE_own(self, h);
+	if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left)) h = PNODE_moveRedRight(self, h);
+
+	h->right = PNODE_deleteMax(self, h->right);
+	return PNODE_balance(self, h);
+}
+
+static Node* PNODE_remove(PersistentBST* self, Node* h, Key key)
+{
+	h = PNODE_own(self, h);
+	if (RBT_cmp(key, h->key) < 0)
+	{
+		if (!NODE_isRed(h->left) && !NODE_isRed(h->left->left)) h = PNODE_moveRedLeft(self, h);
+		h->left = PNODE_remove(self, h->left, key);
+	}
+	else
+	{
+		if (NODE_isRed(h->left)) h = PNODE_rotateRight(self, h);
+		if (RBT_cmp(key, h->key) == 0 && (h->right == NULL))
+		{
+			PNODE_drop(self, h);
+			return NULL;
+		}
+		if (!NODE_isRed(h->right) && !NODE_isRed(h->right->left)) h = PNODE_moveRedRight(self, h);
+		if (RBT_cmp(key, h->key) == 0)
+		{
+			// the successor may belong to an older version, so its value is copied rather than moved
+			Node* x = NODE_min_bykey(h->right);
+			NODE_releaseVal(NULL, h);
+			applyKeyVal(NULL, h, x->key, x->val);
+			h->key = x->key;
+
+			h->right = PNODE_deleteMin(self, h->right);
+		}
+		else h->right = PNODE_remove(self, h->right, key);
+	}
+	return PNODE_balance(self, h);
+}
+
+#pragma endregion
+
+#pragma region Private PBST_* functions
+
+// start a write: nodes stamped with the new version may be changed in place
+static Node* PBST_begin(PersistentBST* self)
+{
+	pthread_mutex_lock(&self->writer);
+	self->version++;
+	if (self->version == 0) self->version++;	// 0 is the stamp of nodes from CreateNode
+	return atomic_load_explicit(&self->root, memory_order_relaxed);
+}
+
+// free the retired nodes that no pinned reader can reach any more
+static void PBST_reclaim(PersistentBST* self)
+{
+	uint64_t oldest = atomic_load(&self->epoch);
+	int i;
+	for (i = 0; i < PBST_MAX_READERS; i++)
+	{
+		uint64_t pinned = atomic_load(&self->readers[i].epoch);
+		if (pinned != 0 && pinned < oldest) oldest = pinned;
+	}
+
+	// a node retired in epoch e can be seen by readers that pinned e or earlier
+	size_t kept = 0, j;
+	for (j = 0; j < self->retiredCount; j++)
+	{
+		if (self->retired[j].epoch < oldest) NODE_free(NULL, &self->retired[j].node);
+		else self->retired[kept++] = self->retired[j];
+	}
+	self->retiredCount = kept;
+}
+
+// publish the new version, advance the epoch and let go of the writer lock
+static void PBST_publish(PersistentBST* self, Node* root, size_t retiredBefore)
+{
+	if (root != NULL) root->color = BLACK;
+	atomic_store(&self->root, root);
+
+	// readers pinning from here on see the new root, so the old nodes belong to the current epoch
+	uint64_t epoch = atomic_fetch_add(&self->epoch, 1);
+	size_t j;
+	for (j = retiredBefore; j < self->retiredCount; j++) self->retired[j].epoch = epoch;
+
+	PBST_reclaim(self);
+	pthread_mutex_unlock(&self->writer);
+}
+
+#pragma endregion
+
+/* Prepares an empty persistent tree. */
+void PBST_init(PersistentBST* self)
+{
+	memset(self, 0, sizeof(PersistentBST));
+	atomic_init(&self->root, NULL);
+	atomic_init(&self->epoch, 1);
+
+	int i;
+	for (i = 0; i < PBST_MAX_READERS; i++) atomic_init(&self->readers[i].epoch, 0);
+
+	pthread_mutex_init(&self->writer, NULL);
+	self->version = 0;
+}
+
+/* Inserts or overwrites {key} in a new version. A NULL {val} removes the key. */
+void PBST_put(PersistentBST* self, Key key, Value val)
+{
+	if (val == NULL)
+	{
+		PBST_remove(self, key);
+		return;
+	}
+
+	Node* root = PBST_begin(self);
+	size_t retiredBefore = self->retiredCount;
+	PBST_publish(self, PNODE_put(self, root, key, val), retiredBefore);
+}
+
+/* Removes {key}, if present, in a new version. */
+void PBST_remove(PersistentBST* self, Key key)
+{
+	Node* root = PBST_begin(self);
+	size_t retiredBefore = self->retiredCount;
+	if (NODE_get(root, key) == NULL)
+	{
+		pthread_mutex_unlock(&self->writer);
+		return;
+	}
+
+	// if both children of root are black, set root to red
+	root = PNODE_own(self, root);
+	if (!NODE_isRed(root->left) && !NODE_isRed(root->right)) root->color = RED;
+
+	PBST_publish(self, PNODE_remove(self, root, key), retiredBefore);
+}
+
+/* Removes the largest key in a new version. */
+void PBST_deleteMax(PersistentBST* self)
+{
+	Node* root = PBST_begin(self);
+	size_t retiredBefore = self->retiredCount;
+	if (root == NULL) { printf("BST underflow"); exit(EXIT_FAILURE); }
+
+	// if both children of root are black, set root to red
+	root = PNODE_own(self, root);
+	if (!NODE_isRed(root->left) && !NODE_isRed(root->right)) root->color = RED;
+
+	PBST_publish(self, PNODE_deleteMax(self, root), retiredBefore);
+}
+
+/* Pins the current version for reading. Never blocks on writers; the version
+   stays intact until PBST_unpin, however many writes happen meanwhile. */
+PBST_Pin PBST_pin(PersistentBST* self)
+{
+	PBST_Pin pin = { .owner = self, .slot = -1, .view = { .root = NULL, .pool = NULL } };
+
+	int start = (PBST_slotHint >= 0) ? PBST_slotHint : (int)(((size_t)&pin >> 6) % PBST_MAX_READERS);
+	int i;
+	for (i = 0; i < PBST_MAX_READERS; i++)
+	{
+		int slot = (start + i) % PBST_MAX_READERS;
+		uint_fast64_t expected = 0;
+		uint_fast64_t epoch = atomic_load(&self->epoch);
+		if (atomic_compare_exchange_strong(&self->readers[slot].epoch, &expected, epoch))
+		{
+			pin.slot = slot;
+			PBST_slotHint = slot;
+			break;
+		}
+	}
+	if (pin.slot < 0) { printf("too many readers pinned at once"); exit(EXIT_FAILURE); }
+
+	// the slot is visible before the root is read (both sequentially consistent), so the
+	// writer either sees this reader or this reader sees the writer's new root
+	pin.view.root = atomic_load(&self->root);
+	return pin;
+}
+
+/* Releases a pinned version. */
+void PBST_unpin(PBST_Pin* pin)
+{
+	if (pin->slot < 0) return;
+	atomic_store_explicit(&pin->owner->readers[pin->slot].epoch, 0, memory_order_release);
+	pin->slot = -1;
+	pin->view.root = NULL;
+}
+
+/* Frees the tree and every retired node. No reader may hold a pin. */
+void PBST_free(PersistentBST* self)
+{
+	size_t j;
+	for (j = 0; j < self->retiredCount; j++) NODE_free(NULL, &self->retired[j].node);
+	free(self->retired);
+
+	RedBlackBST tree = { .root = atomic_load(&self->root), .pool = NULL };
+	RBT_free(&tree);
+
+	pthread_mutex_destroy(&self->writer);
+	self->retired = NULL;
+	self->retiredCount = self->retiredCapacity = 0;
+	atomic_store(&self->root, NULL);
+}
+
+#endif // RBT_PERSISTENT
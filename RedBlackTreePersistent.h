@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "RedBlackTree.h"
+
+#ifdef RBT_PERSISTENT
+
+/***************************************************************************
+*  Persistent red-black tree.
+*  Writes never modify a published node: every node on the affected path is
+*  copied and the new root is published atomically, so readers work on an
+*  immutable version without taking any lock. Replaced nodes are retired
+*  and freed once no reader can still hold a version that reaches them
+*  (epoch based reclamation). Writers are serialized by a mutex. Needs
+*  RBT_PERSISTENT, which adds the version stamp to Node.
+***************************************************************************/
+
+#define PBST_MAX_READERS 128		// readers that can hold a pin at the same time
+
+typedef struct _PBST_ReaderSlot
+{
+	atomic_uint_fast64_t epoch;		// epoch the reader pinned, 0 when the slot is free
+	char padding[64 - sizeof(atomic_uint_fast64_t)];	// one slot per cache line
+} PBST_ReaderSlot;
+
+typedef struct _PBST_Retired
+{
+	Node* node;						// unlinked from the current version
+	uint64_t epoch;					// epoch in which it was unlinked
+} PBST_Retired;
+
+typedef struct _PersistentBST
+{
+	_Atomic(Node*) root;			// current version
+	atomic_uint_fast64_t epoch;		// advanced after every published write
+	PBST_ReaderSlot readers[PBST_MAX_READERS];
+
+	pthread_mutex_t writer;			// held for the whole of a write
+	unsigned version;				// stamp given to the nodes copied by the current write
+	PBST_Retired* retired;			// nodes waiting for their readers to leave
+	size_t retiredCount;
+	size_t retiredCapacity;
+} PersistentBST;
+
+/* A pinned version. {view} is an ordinary tree that can be passed to any of the
+   read-only RBT_* functions until the pin is released. */
+typedef struct _PBST_Pin
+{
+	PersistentBST* owner;
+	int slot;
+	RedBlackBST view;
+} PBST_Pin;
+
+void PBST_init(PersistentBST* self);
+void PBST_free(PersistentBST* self);
+
+void PBST_put(PersistentBST* self, Key key, Value val);
+void PBST_remove(PersistentBST* self, Key key);
+void PBST_deleteMax(PersistentBST* self);
+
+PBST_Pin PBST_pin(PersistentBST* self);
+void PBST_unpin(PBST_Pin* pin);
+
+#endif // RBT_PERSISTENT
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "RedBlackTreePool.h"
+#include "RedBlackTreeNode.h"
+
+/***************************************************************************
+*  Slab allocator for tree nodes.
+*  Nodes are carved out of large contiguous slabs and recycled through a
+*  free list, so churn never reaches the general purpose allocator and
+*  a tree's nodes stay close together in memory.
+*  Heap values are recycled the same way, by power of two size class.
+*  Neither nodes nor value buffers are handed back before POOL_destroy, so
+*  memory once used by a pooled tree stays readable for its whole life.
+***************************************************************************/
+
+// a value buffer: its size class, then the characters
+typedef struct _ValueBuffer
+{
+	size_t sizeClass;
+	char data[];
+} ValueBuffer;
+
+#define POOL_VALUE_MIN 32
+
+// smallest size class that holds length bytes
+static size_t POOL_valueClass(size_t length)
+{
+	size_t sizeClass = 0;
+	while (((size_t)POOL_VALUE_MIN << sizeClass) < length) sizeClass++;
+	return sizeClass;
+}
+
+/* Creates an empty pool that grows {slabSize} nodes at a time. */
+NodePool* POOL_create(int slabSize)
+{
+	if (slabSize <= 0) { printf("slab size must be positive"); exit(EXIT_FAILURE); }
+
+	NodePool* pool = (NodePool*)calloc(1, sizeof(NodePool));
+	pool->slabs = pool->oldest = NULL;
+	pool->free = pool->freeTail = NULL;
+	pool->slabSize = slabSize;
+	pool->refs = 1;
+
+	int i;
+	for (i = 0; i < POOL_VALUE_CLASSES; i++) pool->freeVals[i] = pool->freeValTails[i] = NULL;
+	return pool;
+}
+
+/* Hands out an uninitialised node, reusing released nodes first. */
+Node* POOL_alloc(NodePool* pool)
+{
+	if (pool->free != NULL)
+	{
+		Node* x = pool->free;
+		pool->free = x->left;
+		return x;
+	}
+
+	NodeSlab* slab = pool->slabs;
+	if (slab == NULL || slab->used == slab->capacity)
+	{
+		// zeroed, so a node's links are never garbage, not even before its first use
+		slab = (NodeSlab*)calloc(1, sizeof(NodeSlab) + (size_t)pool->slabSize * sizeof(Node));
+		if (slab == NULL) { printf("out of memory allocating node slab"); exit(EXIT_FAILURE); }
+
+		slab->next = pool->slabs;
+		slab->used = 0;
+		slab->capacity = pool->slabSize;
+		if (pool->slabs == NULL) pool->oldest = slab;
+		pool->slabs = slab;
+	}
+	return &slab->nodes[slab->used++];
+}
+
+/* Returns a node to the free list. Its value must already be released. */
+void POOL_release(NodePool* pool, Node* x)
+{
+	x->val = NULL;
+	x->left = pool->free;
+	if (pool->free == NULL) pool->freeTail = x;
+	pool->free = x;
+}
+
+/* Hands out a buffer of at least {length} bytes for a value, reusing released buffers of the same size class. */
+char* POOL_allocVal(NodePool* pool, size_t length)
+{
+	size_t sizeClass = POOL_valueClass(length);
+	if (sizeClass >= POOL_VALUE_CLASSES) { printf("value too large for the pool"); exit(EXIT_FAILURE); }
+
+	char* val = pool->freeVals[sizeClass];
+	if (val != NULL)
+	{
+		memcpy(&pool->freeVals[sizeClass], val, sizeof(char*));
+		return val;
+	}
+
+	ValueBuffer* buffer = (ValueBuffer*)malloc(sizeof(ValueBuffer) + ((size_t)POOL_VALUE_MIN << sizeClass));
+	if (buffer == NULL) { printf("out of memory allocating value"); exit(EXIT_FAILURE); }
+
+	buffer->sizeClass = sizeClass;
+	return buffer->data;
+}
+
+/* Returns a value buffer from POOL_allocVal to its size class. */
+void POOL_releaseVal(NodePool* pool, char* val)
+{
+	ValueBuffer* buffer = (ValueBuffer*)(val - offsetof(ValueBuffer, data));
+	memcpy(val, &pool->freeVals[buffer->sizeClass], sizeof(char*));
+	if (pool->freeVals[buffer->sizeClass] == NULL) pool->freeValTails[buffer->sizeClass] = val;
+	pool->freeVals[buffer->sizeClass] = val;
+}
+
+/* Number of bytes a value buffer from POOL_allocVal can hold. */
+size_t POOL_valCapacity(const char* val)
+{
+	const ValueBuffer* buffer = (const ValueBuffer*)(val - offsetof(ValueBuffer, data));
+	return (size_t)POOL_VALUE_MIN << buffer->sizeClass;
+}
+
+/* Lets one more tree use {pool}. Each user must call POOL_destroy once. */
+NodePool* POOL_share(NodePool* pool)
+{
+	if (pool != NULL) pool->refs++;
+	return pool;
+}
+
+bool POOL_isShared(const NodePool* pool)
+{
+	return pool != NULL && pool->refs > 1;
+}
+
+/* Moves every slab, released node and released value buffer of {other} into {pool}
+   and frees {other}, so nodes allocated from either now belong to {pool}. Each list is
+   spliced on at its tail, so this takes O(1). Returns false, and changes nothing, when
+   other trees still use {other}. */
+bool POOL_adopt(NodePool* pool, NodePool* other)
+{
+	if (other == NULL || other == pool) return true;
+	if (POOL_isShared(other)) return false;
+
+	// older slabs go to the back so the slab being carved stays in front
+	if (other->slabs != NULL)
+	{
+		if (pool->slabs == NULL) pool->slabs = other->slabs;
+		else pool->oldest->next = other->slabs;
+		pool->oldest = other->oldest;
+	}
+
+	if (other->free != NULL)
+	{
+		other->freeTail->left = pool->free;
+		if (pool->free == NULL) pool->freeTail = other->freeTail;
+		pool->free = other->free;
+	}
+
+	int c;
+	for (c = 0; c < POOL_VALUE_CLASSES; c++)
+	{
+		if (other->freeVals[c] == NULL) continue;
+
+		// the tail of other's list links on to pool's list
+		memcpy(other->freeValTails[c], &pool->freeVals[c], sizeof(char*));
+		if (pool->freeVals[c] == NULL) pool->freeValTails[c] = other->freeValTails[c];
+		pool->freeVals[c] = other->freeVals[c];
+	}
+	free(other);
+	return true;
+}
+
+/* Releases every value still held by the pool's nodes, then the slabs themselves.
+   Slots are visited in address order, so no tree walk is needed. A shared pool only
+   loses one user. */
+void POOL_destroy(NodePool* pool)
+{
+	if (pool == NULL) return;
+	if (--pool->refs > 0) return;
+
+	NodeSlab* slab = pool->slabs;
+	while (slab != NULL)
+	{
+		int i;
+		for (i = 0; i < slab->used; i++)
+		{
+			NODE_releaseVal(pool, &slab->nodes[i]);
+		}
+
+		NodeSlab* release = slab;
+		slab = slab->next;
+		free(release);
+	}
+
+	// every value is on a free list by now
+	int c;
+	for (c = 0; c < POOL_VALUE_CLASSES; c++)
+	{
+		char* val = pool->freeVals[c];
+		while (val != NULL)
+		{
+			char* next;
+			memcpy(&next, val, sizeof(char*));
+			free(val - offsetof(ValueBuffer, data));
+			val = next;
+		}
+	}
+	free(pool);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "RedBlackTree.h"
+
+#define POOL_DEFAULT_SLAB 256
+#define POOL_VALUE_CLASSES 27		// heap value size classes, 32 bytes doubling up to 2GB
+
+typedef struct _NodeSlab
+{
+	struct _NodeSlab* next;		// next (older) slab owned by the pool
+	int used;					// slots handed out so far
+	int capacity;				// number of slots in this slab
+	Node nodes[];				// contiguous node storage
+} NodeSlab;
+
+struct _NodePool
+{
+	NodeSlab* slabs;			// newest slab first
+	NodeSlab* oldest;			// last slab on the list, so another pool's slabs splice on in O(1)
+	Node* free;					// released nodes, linked through ->left
+	Node* freeTail;				// last node on the free list, stale while the list is empty
+	int slabSize;				// slots per newly allocated slab
+	char* freeVals[POOL_VALUE_CLASSES];	// released value buffers by size class, linked through their first bytes
+	char* freeValTails[POOL_VALUE_CLASSES];	// last buffer on each list, stale while the list is empty
+	int refs;					// trees using the pool, it is destroyed when the last lets go
+};
+
+NodePool*	POOL_create(int slabSize);
+Node*		POOL_alloc(NodePool* pool);
+void		POOL_release(NodePool* pool, Node* x);
+char*		POOL_allocVal(NodePool* pool, size_t length);
+void		POOL_releaseVal(NodePool* pool, char* val);
+size_t		POOL_valCapacity(const char* val);
+NodePool*	POOL_share(NodePool* pool);
+bool		POOL_isShared(const NodePool* pool);
+bool		POOL_adopt(NodePool* pool, NodePool* other);
+void		POOL_destroy(NodePool* pool);
@@ -0,0 +1,467 @@
+// pthread_rwlock_t is POSIX, not C11
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "RedBlackTreeSharded.h"
+
+struct _ShardLock
+{
+	_Alignas(64) pthread_rwlock_t rw;	// each lock on cache lines of its own
+};
+
+#pragma region Private SHARD_* functions
+
+// lower bound of shard i's range. A boundary only moves while both shards next to it are
+// write locked, so it is stable for as long as either one is locked
+#define SHARD_LOWER(self, i) atomic_load_explicit(&(self)->lower[i], memory_order_relaxed)
+
+// index of the shard whose range holds key. Without a lock the boundaries may be moving,
+// so the answer is only a guess until SHARD_holds confirms it under the shard's lock
+static int SHARD_of(const ShardedBST* self, Key key)
+{
+	int lo = 1, hi = self->count - 1, shard = 0;
+	while (lo <= hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (SHARD_LOWER(self, mid) <= key)
+		{
+			shard = mid;
+			lo = mid + 1;
+		}
+		else hi = mid - 1;
+	}
+	return shard;
+}
+
+// with shards from and to locked: do shards from..to cover every key in [lo, hi]?
+static bool SHARD_holds(const ShardedBST* self, int from, int to, Key lo, Key hi)
+{
+	return (from == 0 || SHARD_LOWER(self, from) <= lo) && (to == self->count - 1 || hi < SHARD_LOWER(self, to + 1));
+}
+
+// lock shards from..to, always in ascending order so that no two threads can deadlock
+static void SHARD_lock(ShardedBST* self, int from, int to, bool write)
+{
+	int i;
+	for (i = from; i <= to; i++)
+	{
+		if (write) pthread_rwlock_wrlock(&self->shards[i].lock->rw);
+		else pthread_rwlock_rdlock(&self->shards[i].lock->rw);
+	}
+}
+
+static void SHARD_unlock(ShardedBST* self, int from, int to)
+{
+	int i;
+	for (i = to; i >= from; i--) pthread_rwlock_unlock(&self->shards[i].lock->rw);
+}
+
+// lock the shard that holds key and return its index. If a rebalance moved the key to a
+// neighbour between the guess and the lock, let go and follow it
+static int SHARD_lockKey(ShardedBST* self, Key key, bool write)
+{
+	while (true)
+	{
+		int s = SHARD_of(self, key);
+		SHARD_lock(self, s, s, write);
+		if (SHARD_holds(self, s, s, key, key)) return s;
+		SHARD_unlock(self, s, s);
+	}
+}
+
+// lock shards 0..s where s holds key, and return s
+static int SHARD_lockUpTo(ShardedBST* self, Key key)
+{
+	while (true)
+	{
+		int s = SHARD_of(self, key);
+		SHARD_lock(self, 0, s, false);
+		if (SHARD_holds(self, s, s, key, key)) return s;
+		SHARD_unlock(self, 0, s);
+	}
+}
+
+// count an operation against its shard: the one that brings a shard to SBST_REBALANCE_INTERVAL
+// checks for a hot shard, so no counter is shared between shards
+static bool SHARD_tick(Shard* shard)
+{
+	return atomic_fetch_add_explicit(&shard->load, 1, memory_order_relaxed) + 1 == SBST_REBALANCE_INTERVAL;
+}
+
+// move the lower half of shard hot into its left neighbour. RBT_split and RBT_join
+// keep each tree's seq, dead count and cached ends right as the nodes change trees
+static void SHARD_shiftLeft(ShardedBST* self, int hot)
+{
+	RedBlackBST* from = &self->shards[hot].tree;
+	RedBlackBST* to = &self->shards[hot - 1].tree;
+	RedBlackBST upper = { .root = NULL };
+
+	Key median = RBT_select(from, RBT_size(from) / 2);
+	RBT_split(from, median, &upper);
+	RBT_join(to, from);
+	RBT_join(from, &upper);
+	atomic_store_explicit(&self->lower[hot], median, memory_order_relaxed);
+}
+
+// move the upper half of shard hot into its right neighbour
+static void SHARD_shiftRight(ShardedBST* self, int hot)
+{
+	RedBlackBST* from = &self->shards[hot].tree;
+	RedBlackBST* to = &self->shards[hot + 1].tree;
+	RedBlackBST upper = { .root = NULL };
+
+	Key median = RBT_select(from, RBT_size(from) / 2);
+	RBT_split(from, median, &upper);
+	RBT_join(&upper, to);
+	RBT_join(to, &upper);
+	atomic_store_explicit(&self->lower[hot + 1], median, memory_order_relaxed);
+}
+
+#pragma endregion
+
+/* Cuts [lo, hi] into {shards} equal ranges. Keys outside it go to the first or last shard. */
+void SBST_init(ShardedBST* self, int shards, Key lo, Key hi)
+{
+	if (shards <= 0) { printf("shard count must be positive"); exit(EXIT_FAILURE); }
+	if (lo > hi) { printf("empty key range for shards"); exit(EXIT_FAILURE); }
+
+	self->count = shards;
+	self->shards = (Shard*)aligned_alloc(_Alignof(Shard), (size_t)shards * sizeof(Shard));
+	self->lower = (_Atomic(Key)*)malloc((size_t)shards * sizeof(*self->lower));
+	self->locks = (ShardLock*)aligned_alloc(_Alignof(ShardLock), (size_t)shards * sizeof(ShardLock));
+	if (self->shards == NULL || self->lower == NULL || self->locks == NULL) { printf("out of memory creating shards"); exit(EXIT_FAILURE); }
+
+	int i;
+	for (i = 0; i < shards; i++)
+	{
+		Shard* shard = &self->shards[i];
+		shard->lock = &self->locks[i];
+		pthread_rwlock_init(&shard->lock->rw, NULL);
+		shard->tree.root = NULL;
+		shard->tree.pool = NULL;	// nodes move between shards, so they share the general allocator
+		shard->tree.seq = 0;
+		shard->tree.starved = 0;
+#ifdef RBT_PRIORITY_QUEUE
+		shard->tree.first = shard->tree.last = NULL;
+#endif
+#ifdef RBT_LAZY_DELETE
+		shard->tree.dead = 0;
+		shard->tree.sweeping = false;
+#endif
+		atomic_init(&shard->size, 0);
+		atomic_init(&shard->load, 0);
+
+		atomic_init(&self->lower[i], (Key)(lo + ((long long)hi - lo + 1) * i / shards));
+	}
+}
+
+/* Frees every shard. No other thread may be using the tree. */
+void SBST_free(ShardedBST* self)
+{
+	int i;
+	for (i = 0; i < self->count; i++)
+	{
+		RBT_free(&self->shards[i].tree);
+		pthread_rwlock_destroy(&self->shards[i].lock->rw);
+	}
+	free(self->shards);
+	free(self->lower);
+	free(self->locks);
+	self->shards = NULL;
+	self->lower = NULL;
+	self->locks = NULL;
+	self->count = 0;
+}
+
+/* Inserts or overwrites {key}, locking only the shard that holds it. */
+void SBST_put(ShardedBST* self, Key key, Value val)
+{
+	int s = SHARD_lockKey(self, key, true);
+	Shard* shard = &self->shards[s];
+
+	RBT_put(&shard->tree, key, val);
+	atomic_store_explicit(&shard->size, RBT_size(&shard->tree), memory_order_relaxed);
+	bool check = SHARD_tick(shard);
+
+	SHARD_unlock(self, s, s);
+	if (check) SBST_rebalance(self);
+}
+
+/* Removes {key}, if present, locking only the shard that holds it. */
+void SBST_remove(ShardedBST* self, Key key)
+{
+	int s = SHARD_lockKey(self, key, true);
+	Shard* shard = &self->shards[s];
+
+	RBT_remove(&shard->tree, key);
+	atomic_store_explicit(&shard->size, RBT_size(&shard->tree), memory_order_relaxed);
+	bool check = SHARD_tick(shard);
+
+	SHARD_unlock(self, s, s);
+	if (check) SBST_rebalance(self);
+}
+
+/* Copies the value stored for {key} into {out} (truncated to {outSize} bytes).
+   The value cannot be handed out by pointer, another thread may replace it. */
+bool SBST_get(ShardedBST* self, Key key, char* out, size_t outSize)
+{
+	int s = SHARD_lockKey(self, key, false);
+	Shard* shard = &self->shards[s];
+
+	Value* val = RBT_get(&shard->tree, key);
+	if (val != NULL && out != NULL && outSize > 0) snprintf(out, outSize, "%s", *val);
+	bool check = SHARD_tick(shard);
+
+	SHARD_unlock(self, s, s);
+	if (check) SBST_rebalance(self);
+	return val != NULL;
+}
+
+bool SBST_contains(ShardedBST* self, Key key)
+{
+	return SBST_get(self, key, NULL, 0);
+}
+
+/* Returns the number of keys across all shards, as of one moment. */
+int SBST_size(ShardedBST* self)
+{
+	SHARD_lock(self, 0, self->count - 1, false);
+
+	int size = 0, i;
+	for (i = 0; i < self->count; i++) size += RBT_size(&self->shards[i].tree);
+
+	SHARD_unlock(self, 0, self->count - 1);
+	return size;
+}
+
+/* Return the number of keys strictly less than {key}. Locks the shards up to {key}'s. */
+int SBST_rank(ShardedBST* self, Key key)
+{
+	int s = SHARD_lockUpTo(self, key);
+
+	int rank = RBT_rank(&self->shards[s].tree, key), i;
+	for (i = 0; i < s; i++) rank += RBT_size(&self->shards[i].tree);
+
+	SHARD_unlock(self, 0, s);
+	return rank;
+}
+
+/* Return the kth smallest key across all shards. */
+Key SBST_select(ShardedBST* self, int k)
+{
+	SHARD_lock(self, 0, self->count - 1, false);
+
+	int i;
+	Key key = 0;
+	bool found = false;
+	for (i = 0; i < self->count && k >= 0; i++)
+	{
+		int size = RBT_size(&self->shards[i].tree);
+		if (k < size)
+		{
+			key = RBT_select(&self->shards[i].tree, k);
+			found = true;
+			break;
+		}
+		k -= size;
+	}
+
+	SHARD_unlock(self, 0, self->count - 1);
+
+	if (!found) { printf("Illegal arguement"); exit(EXIT_FAILURE); }
+	return key;
+}
+
+/* Finds the largest key less than or equal to {key}, looking into lower shards when
+   {key}'s own shard has none. Returns false if there is no such key. */
+bool SBST_floor(ShardedBST* self, Key key, Key* out)
+{
+	int s = SHARD_of(self, key), from = s;
+	bool found = false;
+
+	while (true)
+	{
+		// the candidates from..s are locked together, so the answer holds for one moment
+		SHARD_lock(self, from, s, false);
+		if (!SHARD_holds(self, s, s, key, key))
+		{
+			// a rebalance moved the key away: start over from its new shard
+			SHARD_unlock(self, from, s);
+			s = from = SHARD_of(self, key);
+			continue;
+		}
+
+		int i;
+		for (i = s; i >= from && !found; i--)
+		{
+			RedBlackBST* tree = &self->shards[i].tree;
+			if (RBT_isEmpty(tree)) continue;
+
+			const Node* x = (i == s) ? RBT_floor(tree, key) : RBT_max_bykey(tree);
+			if (x != NULL)
+			{
+				*out = x->key;
+				found = true;
+			}
+		}
+		SHARD_unlock(self, from, s);
+		if (found || from == 0) break;
+
+		// widen to the nearest lower shard that looks non-empty
+		from--;
+		while (from > 0 && atomic_load_explicit(&self->shards[from].size, memory_order_relaxed) == 0) from--;
+	}
+
+	return found;
+}
+
+/* Finds the smallest key greater than or equal to {key}, looking into higher shards when
+   {key}'s own shard has none. Returns false if there is no such key. */
+bool SBST_ceiling(ShardedBST* self, Key key, Key* out)
+{
+	int s = SHARD_of(self, key), to = s;
+	bool found = false;
+
+	while (true)
+	{
+		SHARD_lock(self, s, to, false);
+		if (!SHARD_holds(self, s, s, key, key))
+		{
+			SHARD_unlock(self, s, to);
+			s = to = SHARD_of(self, key);
+			continue;
+		}
+
+		int i;
+		for (i = s; i <= to && !found; i++)
+		{
+			RedBlackBST* tree = &self->shards[i].tree;
+			if (RBT_isEmpty(tree)) continue;
+
+			const Node* x = (i == s) ? RBT_ceiling(tree, key) : RBT_min_bykey(tree);
+			if (x != NULL)
+			{
+				*out = x->key;
+				found = true;
+			}
+		}
+		SHARD_unlock(self, s, to);
+		if (found || to == self->count - 1) break;
+
+		// widen to the nearest higher shard that looks non-empty
+		to++;
+		while (to < self->count - 1 && atomic_load_explicit(&self->shards[to].size, memory_order_relaxed) == 0) to++;
+	}
+
+	return found;
+}
+
+/* Calls {func} for every key in [lo, hi] in order, with its value and {ctx}, while the
+   shards covering the range are locked. Returns the number of keys visited. */
+int SBST_keys_range(ShardedBST* self, Key lo, Key hi, void(*func)(Key, Value, void*), void* ctx)
+{
+	if (lo > hi) return 0;
+
+	int from, to;
+	while (true)
+	{
+		from = SHARD_of(self, lo);
+		to = SHARD_of(self, hi);
+		if (from > to) continue;	// read in the middle of a boundary move
+
+		SHARD_lock(self, from, to, false);
+		if (SHARD_holds(self, from, to, lo, hi)) break;
+		SHARD_unlock(self, from, to);
+	}
+
+	int visited = 0, i;
+	for (i = from; i <= to; i++)
+	{
+		RBT_Cursor cursor;
+		Node* x;
+		for (RBT_cursor_range(&cursor, &self->shards[i].tree, lo, hi); (x = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor))
+		{
+			func(x->key, x->val, ctx);
+			visited++;
+		}
+	}
+
+	SHARD_unlock(self, from, to);
+	return visited;
+}
+
+/* If one shard has taken more than SBST_HOT_RATIO times the average load of the other
+   shards since the last check, hands half of its keys to its less loaded neighbour and
+   moves the boundary with them. Only those two shards are locked while it does, and split
+   and join keep it O(log n). Called when a shard reaches SBST_REBALANCE_INTERVAL operations. */
+void SBST_rebalance(ShardedBST* self)
+{
+	if (self->count < 2) return;
+
+	// the loads keep counting while they are read, which only blurs the picture a little
+	long total = 0, hotLoad = -1;
+	int hot = 0, i;
+	for (i = 0; i < self->count; i++)
+	{
+		long load = atomic_load_explicit(&self->shards[i].load, memory_order_relaxed);
+		total += load;
+		if (load > hotLoad)
+		{
+			hotLoad = load;
+			hot = i;
+		}
+	}
+
+	// against the others' average, not the overall one: that includes the hot shard itself,
+	// which no shard can outrun SBST_HOT_RATIO times over when there are that few shards
+	if (hotLoad * (self->count - 1) > SBST_HOT_RATIO * (total - hotLoad))
+	{
+		long left = (hot > 0) ? atomic_load_explicit(&self->shards[hot - 1].load, memory_order_relaxed) : -1;
+		long right = (hot < self->count - 1) ? atomic_load_explicit(&self->shards[hot + 1].load, memory_order_relaxed) : -1;
+		int to = (right < 0 || (left >= 0 && left <= right)) ? hot - 1 : hot + 1;
+		int first = (to < hot) ? to : hot;
+
+		// the boundary between the two shards moves, so both are locked for writing
+		SHARD_lock(self, first, first + 1, true);
+		if (RBT_size(&self->shards[hot].tree) >= 2)
+		{
+			if (to < hot) SHARD_shiftLeft(self, hot);
+			else SHARD_shiftRight(self, hot);
+
+			atomic_store(&self->shards[hot].size, RBT_size(&self->shards[hot].tree));
+			atomic_store(&self->shards[to].size, RBT_size(&self->shards[to].tree));
+		}
+		SHARD_unlock(self, first, first + 1);
+	}
+
+	for (i = 0; i < self->count; i++) atomic_store_explicit(&self->shards[i].load, 0, memory_order_relaxed);
+}
+
+/* Checks every shard's tree and that each key lies inside its shard's range. */
+bool SBST_self_check(ShardedBST* self)
+{
+	SHARD_lock(self, 0, self->count - 1, false);
+
+	bool ok = true;
+	int i;
+	for (i = 0; i < self->count && ok; i++)
+	{
+		RedBlackBST* tree = &self->shards[i].tree;
+		if (!RBT_self_check(tree)) ok = false;
+		else if (atomic_load(&self->shards[i].size) != RBT_size(tree)) { printf("Shard size out of date\n"); ok = false; }
+		else if (!RBT_isEmpty(tree))
+		{
+			if (i > 0 && RBT_min_bykey(tree)->key < SHARD_LOWER(self, i)) { printf("Key below its shard\n"); ok = false; }
+			if (i < self->count - 1 && RBT_max_bykey(tree)->key >= SHARD_LOWER(self, i + 1)) { printf("Key above its shard\n"); ok = false; }
+		}
+	}
+
+	SHARD_unlock(self, 0, self->count - 1);
+	return ok;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "RedBlackTree.h"
+
+/***************************************************************************
+*  Sharded red-black tree.
+*  The key space is cut into ranges, each held by its own RedBlackBST behind
+*  its own reader-writer lock, so threads working on different ranges never
+*  contend. Operations that span shards lock the shards they need in
+*  ascending order. Shard boundaries move towards cold neighbours when one
+*  range takes a disproportionate share of the traffic. A boundary moves
+*  with both of its shards locked, so an operation finds its shard without
+*  any lock and checks the guess once it holds that shard's.
+***************************************************************************/
+
+#define SBST_REBALANCE_INTERVAL 65536	// operations on one shard between checks for a hot shard
+#define SBST_HOT_RATIO 2				// a shard is hot at this many times the other shards' average load
+
+// a reader-writer lock, kept out of this header so that including it needs no POSIX feature macros
+typedef struct _ShardLock ShardLock;
+
+typedef struct _Shard
+{
+	_Alignas(64) ShardLock* lock;	// guards tree
+	RedBlackBST tree;
+	atomic_int size;				// the tree's size, readable without the lock
+	atomic_long load;				// operations since the last rebalance
+} Shard;
+
+typedef struct _ShardedBST
+{
+	int count;						// number of shards
+	Shard* shards;
+	_Atomic(Key)* lower;			// smallest key of each shard's range, lower[0] is unused
+	ShardLock* locks;				// one per shard, a boundary moves with both its shards locked
+} ShardedBST;
+
+void SBST_init(ShardedBST* self, int shards, Key lo, Key hi);
+void SBST_free(ShardedBST* self);
+
+void SBST_put(ShardedBST* self, Key key, Value val);
+void SBST_remove(ShardedBST* self, Key key);
+
+bool SBST_get(ShardedBST* self, Key key, char* out, size_t outSize);
+bool SBST_contains(ShardedBST* self, Key key);
+int SBST_size(ShardedBST* self);
+
+int SBST_rank(ShardedBST* self, Key key);
+Key SBST_select(ShardedBST* self, int k);
+bool SBST_floor(ShardedBST* self, Key key, Key* out);
+bool SBST_ceiling(ShardedBST* self, Key key, Key* out);
+int SBST_keys_range(ShardedBST* self, Key lo, Key hi, void(*func)(Key, Value, void*), void* ctx);
+
+void SBST_rebalance(ShardedBST* self);
+bool SBST_self_check(ShardedBST* self);
@@ -1,74 +1,2718 @@
-#include <string.h>
-#include <stdio.h>
-#include <stdlib.h>
-
-#include "RedBlackTree.h"
-void printNode(RedBlackBST* self, Node* node);
-void testBST(RedBlackBST* self, int test_size);
-
-int main()
-{
-	RedBlackBST st = { .root = NULL }; 
-
-	testBST(&st, 20);
-
-	printf("Press enter to exit...");
-	getc(stdin);
-
-	RBT_free(&st);
-}
-
-void printNode(RedBlackBST* self, Node* node)
-{
-	printf("%d %s at %p => (%p)\n", node->key, *RBT_get(self, node->key), node, node->val);
-}
-
-void testBST(RedBlackBST* self, int test_size)
-{
-	KeyList *q;
-	int i;
-
-	// Add test_size nodes to the tree
-	for (i = 1; i <= test_size; i++)
-	{
-		char val[2];
-		sprintf(val, "%c", i % ((int)'Z' - 'A' - 1) + 'A' - 1);
-
-		RBT_put(self, i, val);
-	}
-
-	// Print the in order traversal
-	q = RBT_keys(self);
-	KL_forEach(self, q, printNode);
-
-	// Remove in order
-	for (i = 1; i <= test_size; i++)
-	{
-		RBT_remove(self, i);
-		KeyList *list = RBT_keys(self);
-		printf("---\n");
-		KL_forEach(self, list, printNode);
-	}
-
-	// Fill the tree back up for another test
-	for (i = 1; i <= test_size; i++)
-	{
-		char val[2];
-		sprintf(val, "%c", i % ((int)'Z' - 'A' - 1) + 'A' - 1);
-
-		RBT_put(self, i, val);
-	}
-
-	// Print the in order traversal
-	q = RBT_keys(self);
-	KL_forEach(self, q, printNode);
-	
-	// Remove the nodes by removing the root one at a time
-	while (!RBT_isEmpty(self))
-	{
-		RBT_remove(self, self->root->key);
-		KeyList *list = RBT_keys(self);
-		printf("---\n");
-		KL_forEach(self, list, printNode);
-	}
-}
\ No newline at end of file
+// the benchmarks use mmap's MAP_ANONYMOUS, pthread_attr_setstack and other calls that are POSIX or BSD, not C11
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "RedBlackTree.h"
+#include "RedBlackTreeCompact.h"
+#include "RedBlackTreeGeneric.h"
+#include "RedBlackTreeDurable.h"
+#include "RedBlackTreeSharded.h"
+#include "RedBlackTreeFrozen.h"
+#include "RedBlackTreePersistent.h"
+#include "RedBlackTreeCombining.h"
+#include "RedBlackTreeMapped.h"
+#include "RedBlackTreeBuffered.h"
+
+// string keys with the collation passed to the comparison as an extra argument
+static int compareNames(const char* a, const char* b, bool ignoreCase)
+{
+	for (; *a != '\0' && *b != '\0'; a++, b++)
+	{
+		int x = ignoreCase ? tolower((unsigned char)*a) : (unsigned char)*a;
+		int y = ignoreCase ? tolower((unsigned char)*b) : (unsigned char)*b;
+		if (x != y) return x - y;
+	}
+	return (unsigned char)*a - (unsigned char)*b;
+}
+DEFINE_RBT(NameBST, const char*, int, compareNames, true)
+
+// run the benchmarks after the demo
+//#define BENCHMARKS
+
+#ifdef BENCHMARKS
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "RedBlackTreeNode.h"
+
+// the same keys and order as RedBlackBST, once with the comparison inlined and once through a pointer
+static int (*volatile compareThroughPointer)(Key a, Key b);
+#define CMP_THROUGH_POINTER(a, b) compareThroughPointer((a), (b))
+DEFINE_RBT(InlineBST, Key, Value, RBT_CMP_NUMBER)
+DEFINE_RBT(PointerBST, Key, Value, CMP_THROUGH_POINTER)
+
+void benchReads(int n, int queries);
+void benchFrozen(int n, int queries);
+#ifdef RBT_PERSISTENT
+void benchPersistent(int n, double seconds);
+#endif
+void benchSharded(int keys, int opsPerThread);
+void benchOptimistic(int n, int queries, double seconds);
+void benchCombining(int keys, int opsPerThread);
+void benchSetOps(int n);
+void benchRangeDelete(int n);
+void benchQuantiles(int n, int rounds);
+void benchHinted(int n);
+void benchPriorityQueue(int n, int ops);
+void benchMapped(int n, int queries);
+void benchDurable(double seconds, int snapshotEvery);
+void testRecovery(int rounds);
+void benchBuffered(int n, int queries);
+void benchRemoveLatency(int n);
+void benchGeneric(int n, int queries);
+void benchPutBatch(int n);
+void benchWritePaths(int n);
+void benchCompact(int n, int queries);
+#ifdef RBT_AGGREGATE
+void benchAggregate(int n, int queries);
+#endif
+#endif // BENCHMARKS
+
+void printNode(RedBlackBST* self, Node* node);
+void testBST(RedBlackBST* self, int test_size);
+void testGetMany(int n);
+void testCompact(int n, int ops);
+void testKeys(void);
+void testDurableReopen(void);
+void testHints(int n);
+void testPoolMixing(int n);
+void testShardShift(int n);
+void testFrozen(int n, int queries);
+void testSetOps(int n);
+void testRangeRemoval(int n, int rounds);
+void testSelectMany(int n);
+void testEnds(int n, int ops);
+void testOptimistic(int n, int ops);
+void testCombining(int n, int ops);
+void testMapped(int n, int queries);
+void testBuffered(int n, int ops);
+#ifdef RBT_PERSISTENT
+void testPersistent(int n, int ops);
+#endif
+#ifdef RBT_AGGREGATE
+void testAggregate(int n, int queries);
+#endif
+#ifdef RBT_LAZY_DELETE
+void testLazyDelete(int n, int ops);
+#endif
+
+int main()
+{
+	RedBlackBST st = { .root = NULL }; 
+
+	testBST(&st, 20);
+	testGetMany(1000);
+	testCompact(2000, 100000);
+	testKeys();
+	testDurableReopen();
+	testHints(3000);
+	testPoolMixing(2000);
+	testShardShift(2000);
+	testFrozen(1001, 100000);
+	testSetOps(2000);
+	testRangeRemoval(2000, 40);
+	testSelectMany(1000);
+	testEnds(2000, 20000);
+	testOptimistic(2000, 20000);
+	testCombining(1000, 20000);
+	testMapped(2000, 20000);
+	testBuffered(2000, 20000);
+#ifdef RBT_PERSISTENT
+	testPersistent(2000, 20000);
+#endif
+#ifdef RBT_AGGREGATE
+	testAggregate(2000, 2000);
+#endif
+#ifdef RBT_LAZY_DELETE
+	testLazyDelete(2000, 20000);
+#endif
+
+#ifdef BENCHMARKS
+	benchReads(1000000, 2000000);
+	benchFrozen(1000000, 2000000);
+#ifdef RBT_PERSISTENT
+	benchPersistent(1000000, 0.5);
+#endif
+	benchSharded(1 << 20, 100000);
+	benchOptimistic(1000000, 2000000, 0.5);
+	benchCombining(1 << 16, 50000);
+	benchSetOps(2000000);
+	benchRangeDelete(2000000);
+	benchQuantiles(1000000, 10000);
+	benchHinted(2000000);
+	benchPriorityQueue(1000000, 2000000);
+	benchMapped(1000000, 2000000);
+	benchDurable(1.0, 100000);
+	testRecovery(5);
+	benchBuffered(2000000, 1000000);
+	benchRemoveLatency(1000000);
+	benchGeneric(1000000, 2000000);
+	benchPutBatch(1000000);
+	benchWritePaths(1000000);
+	benchCompact(10000000, 2000000);
+#ifdef RBT_AGGREGATE
+	benchAggregate(1000000, 1000);
+#endif
+#endif // BENCHMARKS
+
+	printf("Press enter to exit...");
+	getc(stdin);
+
+	RBT_free(&st);
+}
+
+void printNode(RedBlackBST* self, Node* node)
+{
+	printf("%d %s at %p => (%p)\n", node->key, *RBT_get(self, node->key), node, node->val);
+}
+
+void testBST(RedBlackBST* self, int test_size)
+{
+	KeyList *q;
+	int i;
+
+	// Add test_size nodes to the tree
+	for (i = 1; i <= test_size; i++)
+	{
+		char val[2];
+		sprintf(val, "%c", i % ((int)'Z' - 'A' - 1) + 'A' - 1);
+
+		RBT_put(self, i, val);
+	}
+
+	// Print the in order traversal
+	q = RBT_keys(self);
+	KL_forEach(self, q, printNode);
+
+	// Remove in order
+	for (i = 1; i <= test_size; i++)
+	{
+		RBT_remove(self, i);
+		KeyList *list = RBT_keys(self);
+		printf("---\n");
+		KL_forEach(self, list, printNode);
+	}
+
+	// Fill the tree back up for another test
+	for (i = 1; i <= test_size; i++)
+	{
+		char val[2];
+		sprintf(val, "%c", i % ((int)'Z' - 'A' - 1) + 'A' - 1);
+
+		RBT_put(self, i, val);
+	}
+
+	// Print the in order traversal
+	q = RBT_keys(self);
+	KL_forEach(self, q, printNode);
+	
+	// Remove the nodes by removing the root one at a time
+	while (!RBT_isEmpty(self))
+	{
+		RBT_remove(self, self->root->key);
+		KeyList *list = RBT_keys(self);
+		printf("---\n");
+		KL_forEach(self, list, printNode);
+	}
+}
+
+/* RBT_get_many against RBT_get on the same keys: present, absent and repeated keys, in
+   batches of every size from empty to several times the number of lookups it runs at once. */
+void testGetMany(int n)
+{
+	RedBlackBST tree = { .root = NULL };
+	Key keys[64];
+	Value* out[64];
+	int i, batch, round, mismatches = 0;
+
+	// once on the empty tree, then on the even keys 2..2n
+	for (round = 0; round < 2; round++)
+	{
+		if (round == 1) for (i = 1; i <= n; i++) RBT_put(&tree, 2 * i, "v");
+
+		for (batch = 0; batch <= 64; batch++)
+		{
+			// odd keys and keys past 2n miss, and every third key repeats the one before it
+			for (i = 0; i < batch; i++) keys[i] = (i % 3 == 2) ? keys[i - 1] : rand() % (2 * n + 10) + 1;
+
+			RBT_get_many(&tree, keys, out, batch);
+			for (i = 0; i < batch; i++) if (out[i] != RBT_get(&tree, keys[i])) mismatches++;
+		}
+	}
+
+	printf("get_many against get: %s\n", mismatches == 0 ? "same results" : "results differ!");
+	RBT_free(&tree);
+}
+
+/* Key 0 and negative keys in RedBlackBST, and a DEFINE_RBT tree whose comparison takes
+   an extra argument: names compared without regard to case. */
+void testKeys(void)
+{
+	RedBlackBST tree = { .root = NULL };
+	NameBST names;
+	bool same = true;
+	int k;
+
+	for (k = -3; k <= 3; k++) RBT_put(&tree, k, "v");
+	same = same && RBT_size(&tree) == 7 && RBT_contains(&tree, 0) && RBT_rank(&tree, 0) == 3 && RBT_select(&tree, 3) == 0;
+	RBT_remove(&tree, 0);
+	same = same && RBT_size(&tree) == 6 && !RBT_contains(&tree, 0) && RBT_rank(&tree, 1) == 3;
+
+	NameBST_init(&names);
+	NameBST_put(&names, "bob", 1);
+	NameBST_put(&names, "Alice", 2);
+	NameBST_put(&names, "BOB", 3);
+	NameBST_put(&names, "carol", 4);
+	same = same && NameBST_size(&names) == 3 && *NameBST_get(&names, "Bob") == 3;
+	same = same && strcmp(NameBST_select(&names, 0), "Alice") == 0 && strcmp(NameBST_select(&names, 2), "carol") == 0;
+	same = same && NameBST_self_check(&names);
+
+	printf("key 0 and extra comparison arguments: %s\n", same ? "handled" : "mishandled!");
+	NameBST_free(&names);
+	RBT_free(&tree);
+}
+
+void removeDurableFiles(const char* path)
+{
+	char file[256];
+	snprintf(file, sizeof(file), "%s.wal", path);
+	remove(file);
+	snprintf(file, sizeof(file), "%s.snap", path);
+	remove(file);
+	snprintf(file, sizeof(file), "%s.snap.tmp", path);
+	remove(file);
+}
+
+/* A durable tree written with key 0 among other keys, reopened once from the log alone and
+   once from a snapshot: both must give back every write, with nothing taken for a torn log. */
+void testDurableReopen(void)
+{
+	const char* path = "testDurableReopen";
+	const Key keys[] = { 5, 0, 7, -3 };
+	DurableBST tree;
+	bool same = true;
+	int round, i;
+
+	removeDurableFiles(path);
+	for (round = 0; round < 3 && same; round++)
+	{
+		same = DBST_open(&tree, path, 1, 0);
+		if (!same) break;
+		if (round == 0)
+		{
+			for (i = 0; i < 4; i++) DBST_put(&tree, keys[i], "v");
+			DBST_remove(&tree, 5);
+		}
+		else
+		{
+			// the first reopen replays all five writes, the second starts from the snapshot
+			same = tree.recovered == (round == 1 ? 5 : 0) && RBT_size(&tree.tree) == 3 && RBT_self_check(&tree.tree);
+			for (i = 1; i < 4 && same; i++) same = RBT_contains(&tree.tree, keys[i]);
+			if (round == 1) same = same && DBST_checkpoint(&tree);
+		}
+		DBST_close(&tree);
+	}
+	removeDurableFiles(path);
+
+	printf("durable tree reopened with key 0: %s\n", same ? "every write back" : "writes lost!");
+}
+
+// do the two trees hold the same keys with the same values?
+static bool sameEntries(const RedBlackBST* a, const RedBlackBST* b)
+{
+	int size = RBT_size(a), k;
+	if (RBT_size(b) != size) return false;
+	for (k = 0; k < size; k++)
+	{
+		Key key = RBT_select(a, k);
+		Value* x = RBT_get(a, key);
+		Value* y = RBT_get(b, key);
+		if (RBT_select(b, k) != key || x == NULL || y == NULL || strcmp(*x, *y) != 0) return false;
+	}
+	return true;
+}
+
+/* RBT_put_hint against RBT_put on ascending, descending and random keys, with removals
+   in between to leave hints stale. A hint kept across RBT_free must fall back to a search
+   instead of following the freed nodes. */
+void testHints(int n)
+{
+	RedBlackBST hinted = { .root = NULL }, reference = { .root = NULL };
+	const char* values[] = { "a", "a value too long to be stored inline" };
+	RBT_Cursor hint;
+	bool same = true;
+	int stream, i;
+
+	RBT_use_pool(&hinted, 0);
+	RBT_cursor_init(&hint, &hinted);
+	for (stream = 0; stream < 3 && same; stream++)
+	{
+		for (i = 0; i < n; i++)
+		{
+			Key key = (stream == 0) ? i - n / 2 : (stream == 1) ? n - i : rand() % (2 * n) - n;
+			Value val = (Value)values[(i / 7) % 2];
+			RBT_put_hint(&hinted, &hint, key, val);
+			RBT_put(&reference, key, val);
+			if (i % 10 == 4)
+			{
+				key = rand() % (2 * n) - n;
+				RBT_remove(&hinted, key);
+				RBT_remove(&reference, key);
+			}
+		}
+		same = RBT_self_check(&hinted) && sameEntries(&hinted, &reference);
+
+		// the hint now sits in a tree that is about to go away
+		RBT_free(&hinted);
+		RBT_free(&reference);
+	}
+
+	printf("put_hint against put: %s\n", same ? "same results" : "results differ!");
+	RBT_free(&hinted);
+}
+
+/* RBT_join and RBT_union between a pooled and an unpooled tree, either way round, from a
+   pool a third tree still uses, and between two pools that merge. The nodes that cannot
+   share a pool are copied, and the result must match RBT_put, down to the writes after it
+   that reuse the merged free lists. */
+void testPoolMixing(int n)
+{
+	const char* values[] = { "a", "a value too long to be stored inline" };
+	bool same = true;
+	int mix, i;
+
+	// 0: only self pooled, 1: only other pooled, 2: other's pool shared with third, 3: all pooled
+	for (mix = 0; mix < 4 && same; mix++)
+	{
+		RedBlackBST self = { .root = NULL }, other = { .root = NULL }, third = { .root = NULL }, reference = { .root = NULL };
+		if (mix != 1) RBT_use_pool(&self, 64);
+		if (mix != 0) RBT_use_pool(&other, 64);
+		if (mix == 1 || mix == 3) RBT_use_pool(&third, 64);
+
+		for (i = 0; i < 3 * n; i++)
+		{
+			Value val = (Value)values[i % 2];
+			Key key = (i < 2 * n || mix == 2) ? i : (i * 7919) % (3 * n);
+			RBT_put(&reference, key, val);
+			RBT_put(i < n ? &self : (i < 2 * n || mix == 2) ? &other : &third, key, val);
+		}
+		if (mix == 2) RBT_split(&other, 2 * n, &third);
+
+		RBT_join(&self, &other);
+		RBT_union(&self, &third);
+		same = RBT_isEmpty(&other) && RBT_isEmpty(&third) && RBT_self_check(&self) && sameEntries(&self, &reference);
+
+		for (i = 0; i < n && same; i++)
+		{
+			Key key = rand() % (3 * n);
+			if (i % 2 == 0)
+			{
+				RBT_remove(&self, key);
+				RBT_remove(&reference, key);
+			}
+			else
+			{
+				RBT_put(&self, key, (Value)values[1]);
+				RBT_put(&reference, key, (Value)values[1]);
+			}
+		}
+		same = same && RBT_self_check(&self) && sameEntries(&self, &reference);
+
+		RBT_free(&self);
+		RBT_free(&other);
+		RBT_free(&third);
+		RBT_free(&reference);
+	}
+
+	printf("join and union across node pools: %s\n", same ? "same results" : "results differ!");
+}
+
+// does the sharded tree hold the same keys, in the same order, as the reference?
+static bool shardedMatches(ShardedBST* sharded, const RedBlackBST* reference)
+{
+	int size = RBT_size(reference), k;
+	if (!SBST_self_check(sharded) || SBST_size(sharded) != size) return false;
+	for (k = 0; k < size; k++)
+	{
+		Key key = RBT_select(reference, k);
+		if (SBST_select(sharded, k) != key || SBST_rank(sharded, key) != k || !SBST_contains(sharded, key)) return false;
+	}
+	return true;
+}
+
+/* Reads on the lowest shard only make it hot, so the rebalance moves half of it into its
+   neighbour, with two shards as with four. Both shards must keep working afterwards, down
+   to removing every key, with the cached ends of RBT_PRIORITY_QUEUE following the nodes
+   that changed trees. */
+void testShardShift(int n)
+{
+	bool same = true;
+	int shards, i;
+
+	for (shards = 2; shards <= 4 && same; shards += 2)
+	{
+		ShardedBST sharded;
+		RedBlackBST reference = { .root = NULL };
+
+		SBST_init(&sharded, shards, 0, n - 1);
+		for (i = 0; i < n; i++)
+		{
+			Key key = (i * 7) % n;
+			SBST_put(&sharded, key, "v");
+			RBT_put(&reference, key, "v");
+		}
+		for (i = 0; i < 8 * n; i++) SBST_contains(&sharded, i % (n / shards));
+
+		SBST_rebalance(&sharded);
+		Key lower = sharded.lower[1];
+		same = lower != n / shards && shardedMatches(&sharded, &reference);
+
+		// every key in order, emptying shard after shard through their cached ends
+		for (i = 0; i < n && same; i++)
+		{
+			SBST_remove(&sharded, i);
+			RBT_remove(&reference, i);
+			if (i % 100 == 0 || i == lower - 1 || i == lower) same = shardedMatches(&sharded, &reference);
+		}
+		same = same && SBST_size(&sharded) == 0 && SBST_self_check(&sharded);
+
+		SBST_free(&sharded);
+		RBT_free(&reference);
+	}
+
+	printf("sharded tree after a rebalance: %s\n", same ? "same results" : "results differ!");
+}
+
+// any int, INT_MIN and INT_MAX included
+static Key randomKey(void)
+{
+	return (Key)(((unsigned)rand() << 16) ^ (unsigned)rand());
+}
+
+/* A frozen copy against the live tree it was made from, with keys and queries spread over
+   the whole int range and the extremes among them. Run once with INT_MAX in the tree and
+   once without, since the frozen layout pads its last block with INT_MAX. */
+void testFrozen(int n, int queries)
+{
+	const Key extremes[] = { INT_MIN, INT_MIN + 1, -1, 0, 1, INT_MAX - 1, INT_MAX };
+	bool same = true;
+	int round, i;
+
+	for (round = 0; round < 2 && same; round++)
+	{
+		RedBlackBST live = { .root = NULL };
+		for (i = 0; i < n; i++) RBT_put(&live, randomKey(), "v");
+		RBT_put(&live, INT_MIN, "min");
+		if (round == 0) RBT_put(&live, INT_MAX, "max");
+		else RBT_remove(&live, INT_MAX);
+
+		FrozenBST* frozen = RBT_freeze(&live);
+		same = FRZ_size(frozen) == RBT_size(&live);
+		for (i = 0; i < queries && same; i++)
+		{
+			Key key = (i < 7) ? extremes[i] : (i % 2 == 0) ? randomKey() : RBT_select(&live, rand() % RBT_size(&live));
+			Value* x = RBT_get(&live, key);
+			Value* y = FRZ_get(frozen, key);
+			const Node* floor = RBT_floor(&live, key);
+			const Node* ceiling = RBT_ceiling(&live, key);
+			const Key* frozenFloor = FRZ_floor(frozen, key);
+			const Key* frozenCeiling = FRZ_ceiling(frozen, key);
+
+			same = (x == NULL) == (y == NULL) && (x == NULL || strcmp(*x, *y) == 0)
+				&& FRZ_contains(frozen, key) == (x != NULL) && FRZ_rank(frozen, key) == RBT_rank(&live, key)
+				&& (floor == NULL) == (frozenFloor == NULL) && (floor == NULL || floor->key == *frozenFloor)
+				&& (ceiling == NULL) == (frozenCeiling == NULL) && (ceiling == NULL || ceiling->key == *frozenCeiling);
+		}
+		for (i = 0; i < RBT_size(&live) && same; i++) same = FRZ_select(frozen, i) == RBT_select(&live, i);
+
+		FRZ_free(frozen);
+		RBT_free(&live);
+	}
+
+	printf("frozen against live over the int range: %s\n", same ? "same results" : "results differ!");
+}
+
+/* RBT_union, RBT_intersect and RBT_difference against putting or removing the keys of the
+   other tree one at a time. The two trees overlap in part and hold values of both lengths,
+   and each operation runs once with both trees pooled and once with neither. */
+void testSetOps(int n)
+{
+	const char* values[] = { "a", "b", "a value too long to be stored inline" };
+	bool same = true;
+	int round, i;
+
+	// 0: union, 1: intersect, 2: difference, each pooled and then not
+	for (round = 0; round < 6 && same; round++)
+	{
+		RedBlackBST self = { .root = NULL }, other = { .root = NULL }, reference = { .root = NULL };
+		int op = round / 2;
+		if (round % 2 == 0)
+		{
+			RBT_use_pool(&self, 64);
+			RBT_use_pool(&other, 64);
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			Key key = rand() % (2 * n);
+			RBT_put(&self, key, (Value)values[i % 2]);
+			RBT_put(&reference, key, (Value)values[i % 2]);
+			RBT_put(&other, rand() % (2 * n) + n / 2, (Value)values[2 - i % 2]);
+		}
+
+		for (i = 0; i < 3 * n; i++)
+		{
+			Value* val = RBT_get(&other, i);
+			if (op == 0 && val != NULL) RBT_put(&reference, i, *val);
+			else if ((op == 1) == (val == NULL)) RBT_remove(&reference, i);
+		}
+
+		if (op == 0) RBT_union(&self, &other);
+		else if (op == 1) RBT_intersect(&self, &other);
+		else RBT_difference(&self, &other);
+		same = RBT_isEmpty(&other) && RBT_self_check(&self) && sameEntries(&self, &reference);
+
+		RBT_free(&self);
+		RBT_free(&other);
+		RBT_free(&reference);
+	}
+
+	printf("set operations against single puts and removes: %s\n", same ? "same results" : "results differ!");
+}
+
+/* RBT_remove_range and RBT_extract_range against removing the keys of the range one at a
+   time, on a pooled tree. Ranges may be empty, reversed or reach past either end. */
+void testRangeRemoval(int n, int rounds)
+{
+	RedBlackBST tree = { .root = NULL }, reference = { .root = NULL };
+	bool same = true;
+	int round, i;
+
+	RBT_use_pool(&tree, 64);
+	for (i = 0; i < n; i++)
+	{
+		Key key = rand() % (2 * n);
+		RBT_put(&tree, key, "v");
+		RBT_put(&reference, key, "v");
+	}
+
+	for (round = 0; round < rounds && same; round++)
+	{
+		Key lo = rand() % (2 * n + 20) - 10, hi = lo + rand() % (n / 8) - n / 64, key;
+		int removed, expected = 0;
+
+		if (round % 2 == 0) removed = RBT_remove_range(&tree, lo, hi);
+		else
+		{
+			RedBlackBST range = RBT_extract_range(&tree, lo, hi);
+			removed = RBT_size(&range);
+			same = RBT_self_check(&range) && (removed == 0 || (RBT_min_bykey(&range)->key >= lo && RBT_max_bykey(&range)->key <= hi));
+			RBT_free(&range);
+		}
+
+		for (key = lo; key <= hi; key++)
+		{
+			if (!RBT_contains(&reference, key)) continue;
+			RBT_remove(&reference, key);
+			expected++;
+		}
+		same = same && removed == expected && RBT_self_check(&tree) && sameEntries(&tree, &reference);
+
+		// refill part of what went, so later ranges find keys again
+		for (i = 0; i < n / 20; i++)
+		{
+			key = rand() % (2 * n);
+			RBT_put(&tree, key, "v");
+			RBT_put(&reference, key, "v");
+		}
+	}
+
+	printf("range removal against single removes: %s\n", same ? "same results" : "results differ!");
+	RBT_free(&tree);
+	RBT_free(&reference);
+}
+
+/* RBT_select_many, RBT_rank_many and RBT_histogram against RBT_select and RBT_rank, in
+   batches of every size from empty to 64, with repeated ranks and keys that are absent. */
+void testSelectMany(int n)
+{
+	RedBlackBST tree = { .root = NULL };
+	int ranks[64], counts[64], out[64];
+	Key keys[65], selected[64];
+	int i, batch, size, mismatches = 0;
+
+	for (i = 0; i < n; i++) RBT_put(&tree, rand() % (4 * n), "v");
+	size = RBT_size(&tree);
+
+	for (batch = 0; batch <= 64; batch++)
+	{
+		// ascending ranks and keys, each step small enough to repeat now and then
+		for (i = 0; i < batch; i++)
+		{
+			ranks[i] = (i == 0) ? rand() % (size / 4) : ranks[i - 1] + rand() % (size / batch + 1) / 2;
+			if (ranks[i] >= size) ranks[i] = size - 1;
+		}
+		for (i = 0; i <= batch; i++) keys[i] = (i == 0) ? rand() % n - n / 2 : keys[i - 1] + rand() % (8 * n / (batch + 1));
+
+		RBT_select_many(&tree, ranks, selected, batch);
+		RBT_rank_many(&tree, keys, out, batch);
+		if (batch > 0) RBT_histogram(&tree, keys, counts, batch);
+		for (i = 0; i < batch; i++)
+		{
+			if (selected[i] != RBT_select(&tree, ranks[i]) || out[i] != RBT_rank(&tree, keys[i])) mismatches++;
+			if (i < batch - 1 && counts[i] != RBT_rank(&tree, keys[i + 1]) - RBT_rank(&tree, keys[i])) mismatches++;
+		}
+		if (batch > 0 && counts[batch - 1] != RBT_rank(&tree, keys[batch]) - RBT_rank(&tree, keys[batch - 1])) mismatches++;
+	}
+
+	printf("select_many and rank_many against select and rank: %s\n", mismatches == 0 ? "same results" : "results differ!");
+	RBT_free(&tree);
+}
+
+/* RBT_pop_min, RBT_pop_max, RBT_min_bykey and RBT_max_bykey against RBT_select on a tree
+   that is put to, removed from, split and joined in between. RBT_self_check also checks
+   the cached ends of RBT_PRIORITY_QUEUE. */
+void testEnds(int n, int ops)
+{
+	RedBlackBST tree = { .root = NULL }, reference = { .root = NULL }, upper = { .root = NULL };
+	bool same = true;
+	int i;
+	Key k;
+
+	RBT_use_pool(&tree, 64);
+	for (i = 0; i < ops && same; i++)
+	{
+		Key key = rand() % (2 * n);
+		Node* popped = NULL;
+		int size = RBT_size(&reference);
+
+		switch (rand() % 8)
+		{
+		case 0:
+		case 1:
+		case 2:
+			RBT_put(&tree, key, "v");
+			RBT_put(&reference, key, "v");
+			break;
+		case 3:
+			RBT_remove(&tree, key);
+			RBT_remove(&reference, key);
+			break;
+		case 4:
+			popped = RBT_pop_min(&tree);
+			if (size > 0) key = RBT_select(&reference, 0);
+			break;
+		case 5:
+			popped = RBT_pop_max(&tree);
+			if (size > 0) key = RBT_select(&reference, size - 1);
+			break;
+		case 6:
+			RBT_remove_range(&tree, key, key + n / 64);
+			for (k = key; k <= key + n / 64; k++) RBT_remove(&reference, k);
+			break;
+		default:
+			RBT_split(&tree, key, &upper);
+			RBT_join(&tree, &upper);
+		}
+
+		if (popped != NULL || size == 0) same = (popped == NULL) == (size == 0) && (popped == NULL || popped->key == key);
+		if (popped != NULL) RBT_remove(&reference, key);
+		RBT_release(&tree, popped);
+
+		size = RBT_size(&reference);
+		same = same && RBT_size(&tree) == size;
+		if (size > 0) same = same && RBT_min_bykey(&tree)->key == RBT_select(&reference, 0) && RBT_max_bykey(&tree)->key == RBT_select(&reference, size - 1);
+		if (i % 500 == 0) same = same && RBT_self_check(&tree);
+	}
+	same = same && RBT_self_check(&tree) && sameEntries(&tree, &reference);
+
+	printf("priority queue ends against select: %s\n", same ? "same results" : "results differ!");
+	RBT_free(&tree);
+	RBT_free(&upper);
+	RBT_free(&reference);
+}
+
+typedef struct _OptimisticTest
+{
+	RedBlackBST* tree;
+	int n;
+	int ops;
+} OptimisticTest;
+
+// puts and removes on the odd keys only, leaving the even ones alone
+void* optimisticWriter(void* arg)
+{
+	OptimisticTest* test = (OptimisticTest*)arg;
+	unsigned seed = 12345;
+	int i;
+
+	for (i = 0; i < test->ops; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		Key key = 2 * (int)((seed >> 4) % (unsigned)test->n) + 1;
+		if (seed % 2 == 0) RBT_put(test->tree, key, "odd");
+		else RBT_remove(test->tree, key);
+	}
+	return NULL;
+}
+
+/* The lock-free reads against their locked counterparts, first on a quiet tree with writes
+   in between, then while a writer thread changes the odd keys: reads of the even keys it
+   leaves alone must come back exact, and their ranks within what the odd keys allow. */
+void testOptimistic(int n, int ops)
+{
+	RedBlackBST tree = { .root = NULL };
+	OptimisticTest test = { .tree = &tree, .n = n, .ops = ops };
+	pthread_t writer;
+	char value[64];
+	bool same = true;
+	int i;
+
+	RBT_use_pool(&tree, 64);
+	for (i = 0; i < n; i++) RBT_put(&tree, 2 * i, (i % 2 == 0) ? "even" : "an even key with a value too long to be stored inline");
+
+	for (i = 0; i < ops && same; i++)
+	{
+		Key key = rand() % (2 * n + 2) - 1, found;
+		Value* val = RBT_get(&tree, key);
+		const Node* floor = RBT_floor(&tree, key);
+		const Node* ceiling = RBT_ceiling(&tree, key);
+		bool hasFloor = RBT_optimistic_floor(&tree, key, &found);
+
+		same = RBT_optimistic_get(&tree, key, value, sizeof(value)) == (val != NULL) && (val == NULL || strcmp(value, *val) == 0)
+			&& hasFloor == (floor != NULL) && (floor == NULL || found == floor->key)
+			&& RBT_optimistic_rank(&tree, key) == RBT_rank(&tree, key);
+		bool hasCeiling = RBT_optimistic_ceiling(&tree, key, &found);
+		same = same && hasCeiling == (ceiling != NULL) && (ceiling == NULL || found == ceiling->key);
+
+		if (i % 4 == 0) RBT_put(&tree, 2 * (rand() % n) + 1, "odd");
+		if (i % 4 == 2) RBT_remove(&tree, 2 * (rand() % n) + 1);
+	}
+
+	pthread_create(&writer, NULL, optimisticWriter, &test);
+	for (i = 0; i < ops && same; i++)
+	{
+		int k = rand() % n, rank;
+		Key found = -1;
+		same = RBT_optimistic_get(&tree, 2 * k, value, sizeof(value)) && value[0] == (k % 2 == 0 ? 'e' : 'a');
+		same = same && RBT_optimistic_floor(&tree, 2 * k, &found) && found == 2 * k;
+		same = same && RBT_optimistic_ceiling(&tree, 2 * k, &found) && found == 2 * k;
+		rank = RBT_optimistic_rank(&tree, 2 * k);
+		same = same && rank >= k && rank <= 2 * k;
+	}
+	pthread_join(writer, NULL);
+	same = same && RBT_self_check(&tree);
+
+	printf("optimistic reads against locked reads: %s\n", same ? "same results" : "results differ!");
+	RBT_free(&tree);
+}
+
+typedef struct _CombiningTest
+{
+	FCBST* combined;
+	RedBlackBST reference;			// the keys this thread owns, as it wrote them
+	int id, threads;
+	int n;
+	int ops;
+	bool same;
+} CombiningTest;
+
+// puts, removes and gets through the combiner on the keys this thread owns, checked against its own tree
+void* combiningTester(void* arg)
+{
+	CombiningTest* test = (CombiningTest*)arg;
+	unsigned seed = (unsigned)test->id * 7919 + 1;
+	char value[64];
+	int i;
+
+	for (i = 0; i < test->ops && test->same; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		Key key = (Key)((seed >> 4) % (unsigned)test->n) * test->threads + test->id;
+		Value* val = RBT_get(&test->reference, key);
+
+		switch (seed % 4)
+		{
+		case 0:
+		case 1:
+			sprintf(value, (seed % 8 < 4) ? "%d" : "%d, a value too long to be stored inline", key);
+			FCBST_put(test->combined, key, value);
+			RBT_put(&test->reference, key, value);
+			break;
+		case 2:
+			test->same = FCBST_remove(test->combined, key) == (val != NULL);
+			RBT_remove(&test->reference, key);
+			break;
+		default:
+			test->same = FCBST_get(test->combined, key, value, sizeof(value)) == (val != NULL) && (val == NULL || strcmp(value, *val) == 0);
+		}
+	}
+	return NULL;
+}
+
+/* The flat-combining tree against RedBlackBST: one thread mixing every operation with
+   deleteMax, then four threads at once, each on keys of its own so that it can check every
+   result against a tree of its own. The combined tree must end up holding all their keys. */
+void testCombining(int n, int ops)
+{
+	FCBST combined;
+	CombiningTest tests[4];
+	pthread_t threads[4];
+	char value[64];
+	bool same = true;
+	int i, t, size = 0;
+
+	FCBST_init(&combined);
+	tests[0].reference = (RedBlackBST){ .root = NULL };
+	for (i = 0; i < ops && same; i++)
+	{
+		Key key = rand() % n, removed;
+		Value* val = RBT_get(&tests[0].reference, key);
+
+		switch (rand() % 5)
+		{
+		case 0:
+		case 1:
+			FCBST_put(&combined, key, "v");
+			RBT_put(&tests[0].reference, key, "v");
+			break;
+		case 2:
+			same = FCBST_remove(&combined, key) == (val != NULL);
+			RBT_remove(&tests[0].reference, key);
+			break;
+		case 3:
+			same = FCBST_get(&combined, key, value, sizeof(value)) == (val != NULL) && (val == NULL || strcmp(value, *val) == 0);
+			break;
+		default:
+			same = FCBST_deleteMax(&combined, &removed) == !RBT_isEmpty(&tests[0].reference);
+			if (!RBT_isEmpty(&tests[0].reference))
+			{
+				same = same && removed == RBT_max_bykey(&tests[0].reference)->key;
+				RBT_deleteMax(&tests[0].reference);
+			}
+		}
+	}
+	same = same && sameEntries(&combined.tree, &tests[0].reference) && RBT_self_check(&combined.tree);
+	RBT_free(&tests[0].reference);
+	FCBST_free(&combined);
+
+	FCBST_init(&combined);
+	for (t = 0; t < 4; t++)
+	{
+		tests[t] = (CombiningTest){ .combined = &combined, .reference = { .root = NULL }, .id = t, .threads = 4, .n = n, .ops = ops, .same = true };
+		pthread_create(&threads[t], NULL, combiningTester, &tests[t]);
+	}
+	for (t = 0; t < 4; t++)
+	{
+		pthread_join(threads[t], NULL);
+		same = same && tests[t].same;
+	}
+	for (t = 0; t < 4; t++)
+	{
+		for (i = 0; i < RBT_size(&tests[t].reference) && same; i++)
+		{
+			Key key = RBT_select(&tests[t].reference, i);
+			Value* val = RBT_get(&combined.tree, key);
+			same = val != NULL && strcmp(*val, *RBT_get(&tests[t].reference, key)) == 0;
+		}
+		size += RBT_size(&tests[t].reference);
+		RBT_free(&tests[t].reference);
+	}
+	same = same && RBT_size(&combined.tree) == size && RBT_self_check(&combined.tree);
+	FCBST_free(&combined);
+
+	printf("flat combining against RedBlackBST: %s\n", same ? "same results" : "results differ!");
+}
+
+/* A mapped image against the tree it was saved from, key 0, negative keys and values of
+   both lengths among them, then an image of an empty tree. */
+void testMapped(int n, int queries)
+{
+	const char* path = "testMapped.img";
+	const char* values[] = { "a", "a value too long to be stored inline" };
+	bool same = true;
+	int round, i;
+
+	for (round = 0; round < 2 && same; round++)
+	{
+		RedBlackBST tree = { .root = NULL };
+		if (round == 0)
+		{
+			for (i = 0; i < n; i++) RBT_put(&tree, rand() % (2 * n) - n, (Value)values[i % 2]);
+			RBT_put(&tree, 0, "zero");
+		}
+
+		MappedBST* mapped = RBT_save(&tree, path) ? RBT_open_mapped(path) : NULL;
+		same = mapped != NULL && MAP_self_check(mapped) && MAP_size(mapped) == RBT_size(&tree) && MAP_isEmpty(mapped) == RBT_isEmpty(&tree);
+		for (i = 0; i < queries && same; i++)
+		{
+			Key key = rand() % (2 * n + 2) - n - 1;
+			Value* x = RBT_get(&tree, key);
+			const char* y = MAP_get(mapped, key);
+			// floor and ceiling only take non-empty trees
+			const Node* floor = (round == 0) ? RBT_floor(&tree, key) : NULL;
+			const Node* ceiling = (round == 0) ? RBT_ceiling(&tree, key) : NULL;
+			const Key* mappedFloor = (round == 0) ? MAP_floor(mapped, key) : NULL;
+			const Key* mappedCeiling = (round == 0) ? MAP_ceiling(mapped, key) : NULL;
+
+			same = (x == NULL) == (y == NULL) && (x == NULL || strcmp(*x, y) == 0)
+				&& MAP_contains(mapped, key) == (x != NULL) && MAP_rank(mapped, key) == RBT_rank(&tree, key)
+				&& (floor == NULL) == (mappedFloor == NULL) && (floor == NULL || floor->key == *mappedFloor)
+				&& (ceiling == NULL) == (mappedCeiling == NULL) && (ceiling == NULL || ceiling->key == *mappedCeiling);
+		}
+		for (i = 0; i < RBT_size(&tree) && same; i++) same = MAP_select(mapped, i) == RBT_select(&tree, i);
+
+		if (mapped != NULL) MAP_close(mapped);
+		RBT_free(&tree);
+	}
+	remove(path);
+
+	printf("mapped image against the saved tree: %s\n", same ? "same results" : "results differ!");
+}
+
+typedef struct _BufferedVisit
+{
+	const RedBlackBST* reference;
+	Key previous;
+	int count;
+	bool same;
+} BufferedVisit;
+
+// every key visited must be in the reference with the same value, in ascending order
+static void visitBuffered(Key key, Value val, void* ctx)
+{
+	BufferedVisit* visit = (BufferedVisit*)ctx;
+	Value* expected = RBT_get(visit->reference, key);
+	if (expected == NULL || strcmp(*expected, val) != 0 || (visit->count > 0 && key <= visit->previous)) visit->same = false;
+	visit->previous = key;
+	visit->count++;
+}
+
+/* The buffered tree against RedBlackBST, with a buffer small enough to be merged many times
+   over: gets, floors, ceilings and range scans between the writes must see every write
+   whether it is still buffered or already merged. */
+void testBuffered(int n, int ops)
+{
+	const char* values[] = { "a", "b", "a value too long to be stored inline" };
+	BufferedBST buffered;
+	RedBlackBST reference = { .root = NULL };
+	bool same = true;
+	int i;
+
+	BBST_init(&buffered, 64);
+	for (i = 0; i < ops && same; i++)
+	{
+		Key key = rand() % n, found;
+		if (rand() % 3 == 0)
+		{
+			BBST_remove(&buffered, key);
+			RBT_remove(&reference, key);
+		}
+		else
+		{
+			BBST_put(&buffered, key, (Value)values[i % 3]);
+			RBT_put(&reference, key, (Value)values[i % 3]);
+		}
+
+		key = rand() % (n + 2) - 1;
+		Value* x = RBT_get(&reference, key);
+		Value* y = BBST_get(&buffered, key);
+		const Node* floor = RBT_isEmpty(&reference) ? NULL : RBT_floor(&reference, key);
+		const Node* ceiling = RBT_isEmpty(&reference) ? NULL : RBT_ceiling(&reference, key);
+		same = (x == NULL) == (y == NULL) && (x == NULL || strcmp(*x, *y) == 0) && BBST_contains(&buffered, key) == (x != NULL);
+		same = same && BBST_floor(&buffered, key, &found) == (floor != NULL) && (floor == NULL || found == floor->key);
+		same = same && BBST_ceiling(&buffered, key, &found) == (ceiling != NULL) && (ceiling == NULL || found == ceiling->key);
+
+		if (i % 100 == 0)
+		{
+			BufferedVisit visit = { .reference = &reference, .count = 0, .same = true };
+			int visited = BBST_keys_range(&buffered, key, key + n / 10, visitBuffered, &visit);
+			same = same && visit.same && visited == visit.count && visited == RBT_range_size(&reference, key, key + n / 10);
+		}
+	}
+	BBST_flush(&buffered);
+	same = same && RBT_self_check(&buffered.tree) && sameEntries(&buffered.tree, &reference);
+
+	printf("buffered tree against RedBlackBST: %s\n", same ? "same results" : "results differ!");
+	BBST_free(&buffered);
+	RBT_free(&reference);
+}
+
+#ifdef RBT_PERSISTENT
+// put every entry of {from} into {to}
+static void copyEntries(const RedBlackBST* from, RedBlackBST* to)
+{
+	RBT_Cursor cursor;
+	Node* x;
+	for (RBT_cursor_init(&cursor, from); (x = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor)) RBT_put(to, x->key, x->val);
+}
+
+/* The persistent tree against RedBlackBST under puts, removes and deleteMax. Every so often
+   a version is pinned and must match the reference at that moment, and still match a copy
+   of it after the writes that follow. */
+void testPersistent(int n, int ops)
+{
+	const char* values[] = { "a", "a value too long to be stored inline" };
+	PersistentBST persistent;
+	RedBlackBST reference = { .root = NULL };
+	bool same = true;
+	int i;
+
+	PBST_init(&persistent);
+	for (i = 0; i < ops && same; i++)
+	{
+		Key key = rand() % n;
+		switch (rand() % 6)
+		{
+		case 0:
+			PBST_remove(&persistent, key);
+			RBT_remove(&reference, key);
+			break;
+		case 1:
+			PBST_deleteMax(&persistent);
+			if (!RBT_isEmpty(&reference)) RBT_deleteMax(&reference);
+			break;
+		default:
+			PBST_put(&persistent, key, (Value)values[i % 2]);
+			RBT_put(&reference, key, (Value)values[i % 2]);
+		}
+
+		if (i % 1000 == 999)
+		{
+			RedBlackBST snapshot = { .root = NULL };
+			PBST_Pin pin = PBST_pin(&persistent);
+			copyEntries(&reference, &snapshot);
+			same = sameEntries(&pin.view, &reference);
+
+			// writes after the pin go to a new version
+			for (key = 0; key < n; key += 3) PBST_put(&persistent, key, "later");
+			for (key = 0; key < n; key += 3) RBT_put(&reference, key, "later");
+			same = same && RBT_self_check(&pin.view) && sameEntries(&pin.view, &snapshot);
+
+			PBST_unpin(&pin);
+			RBT_free(&snapshot);
+		}
+	}
+	PBST_Pin pin = PBST_pin(&persistent);
+	same = same && RBT_self_check(&pin.view) && sameEntries(&pin.view, &reference);
+	PBST_unpin(&pin);
+
+	printf("persistent versions against RedBlackBST: %s\n", same ? "same results" : "results differ!");
+	PBST_free(&persistent);
+	RBT_free(&reference);
+}
+#endif // RBT_PERSISTENT
+
+#ifdef RBT_AGGREGATE
+/* RBT_range_aggregate against combining the entries a cursor walks over the same range,
+   while puts and removes change the values below it. */
+void testAggregate(int n, int queries)
+{
+	RedBlackBST tree = { .root = NULL };
+	char value[16];
+	bool same = true;
+	int i;
+
+	for (i = 0; i < queries && same; i++)
+	{
+		Key key = rand() % n, lo = rand() % (n + 20) - 10, hi = lo + rand() % (n / 4) - n / 64;
+		RBT_Cursor cursor;
+		Node* x;
+
+		sprintf(value, "%d", rand() % 2001 - 1000);
+		RBT_put(&tree, key, value);
+		if (i % 3 == 0) RBT_remove(&tree, rand() % n);
+
+		Aggregate expected = AGG_identity(), range = RBT_range_aggregate(&tree, lo, hi);
+		RBT_cursor_range(&cursor, &tree, lo, hi);
+		for (; (x = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor)) expected = AGG_combine(expected, AGG_lift(x->key, x->val));
+		same = range.count == expected.count && range.sum == expected.sum && range.min == expected.min && range.max == expected.max;
+	}
+	same = same && RBT_self_check(&tree);
+
+	printf("range aggregates against a cursor walk: %s\n", same ? "same results" : "results differ!");
+	RBT_free(&tree);
+}
+#endif // RBT_AGGREGATE
+
+#ifdef RBT_LAZY_DELETE
+// do size, rank and select see exactly the keys 1..n that are marked live?
+static bool lazyMatches(const RedBlackBST* tree, const bool* live, int n)
+{
+	int k, below = 0;
+	for (k = 1; k <= n; k++)
+	{
+		if (RBT_rank(tree, k) != below || RBT_contains(tree, k) != live[k]) return false;
+		if (live[k] && RBT_select(tree, below++) != k) return false;
+	}
+	return RBT_size(tree) == below && RBT_self_check(tree);
+}
+
+/* Random lazy removals and puts on keys 1..n, two removals to a put so that dead nodes pile
+   up and sweeps run. Size, rank and select must count only the live keys throughout, and
+   RBT_compact must free every dead node and leave those counts as they were. */
+void testLazyDelete(int n, int ops)
+{
+	RedBlackBST tree = { .root = NULL };
+	bool* live = (bool*)calloc((size_t)n + 1, sizeof(bool));
+	bool same = true, sawDead = false, sawSweep = false;
+	int i;
+
+	for (i = 1; i <= n; i++)
+	{
+		RBT_put(&tree, i, "v");
+		live[i] = true;
+	}
+
+	for (i = 0; i < ops && same; i++)
+	{
+		Key key = rand() % n + 1;
+		if (i % 3 == 2) RBT_put(&tree, key, "v");
+		else RBT_remove(&tree, key);
+		live[key] = (i % 3 == 2);
+
+		sawDead = sawDead || tree.dead > 0;
+		sawSweep = sawSweep || tree.sweeping;
+		if (i % 500 == 499) same = lazyMatches(&tree, live, n);
+	}
+	same = same && lazyMatches(&tree, live, n);
+
+	RBT_compact(&tree);
+	same = same && tree.dead == 0 && !tree.sweeping && lazyMatches(&tree, live, n);
+
+	printf("lazy removal: %s\n", (same && sawDead && sawSweep) ? "only live keys counted" : "counts differ!");
+	free(live);
+	RBT_free(&tree);
+}
+#endif
+
+// does the compact tree hold the same keys and values as the reference tree, in the same order?
+static bool compactMatches(const CompactBST* compact, const RedBlackBST* reference, int n)
+{
+	int size = RBT_size(reference), k;
+	if (CRBT_size(compact) != size) return false;
+	if (size > 0 && (CRBT_min_bykey(compact) != RBT_min_bykey(reference)->key || CRBT_max_bykey(compact) != RBT_max_bykey(reference)->key)) return false;
+
+	for (k = 0; k < size; k++) if (CRBT_select(compact, k) != RBT_select(reference, k)) return false;
+	for (k = 1; k <= n + 1; k++)
+	{
+		Value* expected = RBT_get(reference, k);
+		Value found = CRBT_get(compact, k);
+		if ((expected == NULL) != (found == NULL) || (found != NULL && strcmp(found, *expected) != 0)) return false;
+		if (CRBT_rank(compact, k) != RBT_rank(reference, k)) return false;
+		if (size == 0) continue;
+
+		const Key* floor = CRBT_floor(compact, k);
+		const Key* ceiling = CRBT_ceiling(compact, k);
+		Node* floorNode = RBT_floor(reference, k);
+		Node* ceilingNode = RBT_ceiling(reference, k);
+		if ((floor == NULL) != (floorNode == NULL) || (floor != NULL && *floor != floorNode->key)) return false;
+		if ((ceiling == NULL) != (ceilingNode == NULL) || (ceiling != NULL && *ceiling != ceilingNode->key)) return false;
+	}
+	return true;
+}
+
+/* Random puts, removals and deleteMax calls on keys 1..n, applied to a CompactBST and to a
+   RedBlackBST alike; both must agree on every query and the compact tree must stay valid.
+   Values alternate between ones stored inline and ones too long for it. */
+void testCompact(int n, int ops)
+{
+	INIT_CompactBST(compact);
+	RedBlackBST reference = { .root = NULL };
+	const char* values[] = { "a", "bcdefg", "a value too long to be stored inline", "hijklmn" };
+	bool same = true;
+	int i;
+
+	for (i = 0; i < ops && same; i++)
+	{
+		int roll = rand() % 100;
+		Key key = rand() % n + 1;
+		if (roll < 60)
+		{
+			CRBT_put(&compact, key, (Value)values[i % 4]);
+			RBT_put(&reference, key, (Value)values[i % 4]);
+		}
+		else if (roll < 95)
+		{
+			CRBT_remove(&compact, key);
+			RBT_remove(&reference, key);
+		}
+		else if (!RBT_isEmpty(&reference))
+		{
+			CRBT_deleteMax(&compact);
+			RBT_deleteMax(&reference);
+		}
+
+		if (i % 1000 == 999) same = CRBT_self_check(&compact) && compactMatches(&compact, &reference, n);
+	}
+	same = same && CRBT_self_check(&compact) && compactMatches(&compact, &reference, n);
+
+	// and all the way down to empty
+	while (same && !RBT_isEmpty(&reference))
+	{
+		Key key = RBT_select(&reference, rand() % RBT_size(&reference));
+		CRBT_remove(&compact, key);
+		RBT_remove(&reference, key);
+	}
+	same = same && CRBT_isEmpty(&compact) && CRBT_height(&compact) == -1;
+
+	printf("compact tree against RedBlackBST: %s\n", same ? "same results" : "results differ!");
+	CRBT_free(&compact);
+	RBT_free(&reference);
+}
+
+#ifdef BENCHMARKS
+
+#pragma region Benchmarks
+
+/* Seconds of processor time since {start}. */
+double elapsed(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Seconds of wall clock time since {start}, for benchmarks that run several threads. */
+double wallElapsed(const struct timespec* start)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Fills an empty tree with the keys 1, 3, 5, ... so that every other key misses. */
+void fillOdd(RedBlackBST* self, int n)
+{
+	Key* keys = (Key*)malloc(n * sizeof(Key));
+	Value* vals = (Value*)malloc(n * sizeof(Value));
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		keys[i] = 2 * i + 1;
+		vals[i] = "v";
+	}
+	RBT_build_sorted(self, keys, vals, n);
+	free(keys);
+	free(vals);
+}
+
+/* Ordered queries: the iterative NODE_* functions against the original recursive ones. */
+void benchReads(int n, int queries)
+{
+	RedBlackBST tree = { .root = NULL };
+	Key* keys = (Key*)malloc(queries * sizeof(Key));
+	long check = 0;
+	clock_t start;
+	int i;
+
+	fillOdd(&tree, n);
+	for (i = 0; i < queries; i++) keys[i] = rand() % (2 * n + 1) + 1;
+
+	printf("\nordered queries, %d keys, %d queries    recursive  iterative\n", n, queries);
+
+#define BENCH_READ(NAME, RECURSIVE, ITERATIVE) \
+	{ \
+		start = clock(); \
+		for (i = 0; i < queries; i++) check += (long)(size_t)(RECURSIVE); \
+		double before = elapsed(start); \
+		start = clock(); \
+		for (i = 0; i < queries; i++) check -= (long)(size_t)(ITERATIVE); \
+		printf("%-40s %8.3fs  %8.3fs\n", NAME, before, elapsed(start)); \
+	}
+
+	BENCH_READ("floor", NODE_floor_recursive(tree.root, keys[i]), NODE_floor(tree.root, keys[i]));
+	BENCH_READ("ceiling", NODE_ceiling_recursive(tree.root, keys[i]), NODE_ceiling(tree.root, keys[i]));
+	BENCH_READ("rank", NODE_rank_recursive(keys[i], tree.root), NODE_rank(keys[i], tree.root));
+	BENCH_READ("select", NODE_select_recursive(tree.root, keys[i] % n), NODE_select(tree.root, keys[i] % n));
+	BENCH_READ("min", NODE_min_bykey_recursive(tree.root), NODE_min_bykey(tree.root));
+	BENCH_READ("max", NODE_max_bykey_recursive(tree.root), NODE_max_bykey(tree.root));
+
+#undef BENCH_READ
+
+	start = clock();
+	check += NODE_height_recursive(tree.root);
+	double before = elapsed(start);
+	start = clock();
+	check -= NODE_height(tree.root);
+	printf("%-40s %8.3fs  %8.3fs\n", "height (one full walk)", before, elapsed(start));
+
+	// the two versions must agree, so everything added was taken away again
+	if (check != 0) printf("recursive and iterative results differ!\n");
+
+	free(keys);
+	RBT_free(&tree);
+}
+
+/* Lookups on a live tree against the same queries on a frozen copy of it. */
+void benchFrozen(int n, int queries)
+{
+	RedBlackBST tree = { .root = NULL };
+	Key* keys = (Key*)malloc(queries * sizeof(Key));
+	long check = 0;
+	clock_t start;
+	int i;
+
+	fillOdd(&tree, n);
+	for (i = 0; i < queries; i++) keys[i] = rand() % (2 * n + 1) + 1;
+
+	start = clock();
+	FrozenBST* frozen = RBT_freeze(&tree);
+	printf("\nfrozen copy, %d keys, frozen in %.3fs           live     frozen\n", n, elapsed(start));
+
+#define BENCH_FROZEN(NAME, LIVE, FROZEN) \
+	{ \
+		start = clock(); \
+		for (i = 0; i < queries; i++) check += (long)(LIVE); \
+		double before = elapsed(start); \
+		start = clock(); \
+		for (i = 0; i < queries; i++) check -= (long)(FROZEN); \
+		printf("%-40s %8.3fs  %8.3fs\n", NAME, before, elapsed(start)); \
+	}
+
+	BENCH_FROZEN("get", NODE_get(tree.root, keys[i]) != NULL, FRZ_get(frozen, keys[i]) != NULL);
+	BENCH_FROZEN("floor", NODE_floor(tree.root, keys[i])->key, *FRZ_floor(frozen, keys[i]));
+	BENCH_FROZEN("rank", NODE_rank(keys[i], tree.root), FRZ_rank(frozen, keys[i]));
+	BENCH_FROZEN("select", NODE_select(tree.root, keys[i] % n)->key, FRZ_select(frozen, keys[i] % n));
+
+#undef BENCH_FROZEN
+
+	// both sides must agree, so everything added was taken away again
+	if (check != 0) printf("live and frozen results differ!\n");
+
+	FRZ_free(frozen);
+	free(keys);
+	RBT_free(&tree);
+}
+
+#ifdef RBT_PERSISTENT
+typedef struct _PersistentBench
+{
+	PersistentBST* tree;
+	int n;
+	atomic_bool stop;
+	atomic_long reads;
+} PersistentBench;
+
+// pins a version, runs a batch of gets on it, repeats until told to stop
+void* persistentReader(void* arg)
+{
+	PersistentBench* bench = (PersistentBench*)arg;
+	unsigned seed = (unsigned)(size_t)&seed;
+	long reads = 0;
+	Value* volatile found;
+
+	while (!atomic_load_explicit(&bench->stop, memory_order_relaxed))
+	{
+		PBST_Pin pin = PBST_pin(bench->tree);
+		int i;
+		for (i = 0; i < 256; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			found = RBT_get(&pin.view, (int)(seed % (2 * bench->n)) + 1);
+			reads++;
+		}
+		PBST_unpin(&pin);
+	}
+	atomic_fetch_add(&bench->reads, reads);
+	(void)found;
+	return NULL;
+}
+
+// keeps overwriting random keys until told to stop
+void* persistentWriter(void* arg)
+{
+	PersistentBench* bench = (PersistentBench*)arg;
+	long writes = 0;
+	while (!atomic_load_explicit(&bench->stop, memory_order_relaxed))
+	{
+		PBST_put(bench->tree, 2 * (rand() % bench->n) + 1, "w");
+		writes++;
+	}
+	return (void*)writes;
+}
+
+/* Reader throughput on a persistent tree while one writer runs, for 1 to 8 reader threads. */
+void benchPersistent(int n, double seconds)
+{
+	PersistentBST tree;
+	PBST_init(&tree);
+
+	int i;
+	for (i = 0; i < n; i++) PBST_put(&tree, 2 * i + 1, "v");
+
+	printf("\npersistent tree, %d keys, one writer      reads/s   writes/s\n", n);
+
+	int readers;
+	for (readers = 1; readers <= 8; readers *= 2)
+	{
+		PersistentBench bench = { .tree = &tree, .n = n };
+		atomic_init(&bench.stop, false);
+		atomic_init(&bench.reads, 0);
+
+		pthread_t threads[8], writer;
+		struct timespec start;
+		timespec_get(&start, TIME_UTC);
+
+		pthread_create(&writer, NULL, persistentWriter, &bench);
+		for (i = 0; i < readers; i++) pthread_create(&threads[i], NULL, persistentReader, &bench);
+
+		while (wallElapsed(&start) < seconds) sched_yield();
+		atomic_store(&bench.stop, true);
+
+		void* writes;
+		for (i = 0; i < readers; i++) pthread_join(threads[i], NULL);
+		pthread_join(writer, &writes);
+
+		double took = wallElapsed(&start);
+		char label[64];
+		sprintf(label, "%d reader thread%s", readers, readers == 1 ? "" : "s");
+		printf("%-40s %9.0f  %9.0f\n", label, atomic_load(&bench.reads) / took, (long)(size_t)writes / took);
+	}
+
+	PBST_free(&tree);
+}
+#endif // RBT_PERSISTENT
+
+typedef struct _ShardedBench
+{
+	ShardedBST* tree;
+	int keys;
+	int ops;
+	unsigned seed;
+} ShardedBench;
+
+// a mix of 50% puts, 25% removes and 25% gets, with every eighth operation a floor or rank
+void* shardedWorker(void* arg)
+{
+	ShardedBench* bench = (ShardedBench*)arg;
+	unsigned seed = bench->seed;
+	char value[16];
+	Key found;
+	int i;
+
+	for (i = 0; i < bench->ops; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		Key key = (Key)((seed >> 4) % (unsigned)bench->keys) + 1;
+
+		if (i % 8 == 7)
+		{
+			if (i % 16 == 7) SBST_floor(bench->tree, key, &found);
+			else SBST_rank(bench->tree, key);
+			continue;
+		}
+
+		switch (seed % 4)
+		{
+		case 0:
+		case 1:
+			sprintf(value, "%d", key);
+			SBST_put(bench->tree, key, value);
+			break;
+		case 2:
+			SBST_remove(bench->tree, key);
+			break;
+		default:
+			if (SBST_get(bench->tree, key, value, sizeof(value)) && atoi(value) != key) printf("sharded get returned the wrong value!\n");
+		}
+	}
+	return NULL;
+}
+
+/* Stress and throughput test for the sharded tree, 1 to 64 threads, one shard (a single
+   global lock) against 16 shards. Checks the shards are consistent after every run. */
+void benchSharded(int keys, int opsPerThread)
+{
+	printf("\nsharded tree, %d ops per thread            1 shard  16 shards  (ops/s)\n", opsPerThread);
+
+	int threads;
+	for (threads = 1; threads <= 64; threads *= 2)
+	{
+		double rates[2];
+		int run;
+		for (run = 0; run < 2; run++)
+		{
+			ShardedBST tree;
+			SBST_init(&tree, run == 0 ? 1 : 16, 1, keys);
+
+			pthread_t ids[64];
+			ShardedBench benches[64];
+			struct timespec start;
+			timespec_get(&start, TIME_UTC);
+
+			int i;
+			for (i = 0; i < threads; i++)
+			{
+				benches[i] = (ShardedBench) { .tree = &tree, .keys = keys, .ops = opsPerThread, .seed = (unsigned)i * 7919 + 1 };
+				pthread_create(&ids[i], NULL, shardedWorker, &benches[i]);
+			}
+			for (i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+
+			rates[run] = (double)threads * opsPerThread / wallElapsed(&start);
+			if (!SBST_self_check(&tree)) printf("sharded tree is inconsistent!\n");
+			SBST_free(&tree);
+		}
+
+		char label[64];
+		sprintf(label, "%d thread%s", threads, threads == 1 ? "" : "s");
+		printf("%-40s %9.0f  %9.0f\n", label, rates[0], rates[1]);
+	}
+}
+
+typedef struct _OptimisticBench
+{
+	RedBlackBST* tree;
+	int n;
+	atomic_bool stop;
+	atomic_long reads;
+} OptimisticBench;
+
+// optimistic gets until told to stop
+void* optimisticReader(void* arg)
+{
+	OptimisticBench* bench = (OptimisticBench*)arg;
+	unsigned seed = (unsigned)(size_t)&seed;
+	char value[32];
+	long reads = 0;
+
+	while (!atomic_load_explicit(&bench->stop, memory_order_relaxed))
+	{
+		seed = seed * 1103515245 + 12345;
+		RBT_optimistic_get(bench->tree, (int)(seed % (2 * bench->n)) + 1, value, sizeof(value));
+		reads++;
+	}
+	atomic_fetch_add(&bench->reads, reads);
+	return NULL;
+}
+
+/* Optimistic reads: their cost against plain RBT_get on a quiet tree, then reader
+   throughput from 1 to 8 threads while the single writer keeps overwriting keys. */
+void benchOptimistic(int n, int queries, double seconds)
+{
+	RedBlackBST tree = { .root = NULL };
+	RBT_use_pool(&tree, 0);
+	fillOdd(&tree, n);
+
+	Key* keys = (Key*)malloc(queries * sizeof(Key));
+	char value[32];
+	long check = 0;
+	clock_t start = clock();
+	int i;
+	for (i = 0; i < queries; i++) keys[i] = rand() % (2 * n + 1) + 1;
+
+	printf("\noptimistic reads, %d keys, %d queries       RBT_get  optimistic\n", n, queries);
+
+	// the plain lookup copies the value out too, as it would have to under a lock
+	start = clock();
+	for (i = 0; i < queries; i++)
+	{
+		Value* found = RBT_get(&tree, keys[i]);
+		if (found != NULL) snprintf(value, sizeof(value), "%s", *found);
+		check += found != NULL;
+	}
+	double before = elapsed(start);
+	start = clock();
+	for (i = 0; i < queries; i++) check -= RBT_optimistic_get(&tree, keys[i], value, sizeof(value));
+	printf("%-40s %8.3fs  %8.3fs\n", "get, no writer", before, elapsed(start));
+	if (check != 0) printf("plain and optimistic results differ!\n");
+
+	int readers;
+	for (readers = 1; readers <= 8; readers *= 2)
+	{
+		OptimisticBench bench = { .tree = &tree, .n = n };
+		atomic_init(&bench.stop, false);
+		atomic_init(&bench.reads, 0);
+
+		pthread_t threads[8];
+		struct timespec begin;
+		timespec_get(&begin, TIME_UTC);
+		for (i = 0; i < readers; i++) pthread_create(&threads[i], NULL, optimisticReader, &bench);
+
+		// this thread is the writer, writing as fast as it can; readers that keep losing to it make it hold off
+		long writes = 0;
+		while (wallElapsed(&begin) < seconds)
+		{
+			RBT_put(&tree, 2 * (rand() % n) + 1, "w");
+			writes++;
+		}
+		atomic_store(&bench.stop, true);
+		for (i = 0; i < readers; i++) pthread_join(threads[i], NULL);
+
+		double took = wallElapsed(&begin);
+		char label[64];
+		sprintf(label, "%d reader%s + writer, per second", readers, readers == 1 ? "" : "s");
+		printf("%-40s %9.0f reads  %9.0f writes\n", label, atomic_load(&bench.reads) / took, writes / took);
+	}
+
+	free(keys);
+	RBT_free(&tree);
+}
+
+typedef struct _CombiningBench
+{
+	FCBST* combined;				// the flat-combining tree, or NULL to use locked
+	RedBlackBST* locked;
+	pthread_mutex_t* lock;
+	int keys;
+	int ops;
+	unsigned seed;
+} CombiningBench;
+
+// a mix of 50% puts, 25% removes and 25% gets, each under the lock or through the combiner
+void* combiningWorker(void* arg)
+{
+	CombiningBench* bench = (CombiningBench*)arg;
+	unsigned seed = bench->seed;
+	char value[16];
+	int i;
+
+	for (i = 0; i < bench->ops; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		Key key = (Key)((seed >> 4) % (unsigned)bench->keys) + 1;
+		bool found = false;
+
+		if (seed % 4 < 2) sprintf(value, "%d", key);
+		if (bench->combined != NULL)
+		{
+			switch (seed % 4)
+			{
+			case 0:
+			case 1: FCBST_put(bench->combined, key, value); break;
+			case 2: FCBST_remove(bench->combined, key); break;
+			default: found = FCBST_get(bench->combined, key, value, sizeof(value));
+			}
+		}
+		else
+		{
+			pthread_mutex_lock(bench->lock);
+			switch (seed % 4)
+			{
+			case 0:
+			case 1: RBT_put(bench->locked, key, value); break;
+			case 2: RBT_remove(bench->locked, key); break;
+			default:
+			{
+				Value* val = RBT_get(bench->locked, key);
+				if ((found = (val != NULL))) snprintf(value, sizeof(value), "%s", *val);
+			}
+			}
+			pthread_mutex_unlock(bench->lock);
+		}
+		if (found && atoi(value) != key) printf("get returned the wrong value!\n");
+	}
+	return NULL;
+}
+
+/* Contended writes, 1 to 64 threads: one mutex around a RedBlackBST against the
+   flat-combining front end. Checks the tree after every run. */
+void benchCombining(int keys, int opsPerThread)
+{
+	printf("\ncombining tree, %d ops per thread           mutex  combining  (ops/s)\n", opsPerThread);
+
+	int threads;
+	for (threads = 1; threads <= 64; threads *= 2)
+	{
+		double rates[2];
+		int run;
+		for (run = 0; run < 2; run++)
+		{
+			RedBlackBST locked = { .root = NULL };
+			pthread_mutex_t lock;
+			pthread_mutex_init(&lock, NULL);
+			FCBST* combined = NULL;
+			if (run == 1)
+			{
+				combined = (FCBST*)aligned_alloc(_Alignof(FCBST), sizeof(FCBST));
+				FCBST_init(combined);
+			}
+
+			pthread_t ids[64];
+			CombiningBench benches[64];
+			struct timespec start;
+			timespec_get(&start, TIME_UTC);
+
+			int i;
+			for (i = 0; i < threads; i++)
+			{
+				benches[i] = (CombiningBench) { .combined = combined, .locked = &locked, .lock = &lock, .keys = keys, .ops = opsPerThread, .seed = (unsigned)i * 7919 + 1 };
+				pthread_create(&ids[i], NULL, combiningWorker, &benches[i]);
+			}
+			for (i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+
+			rates[run] = (double)threads * opsPerThread / wallElapsed(&start);
+			if (!RBT_self_check(combined != NULL ? &combined->tree : &locked)) printf("combining tree is inconsistent!\n");
+			if (combined != NULL)
+			{
+				FCBST_free(combined);
+				free(combined);
+			}
+			RBT_free(&locked);
+			pthread_mutex_destroy(&lock);
+		}
+
+		char label[64];
+		sprintf(label, "%d thread%s", threads, threads == 1 ? "" : "s");
+		printf("%-40s %9.0f  %9.0f\n", label, rates[0], rates[1]);
+	}
+}
+
+/* Fills an empty tree with the odd keys first, first + 2, ... */
+void fillOddFrom(RedBlackBST* self, int n, Key first)
+{
+	Key* keys = (Key*)malloc(n * sizeof(Key));
+	Value* vals = (Value*)malloc(n * sizeof(Value));
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		keys[i] = first + 2 * i;
+		vals[i] = "v";
+	}
+	RBT_build_sorted(self, keys, vals, n);
+	free(keys);
+	free(vals);
+}
+
+/* Set operations on two trees of n keys sharing half of them: one RBT_put or RBT_remove
+   per key of the other tree, against RBT_union, RBT_intersect and RBT_difference. */
+void benchSetOps(int n)
+{
+	const char* names[] = { "union", "intersect", "difference" };
+	printf("\nset operations, two trees of %d keys      per key  split/join\n", n);
+
+	int op;
+	for (op = 0; op < 3; op++)
+	{
+		double took[2];
+		int size[2], run;
+		for (run = 0; run < 2; run++)
+		{
+			RedBlackBST a = { .root = NULL }, b = { .root = NULL };
+			fillOddFrom(&a, n, 1);
+			fillOddFrom(&b, n, n + 1);
+
+			struct timespec start;
+			timespec_get(&start, TIME_UTC);
+			if (run == 0)
+			{
+				RBT_Cursor cursor;
+				Node* x;
+				if (op == 1)
+				{
+					// a key can only go once the walk has moved past it
+					Key* drop = (Key*)malloc(n * sizeof(Key));
+					int count = 0, i;
+					for (RBT_cursor_init(&cursor, &a); (x = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor))
+					{
+						if (!RBT_contains(&b, x->key)) drop[count++] = x->key;
+					}
+					for (i = 0; i < count; i++) RBT_remove(&a, drop[i]);
+					free(drop);
+				}
+				else
+				{
+					for (RBT_cursor_init(&cursor, &b); (x = RBT_cursor_node(&cursor)) != NULL; RBT_cursor_next(&cursor))
+					{
+						if (op == 0) RBT_put(&a, x->key, x->val);
+						else RBT_remove(&a, x->key);
+					}
+				}
+			}
+			else if (op == 0) RBT_union(&a, &b);
+			else if (op == 1) RBT_intersect(&a, &b);
+			else RBT_difference(&a, &b);
+
+			took[run] = wallElapsed(&start);
+			size[run] = RBT_size(&a);
+			if (!RBT_self_check(&a)) printf("set operation left a broken tree!\n");
+			RBT_free(&a);
+			RBT_free(&b);
+		}
+
+		if (size[0] != size[1]) printf("set operation results differ!\n");
+		printf("%-40s %8.3fs  %8.3fs\n", names[op], took[0], took[1]);
+	}
+}
+
+// KL_forEach callback: remove the node's key
+void removeNode(RedBlackBST* self, Node* node)
+{
+	RBT_remove(self, node->key);
+}
+
+/* Deleting a window of keys: RBT_keys_range and one RBT_remove per key, against
+   RBT_remove_range, for windows of 1% and half of the tree. */
+void benchRangeDelete(int n)
+{
+	printf("\nrange delete, %d keys                   per key  remove_range\n", n);
+
+	int percent;
+	for (percent = 1; percent <= 50; percent += 49)
+	{
+		Key lo = n / 2, hi = lo + 2 * (int)((long long)n * percent / 100);
+		double took[2];
+		int size[2], run;
+		for (run = 0; run < 2; run++)
+		{
+			RedBlackBST tree = { .root = NULL };
+			fillOdd(&tree, n);
+
+			struct timespec start;
+			timespec_get(&start, TIME_UTC);
+			if (run == 0) KL_forEach(&tree, RBT_keys_range(&tree, lo, hi), removeNode);
+			else RBT_remove_range(&tree, lo, hi);
+			took[run] = wallElapsed(&start);
+
+			size[run] = RBT_size(&tree);
+			if (!RBT_self_check(&tree)) printf("range delete left a broken tree!\n");
+			RBT_free(&tree);
+		}
+
+		if (size[0] != size[1]) printf("range delete results differ!\n");
+		char label[64];
+		sprintf(label, "%d%% of the keys", percent);
+		printf("%-40s %8.3fs  %8.3fs\n", label, took[0], took[1]);
+	}
+}
+
+#ifdef RBT_AGGREGATE
+/* Range aggregates over windows of 1% of the keys: RBT_keys_range and AGG_combine
+   over the list, against RBT_range_aggregate. */
+void benchAggregate(int n, int queries)
+{
+	RedBlackBST tree = { .root = NULL };
+	fillOdd(&tree, n);
+	printf("\nrange aggregate, %d keys, %d queries     keys_range  aggregate\n", n, queries);
+
+	// both loops draw the same windows
+	long long check = 0;
+	int i;
+	struct timespec start;
+	srand(1);
+	timespec_get(&start, TIME_UTC);
+	for (i = 0; i < queries; i++)
+	{
+		Key lo = rand() % (2 * n) + 1;
+		Aggregate sum = AGG_identity();
+		KeyList* list = RBT_keys_range(&tree, lo, lo + n / 50);
+		while (list != NULL)
+		{
+			if (list->node != NULL) sum = AGG_combine(sum, AGG_lift(list->node->key, list->node->val));
+			KeyList* next = list->next;
+			free(list);
+			list = next;
+		}
+		check += sum.count;
+	}
+	double before = wallElapsed(&start);
+
+	srand(1);
+	timespec_get(&start, TIME_UTC);
+	for (i = 0; i < queries; i++)
+	{
+		Key lo = rand() % (2 * n) + 1;
+		check -= RBT_range_aggregate(&tree, lo, lo + n / 50).count;
+	}
+	printf("%-40s %8.3fs  %8.3fs\n", "1% windows", before, wallElapsed(&start));
+	if (check != 0) printf("keys_range and range_aggregate disagree!\n");
+
+	RBT_free(&tree);
+}
+#endif // RBT_AGGREGATE
+
+/* Dashboard queries, p50/p90/p99/p999 and a 100 bucket histogram: one RBT_select per
+   quantile and one RBT_range_size per bucket, against RBT_quantiles and RBT_histogram. */
+void benchQuantiles(int n, int rounds)
+{
+	RedBlackBST tree = { .root = NULL };
+	fillOdd(&tree, n);
+	printf("\nquantiles and histogram, %d keys, %d rounds    single  shared walk\n", n, rounds);
+
+	const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+	Key bounds[101], keys[4];
+	int counts[100], ranks[4], i, j;
+	for (j = 0; j <= 100; j++) bounds[j] = 1 + (Key)((long long)2 * n * j / 100);
+	for (j = 0; j < 4; j++) ranks[j] = (int)(q[j] * n);
+
+	long long check = 0;
+	clock_t start = clock();
+	for (i = 0; i < rounds; i++)
+	{
+		for (j = 0; j < 4; j++) check += RBT_select(&tree, ranks[j]);
+		for (j = 0; j < 100; j++) check += RBT_range_size(&tree, bounds[j], bounds[j + 1] - 1);
+	}
+	double before = elapsed(start);
+
+	start = clock();
+	for (i = 0; i < rounds; i++)
+	{
+		RBT_select_many(&tree, ranks, keys, 4);
+		RBT_histogram(&tree, bounds, counts, 100);
+		for (j = 0; j < 4; j++) check -= keys[j];
+		for (j = 0; j < 100; j++) check -= counts[j];
+	}
+	printf("%-40s %8.3fs  %8.3fs\n", "4 quantiles + 100 buckets", before, elapsed(start));
+	if (check != 0) printf("single and shared walks disagree!\n");
+
+	RBT_free(&tree);
+}
+
+/* Inserting key streams in or near sorted order: a search from the root for every key,
+   RBT_put (with its append fast path under RBT_APPEND), and RBT_put_hint following
+   the previous key. */
+void benchHinted(int n)
+{
+	printf("\nhinted insert, %d keys                   from root  RBT_put  put_hint\n", n);
+
+	const char* labels[] = { "ascending", "descending", "nearly sorted" };
+	Key* keys = (Key*)malloc(n * sizeof(Key));
+	int stream, i;
+	for (stream = 0; stream < 3; stream++)
+	{
+		for (i = 0; i < n; i++) keys[i] = (stream == 1) ? n - i : i + 1;
+		if (stream == 2)
+		{
+			// swap about one key in a hundred with a neighbour up to 8 places away
+			srand(19);
+			for (i = 0; i < n / 100; i++)
+			{
+				int a = rand() % n, b = a + rand() % 8 + 1;
+				if (b >= n) continue;
+				Key t = keys[a]; keys[a] = keys[b]; keys[b] = t;
+			}
+		}
+
+		double took[3];
+		int run;
+		for (run = 0; run < 3; run++)
+		{
+			RedBlackBST tree = { .root = NULL };
+			RBT_Cursor hint;
+			RBT_cursor_init(&hint, &tree);
+
+			clock_t start = clock();
+			for (i = 0; i < n; i++)
+			{
+				if (run == 0)
+				{
+					tree.root = NODE_put_iterative(tree.pool, tree.root, keys[i], "v");
+					tree.root->color = BLACK;
+				}
+				else if (run == 1) RBT_put(&tree, keys[i], "v");
+				else RBT_put_hint(&tree, &hint, keys[i], "v");
+			}
+			took[run] = elapsed(start);
+
+			if (RBT_size(&tree) != n || !RBT_self_check(&tree)) printf("hinted insert left a broken tree!\n");
+			RBT_free(&tree);
+		}
+		printf("%-40s %8.3fs  %8.3fs  %8.3fs\n", labels[stream], took[0], took[1], took[2]);
+	}
+
+	free(keys);
+}
+
+/* The i-th key of a stream of distinct, non-zero keys in scrambled order. */
+Key scrambledKey(int i)
+{
+	return (Key)((long long)(i + 1) * 1103515245 % 2147483647);
+}
+
+typedef struct _HeapEntry
+{
+	Key key;
+	Value val;
+} HeapEntry;
+
+void heapPush(HeapEntry* heap, int* size, Key key, Value val)
+{
+	int i = (*size)++;
+	while (i > 0 && heap[(i - 1) / 2].key > key)
+	{
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i].key = key;
+	heap[i].val = val;
+}
+
+HeapEntry heapPop(HeapEntry* heap, int* size)
+{
+	HeapEntry top = heap[0], last = heap[--(*size)];
+	int i = 0;
+	while (2 * i + 1 < *size)
+	{
+		int child = 2 * i + 1;
+		if (child + 1 < *size && heap[child + 1].key < heap[child].key) child++;
+		if (heap[child].key >= last.key) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+/* The tree as a priority queue next to a binary heap of key-value pointers: filling it,
+   popping the minimum and pushing a new key {ops} times, peeking, and draining it. Peeks
+   are O(1) with RBT_PRIORITY_QUEUE defined and a descent without it. */
+void benchPriorityQueue(int n, int ops)
+{
+	printf("\npriority queue, %d keys, %d ops         binary heap  RBT_pop_min\n", n, ops);
+
+	HeapEntry* heap = (HeapEntry*)malloc(n * sizeof(HeapEntry));
+	RedBlackBST tree = { .root = NULL };
+	RBT_use_pool(&tree, 0);
+	const char* labels[] = { "fill", "pop min and push", "peek min", "drain" };
+	double took[4][2];
+	long long check = 0;
+	int size = 0, i, run;
+
+	for (run = 0; run < 2; run++)
+	{
+		clock_t start = clock();
+		for (i = 0; i < n; i++)
+		{
+			if (run == 0) heapPush(heap, &size, scrambledKey(i), "v");
+			else RBT_put(&tree, scrambledKey(i), "v");
+		}
+		took[0][run] = elapsed(start);
+
+		start = clock();
+		for (i = 0; i < ops; i++)
+		{
+			if (run == 0)
+			{
+				check += heapPop(heap, &size).key;
+				heapPush(heap, &size, scrambledKey(n + i), "v");
+			}
+			else
+			{
+				Node* min = RBT_pop_min(&tree);
+				check -= min->key;
+				RBT_release(&tree, min);
+				RBT_put(&tree, scrambledKey(n + i), "v");
+			}
+		}
+		took[1][run] = elapsed(start);
+
+		start = clock();
+		for (i = 0; i < ops; i++)
+		{
+			if (run == 0) check += heap[0].key;
+			else check -= RBT_min_bykey(&tree)->key;
+		}
+		took[2][run] = elapsed(start);
+
+		start = clock();
+		for (i = 0; i < n; i++)
+		{
+			if (run == 0) check += heapPop(heap, &size).key;
+			else
+			{
+				Node* min = RBT_pop_min(&tree);
+				check -= min->key;
+				RBT_release(&tree, min);
+			}
+		}
+		took[3][run] = elapsed(start);
+	}
+
+	for (i = 0; i < 4; i++) printf("%-40s %8.3fs  %8.3fs\n", labels[i], took[i][0], took[i][1]);
+	if (check != 0 || !RBT_isEmpty(&tree)) printf("heap and tree disagree!\n");
+
+	RBT_free(&tree);
+	free(heap);
+}
+
+/* Starting up from a saved image: rebuilding the tree through RBT_put against mapping
+   the image RBT_save wrote, then lookups in each. */
+void benchMapped(int n, int queries)
+{
+	const char* path = "benchMapped.rbt";
+	printf("\nmapped image, %d keys, %d gets           rebuild    mapped\n", n, queries);
+
+	char val[32];
+	int i;
+	struct timespec start;
+	timespec_get(&start, TIME_UTC);
+	RedBlackBST tree = { .root = NULL };
+	for (i = 0; i < n; i++)
+	{
+		sprintf(val, "value %d", i);
+		RBT_put(&tree, scrambledKey(i), val);
+	}
+	double rebuild = wallElapsed(&start);
+
+	timespec_get(&start, TIME_UTC);
+	if (!RBT_save(&tree, path)) { printf("could not write %s\n", path); RBT_free(&tree); return; }
+	printf("%-40s %8.3fs\n", "save", wallElapsed(&start));
+
+	timespec_get(&start, TIME_UTC);
+	MappedBST* mapped = RBT_open_mapped(path);
+	if (mapped == NULL) { printf("could not map %s\n", path); RBT_free(&tree); return; }
+	bool found = MAP_get(mapped, scrambledKey(n / 2)) != NULL;
+	printf("%-40s %8.3fs  %8.3fs\n", "startup and first get", rebuild, wallElapsed(&start));
+	if (!found || !MAP_self_check(mapped)) printf("mapped image is broken!\n");
+
+	long long check = 0;
+	srand(21);
+	timespec_get(&start, TIME_UTC);
+	for (i = 0; i < queries; i++) check += RBT_get(&tree, scrambledKey(rand() % n)) != NULL;
+	double before = wallElapsed(&start);
+
+	srand(21);
+	timespec_get(&start, TIME_UTC);
+	for (i = 0; i < queries; i++) check -= MAP_get(mapped, scrambledKey(rand() % n)) != NULL;
+	printf("%-40s %8.3fs  %8.3fs\n", "gets", before, wallElapsed(&start));
+	if (check != 0) printf("tree and mapped image disagree!\n");
+
+	MAP_close(mapped);
+	RBT_free(&tree);
+	remove(path);
+}
+
+/* Write throughput of a durable tree for different group commit sizes, each row writing
+   for {seconds}, then the time to recover the last one. */
+void benchDurable(double seconds, int snapshotEvery)
+{
+	const char* path = "benchDurable";
+	const int syncs[] = { 1, 16, 256, 4096, 0 };
+	printf("\ndurable tree, snapshot every %d writes       writes/s\n", snapshotEvery);
+
+	char val[32];
+	int row, i = 0;
+	for (row = 0; row < (int)(sizeof(syncs) / sizeof(syncs[0])); row++)
+	{
+		removeDurableFiles(path);
+		DurableBST tree;
+		if (!DBST_open(&tree, path, syncs[row], snapshotEvery)) { printf("could not open %s\n", path); return; }
+
+		struct timespec start;
+		timespec_get(&start, TIME_UTC);
+		double took;
+		for (i = 0; (took = wallElapsed(&start)) < seconds; )
+		{
+			// check the clock once every 64 writes
+			int stop = i + 64;
+			for (; i < stop; i++)
+			{
+				sprintf(val, "value %d", i);
+				DBST_put(&tree, scrambledKey(i), val);
+			}
+		}
+		DBST_close(&tree);
+
+		char label[48];
+		if (syncs[row] > 0) snprintf(label, sizeof(label), "sync every %d writes", syncs[row]);
+		else snprintf(label, sizeof(label), "never sync");
+		printf("%-40s %10.0f\n", label, i / took);
+	}
+
+	struct timespec start;
+	timespec_get(&start, TIME_UTC);
+	DurableBST tree;
+	if (!DBST_open(&tree, path, 0, snapshotEvery)) { printf("could not reopen %s\n", path); return; }
+	double took = wallElapsed(&start);
+	printf("recover %d keys, %d replayed from the log   %8.3fs\n", RBT_size(&tree.tree), tree.recovered, took);
+	if (RBT_size(&tree.tree) != i || !RBT_self_check(&tree.tree)) printf("recovered tree is broken!\n");
+	DBST_close(&tree);
+	removeDurableFiles(path);
+}
+
+/* Kills a process writing to a durable tree at a random moment and checks that recovery
+   gives back the tree as it was after some complete write, no earlier than the last sync.
+   The writer puts the keys 1, 2, 3, ... in order, and after every tenth key i removes i / 2. */
+void testRecovery(int rounds)
+{
+	const char* path = "testRecovery";
+	printf("\nkill and recover, %d rounds\n", rounds);
+
+	// the writer publishes how many keys are durable here
+	volatile int* durable = (volatile int*)mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (durable == (volatile int*)MAP_FAILED) { printf("could not share memory with the writer\n"); return; }
+
+	char val[32];
+	int round;
+	srand(22);
+	for (round = 0; round < rounds; round++)
+	{
+		removeDurableFiles(path);
+		*durable = 0;
+
+		pid_t writer = fork();
+		if (writer < 0) { printf("could not start the writer\n"); break; }
+		if (writer == 0)
+		{
+			DurableBST tree;
+			if (!DBST_open(&tree, path, 64, 20000)) _exit(EXIT_FAILURE);
+			int i;
+			for (i = 1; ; i++)
+			{
+				sprintf(val, "value %d", i);
+				DBST_put(&tree, i, val);
+				if (i % 10 == 0) DBST_remove(&tree, i / 2);
+				if (tree.unsynced == 0) *durable = i;
+			}
+		}
+
+		struct timespec pause = { 0, (20 + rand() % 180) * 1000000L };
+		nanosleep(&pause, NULL);
+		kill(writer, SIGKILL);
+		waitpid(writer, NULL, 0);
+
+		DurableBST tree;
+		if (!DBST_open(&tree, path, 64, 20000)) { printf("round %d: could not recover\n", round); continue; }
+
+		// the last key put tells how far the writer got; only the removal that came with it may be missing
+		int m = RBT_isEmpty(&tree.tree) ? 0 : RBT_max_bykey(&tree.tree)->key;
+		bool ok = m >= *durable && RBT_self_check(&tree.tree);
+		int k, expected = 0;
+		for (k = 1; k <= m && ok; k++)
+		{
+			Value* found = RBT_get(&tree.tree, k);
+			if (k % 5 == 0 && 2 * k < m) ok = found == NULL;
+			else if (k % 5 == 0 && 2 * k == m && found == NULL) continue;
+			else
+			{
+				sprintf(val, "value %d", k);
+				ok = found != NULL && strcmp(*found, val) == 0;
+				expected++;
+			}
+		}
+		ok = ok && RBT_size(&tree.tree) == expected;
+		printf("round %d: %d keys durable, recovered through key %d (%d replayed): %s\n", round, *durable, m, tree.recovered, ok ? "ok" : "FAILED");
+		DBST_close(&tree);
+	}
+
+	munmap((void*)durable, sizeof(int));
+	removeDurableFiles(path);
+}
+
+/* Ingest through RBT_put against a write buffer merged in sorted batches, for a few buffer
+   sizes, then the cost of reading through a half full buffer. One write in eight is a removal. */
+void benchBuffered(int n, int queries)
+{
+	const int capacities[] = { 4096, BBST_DEFAULT_CAPACITY, 262144 };
+	printf("\nbuffered writes, %d keys, %d reads                RBT_*    buffered\n", n, queries);
+
+	char val[32];
+	int i, row;
+	clock_t start = clock();
+	RedBlackBST plain = { .root = NULL };
+	for (i = 0; i < n; i++)
+	{
+		sprintf(val, "value %d", i);
+		if (i % 8 == 7) RBT_remove(&plain, scrambledKey(i / 2));
+		else RBT_put(&plain, scrambledKey(i), val);
+	}
+	double direct = elapsed(start);
+
+	BufferedBST buffered;
+	for (row = 0; row < (int)(sizeof(capacities) / sizeof(capacities[0])); row++)
+	{
+		if (row > 0) BBST_free(&buffered);
+		BBST_init(&buffered, capacities[row]);
+		start = clock();
+		for (i = 0; i < n; i++)
+		{
+			sprintf(val, "value %d", i);
+			if (i % 8 == 7) BBST_remove(&buffered, scrambledKey(i / 2));
+			else BBST_put(&buffered, scrambledKey(i), val);
+		}
+		char label[48];
+		snprintf(label, sizeof(label), "ingest, buffer of %d", capacities[row]);
+		printf("%-48s %8.3fs  %8.3fs\n", label, direct, elapsed(start));
+	}
+
+	// leave the last buffer half full for the reads
+	for (i = 0; i < capacities[row - 1] / 2; i++)
+	{
+		RBT_put(&plain, scrambledKey(n + i), "late");
+		BBST_put(&buffered, scrambledKey(n + i), "late");
+	}
+
+	long long check = 0;
+	srand(23);
+	start = clock();
+	for (i = 0; i < queries; i++) check += RBT_get(&plain, scrambledKey(rand() % n)) != NULL;
+	double before = elapsed(start);
+	srand(23);
+	start = clock();
+	for (i = 0; i < queries; i++) check -= BBST_get(&buffered, scrambledKey(rand() % n)) != NULL;
+	printf("%-48s %8.3fs  %8.3fs\n", "gets", before, elapsed(start));
+
+	Key floor;
+	srand(23);
+	start = clock();
+	for (i = 0; i < queries / 100; i++) check += RBT_floor(&plain, scrambledKey(rand() % n)) != NULL;
+	before = elapsed(start);
+	srand(23);
+	start = clock();
+	for (i = 0; i < queries / 100; i++) check -= BBST_floor(&buffered, scrambledKey(rand() % n), &floor);
+	printf("%-48s %8.3fs  %8.3fs\n", "floors (a hundredth as many)", before, elapsed(start));
+
+	BBST_flush(&buffered);
+	if (check != 0 || RBT_size(&buffered.tree) != RBT_size(&plain) || !RBT_self_check(&buffered.tree)) printf("buffered tree disagrees!\n");
+	BBST_free(&buffered);
+	RBT_free(&plain);
+}
+
+
+static int compareLatency(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* Latency of single removals, taking out three keys in four in an order unrelated to the
+   one they went in, so that lazy removal compacts along the way. Build with and without RBT_LAZY_DELETE to compare. */
+void benchRemoveLatency(int n)
+{
+#ifdef RBT_LAZY_DELETE
+	const char* mode = "lazy";
+#else
+	const char* mode = "eager";
+#endif
+	printf("\nremove latency, %d keys, %-5s      p50       p99     p99.9       max     total\n", n, mode);
+
+	RedBlackBST tree = { .root = NULL };
+	RBT_use_pool(&tree, 0);
+	int i, removes = n / 4 * 3;
+	for (i = 0; i < n; i++) RBT_put(&tree, scrambledKey(i), "v");
+
+	double* took = (double*)malloc(removes * sizeof(double));
+	double total = 0;
+	for (i = 0; i < removes; i++)
+	{
+		struct timespec start;
+		timespec_get(&start, TIME_UTC);
+		RBT_remove(&tree, scrambledKey((int)((long long)i * 7919 % n)));
+		took[i] = wallElapsed(&start) * 1e6;
+		total += took[i];
+	}
+
+#ifdef RBT_LAZY_DELETE
+	struct timespec start;
+	timespec_get(&start, TIME_UTC);
+	RBT_compact(&tree);
+	double compact = wallElapsed(&start);
+#endif
+	if (RBT_size(&tree) != n - removes || !RBT_self_check(&tree)) printf("removals left a broken tree!\n");
+
+	qsort(took, removes, sizeof(double), compareLatency);
+	printf("%-40s %7.2fus %7.2fus %7.2fus %7.0fus %8.3fs\n", "RBT_remove", took[removes / 2], took[(int)(removes * 0.99)],
+		took[(int)(removes * 0.999)], took[removes - 1], total / 1e6);
+#ifdef RBT_LAZY_DELETE
+	printf("%-40s %8.3fs\n", "RBT_compact of what is left", compact);
+#endif
+
+	free(took);
+	RBT_free(&tree);
+}
+
+
+static int compareKeys(Key a, Key b)
+{
+	return (a > b) - (a < b);
+}
+
+/* RBT_put and RBT_get against a DEFINE_RBT tree of the same key and value types, with the
+   comparison inlined and with it called through a function pointer. The generic tree
+   stores the value pointer instead of copying the string. */
+void benchGeneric(int n, int queries)
+{
+	printf("\ngeneric trees, %d keys, %d gets         RBT_*  inline cmp  cmp pointer\n", n, queries);
+
+	RedBlackBST tree = { .root = NULL };
+	InlineBST inlined;
+	PointerBST pointed;
+	InlineBST_init(&inlined);
+	PointerBST_init(&pointed);
+	compareThroughPointer = compareKeys;
+
+	double took[2][3];
+	long long found[3] = { 0, 0, 0 };
+	int i, run;
+	for (run = 0; run < 3; run++)
+	{
+		clock_t start = clock();
+		for (i = 0; i < n; i++)
+		{
+			Key key = scrambledKey(i);
+			if (run == 0) RBT_put(&tree, key, "v");
+			else if (run == 1) InlineBST_put(&inlined, key, "v");
+			else PointerBST_put(&pointed, key, "v");
+		}
+		took[0][run] = elapsed(start);
+
+		start = clock();
+		for (i = 0; i < queries; i++)
+		{
+			// every other key misses
+			Key key = scrambledKey(i % (2 * n));
+			if (run == 0) found[run] += RBT_get(&tree, key) != NULL;
+			else if (run == 1) found[run] += InlineBST_get(&inlined, key) != NULL;
+			else found[run] += PointerBST_get(&pointed, key) != NULL;
+		}
+		took[1][run] = elapsed(start);
+	}
+
+	printf("%-40s %8.3fs  %8.3fs  %8.3fs\n", "put", took[0][0], took[0][1], took[0][2]);
+	printf("%-40s %8.3fs  %8.3fs  %8.3fs\n", "get", took[1][0], took[1][1], took[1][2]);
+	if (found[0] != found[1] || found[0] != found[2] || !InlineBST_self_check(&inlined)) printf("generic trees disagree!\n");
+
+	RBT_free(&tree);
+	InlineBST_free(&inlined);
+	PointerBST_free(&pointed);
+}
+
+
+/* RBT_put_batch against one RBT_put per key, on random batches large enough next to the
+   tree to be merged by rebuilding it and small enough to go in by splitting and joining. */
+void benchPutBatch(int n)
+{
+	static const int batches[] = { 10000, 100000, 500000, 2000000, 4000000 };
+	printf("\nput_batch into %d keys                   per key   put_batch  speedup\n", n);
+
+	int b;
+	for (b = 0; b < (int)(sizeof(batches) / sizeof(batches[0])); b++)
+	{
+		int count = batches[b], i, run;
+		Key* keys = (Key*)malloc(count * sizeof(Key));
+		Value* vals = (Value*)malloc(count * sizeof(Value));
+		// about half of the keys are already in the tree
+		for (i = 0; i < count; i++)
+		{
+			keys[i] = rand() % (4 * n) + 1;
+			vals[i] = "w";
+		}
+
+		double took[2];
+		int size[2];
+		for (run = 0; run < 2; run++)
+		{
+			RedBlackBST tree = { .root = NULL };
+			fillOdd(&tree, n);
+
+			clock_t start = clock();
+			if (run == 0) for (i = 0; i < count; i++) RBT_put(&tree, keys[i], vals[i]);
+			else RBT_put_batch(&tree, keys, vals, count);
+			took[run] = elapsed(start);
+
+			size[run] = RBT_size(&tree);
+			if (!RBT_self_check(&tree)) printf("put_batch left a broken tree!\n");
+			RBT_free(&tree);
+		}
+
+		if (size[0] != size[1]) printf("put_batch results differ!\n");
+		char label[64];
+		sprintf(label, "%d keys (%s)", count, count >= n ? "rebuild" : "split/join");
+		printf("%-40s %8.3fs  %8.3fs  %6.1fx\n", label, took[0], took[1], took[0] / took[1]);
+		free(keys);
+		free(vals);
+	}
+}
+
+
+#define WRITE_STACK (1 << 20)		// stack given to each benchmark thread
+#define STACK_PAINT 0xA5			// byte the stack is filled with beforehand
+
+typedef struct _WriteBench
+{
+	RedBlackBST tree;				// only its root and pool are used
+	bool recursive;					// NODE_put/NODE_remove, or their iterative versions
+	bool removing;					// take the keys out again instead of putting them in
+	int n;							// writes, 0 to measure the thread's own stack use
+	double* took;					// microseconds each write took
+} WriteBench;
+
+// n timed writes through one of the two write paths, with the root handling of RBT_put and RBT_remove
+static void* writeWorker(void* arg)
+{
+	WriteBench* bench = (WriteBench*)arg;
+	int i;
+	for (i = 0; i < bench->n; i++)
+	{
+		struct timespec start;
+		timespec_get(&start, TIME_UTC);
+		if (!bench->removing)
+		{
+			Key key = scrambledKey(i);
+			Node* root = bench->tree.root;
+			root = bench->recursive ? NODE_put(bench->tree.pool, root, key, "v") : NODE_put_iterative(bench->tree.pool, root, key, "v");
+			root->color = BLACK;
+			bench->tree.root = root;
+		}
+		else
+		{
+			Key key = scrambledKey((int)((long long)i * 7919 % bench->n));
+			Node* root = bench->tree.root;
+			if (!NODE_isRed(root->left) && !NODE_isRed(root->right)) root->color = RED;
+			root = bench->recursive ? NODE_remove(bench->tree.pool, root, key) : NODE_remove_iterative(bench->tree.pool, root, key);
+			if (root != NULL) root->color = BLACK;
+			bench->tree.root = root;
+		}
+		bench->took[i] = wallElapsed(&start) * 1e6;
+	}
+	return NULL;
+}
+
+// run the writes on a thread whose stack was painted beforehand, returning how many bytes of it were written to
+static size_t writeOnPaintedStack(WriteBench* bench)
+{
+	char* stack = (char*)aligned_alloc(4096, WRITE_STACK);
+	memset(stack, STACK_PAINT, WRITE_STACK);
+
+	pthread_attr_t attr;
+	pthread_t id;
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, stack, WRITE_STACK);
+	pthread_create(&id, &attr, writeWorker, bench);
+	pthread_join(id, NULL);
+	pthread_attr_destroy(&attr);
+
+	// the stack grows down, so the paint left at the bottom was never reached
+	size_t untouched = 0;
+	while (untouched < WRITE_STACK && (unsigned char)stack[untouched] == STACK_PAINT) untouched++;
+	free(stack);
+	return WRITE_STACK - untouched;
+}
+
+/* Latency and stack use of single puts and removals through the recursive write path
+   (RECURSIVE_WRITES) and the iterative one. The stack use is the deepest any of the n
+   writes went, less what an idle thread uses. */
+void benchWritePaths(int n)
+{
+	printf("\nwrite paths, %d keys                   recursive  iterative\n", n);
+
+	double* took = (double*)malloc(n * sizeof(double));
+	WriteBench idle = { .tree = { .root = NULL }, .n = 0, .took = took };
+	size_t base = 0;
+
+	// the first round only warms up: it binds the library calls and faults the memory in,
+	// which would otherwise be charged to whichever path ran first
+	double p50[2][2], p99[2][2], max[2][2];
+	size_t stack[2][2];
+	int round, path, op;
+	for (round = 0; round < 2; round++) for (path = 0; path < 2; path++)
+	{
+		if (round == 1 && path == 0) base = writeOnPaintedStack(&idle);
+
+		// each path gets a fresh pool, so neither runs on memory the other left scattered
+		WriteBench bench = { .tree = { .root = NULL }, .recursive = path == 0, .n = n, .took = took };
+		RBT_use_pool(&bench.tree, 0);
+		for (op = 0; op < 2; op++)
+		{
+			bench.removing = op == 1;
+			stack[op][path] = writeOnPaintedStack(&bench) - base;
+			qsort(took, n, sizeof(double), compareLatency);
+			p50[op][path] = took[n / 2];
+			p99[op][path] = took[(int)(n * 0.99)];
+			max[op][path] = took[n - 1];
+		}
+		if (bench.tree.root != NULL) printf("write paths left keys behind!\n");
+		RBT_free(&bench.tree);
+	}
+
+	const char* names[] = { "put", "remove" };
+	for (op = 0; op < 2; op++)
+	{
+		char label[64];
+		sprintf(label, "%s p50", names[op]);
+		printf("%-40s %7.2fus  %7.2fus\n", label, p50[op][0], p50[op][1]);
+		sprintf(label, "%s p99", names[op]);
+		printf("%-40s %7.2fus  %7.2fus\n", label, p99[op][0], p99[op][1]);
+		sprintf(label, "%s max", names[op]);
+		printf("%-40s %7.0fus  %7.0fus\n", label, max[op][0], max[op][1]);
+		sprintf(label, "%s stack", names[op]);
+		printf("%-40s %8zuB  %8zuB\n", label, stack[op][0], stack[op][1]);
+	}
+	free(took);
+}
+
+
+// bytes of this process's memory currently resident
+static size_t residentBytes(void)
+{
+	unsigned long size = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL) return 0;
+	if (fscanf(statm, "%lu %lu", &size, &resident) != 2) resident = 0;
+	fclose(statm);
+	return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+typedef struct _LayoutResult
+{
+	double bytesPerKey;				// growth of the resident set while building, per key
+	double put, get;				// seconds for the n puts and for the lookups
+} LayoutResult;
+
+/* Memory and speed of n keys in a RedBlackBST on the heap, a RedBlackBST with a node pool
+   and a CompactBST. Each tree is built in a process of its own, so the resident set only
+   grows by what that tree takes. Values are short enough for either node to store inline. */
+void benchCompact(int n, int queries)
+{
+	const char* names[] = { "RedBlackBST", "RedBlackBST, pooled", "CompactBST" };
+	printf("\ncompact layout, %d keys, %zu/%zu byte nodes   bytes/key       put       get\n", n, sizeof(Node), sizeof(CompactNode));
+
+	LayoutResult* results = (LayoutResult*)mmap(NULL, 3 * sizeof(LayoutResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == (LayoutResult*)MAP_FAILED) { printf("could not share memory with the builder\n"); return; }
+
+	int layout;
+	for (layout = 0; layout < 3; layout++)
+	{
+		pid_t builder = fork();
+		if (builder < 0) { printf("could not start the builder\n"); break; }
+		if (builder == 0)
+		{
+			RedBlackBST tree = { .root = NULL };
+			INIT_CompactBST(compact);
+			if (layout == 1) RBT_use_pool(&tree, 0);
+
+			size_t before = residentBytes();
+			int found = 0, expected = 0, i;
+			clock_t start = clock();
+			for (i = 0; i < n; i++)
+			{
+				if (layout < 2) RBT_put(&tree, scrambledKey(i), "v");
+				else CRBT_put(&compact, scrambledKey(i), "v");
+			}
+			results[layout].put = elapsed(start);
+			results[layout].bytesPerKey = (double)(residentBytes() - before) / n;
+
+			start = clock();
+			for (i = 0; i < queries; i++)
+			{
+				// half of the keys asked for were never put
+				int j = (int)((long long)i * 7919 % (2 * n));
+				Key key = scrambledKey(j);
+				expected += j < n;
+				if (layout < 2) found += RBT_get(&tree, key) != NULL;
+				else found += CRBT_get(&compact, key) != NULL;
+			}
+			results[layout].get = elapsed(start);
+			_exit(found == expected ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
+		int status;
+		waitpid(builder, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) printf("%s lost keys!\n", names[layout]);
+		printf("%-40s %10.1f  %8.3fs  %8.3fs\n", names[layout], results[layout].bytesPerKey, results[layout].put, results[layout].get);
+	}
+	munmap(results, 3 * sizeof(LayoutResult));
+}
+
+#pragma endregion
+
+#endif // BENCHMARKS